@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Power of two helpers for the allocators. Every alignment d3d12 hands out or asks for (placement, texture data, constant buffers,
+    descriptor heap sizes) is a power of two, so align_up masks instead of dividing. Check anything that comes from outside with
+    is_power_of_two first, a mask with other values rounds to the wrong place.
+*/
+
+inline bool is_power_of_two(uint64_t value)
+{
+    return value && (value & (value - 1)) == 0;
+}
+
+// alignment must be a power of two
+inline uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
@@ -0,0 +1,160 @@
+#include "app_loop.h"
+#include "profiler.h"
+
+namespace
+{
+bool event_queue_pop(AppEventQueue &queue, AppEvent &event)
+{
+    uint32_t read = queue.read.load(std::memory_order_relaxed);
+    if (read == queue.write.load(std::memory_order_acquire))
+        return false;
+    event = queue.events[read & (app_event_capacity - 1)];
+    queue.read.store(read + 1, std::memory_order_release);
+    return true;
+}
+
+void app_loop_thread_stopped(AppLoop &loop)
+{
+    if (loop.running_threads.fetch_sub(1) == 1 && loop.callbacks.stopped)
+        loop.callbacks.stopped();
+}
+
+// Hand every event posted so far to the simulation
+void app_loop_events(AppLoop &loop)
+{
+    AppEvent event;
+    while (event_queue_pop(loop.events, event))
+    {
+        ++loop.handled_count;
+        if (event.type == APP_EVENT_QUIT)
+            app_loop_request_quit(loop);
+        if (loop.callbacks.event)
+            loop.callbacks.event(event);
+    }
+}
+
+void simulation_thread(AppLoop &loop)
+{
+    profiler_thread_name("simulation");
+    for (;;)
+    {
+        app_loop_events(loop);
+
+        // Wait until the renderer is close enough behind
+        uint64_t frame;
+        {
+            std::unique_lock<std::mutex> lock(loop.mutex);
+            loop.frame_changed.wait(lock, [&] { return loop.quit.load() || loop.simulated - loop.rendered < (uint64_t)app_loop_frames_ahead; });
+            if (loop.quit.load())
+                break;
+            frame = loop.simulated;
+        }
+
+        //Events that came in while we waited go into this frame too
+        app_loop_events(loop);
+        if (loop.quit.load())
+            break;
+        if (loop.callbacks.update)
+        {
+            PROFILE_SCOPE("app_loop: update");
+            if (!loop.callbacks.update(frame))
+            {
+                app_loop_request_quit(loop);
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.simulated = frame + 1;
+        loop.frame_changed.notify_all();
+    }
+
+    // Whatever was posted before we stopped is still handled, a quit event included
+    app_loop_events(loop);
+    app_loop_thread_stopped(loop);
+}
+
+void render_thread(AppLoop &loop)
+{
+    profiler_thread_name("render");
+    for (;;)
+    {
+        // Render every frame that was simulated, quitting or not, then stop
+        uint64_t frame;
+        {
+            std::unique_lock<std::mutex> lock(loop.mutex);
+            loop.frame_changed.wait(lock, [&] { return loop.quit.load() || loop.rendered < loop.simulated; });
+            if (loop.rendered == loop.simulated)
+                break;
+            frame = loop.rendered;
+        }
+
+        if (!loop.callbacks.render(frame))
+        {
+            app_loop_request_quit(loop);
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        loop.rendered = frame + 1;
+        loop.frame_changed.notify_all();
+    }
+    app_loop_thread_stopped(loop);
+}
+} // namespace
+
+void app_loop_start(AppLoop &loop, const AppLoopCallbacks &callbacks)
+{
+    loop.events.write.store(0);
+    loop.events.read.store(0);
+    loop.callbacks = callbacks;
+    loop.quit.store(false);
+    loop.simulated = 0;
+    loop.rendered = 0;
+    loop.posted_count.store(0);
+    loop.dropped_count.store(0);
+    loop.handled_count = 0;
+
+    loop.running_threads.store(2);
+    loop.simulation_thread = std::thread(simulation_thread, std::ref(loop));
+    loop.render_thread = std::thread(render_thread, std::ref(loop));
+}
+
+bool app_loop_post(AppLoop &loop, const AppEvent &event)
+{
+    loop.posted_count.fetch_add(1, std::memory_order_relaxed);
+
+    AppEventQueue &queue = loop.events;
+    uint32_t write = queue.write.load(std::memory_order_relaxed);
+    if (write - queue.read.load(std::memory_order_acquire) == app_event_capacity)
+    {
+        // Quitting does not depend on there being room, the event only tells the simulation when
+        if (event.type == APP_EVENT_QUIT)
+            app_loop_request_quit(loop);
+        loop.dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    queue.events[write & (app_event_capacity - 1)] = event;
+    queue.write.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+void app_loop_request_quit(AppLoop &loop)
+{
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    loop.quit.store(true);
+    loop.frame_changed.notify_all();
+}
+
+bool app_loop_quitting(const AppLoop &loop)
+{
+    return loop.quit.load();
+}
+
+void app_loop_join(AppLoop &loop)
+{
+    if (loop.simulation_thread.joinable())
+        loop.simulation_thread.join();
+    if (loop.render_thread.joinable())
+        loop.render_thread.join();
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+    The demo's threads. The platform thread only pumps the window's messages, simulation and rendering run on threads of their own,
+    so a modal loop on the platform thread (a MessageBox, dragging or resizing the window) no longer stops the frame.
+
+        - Platform thread: turns messages into AppEvents and posts them with app_loop_post(). On windows that is window_Callback(),
+          headless has a fake event source that makes up key presses.
+        - Simulation thread: takes the events off the queue, then runs update(frame) for the next frame.
+        - Render thread: runs render(frame) for every frame the simulation finished, in order.
+
+    The event queue is a ring with one producer (the platform thread) and one consumer (the simulation thread), neither takes a lock:
+    the producer writes the event and then publishes it by moving write, the consumer reads it and gives the slot back by moving
+    read. A full queue drops the event and counts it, the platform thread never waits.
+
+    The simulation may run app_loop_frames_ahead frames ahead of the renderer, it waits for the renderer otherwise. Frame state
+    the renderer reads belongs in app_loop_frames_ahead + 1 copies, indexed with the frame number: update(frame) writes copy
+    frame % (app_loop_frames_ahead + 1) while render(frame - 1) reads the one before it.
+
+    Shutdown: app_loop_request_quit() from any thread (an APP_EVENT_QUIT, update or render returning false or a renderer error).
+    The simulation stops, the renderer finishes the frames that were simulated and stops too, and the last of them calls stopped()
+    so the platform thread can leave its loop and app_loop_join(). Nothing renders after that, so the renderer can be cleaned up.
+*/
+
+const uint32_t app_event_capacity = 256; // Power of two
+const int app_loop_frames_ahead = 1;
+
+enum AppEventType
+{
+    APP_EVENT_KEY_DOWN,
+    APP_EVENT_KEY_UP,
+    APP_EVENT_RESIZE,
+    APP_EVENT_QUIT,
+};
+
+struct AppEvent
+{
+    AppEventType type;
+    uint32_t key;    // Virtual key code, APP_EVENT_KEY_*
+    int width;       // Client area, APP_EVENT_RESIZE
+    int height;
+};
+
+struct AppEventQueue
+{
+    std::atomic<uint32_t> write;   // Only the producer writes it
+    uint8_t padding[64];
+    std::atomic<uint32_t> read;    // Only the consumer writes it
+    AppEvent events[app_event_capacity];
+};
+
+struct AppLoopCallbacks
+{
+    std::function<void(const AppEvent &event)> event; // On the simulation thread, before the update of the next frame
+    std::function<bool(uint64_t frame)> update;       // On the simulation thread, false to quit. May be empty
+    std::function<bool(uint64_t frame)> render;       // On the render thread, false to quit
+    std::function<void()> stopped;                    // On the last thread to stop, may be empty
+};
+
+struct AppLoop
+{
+    AppEventQueue events;
+    AppLoopCallbacks callbacks;
+    std::thread simulation_thread;
+    std::thread render_thread;
+    std::atomic<bool> quit;
+    std::atomic<int> running_threads;
+
+    // Frame handoff between the simulation and the renderer
+    std::mutex mutex;
+    std::condition_variable frame_changed;
+    uint64_t simulated;   // Frames updated
+    uint64_t rendered;    // Frames rendered
+
+    // Stats
+    std::atomic<uint64_t> posted_count;  // Events posted
+    std::atomic<uint64_t> dropped_count; // Events the queue had no room for
+    uint64_t handled_count;              // Events the simulation handled
+};
+
+void app_loop_start(AppLoop &loop, const AppLoopCallbacks &callbacks);
+bool app_loop_post(AppLoop &loop, const AppEvent &event); // Platform thread only, false if the queue is full. APP_EVENT_QUIT also asks to quit
+void app_loop_request_quit(AppLoop &loop);                // Any thread
+bool app_loop_quitting(const AppLoop &loop);
+void app_loop_join(AppLoop &loop);                        // Wait for the threads to stop
@@ -0,0 +1,218 @@
+#include "benchmark.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+const BenchmarkScenario benchmark_scenarios[] = {
+    {"triangle", "the demo's triangle, once", 800, 600, 1, 1, 0, 0, 1.0f},
+    {"many-draws", "4096 small triangles, one draw call each", 800, 600, 4096, 4096, 0, 0, 0.02f},
+    {"many-vertices", "a 256x256 grid, 66049 vertices and 131072 triangles in one draw", 800, 600, 1, 1, 256, 256, 1.0f},
+    {"large-resolution", "the triangle on a 3840x2160 back buffer", 3840, 2160, 1, 1, 0, 0, 1.0f},
+};
+const int benchmark_scenario_count = sizeof(benchmark_scenarios) / sizeof(benchmark_scenarios[0]);
+
+const BenchmarkScenario *benchmark_find_scenario(const char *name)
+{
+    for (int i = 0; i < benchmark_scenario_count; ++i)
+    {
+        if (strcmp(benchmark_scenarios[i].name, name) == 0)
+            return &benchmark_scenarios[i];
+    }
+    return nullptr;
+}
+
+Mesh benchmark_scenario_mesh(const BenchmarkScenario &scenario)
+{
+    Mesh mesh;
+    if (scenario.grid_columns > 0)
+    {
+        mesh = mesh_make_grid(scenario.grid_columns, scenario.grid_rows);
+    }
+    else
+    {
+        mesh.name = "triangle";
+        mesh.vertices = {
+            { 0.0f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f },
+            { 0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f },
+            { -0.5f, -0.5f, 0.5f, 0.0f, 1.0f, 1.0f, 1.0f },
+        };
+        mesh.indices = { 0, 1, 2 };
+    }
+
+    for (Vertex &vertex : mesh.vertices)
+    {
+        vertex.pos.x *= scenario.scale;
+        vertex.pos.y *= scenario.scale;
+    }
+    return mesh;
+}
+
+BenchmarkStats benchmark_stats(const std::vector<double> &samples)
+{
+    BenchmarkStats stats = {};
+    if (samples.empty())
+        return stats;
+
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+
+    double sum = 0.0;
+    for (double sample : sorted)
+        sum += sample;
+    stats.mean = sum / n;
+
+    double squares = 0.0;
+    for (double sample : sorted)
+        squares += (sample - stats.mean) * (sample - stats.mean);
+    stats.stddev = n > 1 ? sqrt(squares / (n - 1)) : 0.0;
+
+    // Nearest rank: the smallest sample at least p percent of the samples are not above
+    auto percentile = [&](int p) { return sorted[(n * p + 99) / 100 - 1]; };
+    stats.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) * 0.5;
+    stats.p95 = percentile(95);
+    stats.p99 = percentile(99);
+    stats.min = sorted.front();
+    stats.max = sorted.back();
+    return stats;
+}
+
+BenchmarkResult benchmark_run(const BenchmarkScenario &scenario, int warmup_frames, int frames,
+                              const std::function<bool(double &submit_seconds, uint64_t &barriers)> &frame)
+{
+    BenchmarkResult result;
+    result.scenario = &scenario;
+    result.warmup_frames = warmup_frames;
+    result.triangles = (uint64_t)(scenario.grid_columns > 0 ? scenario.grid_columns * scenario.grid_rows * 2 : 1) * scenario.instances;
+    result.seconds = 0.0;
+    result.frame_ms.reserve(frames);
+    result.submit_ms.reserve(frames);
+    result.barrier_counts.reserve(frames);
+
+    bool running = true;
+    double submit_seconds;
+    uint64_t barriers;
+    for (int i = 0; i < warmup_frames && running; ++i)
+        running = frame(submit_seconds, barriers);
+
+    for (int i = 0; i < frames && running; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        submit_seconds = 0.0;
+        barriers = 0;
+        running = frame(submit_seconds, barriers);
+        auto end = std::chrono::steady_clock::now();
+        if (!running)
+            break;
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        result.seconds += seconds;
+        result.frame_ms.push_back(seconds * 1000.0);
+        result.submit_ms.push_back(submit_seconds * 1000.0);
+        result.barrier_counts.push_back((double)barriers);
+    }
+
+    result.frames = (int)result.frame_ms.size();
+    result.frame = benchmark_stats(result.frame_ms);
+    result.submit = benchmark_stats(result.submit_ms);
+    result.barriers = benchmark_stats(result.barrier_counts);
+    return result;
+}
+
+std::string benchmark_report(const BenchmarkResult &result)
+{
+    const BenchmarkScenario &scenario = *result.scenario;
+    double fps = result.seconds > 0.0 ? result.frames / result.seconds : 0.0;
+    char line[512];
+    std::string report;
+    snprintf(line, sizeof(line), "benchmark: %s (%s), %dx%d, %d frames after %d warmup, %.1f fps, %.4g Mtriangles/s\n", scenario.name,
+             scenario.description, scenario.width, scenario.height, result.frames, result.warmup_frames, fps, fps * result.triangles * 1e-6);
+    report += line;
+
+    const struct
+    {
+        const char *name;
+        const BenchmarkStats &stats;
+    } metrics[] = {{"frame", result.frame}, {"submit", result.submit}};
+    for (const auto &metric : metrics)
+    {
+        snprintf(line, sizeof(line), "  %-6s ms: mean %.3f, median %.3f, p95 %.3f, p99 %.3f, stddev %.3f, min %.3f, max %.3f\n", metric.name,
+                 metric.stats.mean, metric.stats.median, metric.stats.p95, metric.stats.p99, metric.stats.stddev, metric.stats.min, metric.stats.max);
+        report += line;
+    }
+    snprintf(line, sizeof(line), "  barriers per frame: mean %.1f, median %.1f, min %.0f, max %.0f\n", result.barriers.mean, result.barriers.median,
+             result.barriers.min, result.barriers.max);
+    report += line;
+    return report;
+}
+
+namespace
+{
+void write_json_stats(FILE *file, const char *name, const BenchmarkStats &stats)
+{
+    fprintf(file, "\"%s\": {\"mean\": %.6f, \"median\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"stddev\": %.6f, \"min\": %.6f, \"max\": %.6f}", name,
+            stats.mean, stats.median, stats.p95, stats.p99, stats.stddev, stats.min, stats.max);
+}
+
+bool close_file(FILE *file)
+{
+    bool ok = ferror(file) == 0;
+    return fclose(file) == 0 && ok;
+}
+} // namespace
+
+bool benchmark_write_json(const char *path, const char *backend, int threads, const std::vector<BenchmarkResult> &results)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    // Scenario names and descriptions are ours and need no escaping
+    fprintf(file, "{\n  \"backend\": \"%s\",\n  \"threads\": %d,\n  \"scenarios\": [\n", backend, threads);
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchmarkResult &result = results[i];
+        const BenchmarkScenario &scenario = *result.scenario;
+        double fps = result.seconds > 0.0 ? result.frames / result.seconds : 0.0;
+        fprintf(file, "    {\"name\": \"%s\", \"description\": \"%s\", \"width\": %d, \"height\": %d, \"instances\": %u, \"draws\": %u, ",
+                scenario.name, scenario.description, scenario.width, scenario.height, scenario.instances, scenario.draws);
+        fprintf(file, "\"triangles_per_frame\": %llu, \"warmup_frames\": %d, \"frames\": %d, \"fps\": %.3f, \"mtriangles_per_second\": %.6f,\n     ",
+                (unsigned long long)result.triangles, result.warmup_frames, result.frames, fps, fps * result.triangles * 1e-6);
+        write_json_stats(file, "frame_ms", result.frame);
+        fprintf(file, ",\n     ");
+        write_json_stats(file, "submit_ms", result.submit);
+        fprintf(file, ",\n     ");
+        write_json_stats(file, "barriers", result.barriers);
+        fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return close_file(file);
+}
+
+bool benchmark_write_csv(const char *path, const char *backend, int threads, const std::vector<BenchmarkResult> &results)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "backend,threads,scenario,width,height,frames,fps,mtriangles_per_second,metric,mean,median,p95,p99,stddev,min,max\n");
+    for (const BenchmarkResult &result : results)
+    {
+        const BenchmarkScenario &scenario = *result.scenario;
+        double fps = result.seconds > 0.0 ? result.frames / result.seconds : 0.0;
+        const struct
+        {
+            const char *name;
+            const BenchmarkStats &stats;
+        } metrics[] = {{"frame_ms", result.frame}, {"submit_ms", result.submit}, {"barriers", result.barriers}};
+        for (const auto &metric : metrics)
+        {
+            fprintf(file, "%s,%d,%s,%d,%d,%d,%.3f,%.6f,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", backend, threads, scenario.name, scenario.width,
+                    scenario.height, result.frames, fps, fps * result.triangles * 1e-6, metric.name, metric.stats.mean, metric.stats.median,
+                    metric.stats.p95, metric.stats.p99, metric.stats.stddev, metric.stats.min, metric.stats.max);
+        }
+    }
+    return close_file(file);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "mesh.h"
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+    Repeatable frame benchmarks for regression tracking.
+
+    A scenario is a fixed scene: back buffer size, the mesh that is drawn, how many instances of it and in how many draw calls per
+    recording thread. benchmark_run() renders warmup frames that are thrown away (caches, allocators and the frame ring settle), then a
+    fixed number of measured frames, and keeps three samples per frame:
+
+        - frame time: wall time of the whole frame, waits for the queue included. What the user sees
+        - submit time: cpu time spent recording and submitting the frame's command lists, waits for the queue left out. What the cpu costs
+        - barriers: transition barriers the state trackers recorded into the frame's command lists, resolved ones included
+
+    Each of them is reduced to mean, median, p95, p99 (nearest rank), standard deviation, min and max, plus frames and triangles per
+    second. The results are written as JSON (one object per scenario) and CSV (one row per scenario and metric) so a script can
+    compare runs.
+
+    The harness only knows about frames, the frame callback renders one with whichever backend runs it: headless -benchmark NAME
+    on the cpu backend, DirectX12RenderDemo.exe -benchmark NAME on d3d12.
+*/
+
+struct BenchmarkScenario
+{
+    const char *name;
+    const char *description;
+    int width;
+    int height;
+    uint32_t instances;       // Instances drawn per frame, split between the recording threads
+    uint32_t draws;           // Draw calls per frame the instances are split into, at least one per recording thread
+    uint32_t grid_columns;    // 0 draws the triangle, otherwise a grid mesh of columns x rows quads (mesh_make_grid())
+    uint32_t grid_rows;
+    float scale;              // Of the mesh's positions, small triangles keep many draws about the cpu instead of the rasterizer
+};
+
+struct BenchmarkStats
+{
+    double mean;
+    double median;
+    double p95;
+    double p99;
+    double stddev; // Sample standard deviation
+    double min;
+    double max;
+};
+
+struct BenchmarkResult
+{
+    const BenchmarkScenario *scenario;
+    int warmup_frames;
+    int frames;               // Measured frames, fewer than asked for if the frame callback stopped early
+    uint64_t triangles;       // Per frame
+    double seconds;           // Wall time of the measured frames
+    std::vector<double> frame_ms;
+    std::vector<double> submit_ms;
+    std::vector<double> barrier_counts;
+    BenchmarkStats frame;
+    BenchmarkStats submit;
+    BenchmarkStats barriers;
+};
+
+extern const BenchmarkScenario benchmark_scenarios[];
+extern const int benchmark_scenario_count;
+
+const BenchmarkScenario *benchmark_find_scenario(const char *name); // nullptr if there is no such scenario
+Mesh benchmark_scenario_mesh(const BenchmarkScenario &scenario);    // The triangle main.cpp draws, or the grid
+BenchmarkStats benchmark_stats(const std::vector<double> &samples);
+
+// Render warmup + frames frames. frame renders one and sets the cpu seconds it spent recording and submitting and the barriers it recorded,
+// returning false stops the run
+BenchmarkResult benchmark_run(const BenchmarkScenario &scenario, int warmup_frames, int frames,
+                              const std::function<bool(double &submit_seconds, uint64_t &barriers)> &frame);
+
+std::string benchmark_report(const BenchmarkResult &result); // A few lines for the console
+bool benchmark_write_json(const char *path, const char *backend, int threads, const std::vector<BenchmarkResult> &results);
+bool benchmark_write_csv(const char *path, const char *backend, int threads, const std::vector<BenchmarkResult> &results);
@@ -0,0 +1,365 @@
+#include "descriptor_allocator.h"
+#include "frame_ring.h"
+#include "align.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+
+bool descriptor_pool_init(DescriptorPool &pool, uint64_t cpu_base, uint32_t increment, uint32_t capacity)
+{
+    if (capacity == 0 || capacity == descriptor_null || increment == 0)
+        return false;
+
+    pool.cpu_base = cpu_base;
+    pool.increment = increment;
+    pool.capacity = capacity;
+
+    // Highest index at the bottom of the stack, so the heap fills from the front
+    pool.free_indices.resize(capacity);
+    for (uint32_t i = 0; i < capacity; ++i)
+        pool.free_indices[i] = capacity - 1 - i;
+    pool.allocated.assign(capacity, false);
+
+    pool.used = 0;
+    pool.peak = 0;
+    pool.failed_count = 0;
+    return true;
+}
+
+uint32_t descriptor_pool_allocate(DescriptorPool &pool)
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.free_indices.empty())
+    {
+        ++pool.failed_count;
+        return descriptor_null;
+    }
+
+    uint32_t index = pool.free_indices.back();
+    pool.free_indices.pop_back();
+    pool.allocated[index] = true;
+    if (++pool.used > pool.peak)
+        pool.peak = pool.used;
+    return index;
+}
+
+bool descriptor_pool_free(DescriptorPool &pool, uint32_t index)
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (index >= pool.capacity || !pool.allocated[index])
+        return false;
+
+    pool.allocated[index] = false;
+    pool.free_indices.push_back(index);
+    --pool.used;
+    return true;
+}
+
+bool descriptor_ring_init(DescriptorRing &ring, uint64_t cpu_base, uint64_t gpu_base, uint32_t increment, uint32_t capacity)
+{
+    if (!is_power_of_two(capacity) || increment == 0)
+        return false;
+
+    ring.cpu_base = cpu_base;
+    ring.gpu_base = gpu_base;
+    ring.increment = increment;
+    ring.capacity = capacity;
+    ring.head = 0;
+    ring.tail = 0;
+    ring.frames.clear();
+    ring.table_count = 0;
+    ring.descriptor_count = 0;
+    ring.failed_count = 0;
+    return true;
+}
+
+bool descriptor_ring_allocate(DescriptorRing &ring, uint32_t count, DescriptorTable &table)
+{
+    if (count == 0 || count > ring.capacity)
+        return false;
+
+    std::lock_guard<std::mutex> lock(ring.mutex);
+
+    // A table has to be contiguous, if it does not fit before the end of the heap skip the rest and start over at the beginning
+    uint64_t start = ring.head;
+    if ((start & (ring.capacity - 1)) + count > ring.capacity)
+        start = (start + ring.capacity - 1) & ~(uint64_t)(ring.capacity - 1);
+
+    // Would run into descriptors a frame in flight is still reading
+    if (start + count - ring.tail > ring.capacity)
+    {
+        ++ring.failed_count;
+        return false;
+    }
+
+    ring.head = start + count;
+    ++ring.table_count;
+    ring.descriptor_count += count;
+
+    table.index = (uint32_t)(start & (ring.capacity - 1));
+    table.count = count;
+    table.cpu = ring.cpu_base + (uint64_t)table.index * ring.increment;
+    table.gpu = ring.gpu_base + (uint64_t)table.index * ring.increment;
+    return true;
+}
+
+void descriptor_ring_end_frame(DescriptorRing &ring, uint64_t fence_value)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    DescriptorRingFrame frame = {fence_value, ring.head};
+    ring.frames.push_back(frame);
+}
+
+void descriptor_ring_retire(DescriptorRing &ring, uint64_t completed_value)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    while (!ring.frames.empty() && ring.frames.front().fence_value <= completed_value)
+    {
+        ring.tail = ring.frames.front().end;
+        ring.frames.pop_front();
+    }
+}
+
+uint32_t descriptor_ring_used(DescriptorRing &ring)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    return (uint32_t)(ring.head - ring.tail);
+}
+
+// -- Stress test -- //
+
+namespace
+{
+// Stand in for a descriptor, the size of a d3d12 cbv/srv/uav one on most hardware. It says which pool slot it was copied from
+struct StressDescriptor
+{
+    uint32_t source;
+    uint32_t padding[7];
+};
+
+struct StressTable
+{
+    uint32_t index;
+    uint32_t count;
+    uint64_t fence_value; // 0 until the frame it was made in is submitted
+    std::vector<uint32_t> sources;
+};
+
+bool stress_pool(int iterations, std::mt19937 &random)
+{
+    const uint32_t capacity = 4096;
+    const uint64_t cpu_base = 0x10000;
+    const uint32_t increment = sizeof(StressDescriptor);
+
+    DescriptorPool pool;
+    descriptor_pool_init(pool, cpu_base, increment, capacity);
+
+    std::vector<uint32_t> live;
+    std::vector<bool> shadow(capacity, false); // What the test thinks is allocated
+    for (int i = 0; i < iterations; ++i)
+    {
+        // Mostly allocating for a while, long enough to fill the heap, then mostly freeing, so both ends get exercised
+        bool filling = (i / 10000) % 2 == 0;
+        bool allocate = live.empty() || (random() % 4 != 0) == filling;
+        if (allocate)
+        {
+            uint32_t index = descriptor_pool_allocate(pool);
+            if (index == descriptor_null)
+            {
+                if (live.size() != capacity)
+                {
+                    printf("descriptor pool: full with %u of %u descriptors used\n", (unsigned int)live.size(), capacity);
+                    return false;
+                }
+                continue;
+            }
+            if (index >= capacity || shadow[index])
+            {
+                printf("descriptor pool: slot %u handed out twice\n", index);
+                return false;
+            }
+            if (descriptor_pool_cpu(pool, index) != cpu_base + (uint64_t)index * increment)
+            {
+                printf("descriptor pool: wrong handle for slot %u\n", index);
+                return false;
+            }
+            shadow[index] = true;
+            live.push_back(index);
+        }
+        else
+        {
+            size_t pick = random() % live.size();
+            uint32_t index = live[pick];
+            live[pick] = live.back();
+            live.pop_back();
+            shadow[index] = false;
+            if (!descriptor_pool_free(pool, index))
+            {
+                printf("descriptor pool: could not free slot %u\n", index);
+                return false;
+            }
+        }
+
+        if (pool.used != live.size())
+        {
+            printf("descriptor pool: says %u used, %u are\n", pool.used, (unsigned int)live.size());
+            return false;
+        }
+    }
+
+    // Freeing twice has to be refused
+    if (!live.empty() && (!descriptor_pool_free(pool, live.back()) || descriptor_pool_free(pool, live.back())))
+    {
+        printf("descriptor pool: freed slot %u twice\n", live.back());
+        return false;
+    }
+
+    // What an allocate and free costs once the pool is warm
+    const int timed = 1000000;
+    DescriptorPool timing;
+    descriptor_pool_init(timing, cpu_base, increment, capacity);
+    std::vector<uint32_t> batch(256);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < timed; i += (int)batch.size())
+    {
+        for (size_t b = 0; b < batch.size(); ++b)
+            batch[b] = descriptor_pool_allocate(timing);
+        for (size_t b = 0; b < batch.size(); ++b)
+            descriptor_pool_free(timing, batch[b]);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("descriptor pool: %d operations, peak %u of %u descriptors, no slot handed out twice, %.1f ns per allocate + free\n",
+           iterations, pool.peak, capacity, seconds * 1e9 / timed);
+    return true;
+}
+
+// Retire the ring up to the fence and drop the tables of those frames. If anything wrote over them while they were in flight the sources do not match
+bool stress_retire(DescriptorRing &ring, FrameRing &frame_ring, std::vector<StressTable> &live, const std::vector<StressDescriptor> &heap)
+{
+    uint64_t completed = frame_ring_completed(frame_ring);
+    descriptor_ring_retire(ring, completed);
+
+    for (size_t i = 0; i < live.size();)
+    {
+        const StressTable &old = live[i];
+        if (old.fence_value != 0 && old.fence_value <= completed)
+        {
+            for (uint32_t d = 0; d < old.count; ++d)
+            {
+                if (heap[old.index + d].source != old.sources[d])
+                {
+                    printf("descriptor ring: table at %u was overwritten while in flight\n", old.index);
+                    return false;
+                }
+            }
+            live[i] = live.back();
+            live.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return true;
+}
+
+bool stress_ring(int frames, std::mt19937 &random)
+{
+    const uint32_t capacity = 64 * 1024;
+    const uint32_t source_count = 4096;
+    const int frames_in_flight = 3;
+
+    // The cpu pool every table copies from and the shader visible heap, as plain memory
+    std::vector<StressDescriptor> sources(source_count);
+    for (uint32_t i = 0; i < source_count; ++i)
+        sources[i].source = i;
+    std::vector<StressDescriptor> heap(capacity);
+
+    DescriptorRing ring;
+    descriptor_ring_init(ring, (uint64_t)(uintptr_t)heap.data(), 0x200000000ull, sizeof(StressDescriptor), capacity);
+
+    FakeFrameQueue queue(1.0);
+    FrameRing frame_ring;
+    frame_ring_init(frame_ring, &queue, frames_in_flight);
+
+    std::vector<StressTable> live;
+    uint64_t full_waits = 0;
+    double copy_seconds = 0.0;
+    uint64_t copied = 0;
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        frame_ring_begin(frame_ring);
+        if (!stress_retire(ring, frame_ring, live, heap))
+            return false;
+
+        // A few hundred small material tables and now and then a big bindless style one, thousands of descriptors a frame
+        int tables = 64 + (int)(random() % 256);
+        for (int t = 0; t < tables; ++t)
+        {
+            uint32_t count = (random() % 64 == 0) ? 1024 + random() % 4096 : 1 + random() % 16;
+            DescriptorTable table;
+            if (!descriptor_ring_allocate(ring, count, table))
+            {
+                ++full_waits;
+                if (ring.frames.empty())
+                    break;
+                frame_ring_wait(frame_ring, ring.frames.front().fence_value);
+                if (!stress_retire(ring, frame_ring, live, heap))
+                    return false;
+                if (!descriptor_ring_allocate(ring, count, table))
+                    continue;
+            }
+
+            if (table.index + count > capacity || table.cpu != ring.cpu_base + (uint64_t)table.index * ring.increment ||
+                table.gpu != ring.gpu_base + (uint64_t)table.index * ring.increment)
+            {
+                printf("descriptor ring: bad table of %u at %u\n", count, table.index);
+                return false;
+            }
+            for (size_t i = 0; i < live.size(); ++i)
+            {
+                if (table.index < live[i].index + live[i].count && live[i].index < table.index + count)
+                {
+                    printf("descriptor ring: frame %d table at %u overlaps one still in flight at %u\n", frame, table.index, live[i].index);
+                    return false;
+                }
+            }
+
+            // What CopyDescriptors does: gather scattered pool slots into the contiguous table
+            StressTable stress = {table.index, count, 0, std::vector<uint32_t>(count)};
+            for (uint32_t d = 0; d < count; ++d)
+                stress.sources[d] = (uint32_t)(random() % source_count);
+            auto start = std::chrono::steady_clock::now();
+            StressDescriptor *destination = (StressDescriptor *)(uintptr_t)table.cpu;
+            for (uint32_t d = 0; d < count; ++d)
+                memcpy(&destination[d], &sources[stress.sources[d]], sizeof(StressDescriptor));
+            copy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            copied += count;
+            live.push_back(stress);
+        }
+
+        uint64_t fence_value = frame_ring_end(frame_ring);
+        descriptor_ring_end_frame(ring, fence_value);
+        for (size_t i = 0; i < live.size(); ++i)
+        {
+            if (live[i].fence_value == 0)
+                live[i].fence_value = fence_value;
+        }
+    }
+    frame_ring_flush(frame_ring);
+
+    printf("descriptor ring: %d frames, %llu tables, %.0f descriptors per frame, ring full %llu times, no overlaps, %.2f ns per descriptor copied\n",
+           frames, (unsigned long long)ring.table_count, frames ? (double)ring.descriptor_count / frames : 0.0, (unsigned long long)full_waits,
+           copied ? copy_seconds * 1e9 / copied : 0.0);
+    return true;
+}
+} // namespace
+
+bool descriptor_allocator_stress(int frames, unsigned int seed)
+{
+    std::mt19937 random(seed);
+    return stress_pool(frames * 100, random) && stress_ring(frames, random);
+}
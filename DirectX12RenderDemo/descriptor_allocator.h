@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/*
+    Descriptor allocation, in two parts.
+
+    DescriptorPool manages one cpu only descriptor heap of one type (cbv/srv/uav, sampler, rtv, dsv). Views are created in it when their
+    resource is created and live as long as the resource does. Free slots are kept on a stack, so allocating and freeing a descriptor is O(1)
+    and a freed slot is the next one handed out again, nothing ever has to search the heap. Descriptors are indices into the heap,
+    descriptor_pool_cpu() turns one into the handle the api wants.
+
+    DescriptorRing manages the shader visible cbv/srv/uav heap. Shaders can only see one such heap at a time and changing it is expensive,
+    so nothing lives in it for long: every frame copies the descriptor tables it binds out of the cpu pools into a piece of the ring, in one
+    copy per table, and the piece comes back once the fence says the gpu is done with the frame. It is the upload ring (upload_ring.h) counted
+    in descriptors instead of bytes, with the same rules: a table never wraps around the end, memory comes back a whole frame at a time.
+
+    Neither knows about d3d12, the bases and the increment are whatever the device said, so the same code runs in the stress test.
+    Allocating is thread safe in both, recording threads build their tables in parallel. Ending a frame and retiring belong to the thread that submits.
+*/
+
+const uint32_t descriptor_null = 0xffffffffu;
+
+struct DescriptorPool
+{
+    uint64_t cpu_base;  // D3D12_CPU_DESCRIPTOR_HANDLE of the first descriptor
+    uint32_t increment; // GetDescriptorHandleIncrementSize() of the heap's type
+    uint32_t capacity;
+    std::vector<uint32_t> free_indices; // Stack of free slots, the top is handed out next
+    std::vector<bool> allocated;        // To catch freeing a descriptor twice
+    std::mutex mutex;
+
+    // Stats
+    uint32_t used;
+    uint32_t peak;
+    uint64_t failed_count; // Allocations that found the heap full
+};
+
+bool descriptor_pool_init(DescriptorPool &pool, uint64_t cpu_base, uint32_t increment, uint32_t capacity);
+uint32_t descriptor_pool_allocate(DescriptorPool &pool); // Index into the heap, descriptor_null if it is full
+bool descriptor_pool_free(DescriptorPool &pool, uint32_t index); // false if it was not allocated
+inline uint64_t descriptor_pool_cpu(const DescriptorPool &pool, uint32_t index)
+{
+    return pool.cpu_base + (uint64_t)index * pool.increment;
+}
+
+// A piece of the shader visible heap, contiguous, what SetGraphicsRootDescriptorTable points at
+struct DescriptorTable
+{
+    uint32_t index; // First descriptor in the heap
+    uint32_t count;
+    uint64_t cpu;   // Where to copy the descriptors to
+    uint64_t gpu;   // Where the shaders find them
+};
+
+struct DescriptorRingFrame
+{
+    uint64_t fence_value;
+    uint64_t end; // Head when the frame was submitted
+};
+
+struct DescriptorRing
+{
+    uint64_t cpu_base;
+    uint64_t gpu_base;
+    uint32_t increment;
+    uint32_t capacity; // Descriptors, a power of two
+    uint64_t head;     // Descriptors handed out so far, including the ones skipped at the end of the heap
+    uint64_t tail;     // Everything before this is free again
+    std::deque<DescriptorRingFrame> frames; // Submitted frames the gpu may still be reading, oldest first
+    std::mutex mutex;
+
+    // Stats, reset by the caller whenever it likes
+    uint64_t table_count;
+    uint64_t descriptor_count;
+    uint64_t failed_count; // Tables that did not fit because the gpu was too far behind
+};
+
+bool descriptor_ring_init(DescriptorRing &ring, uint64_t cpu_base, uint64_t gpu_base, uint32_t increment, uint32_t capacity);
+bool descriptor_ring_allocate(DescriptorRing &ring, uint32_t count, DescriptorTable &table); // false if there is no room until older frames retire
+void descriptor_ring_end_frame(DescriptorRing &ring, uint64_t fence_value); // Everything allocated since the last call is read by the submission that signals fence_value
+void descriptor_ring_retire(DescriptorRing &ring, uint64_t completed_value); // Free the frames whose fence value the gpu has reached
+uint32_t descriptor_ring_used(DescriptorRing &ring);
+
+// Pools: random allocate and free rounds checking that no slot is handed out twice. Ring: thousands of descriptors a frame copied into
+// tables over a FakeFrameQueue, checking no table overlaps one a frame in flight still uses. Prints timings too, returns false on the first problem
+bool descriptor_allocator_stress(int frames, unsigned int seed);
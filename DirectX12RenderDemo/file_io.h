@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+    Whole file reads and writes for the on disk caches (shaders, pipeline library, root signatures).
+    Writes go to a temporary file next to the target that is renamed over it once everything is flushed, so a crash or a second
+    instance never leaves a half written file where the next run would load it. Readers still validate what they get back.
+*/
+
+// Read all of path into contents. Empty files read fine, callers that need data check the size
+inline bool file_read(const std::string &path, std::vector<uint8_t> &contents)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents.resize(size > 0 ? (size_t)size : 0);
+    bool ok = size >= 0 && fread(contents.data(), 1, contents.size(), file) == contents.size();
+    fclose(file);
+    return ok;
+}
+
+// Replace path with header followed by data. Either may be empty. On failure the old file may be gone but never half written
+inline bool file_write_atomic(const std::string &path, const void *header, size_t header_size, const void *data, size_t size)
+{
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = (!header_size || fwrite(header, 1, header_size, file) == header_size) && (!size || fwrite(data, 1, size, file) == size);
+    ok = fclose(file) == 0 && ok;
+
+    // rename() does not replace an existing file on windows
+    remove(path.c_str());
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,257 @@
+#include "frame_ring.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+
+bool frame_ring_init(FrameRing &ring, FrameQueue *queue, int max_frames_in_flight)
+{
+    if (!queue || max_frames_in_flight < 1 || max_frames_in_flight > frame_ring_max_frames)
+        return false;
+
+    ring.queue = queue;
+    ring.max_frames_in_flight = max_frames_in_flight;
+    ring.fence_value = queue->GetCompletedValue();
+    ring.frame_number = 0;
+    for (int i = 0; i < frame_ring_max_frames; ++i)
+        ring.frame_fence[i] = ring.fence_value;
+    ring.frame_context = 0;
+    ring.wait_count = 0;
+    ring.wait_seconds = 0.0;
+    return true;
+}
+
+bool frame_ring_wait(FrameRing &ring, uint64_t value)
+{
+    // Cheap check first, most of the time the gpu is already past it
+    if (ring.queue->GetCompletedValue() >= value)
+        return true;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = ring.queue->WaitForValue(value);
+    ring.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++ring.wait_count;
+    return ok;
+}
+
+int frame_ring_begin(FrameRing &ring)
+{
+    PROFILE_SCOPE("frame_ring_begin");
+    // The context we are about to reuse was last used max_frames_in_flight frames ago, that frame has to be done on the gpu
+    // If the wait failed the gpu may still be using it, the frame is not begun and the same context comes up next time
+    int context = (int)(ring.frame_number % (uint64_t)ring.max_frames_in_flight);
+    if (!frame_ring_wait(ring, ring.frame_fence[context]))
+        return -1;
+    ring.frame_context = context;
+    ++ring.frame_number;
+    return context;
+}
+
+uint64_t frame_ring_end(FrameRing &ring)
+{
+    uint64_t value = frame_ring_signal(ring);
+    if (value)
+        ring.frame_fence[ring.frame_context] = value;
+    return value;
+}
+
+uint64_t frame_ring_signal(FrameRing &ring)
+{
+    // A value that was never signaled must not be waited for, so it is only taken once the Signal went through
+    if (!ring.queue->Signal(ring.fence_value + 1))
+        return 0;
+    return ++ring.fence_value;
+}
+
+bool frame_ring_flush(FrameRing &ring)
+{
+    return frame_ring_wait(ring, ring.fence_value);
+}
+
+uint64_t frame_ring_completed(FrameRing &ring)
+{
+    return ring.queue->GetCompletedValue();
+}
+
+// -- Fake queue -- //
+
+FakeFrameQueue::FakeFrameQueue(double gpu_frame_ms)
+    : gpu_frame_time(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(gpu_frame_ms))),
+      last_completion(std::chrono::steady_clock::now()),
+      completed_value(0)
+{
+}
+
+bool FakeFrameQueue::Signal(uint64_t value)
+{
+    // The work starts when it is submitted or when the previous work is done, whichever comes last, just like on a real queue
+    auto now = std::chrono::steady_clock::now();
+    auto start = last_completion > now ? last_completion : now;
+    last_completion = start + gpu_frame_time;
+    pending.push_back(std::make_pair(value, last_completion));
+    return true;
+}
+
+uint64_t FakeFrameQueue::GetCompletedValue()
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!pending.empty() && pending.front().second <= now)
+    {
+        completed_value = pending.front().first;
+        pending.pop_front();
+    }
+    return completed_value;
+}
+
+bool FakeFrameQueue::WaitForValue(uint64_t value)
+{
+    while (GetCompletedValue() < value)
+    {
+        // Nothing left that could reach the value, waiting would never end
+        if (pending.empty() || pending.back().first < value)
+            return false;
+
+        std::this_thread::sleep_until(pending.front().second);
+    }
+    return true;
+}
+
+// -- Stress -- //
+
+namespace
+{
+// A fake queue that fails every fail_every-th Signal and wait on purpose and remembers what the ring waited for
+struct StressFrameQueue : FakeFrameQueue
+{
+    StressFrameQueue(double gpu_frame_ms, int fail_every) : FakeFrameQueue(gpu_frame_ms), fail_every(fail_every) {}
+
+    bool Signal(uint64_t value) override
+    {
+        if (++signals % fail_every == 0)
+        {
+            ++failed_signals;
+            return false;
+        }
+        return FakeFrameQueue::Signal(value);
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        waited_for = value;
+        if (++waits % fail_every == 0)
+        {
+            ++failed_waits;
+            return false;
+        }
+        // The fake queue refuses values nobody signaled, the ring must never ask for one
+        if (!FakeFrameQueue::WaitForValue(value))
+        {
+            ++unreachable_waits;
+            return false;
+        }
+        return true;
+    }
+
+    int fail_every;
+    uint64_t signals = 0;
+    uint64_t waits = 0;
+    uint64_t failed_signals = 0;
+    uint64_t failed_waits = 0;
+    uint64_t unreachable_waits = 0;
+    uint64_t waited_for = 0;
+};
+} // namespace
+
+bool frame_ring_stress(int frames, unsigned int seed)
+{
+    const int frames_per_run = 250;
+    std::mt19937 random(seed);
+    uint64_t waits = 0, failed_signals = 0, failed_waits = 0;
+
+    for (int run = 0; run * frames_per_run < frames; ++run)
+    {
+        // Every ring depth in turn, with a "gpu" fast enough to sometimes keep up and sometimes not
+        int frames_in_flight = 1 + run % frame_ring_max_frames;
+        StressFrameQueue queue(0.01 * (1 + random() % 20), 7 + (int)(random() % 20));
+        FrameRing ring;
+        if (!frame_ring_init(ring, &queue, frames_in_flight))
+            return false;
+
+        // What the ring should wait for before handing each context out again, from what frame_ring_end returned
+        uint64_t context_fence[frame_ring_max_frames] = {};
+        int run_frames = std::min(frames_per_run, frames - run * frames_per_run);
+        for (int frame = 0; frame < run_frames;)
+        {
+            int expected = (int)(ring.frame_number % (uint64_t)frames_in_flight);
+            uint64_t frame_number = ring.frame_number;
+            uint64_t failed = queue.failed_waits;
+            queue.waited_for = 0;
+
+            int context = frame_ring_begin(ring);
+            if (queue.waited_for && queue.waited_for != context_fence[expected])
+            {
+                printf("frame ring: %d in flight, frame %llu context %d waited for %llu, its last frame signaled %llu\n", frames_in_flight,
+                       (unsigned long long)frame_number, expected, (unsigned long long)queue.waited_for, (unsigned long long)context_fence[expected]);
+                return false;
+            }
+            if (context < 0)
+            {
+                // Only a wait failed on purpose may refuse the context, and then the same one has to come up again
+                if (queue.failed_waits == failed || ring.frame_number != frame_number)
+                {
+                    printf("frame ring: frame %llu was refused without a failed wait\n", (unsigned long long)frame_number);
+                    return false;
+                }
+                continue;
+            }
+            if (context != expected || queue.GetCompletedValue() < context_fence[context])
+            {
+                printf("frame ring: %d in flight, frame %llu got context %d (expected %d) at fence %llu, it was last used by %llu\n", frames_in_flight,
+                       (unsigned long long)frame_number, context, expected, (unsigned long long)queue.GetCompletedValue(),
+                       (unsigned long long)context_fence[context]);
+                return false;
+            }
+            if (ring.fence_value - queue.GetCompletedValue() >= (uint64_t)frames_in_flight)
+            {
+                printf("frame ring: %d in flight, frame %llu started with %llu frames still on the gpu\n", frames_in_flight, (unsigned long long)frame_number,
+                       (unsigned long long)(ring.fence_value - queue.GetCompletedValue()));
+                return false;
+            }
+
+            uint64_t fence_value = ring.fence_value;
+            uint64_t failed_signal = queue.failed_signals;
+            uint64_t value = frame_ring_end(ring);
+            if (queue.failed_signals != failed_signal ? value != 0 || ring.fence_value != fence_value : value != fence_value + 1)
+            {
+                printf("frame ring: frame %llu end returned %llu after %llu\n", (unsigned long long)frame_number, (unsigned long long)value,
+                       (unsigned long long)fence_value);
+                return false;
+            }
+            if (value)
+                context_fence[context] = value;
+            ++frame;
+
+            // Now and then wait for everything, like a resize or shutdown does
+            if (random() % 64 == 0 && frame_ring_flush(ring) && queue.GetCompletedValue() < ring.fence_value)
+            {
+                printf("frame ring: flush returned before the fence reached %llu\n", (unsigned long long)ring.fence_value);
+                return false;
+            }
+        }
+        if (queue.unreachable_waits)
+        {
+            printf("frame ring: %d in flight, waited %llu times for a value that was never signaled\n", frames_in_flight,
+                   (unsigned long long)queue.unreachable_waits);
+            return false;
+        }
+        waits += queue.waits;
+        failed_signals += queue.failed_signals;
+        failed_waits += queue.failed_waits;
+    }
+
+    printf("frame ring: %d frames at 1 to %d frames in flight, waited %llu times, %llu signals and %llu waits failed on purpose, "
+           "every context reused at the right fence value\n",
+           frames, frame_ring_max_frames, (unsigned long long)waits, (unsigned long long)failed_signals, (unsigned long long)failed_waits);
+    return true;
+}
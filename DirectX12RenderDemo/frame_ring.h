@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <utility>
+
+/*
+    Frame pacing with one timeline fence.
+
+    Every submission signals the next value of a single, ever increasing fence. The cpu keeps a ring of frame contexts (command allocators, per frame
+    upload space, ...) and each context remembers the fence value of the last frame that used it. Before a context is reused we wait for that value.
+    With max_frames_in_flight = N the cpu can be at most N frames ahead of the gpu: frame F waits for frame F - N and nothing else, so how far
+    the cpu runs ahead is deterministic and does not depend on which back buffer the swap chain hands us.
+    N = 1 is lowest latency (cpu and gpu take turns), bigger N trades latency for throughput.
+
+    The ring only talks to the queue through FrameQueue, so the same logic runs on the d3d12 queue, the cpu backend and FakeFrameQueue.
+
+    A failed Signal or wait usually means the device is gone, so the ring hands failures back instead of guessing: frame_ring_begin returns -1
+    and keeps the context locked, frame_ring_end and frame_ring_signal return 0 and do not use up the value, frame_ring_flush returns false.
+    A frame whose Signal failed keeps waiting for its context's previous value, callers should stop rendering rather than reuse it.
+*/
+
+const int frame_ring_max_frames = 8; // Upper limit for max_frames_in_flight, sizes the per frame arrays
+
+// The few things the ring needs from a command queue and its fence
+struct FrameQueue
+{
+    virtual ~FrameQueue() {}
+    virtual bool Signal(uint64_t value) = 0;       // Set the fence to value once everything submitted so far is done
+    virtual uint64_t GetCompletedValue() = 0;      // Last value the fence reached
+    virtual bool WaitForValue(uint64_t value) = 0; // Block until the fence reaches value
+};
+
+struct FrameRing
+{
+    FrameQueue *queue;
+    int max_frames_in_flight;
+    uint64_t fence_value;                             // Last value signaled on the timeline
+    uint64_t frame_number;                            // Frames begun so far
+    uint64_t frame_fence[frame_ring_max_frames];      // Fence value of the last frame that used each context
+    int frame_context;                                // Context of the frame being recorded
+
+    // How often and how long the cpu had to wait for the gpu
+    uint64_t wait_count;
+    double wait_seconds;
+};
+
+bool frame_ring_init(FrameRing &ring, FrameQueue *queue, int max_frames_in_flight);
+int frame_ring_begin(FrameRing &ring);      // Waits until the next context is free and returns its index, -1 if the wait failed
+uint64_t frame_ring_end(FrameRing &ring);   // Signals the frame's fence value, call after submitting the frame's work. 0 if the Signal failed
+uint64_t frame_ring_signal(FrameRing &ring); // Signal a value outside of a frame, e.g. after uploads at startup. 0 if the Signal failed
+bool frame_ring_wait(FrameRing &ring, uint64_t value);
+bool frame_ring_flush(FrameRing &ring);     // Wait for everything signaled so far
+uint64_t frame_ring_completed(FrameRing &ring);
+
+// Run frames over a FakeFrameQueue that fails some Signals and waits on purpose, and check that every frame context is only handed out
+// again once the fence reached the value of the frame that used it last, and that no wait is for a later value than that. Returns false
+// on the first problem
+bool frame_ring_stress(int frames, unsigned int seed);
+
+/*
+    A stand in for a gpu queue: each signaled value completes gpu_frame_time after the previous one did (or after it was signaled, if the
+    "gpu" was idle). Lets the ring be exercised and measured with no device at all, e.g. headless -gpu-ms 5 -frames-in-flight 2
+*/
+struct FakeFrameQueue : FrameQueue
+{
+    explicit FakeFrameQueue(double gpu_frame_ms);
+
+    bool Signal(uint64_t value) override;
+    uint64_t GetCompletedValue() override;
+    bool WaitForValue(uint64_t value) override;
+
+    std::chrono::steady_clock::duration gpu_frame_time;
+    std::chrono::steady_clock::time_point last_completion;
+    std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> pending; // Signaled values that have not completed yet and when they will
+    uint64_t completed_value;
+};
@@ -0,0 +1,101 @@
+#include "gpu_timer.h"
+#include "profiler.h"
+
+bool gpu_timer_init(GpuTimer &timer, GpuTimerQueue *queue, int frames)
+{
+    if (!queue || frames < 1 || frames > frame_ring_max_frames || queue->Frequency() == 0)
+        return false;
+
+    timer.queue = queue;
+    timer.frames = frames;
+    timer.context = 0;
+    timer.active = false;
+    timer.track = profiler_track("gpu");
+    for (GpuTimerFrame &frame : timer.frame)
+    {
+        frame.regions.store(0);
+        frame.resolved = 0;
+    }
+    timer.region_count = 0;
+    timer.dropped_count = 0;
+    return true;
+}
+
+void gpu_timer_shutdown(GpuTimer &timer)
+{
+    timer.queue = nullptr;
+    timer.active = false;
+}
+
+void gpu_timer_begin_frame(GpuTimer &timer, int context)
+{
+    if (!timer.queue)
+        return;
+
+    // The last frame that used this context is done, so are its timestamps
+    GpuTimerFrame &frame = timer.frame[context];
+    std::chrono::steady_clock::time_point cpu_time;
+    uint64_t gpu_ticks;
+    if (frame.resolved > 0 && timer.queue->Calibrate(gpu_ticks, cpu_time))
+    {
+        const uint64_t *results = timer.queue->Results() + (size_t)context * gpu_timer_max_queries;
+        double seconds_per_tick = 1.0 / (double)timer.queue->Frequency();
+        auto to_cpu = [&](uint64_t ticks) {
+            // Signed, the timestamps are from before the calibration
+            double seconds = (double)(int64_t)(ticks - gpu_ticks) * seconds_per_tick;
+            return cpu_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+        };
+        for (uint32_t region = 0; region < frame.resolved; ++region)
+        {
+            uint64_t begin = results[region * 2];
+            uint64_t end = results[region * 2 + 1];
+            profiler_record_time(timer.track, frame.names[region], to_cpu(begin), to_cpu(end < begin ? begin : end));
+        }
+        timer.region_count += frame.resolved;
+    }
+
+    timer.context = context;
+    timer.active = profiler_enabled.load(std::memory_order_relaxed);
+    frame.regions.store(0, std::memory_order_relaxed);
+    frame.resolved = 0;
+}
+
+int gpu_timer_begin(GpuTimer &timer, void *command_list, const char *name)
+{
+    if (!timer.active)
+        return -1;
+
+    GpuTimerFrame &frame = timer.frame[timer.context];
+    uint32_t region = frame.regions.fetch_add(1, std::memory_order_relaxed);
+    if (region >= gpu_timer_max_regions)
+        return -1;
+
+    frame.names[region] = name;
+    timer.queue->Timestamp(command_list, (uint32_t)timer.context * gpu_timer_max_queries + region * 2);
+    return (int)region;
+}
+
+void gpu_timer_end(GpuTimer &timer, void *command_list, int region)
+{
+    if (region < 0)
+        return;
+    timer.queue->Timestamp(command_list, (uint32_t)timer.context * gpu_timer_max_queries + (uint32_t)region * 2 + 1);
+}
+
+void gpu_timer_end_frame(GpuTimer &timer, void *command_list)
+{
+    if (!timer.active)
+        return;
+
+    // Every recording thread is done, the regions count is final
+    GpuTimerFrame &frame = timer.frame[timer.context];
+    uint32_t regions = frame.regions.load(std::memory_order_relaxed);
+    if (regions > gpu_timer_max_regions)
+    {
+        timer.dropped_count += regions - gpu_timer_max_regions;
+        regions = gpu_timer_max_regions;
+    }
+    if (regions > 0)
+        timer.queue->Resolve(command_list, (uint32_t)timer.context * gpu_timer_max_queries, regions * 2);
+    frame.resolved = regions;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "frame_ring.h"
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+/*
+    How long the passes of a frame take on the gpu, next to the cpu markers of profiler.h.
+
+    gpu_timer_begin() and gpu_timer_end() bracket a region of a command list with two timestamp queries. Every frame context has its own
+    range of gpu_timer_max_queries queries and gpu_timer_end_frame() resolves the ones the frame used into the same range of a readback
+    buffer, at the end of the frame's last command list. Nobody waits for the results: the frame ring already waits for a frame context's
+    fence before it is reused, so gpu_timer_begin_frame() reads the results of the frame that last used the context right then.
+
+    Timestamps count in the queue's own ticks. A calibration (a gpu timestamp and the cpu time at the same moment) turns them into
+    steady_clock time, and the regions go to the profiler as events on a track of their own ("gpu"), so the trace shows them under
+    the cpu work that recorded them and the summary lists them with the cpu scopes. Timers only record while the profiler is on.
+
+    The timer knows nothing about d3d12, GpuTimerQueue writes the timestamps and resolves them. On the d3d12 queue that is EndQuery and
+    ResolveQueryData, on the cpu backend the queue writes the time a timestamp command executes, after rasterizing everything before it,
+    so the same passes get the rasterizer's times.
+
+    Regions may be begun and ended from every recording thread at once, gpu_timer_begin_frame() and gpu_timer_end_frame() are called
+    by the thread that submits.
+*/
+
+const uint32_t gpu_timer_max_regions = 64; // Per frame, more are not timed
+const uint32_t gpu_timer_max_queries = gpu_timer_max_regions * 2;
+
+// What the timer needs from a queue, command lists are whatever the queue records into
+struct GpuTimerQueue
+{
+    virtual ~GpuTimerQueue() {}
+    virtual void Timestamp(void *command_list, uint32_t query) = 0;
+    virtual void Resolve(void *command_list, uint32_t first_query, uint32_t count) = 0; // Into the readback memory at the same index
+    virtual const uint64_t *Results() = 0; // Readback memory, one timestamp per query
+    virtual uint64_t Frequency() = 0;      // Ticks per second
+    virtual bool Calibrate(uint64_t &gpu_ticks, std::chrono::steady_clock::time_point &cpu_time) = 0; // The same moment on both clocks
+};
+
+struct GpuTimerFrame
+{
+    std::atomic<uint32_t> regions;             // Regions begun this frame, may go past gpu_timer_max_regions
+    uint32_t resolved;                         // Regions whose results were resolved, read once the context comes around again
+    const char *names[gpu_timer_max_regions];
+};
+
+struct GpuTimer
+{
+    GpuTimerQueue *queue;
+    int frames;       // Frame contexts, each has its own range of queries
+    int context;      // Frame context being recorded
+    bool active;      // Timing this frame, the profiler was on when it began
+    uint32_t track;   // Profiler track the regions go to
+    GpuTimerFrame frame[frame_ring_max_frames];
+
+    // Stats
+    uint64_t region_count;   // Regions reported to the profiler
+    uint64_t dropped_count;  // Regions past gpu_timer_max_regions
+};
+
+bool gpu_timer_init(GpuTimer &timer, GpuTimerQueue *queue, int frames); // The queue has frames * gpu_timer_max_queries queries
+void gpu_timer_shutdown(GpuTimer &timer);
+
+// The frame context is free again (its fence completed), report what it timed last time and start timing the new frame
+void gpu_timer_begin_frame(GpuTimer &timer, int context);
+int gpu_timer_begin(GpuTimer &timer, void *command_list, const char *name); // name has to outlive the frame, -1 if nothing is timed
+void gpu_timer_end(GpuTimer &timer, void *command_list, int region);
+void gpu_timer_end_frame(GpuTimer &timer, void *command_list); // Record the resolve, in the last list of the frame
+
+// Times the rest of the block on a command list
+struct GpuTimerScope
+{
+    GpuTimer &timer;
+    void *command_list;
+    int region;
+
+    GpuTimerScope(GpuTimer &scope_timer, void *list, const char *name)
+        : timer(scope_timer), command_list(list), region(gpu_timer_begin(scope_timer, list, name))
+    {
+    }
+    ~GpuTimerScope()
+    {
+        gpu_timer_end(timer, command_list, region);
+    }
+    GpuTimerScope(const GpuTimerScope &) = delete;
+    GpuTimerScope &operator=(const GpuTimerScope &) = delete;
+};
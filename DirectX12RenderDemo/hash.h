@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+    64 bit FNV-1a, what the caches key their entries with. Fast, no tables, and good enough to tell sources and pipeline descs apart.
+    Start from hash_offset and feed the fields in one at a time. Hash fields, not whole structs, padding bytes are not guaranteed to be zero.
+*/
+
+const uint64_t hash_offset = 0xcbf29ce484222325ull;
+const uint64_t hash_prime = 0x100000001b3ull;
+
+inline void hash_bytes(uint64_t &hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= hash_prime;
+    }
+}
+
+// Strings are hashed with their terminator so "ab" + "c" and "a" + "bc" differ
+inline void hash_string(uint64_t &hash, const char *text)
+{
+    if (!text)
+        text = "";
+    hash_bytes(hash, text, strlen(text) + 1);
+}
+
+template <typename T>
+inline void hash_value(uint64_t &hash, const T &value)
+{
+    hash_bytes(hash, &value, sizeof(value));
+}
@@ -0,0 +1,554 @@
+#include "headless.h"
+#include "software_renderer.h"
+#include "job_system.h"
+#include "frame_ring.h"
+#include "upload_ring.h"
+#include "upload_manager.h"
+#include "heap_allocator.h"
+#include "descriptor_allocator.h"
+#include "render_graph.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "vertex_format.h"
+#include "subresource_copy.h"
+#include "profiler.h"
+#include "benchmark.h"
+#include "app_loop.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct HeadlessOptions
+{
+    int frames = 1000;
+    bool frames_set = false; // -frames was given, benchmarks measure fewer frames by default
+    int warmup = 10;
+    int width = 800;
+    int height = 600;
+    int threads = 0; // 0 means one per hardware thread
+    int instances = 1;
+    int frames_in_flight = 2;
+    int record_threads = 1;
+    double gpu_ms = 0.0; // > 0 puts a FakeFrameQueue with this much "gpu" time per frame behind the ring
+    const char *dump_path = nullptr;
+    const char *isa = nullptr; // nullptr means whatever the cpu supports best
+    const char *profile_path = nullptr; // Chrome trace of the run's profiler markers
+    const char *benchmark = nullptr;    // Scenario name or all, see benchmark.h
+    const char *benchmark_json = nullptr;
+    const char *benchmark_csv = nullptr;
+    bool bench_threads = false;
+    bool bench_kernels = false;
+    bool bench_meshes = false;
+    bool bench_mesh_optimizer = false;
+    bool bench_vertex_formats = false;
+    bool bench_subresource_copy = false;
+    bool bench_update_subresources = false;
+    bool bench_profiler = false;
+    bool bench_jobs = false;
+    bool quantize_vertices = false;
+    bool stress_frame_ring = false;
+    bool stress_upload_ring = false;
+    bool stress_upload_manager = false;
+    bool stress_heap_allocator = false;
+    bool stress_render_graph = false;
+    bool stress_descriptors = false;
+    bool stress_rasterizer = false;
+};
+
+int hardware_threads()
+{
+    unsigned int count = std::thread::hardware_concurrency();
+    return count ? (int)count : 1;
+}
+
+// Render a number of frames and return how long it took in seconds, false if the frame ring failed and rendering stopped
+bool render_frames(int frames, double &seconds)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        bool rendered;
+        {
+            PROFILE_SCOPE("frame");
+            rendered = software_renderer_render();
+        }
+        profiler_frame();
+        if (!rendered)
+            return false;
+    }
+    bool finished = software_renderer_wait();
+    auto end = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(end - start).count();
+    return finished;
+}
+
+// Render a number of frames on the threads window_loop() uses, and return how long it took in seconds. This thread plays the platform
+// thread: in place of the window's messages it posts a key press every millisecond until the loop stops. false if the frame ring failed
+bool render_frames_threaded(int frames, AppLoop &loop, uint64_t &key_presses, double &seconds)
+{
+    AppLoopCallbacks callbacks;
+    callbacks.event = [&key_presses](const AppEvent &event) {
+        if (event.type == APP_EVENT_KEY_DOWN)
+            ++key_presses;
+    };
+    callbacks.update = [frames](uint64_t frame) { return frame < (uint64_t)frames; };
+    // A frame that failed stops the loop like a renderer error does in window_loop()
+    bool rendered = true;
+    callbacks.render = [&rendered](uint64_t) {
+        {
+            PROFILE_SCOPE("frame");
+            rendered = software_renderer_render();
+        }
+        profiler_frame();
+        return rendered;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    app_loop_start(loop, callbacks);
+    for (uint32_t key = 0; !app_loop_quitting(loop); ++key)
+    {
+        AppEvent event = {APP_EVENT_KEY_DOWN, 'A' + key % 26, 0, 0};
+        app_loop_post(loop, event);
+        event.type = APP_EVENT_KEY_UP;
+        app_loop_post(loop, event);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    app_loop_join(loop);
+    bool finished = software_renderer_wait();
+    auto end = std::chrono::steady_clock::now();
+    seconds = std::chrono::duration<double>(end - start).count();
+    return rendered && finished;
+}
+
+int headless_render(const HeadlessOptions &options)
+{
+    job_system_init(options.threads);
+
+    //Same threads as window_loop(), a fake event source in place of the messages
+    AppLoop loop;
+    uint64_t key_presses = 0;
+    double seconds = 0.0;
+    if (!render_frames_threaded(options.frames, loop, key_presses, seconds))
+    {
+        fprintf(stderr, "headless: the frame ring failed to wait or signal, rendering stopped\n");
+        return 1;
+    }
+    printf("headless: %d frames at %dx%d on %d threads in %.3f s, %.1f fps, %.3f ms per frame\n",
+           options.frames, options.width, options.height, job_system_size(), seconds, options.frames / seconds, seconds * 1000.0 / options.frames);
+    printf("headless: %d frames in flight, waited for the queue %llu times for %.3f ms\n",
+           software_frame_ring.max_frames_in_flight, (unsigned long long)software_frame_ring.wait_count, software_frame_ring.wait_seconds * 1000.0);
+    printf("headless: %llu events posted, %llu handled by the simulation thread (%llu key presses), %llu dropped\n",
+           (unsigned long long)loop.posted_count.load(), (unsigned long long)loop.handled_count, (unsigned long long)key_presses,
+           (unsigned long long)loop.dropped_count.load());
+
+    //What the state trackers made of the transitions the recording threads asked for
+    uint64_t requested = 0, barriers = 0, flushes = 0;
+    for (int thread = 0; thread < record_threads_max; ++thread)
+    {
+        requested += software_state_trackers[thread].requested;
+        barriers += software_state_trackers[thread].barriers;
+        flushes += software_state_trackers[thread].flushes;
+    }
+    printf("headless: %.1f barriers per frame in %.1f ResourceBarrier calls, %.1f transitions asked for, %llu state errors\n",
+           (double)barriers / options.frames, (double)flushes / options.frames, (double)requested / options.frames, (unsigned long long)software_barrier_errors);
+
+    if (options.dump_path)
+    {
+        if (!software_target_save_ppm(software_targets[software_present_index], options.dump_path))
+        {
+            fprintf(stderr, "headless: could not write %s\n", options.dump_path);
+            return 1;
+        }
+        printf("headless: wrote %s\n", options.dump_path);
+    }
+    return 0;
+}
+
+// Render the same frames with 1..threads workers and report the speedup over one thread
+int headless_bench_threads(const HeadlessOptions &options)
+{
+    const int warmup_frames = 10;
+    double single_thread_seconds = 0.0;
+
+    printf("threads, ms per frame, fps, speedup, efficiency\n");
+    for (int threads = 1; threads <= options.threads; ++threads)
+    {
+        job_system_init(threads);
+        double seconds = 0.0;
+        if (!render_frames(warmup_frames, seconds) || !render_frames(options.frames, seconds))
+        {
+            fprintf(stderr, "headless: the frame ring failed to wait or signal, rendering stopped\n");
+            return 1;
+        }
+        if (threads == 1)
+            single_thread_seconds = seconds;
+
+        double speedup = single_thread_seconds / seconds;
+        printf("%d, %.3f, %.1f, %.2f, %.0f%%\n", threads, seconds * 1000.0 / options.frames, options.frames / seconds, speedup, speedup * 100.0 / threads);
+    }
+    return 0;
+}
+
+// Set up the cpu backend the way the options say, cleans up after itself if that fails
+bool headless_renderer_init(const HeadlessOptions &options, FakeFrameQueue &fake_queue, int width, int height)
+{
+    software_frame_queue = options.gpu_ms > 0.0 ? &fake_queue : nullptr;
+    software_frames_in_flight = options.frames_in_flight;
+    software_record_threads = options.record_threads;
+    software_vertex_tolerance = options.quantize_vertices ? vertex_format_default_tolerance : 0.0f;
+
+    if (!software_renderer_init(width, height))
+    {
+        fprintf(stderr, "headless: software renderer initialization failed!\n");
+        software_renderer_cleanup();
+        return false;
+    }
+    software_draw_instances = (uint32_t)options.instances;
+
+    if (options.isa)
+    {
+        int isa = 0;
+        while (isa < RASTERIZER_ISA_COUNT && strcmp(options.isa, rasterizer_isa_name((RasterizerIsa)isa)) != 0)
+            ++isa;
+        if (isa == RASTERIZER_ISA_COUNT || !rasterizer_isa_supported((RasterizerIsa)isa))
+        {
+            fprintf(stderr, "headless: isa %s is not available on this cpu\n", options.isa);
+            software_renderer_cleanup();
+            return false;
+        }
+        software_raster_kernel = rasterizer_kernel((RasterizerIsa)isa);
+    }
+    return true;
+}
+
+// Run one scenario or all of them for -warmup + -frames frames each, print the statistics and write them out for regression tracking
+int headless_benchmark(const HeadlessOptions &options)
+{
+    std::vector<const BenchmarkScenario *> scenarios;
+    for (int i = 0; i < benchmark_scenario_count; ++i)
+    {
+        if (strcmp(options.benchmark, "all") == 0 || strcmp(options.benchmark, benchmark_scenarios[i].name) == 0)
+            scenarios.push_back(&benchmark_scenarios[i]);
+    }
+    if (options.warmup < 0)
+    {
+        fprintf(stderr, "headless: -warmup has to be 0 or more\n");
+        return 1;
+    }
+    if (scenarios.empty())
+    {
+        fprintf(stderr, "headless: no benchmark called %s, there is all", options.benchmark);
+        for (int i = 0; i < benchmark_scenario_count; ++i)
+            fprintf(stderr, ", %s", benchmark_scenarios[i].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    int frames = options.frames_set ? options.frames : 200;
+
+    job_system_init(options.threads);
+    std::vector<BenchmarkResult> results;
+    for (const BenchmarkScenario *scenario : scenarios)
+    {
+        Mesh mesh = benchmark_scenario_mesh(*scenario);
+        software_scene_mesh = &mesh;
+        FakeFrameQueue fake_queue(options.gpu_ms);
+        if (!headless_renderer_init(options, fake_queue, scenario->width, scenario->height))
+        {
+            software_scene_mesh = nullptr;
+            job_system_shutdown();
+            return 1;
+        }
+        software_draw_instances = scenario->instances;
+        software_draw_calls = scenario->draws;
+
+        results.push_back(benchmark_run(*scenario, options.warmup, frames, [](double &submit_seconds, uint64_t &barriers) {
+            bool rendered = software_renderer_render();
+            profiler_frame();
+            submit_seconds = software_submit_seconds;
+            barriers = software_frame_barriers;
+            return rendered;
+        }));
+        printf("%s", benchmark_report(results.back()).c_str());
+
+        software_renderer_cleanup();
+        software_scene_mesh = nullptr;
+        software_draw_calls = 1;
+    }
+    job_system_shutdown();
+
+    int result = 0;
+    if (options.benchmark_json && !benchmark_write_json(options.benchmark_json, "software", options.threads, results))
+    {
+        fprintf(stderr, "headless: could not write %s\n", options.benchmark_json);
+        result = 1;
+    }
+    if (options.benchmark_csv && !benchmark_write_csv(options.benchmark_csv, "software", options.threads, results))
+    {
+        fprintf(stderr, "headless: could not write %s\n", options.benchmark_csv);
+        result = 1;
+    }
+    return result;
+}
+} // namespace
+
+int headless_run(int argc, char **argv)
+{
+    HeadlessOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+        {
+            options.frames = atoi(argv[++i]);
+            options.frames_set = true;
+        }
+        else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc)
+            options.warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-benchmark") == 0 && i + 1 < argc)
+            options.benchmark = argv[++i];
+        else if (strcmp(argv[i], "-benchmark-json") == 0 && i + 1 < argc)
+            options.benchmark_json = argv[++i];
+        else if (strcmp(argv[i], "-benchmark-csv") == 0 && i + 1 < argc)
+            options.benchmark_csv = argv[++i];
+        else if (strcmp(argv[i], "-width") == 0 && i + 1 < argc)
+            options.width = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-height") == 0 && i + 1 < argc)
+            options.height = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc)
+            options.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-instances") == 0 && i + 1 < argc)
+            options.instances = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-frames-in-flight") == 0 && i + 1 < argc)
+            options.frames_in_flight = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-record-threads") == 0 && i + 1 < argc)
+            options.record_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-gpu-ms") == 0 && i + 1 < argc)
+            options.gpu_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "-dump") == 0 && i + 1 < argc)
+            options.dump_path = argv[++i];
+        else if (strcmp(argv[i], "-isa") == 0 && i + 1 < argc)
+            options.isa = argv[++i];
+        else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+            options.profile_path = argv[++i];
+        else if (strcmp(argv[i], "-bench-threads") == 0)
+            options.bench_threads = true;
+        else if (strcmp(argv[i], "-bench-kernels") == 0)
+            options.bench_kernels = true;
+        else if (strcmp(argv[i], "-bench-meshes") == 0)
+            options.bench_meshes = true;
+        else if (strcmp(argv[i], "-bench-mesh-optimizer") == 0)
+            options.bench_mesh_optimizer = true;
+        else if (strcmp(argv[i], "-bench-vertex-formats") == 0)
+            options.bench_vertex_formats = true;
+        else if (strcmp(argv[i], "-bench-subresource-copy") == 0)
+            options.bench_subresource_copy = true;
+        else if (strcmp(argv[i], "-bench-update-subresources") == 0)
+            options.bench_update_subresources = true;
+        else if (strcmp(argv[i], "-bench-profiler") == 0)
+            options.bench_profiler = true;
+        else if (strcmp(argv[i], "-bench-jobs") == 0)
+            options.bench_jobs = true;
+        else if (strcmp(argv[i], "-quantize-vertices") == 0)
+            options.quantize_vertices = true;
+        else if (strcmp(argv[i], "-stress-frame-ring") == 0)
+            options.stress_frame_ring = true;
+        else if (strcmp(argv[i], "-stress-upload-ring") == 0)
+            options.stress_upload_ring = true;
+        else if (strcmp(argv[i], "-stress-upload-manager") == 0)
+            options.stress_upload_manager = true;
+        else if (strcmp(argv[i], "-stress-heap-allocator") == 0)
+            options.stress_heap_allocator = true;
+        else if (strcmp(argv[i], "-stress-render-graph") == 0)
+            options.stress_render_graph = true;
+        else if (strcmp(argv[i], "-stress-descriptors") == 0)
+            options.stress_descriptors = true;
+        else if (strcmp(argv[i], "-stress-rasterizer") == 0)
+            options.stress_rasterizer = true;
+    }
+
+    //The kernel benchmark does not need a renderer at all
+    if (options.bench_kernels)
+    {
+        rasterizer_benchmark(4096, 1.0);
+        return 0;
+    }
+
+    if (options.bench_meshes)
+    {
+        return mesh_benchmark() ? 0 : 1;
+    }
+
+    if (options.bench_mesh_optimizer)
+    {
+        return mesh_optimizer_benchmark() ? 0 : 1;
+    }
+
+    if (options.bench_vertex_formats)
+    {
+        return vertex_format_benchmark() ? 0 : 1;
+    }
+
+    if (options.bench_subresource_copy)
+    {
+        job_system_init(options.threads > 0 ? options.threads : hardware_threads());
+        bool ok = subresource_copy_benchmark();
+        job_system_shutdown();
+        return ok ? 0 : 1;
+    }
+
+    if (options.bench_update_subresources)
+    {
+        return subresource_update_benchmark(options.threads > 0 ? options.threads : hardware_threads()) ? 0 : 1;
+    }
+
+    if (options.bench_profiler)
+    {
+        return profiler_overhead_benchmark(options.threads > 0 ? options.threads : hardware_threads()) ? 0 : 1;
+    }
+
+    if (options.bench_jobs)
+    {
+        return job_system_benchmark(options.threads > 0 ? options.threads : hardware_threads()) ? 0 : 1;
+    }
+
+    if (options.stress_frame_ring)
+    {
+        return frame_ring_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.stress_upload_ring)
+    {
+        return upload_ring_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.stress_upload_manager)
+    {
+        return upload_manager_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.stress_heap_allocator)
+    {
+        return heap_allocator_stress(options.frames * 100, 1) ? 0 : 1;
+    }
+
+    if (options.stress_render_graph)
+    {
+        return render_graph_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.stress_descriptors)
+    {
+        return descriptor_allocator_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.stress_rasterizer)
+    {
+        return rasterizer_stress(options.frames, 1) ? 0 : 1;
+    }
+
+    if (options.threads <= 0)
+        options.threads = hardware_threads();
+
+    if (options.frames < 1 || options.width < 1 || options.height < 1 || options.instances < 1)
+    {
+        fprintf(stderr, "headless: frames, width, height and instances must be positive\n");
+        return 1;
+    }
+
+    if (options.record_threads < 1 || options.record_threads > record_threads_max)
+    {
+        fprintf(stderr, "headless: record threads must be between 1 and %d\n", record_threads_max);
+        return 1;
+    }
+
+    if (options.frames_in_flight < 1 || options.frames_in_flight > frame_ring_max_frames)
+    {
+        fprintf(stderr, "headless: frames in flight must be between 1 and %d\n", frame_ring_max_frames);
+        return 1;
+    }
+
+    //Markers cost next to nothing until the profiler is started, so it only is when asked for
+    if (options.profile_path)
+    {
+        profiler_init(true);
+        profiler_thread_name("main");
+    }
+
+    int result = 1;
+    if (options.benchmark)
+    {
+        //Benchmarks set the renderer up once per scenario
+        result = headless_benchmark(options);
+    }
+    else
+    {
+        //Pretend there is a gpu behind the queue so the cpu has something to wait for
+        FakeFrameQueue fake_queue(options.gpu_ms);
+        if (headless_renderer_init(options, fake_queue, options.width, options.height))
+        {
+            result = options.bench_threads ? headless_bench_threads(options) : headless_render(options);
+            software_renderer_cleanup();
+        }
+    }
+
+    if (options.profile_path)
+    {
+        printf("%s", profiler_summary().c_str());
+        if (profiler_write_chrome_trace(options.profile_path))
+        {
+            printf("headless: wrote %s\n", options.profile_path);
+        }
+        else
+        {
+            fprintf(stderr, "headless: could not write %s\n", options.profile_path);
+            result = 1;
+        }
+        profiler_shutdown();
+    }
+
+    job_system_shutdown();
+    return result;
+}
+
+int headless_run_cmdline(const char *cmdline)
+{
+    // Split on whitespace, argv[0] is the program name like it would be in main()
+    std::vector<std::string> arguments;
+    arguments.push_back("DirectX12RenderDemo");
+
+    std::string current;
+    for (const char *c = cmdline; ; ++c)
+    {
+        if (*c == '\0' || *c == ' ' || *c == '\t')
+        {
+            if (!current.empty())
+                arguments.push_back(current);
+            current.clear();
+            if (*c == '\0')
+                break;
+        }
+        else
+        {
+            current += *c;
+        }
+    }
+
+    std::vector<char *> argv;
+    for (size_t i = 0; i < arguments.size(); ++i)
+        argv.push_back(&arguments[i][0]);
+
+    return headless_run((int)argv.size(), argv.data());
+}
+
+#ifndef _WIN32
+// Without windows there is no WinMain and no window, so the cpu backend is the only thing we can run
+int main(int argc, char **argv)
+{
+    return headless_run(argc, argv);
+}
+#endif
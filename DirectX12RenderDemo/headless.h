@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+    Entry point for running the demo without a window or a gpu. Renders with the cpu backend in software_renderer.cpp
+    On windows pass -headless on the command line, everywhere else this is main()
+    Frames are simulated and rendered on threads of their own like the windowed demo (see app_loop.h), the main thread posts made up
+    key presses to them in place of the window's messages. The -bench modes render on the main thread.
+
+    Options:
+        -frames N     number of frames to render (default 1000, 200 measured frames for -benchmark)
+        -width N      back buffer width (default 800)
+        -height N     back buffer height (default 600)
+        -threads N    job system threads including the main one, they rasterize, record and copy (default one per hardware thread)
+        -instances N  draw the triangle N times per frame to put more load on the rasterizer (default 1)
+        -dump FILE    write the last presented frame to FILE as a ppm
+        -frames-in-flight N  how many frames the cpu may run ahead of the queue, 1 to 8 (default 2)
+        -record-threads N  threads recording command lists for each frame, 1 to 8, the instances are split between them (default 1)
+        -gpu-ms X     pretend the queue is a gpu that takes X ms per frame, to see the frame ring wait for it (default 0, no fake gpu)
+        -quantize-vertices  upload the triangle as 16 bit positions and 8 bit colors if that is exact enough (see vertex_format.h)
+        -isa NAME     force the rasterizer kernel: scalar, sse2 or avx2 (default the best one the cpu supports)
+        -profile FILE  time the frame's profiler markers and the passes on the queue (gpu_timer.h), print min, avg and p99 of every
+                      scope and write a Chrome trace to FILE
+        -benchmark NAME  render the scenario NAME (triangle, many-draws, many-vertices, large-resolution or all, see benchmark.h) for
+                      -warmup frames that are not measured and -frames measured ones, print mean, median, p95, p99 and stddev of the
+                      frame and submit times
+        -warmup N     frames a benchmark renders before it measures (default 10)
+        -benchmark-json FILE  write the benchmark results as JSON
+        -benchmark-csv FILE   and as CSV
+        -bench-threads  render -frames frames with 1 up to -threads threads and print the scaling
+        -bench-kernels  print Mpixels/s of every rasterizer kernel on the same random triangles
+        -bench-meshes  print memory and vertex shader invocations of sample meshes drawn with and without an index buffer
+        -bench-mesh-optimizer  shuffle the sample meshes, then print ACMR, ATVR, overdraw and overfetch after every optimization step
+        -bench-vertex-formats  print memory, fetch bytes and the largest error of the sample meshes in every vertex format
+        -bench-subresource-copy  print GB/s of d3dx12's MemcpySubresource against subresource_copy() for texture sizes up to 4096x4096,
+                      on one thread, with streaming stores and on -threads threads
+        -bench-update-subresources  print GB/s of uploading 4096x4096 mip chains, texture arrays and a volume subresource after
+                      subresource, like UpdateSubresources, and spread over 1 up to -threads threads
+        -bench-profiler  print what a profiler marker costs with the profiler off, on, and on -threads threads at once
+        -bench-jobs   print ns per job of 65536 small jobs on 1 up to -threads threads, through a pool with one mutex guarded queue against
+                      job_spawn() and job_parallel_for(), then run a chain of jobs that depend on each other
+        -stress-frame-ring  run -frames frames through the frame ring at every frames in flight count over a fake queue that fails some
+                      signals and waits, and check each frame context is only reused once the fence reached its last frame's value
+        -stress-upload-ring  run -frames frames of random allocations through an upload ring and check none overlaps a frame in flight
+        -stress-upload-manager  run -frames frames of random buffer and texture uploads through the upload manager over a fake copy queue,
+                      check every upload once its ticket is done and print how many copies merging saved. Some batches fail to
+                      execute on purpose, their tickets must never report done
+        -stress-heap-allocator  run -frames * 100 random allocations, frees and defragment passes through the placed resource heap allocator
+        -stress-render-graph  print the compile of an example deferred frame, then compile -frames random render graphs and check them,
+                      also once executed on several command lists
+        -stress-descriptors  run -frames * 100 random operations on a descriptor pool and -frames frames of descriptor tables through the shader visible ring
+        -stress-rasterizer  draw -frames random triangles as tall as the simd kernels can take, and a bit taller, with every kernel and check
+                      they match the scalar one
+*/
+int headless_run(int argc, char **argv);
+
+// Same thing but takes the raw command line WinMain gets
+int headless_run_cmdline(const char *cmdline);
@@ -0,0 +1,799 @@
+#include "heap_allocator.h"
+#include "align.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+// Index of the highest and lowest set bit, value must not be 0
+int bit_scan_reverse(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+int bit_scan_forward(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Size class of a block of units * granularity bytes. Below heap_tlsf_sl_count units every size has its own list,
+// above that each power of two is split into heap_tlsf_sl_count lists
+void tlsf_mapping(uint64_t units, int &fl, int &sl)
+{
+    if (units < (uint64_t)heap_tlsf_sl_count)
+    {
+        fl = 0;
+        sl = (int)units;
+        return;
+    }
+    int top = bit_scan_reverse(units);
+    fl = top - heap_tlsf_sl_log2 + 1;
+    sl = (int)((units >> (top - heap_tlsf_sl_log2)) - heap_tlsf_sl_count);
+}
+
+// Same but rounded up to the next class, so any block in that class or above is big enough
+void tlsf_mapping_search(uint64_t units, int &fl, int &sl)
+{
+    if (units >= (uint64_t)heap_tlsf_sl_count)
+        units += (1ull << (bit_scan_reverse(units) - heap_tlsf_sl_log2)) - 1;
+    tlsf_mapping(units, fl, sl);
+}
+
+uint32_t tlsf_new_block(HeapTlsf &tlsf)
+{
+    if (!tlsf.unused_blocks.empty())
+    {
+        uint32_t block = tlsf.unused_blocks.back();
+        tlsf.unused_blocks.pop_back();
+        return block;
+    }
+    tlsf.blocks.push_back(HeapTlsfBlock());
+    return (uint32_t)(tlsf.blocks.size() - 1);
+}
+
+void tlsf_release_block(HeapTlsf &tlsf, uint32_t block)
+{
+    tlsf.blocks[block].size = 0;
+    tlsf.blocks[block].free = false;
+    tlsf.unused_blocks.push_back(block);
+}
+
+void tlsf_insert_free(HeapTlsf &tlsf, uint32_t block)
+{
+    int fl, sl;
+    tlsf_mapping(tlsf.blocks[block].size / tlsf.granularity, fl, sl);
+
+    uint32_t head = tlsf.free_lists[fl][sl];
+    tlsf.blocks[block].free = true;
+    tlsf.blocks[block].prev_free = heap_tlsf_null;
+    tlsf.blocks[block].next_free = head;
+    if (head != heap_tlsf_null)
+        tlsf.blocks[head].prev_free = block;
+    tlsf.free_lists[fl][sl] = block;
+
+    tlsf.fl_bitmap |= 1ull << fl;
+    tlsf.sl_bitmap[fl] |= 1u << sl;
+    ++tlsf.free_block_count;
+}
+
+void tlsf_remove_free(HeapTlsf &tlsf, uint32_t block)
+{
+    int fl, sl;
+    tlsf_mapping(tlsf.blocks[block].size / tlsf.granularity, fl, sl);
+
+    uint32_t prev = tlsf.blocks[block].prev_free;
+    uint32_t next = tlsf.blocks[block].next_free;
+    if (prev != heap_tlsf_null)
+        tlsf.blocks[prev].next_free = next;
+    else
+        tlsf.free_lists[fl][sl] = next;
+    if (next != heap_tlsf_null)
+        tlsf.blocks[next].prev_free = prev;
+
+    if (tlsf.free_lists[fl][sl] == heap_tlsf_null)
+    {
+        tlsf.sl_bitmap[fl] &= ~(1u << sl);
+        if (tlsf.sl_bitmap[fl] == 0)
+            tlsf.fl_bitmap &= ~(1ull << fl);
+    }
+    tlsf.blocks[block].free = false;
+    --tlsf.free_block_count;
+}
+
+uint32_t tlsf_find_free(const HeapTlsf &tlsf, uint64_t units)
+{
+    int fl, sl;
+    tlsf_mapping_search(units, fl, sl);
+    if (fl >= heap_tlsf_fl_count)
+        return heap_tlsf_null;
+
+    // Anything in this first level at or above the second level, otherwise the smallest non empty class of a bigger first level
+    uint32_t sl_map = tlsf.sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map)
+    {
+        uint64_t fl_map = fl + 1 < heap_tlsf_fl_count ? tlsf.fl_bitmap & (~0ull << (fl + 1)) : 0;
+        if (!fl_map)
+            return heap_tlsf_null;
+        fl = bit_scan_forward(fl_map);
+        sl_map = tlsf.sl_bitmap[fl];
+    }
+    sl = bit_scan_forward(sl_map);
+    return tlsf.free_lists[fl][sl];
+}
+
+// Cut the first size bytes off a block, the rest becomes a new free block right after it
+void tlsf_split(HeapTlsf &tlsf, uint32_t block, uint64_t size)
+{
+    uint32_t rest = tlsf_new_block(tlsf);
+    HeapTlsfBlock &first = tlsf.blocks[block];
+    HeapTlsfBlock &second = tlsf.blocks[rest];
+    second.offset = first.offset + size;
+    second.size = first.size - size;
+    second.alignment = 0;
+    second.retired = false;
+    second.user = nullptr;
+    second.prev_physical = block;
+    second.next_physical = first.next_physical;
+    if (first.next_physical != heap_tlsf_null)
+        tlsf.blocks[first.next_physical].prev_physical = rest;
+    first.next_physical = rest;
+    first.size = size;
+    tlsf_insert_free(tlsf, rest);
+}
+
+// Merge a block into the one physically before it, which is returned
+uint32_t tlsf_merge_into_prev(HeapTlsf &tlsf, uint32_t block)
+{
+    uint32_t prev = tlsf.blocks[block].prev_physical;
+    uint32_t next = tlsf.blocks[block].next_physical;
+    tlsf.blocks[prev].size += tlsf.blocks[block].size;
+    tlsf.blocks[prev].next_physical = next;
+    if (next != heap_tlsf_null)
+        tlsf.blocks[next].prev_physical = prev;
+    tlsf_release_block(tlsf, block);
+    return prev;
+}
+
+// Take size bytes at alignment out of a free block that is big enough, splitting off what is left in front and behind
+uint32_t tlsf_carve(HeapTlsf &tlsf, uint32_t block, uint64_t size, uint64_t alignment)
+{
+    tlsf_remove_free(tlsf, block);
+
+    // Give the padding in front back as its own free block. The block before is in use, free neighbours are always merged
+    uint64_t padding = align_up(tlsf.blocks[block].offset, alignment) - tlsf.blocks[block].offset;
+    if (padding)
+    {
+        tlsf_split(tlsf, block, padding);
+        uint32_t aligned = tlsf.blocks[block].next_physical;
+        tlsf_remove_free(tlsf, aligned);
+        tlsf_insert_free(tlsf, block);
+        block = aligned;
+    }
+
+    // And whatever is left after it
+    if (tlsf.blocks[block].size - size >= tlsf.granularity)
+        tlsf_split(tlsf, block, size);
+
+    HeapTlsfBlock &allocated = tlsf.blocks[block];
+    allocated.free = false;
+    allocated.alignment = alignment;
+    allocated.retired = false;
+    allocated.user = nullptr;
+    tlsf.used_bytes += allocated.size;
+    ++tlsf.allocation_count;
+    return block;
+}
+
+// Move a used block down to offset, into the free block in front of it. The old and new range overlap, the block keeps its handle.
+// What the free block in front has left is the padding for the alignment. The bytes the block leaves behind at its end become a block
+// of their own that is still in use, returned so the caller can free it once nothing reads the old range anymore
+uint32_t tlsf_slide(HeapTlsf &tlsf, uint32_t block, uint64_t offset)
+{
+    uint32_t prev = tlsf.blocks[block].prev_physical;
+    uint64_t distance = tlsf.blocks[block].offset - offset;
+
+    tlsf_remove_free(tlsf, prev);
+    if (offset > tlsf.blocks[prev].offset)
+    {
+        tlsf.blocks[prev].size = offset - tlsf.blocks[prev].offset;
+        tlsf_insert_free(tlsf, prev);
+    }
+    else
+    {
+        uint32_t before = tlsf.blocks[prev].prev_physical;
+        tlsf.blocks[block].prev_physical = before;
+        if (before != heap_tlsf_null)
+            tlsf.blocks[before].next_physical = block;
+        tlsf_release_block(tlsf, prev);
+    }
+    tlsf.blocks[block].offset = offset;
+
+    uint64_t size = tlsf.blocks[block].size;
+    tlsf.blocks[block].size += distance;
+    tlsf_split(tlsf, block, size);
+    uint32_t tail = tlsf.blocks[block].next_physical;
+    tlsf_remove_free(tlsf, tail);
+    tlsf.blocks[tail].alignment = tlsf.granularity;
+    tlsf.blocks[tail].retired = true;
+    tlsf.used_bytes += distance;
+    ++tlsf.allocation_count;
+    return tail;
+}
+
+uint32_t tlsf_first_block(const HeapTlsf &tlsf)
+{
+    for (uint32_t i = 0; i < (uint32_t)tlsf.blocks.size(); ++i)
+    {
+        if (tlsf.blocks[i].size && tlsf.blocks[i].prev_physical == heap_tlsf_null)
+            return i;
+    }
+    return heap_tlsf_null;
+}
+} // namespace
+
+bool heap_tlsf_init(HeapTlsf &tlsf, uint64_t size, uint64_t granularity)
+{
+    if (granularity == 0 || (granularity & (granularity - 1)) != 0 || size < granularity)
+        return false;
+
+    tlsf.size = size & ~(granularity - 1);
+    tlsf.granularity = granularity;
+    tlsf.blocks.clear();
+    tlsf.unused_blocks.clear();
+    tlsf.fl_bitmap = 0;
+    for (int fl = 0; fl < heap_tlsf_fl_count; ++fl)
+    {
+        tlsf.sl_bitmap[fl] = 0;
+        for (int sl = 0; sl < heap_tlsf_sl_count; ++sl)
+            tlsf.free_lists[fl][sl] = heap_tlsf_null;
+    }
+    tlsf.used_bytes = 0;
+    tlsf.allocation_count = 0;
+    tlsf.free_block_count = 0;
+
+    // The whole heap starts out as one free block
+    uint32_t block = tlsf_new_block(tlsf);
+    tlsf.blocks[block].offset = 0;
+    tlsf.blocks[block].size = tlsf.size;
+    tlsf.blocks[block].alignment = 0;
+    tlsf.blocks[block].retired = false;
+    tlsf.blocks[block].user = nullptr;
+    tlsf.blocks[block].prev_physical = heap_tlsf_null;
+    tlsf.blocks[block].next_physical = heap_tlsf_null;
+    tlsf_insert_free(tlsf, block);
+    return true;
+}
+
+uint32_t heap_tlsf_allocate(HeapTlsf &tlsf, uint64_t size, uint64_t alignment)
+{
+    size = align_up(size ? size : 1, tlsf.granularity);
+    if (alignment < tlsf.granularity)
+        alignment = tlsf.granularity;
+    if (!is_power_of_two(alignment))
+        return heap_tlsf_null;
+
+    // Blocks always start at a multiple of the granularity, ask for enough to move the start up to the alignment
+    uint64_t search = size + alignment - tlsf.granularity;
+    if (search > tlsf.size)
+        return heap_tlsf_null;
+
+    uint32_t block = tlsf_find_free(tlsf, search / tlsf.granularity);
+    if (block == heap_tlsf_null)
+        return heap_tlsf_null;
+    return tlsf_carve(tlsf, block, size, alignment);
+}
+
+void heap_tlsf_free(HeapTlsf &tlsf, uint32_t block)
+{
+    tlsf.used_bytes -= tlsf.blocks[block].size;
+    --tlsf.allocation_count;
+
+    uint32_t prev = tlsf.blocks[block].prev_physical;
+    if (prev != heap_tlsf_null && tlsf.blocks[prev].free)
+    {
+        tlsf_remove_free(tlsf, prev);
+        block = tlsf_merge_into_prev(tlsf, block);
+    }
+
+    uint32_t next = tlsf.blocks[block].next_physical;
+    if (next != heap_tlsf_null && tlsf.blocks[next].free)
+    {
+        tlsf_remove_free(tlsf, next);
+        tlsf_merge_into_prev(tlsf, next);
+    }
+
+    tlsf_insert_free(tlsf, block);
+}
+
+uint64_t heap_tlsf_largest_free(const HeapTlsf &tlsf)
+{
+    if (!tlsf.fl_bitmap)
+        return 0;
+
+    // The biggest block is in the highest non empty class, the classes are ranges so look at all of that list
+    int fl = bit_scan_reverse(tlsf.fl_bitmap);
+    int sl = bit_scan_reverse(tlsf.sl_bitmap[fl]);
+    uint64_t largest = 0;
+    for (uint32_t block = tlsf.free_lists[fl][sl]; block != heap_tlsf_null; block = tlsf.blocks[block].next_free)
+        largest = std::max(largest, tlsf.blocks[block].size);
+    return largest;
+}
+
+// -- Heap allocator -- //
+
+void heap_allocator_init(HeapAllocator &allocator, uint64_t heap_size, uint64_t granularity,
+                         const std::function<void *(uint64_t size)> &create_heap, const std::function<void(void *heap)> &destroy_heap)
+{
+    allocator.heap_size = heap_size;
+    allocator.granularity = granularity;
+    allocator.heaps.clear();
+    allocator.heap_objects.clear();
+    allocator.create_heap = create_heap;
+    allocator.destroy_heap = destroy_heap;
+}
+
+void heap_allocator_shutdown(HeapAllocator &allocator)
+{
+    for (size_t i = 0; i < allocator.heaps.size(); ++i)
+    {
+        if (!allocator.heaps[i])
+            continue;
+        allocator.destroy_heap(allocator.heap_objects[i]);
+        delete allocator.heaps[i];
+    }
+    allocator.heaps.clear();
+    allocator.heap_objects.clear();
+}
+
+bool heap_allocator_allocate(HeapAllocator &allocator, uint64_t size, uint64_t alignment, void *user, HeapAllocation &allocation)
+{
+    allocation.heap_index = -1;
+
+    int heap_index = -1;
+    uint32_t block = heap_tlsf_null;
+    for (size_t i = 0; i < allocator.heaps.size() && block == heap_tlsf_null; ++i)
+    {
+        if (!allocator.heaps[i])
+            continue;
+        block = heap_tlsf_allocate(*allocator.heaps[i], size, alignment);
+        heap_index = (int)i;
+    }
+
+    // Nothing has room, make a new heap. Resources bigger than the usual heap size get one just big enough for them
+    if (block == heap_tlsf_null)
+    {
+        uint64_t needed = align_up(size ? size : 1, allocator.granularity) + (alignment > allocator.granularity ? alignment : 0);
+        uint64_t new_size = std::max(allocator.heap_size, needed);
+        void *heap_object = allocator.create_heap(new_size);
+        if (!heap_object)
+            return false;
+
+        HeapTlsf *tlsf = new HeapTlsf;
+        heap_tlsf_init(*tlsf, new_size, allocator.granularity);
+
+        // Reuse the slot of a heap that was released, indices of live allocations must not change
+        heap_index = -1;
+        for (size_t i = 0; i < allocator.heaps.size() && heap_index < 0; ++i)
+        {
+            if (!allocator.heaps[i])
+                heap_index = (int)i;
+        }
+        if (heap_index < 0)
+        {
+            heap_index = (int)allocator.heaps.size();
+            allocator.heaps.push_back(nullptr);
+            allocator.heap_objects.push_back(nullptr);
+        }
+        allocator.heaps[heap_index] = tlsf;
+        allocator.heap_objects[heap_index] = heap_object;
+
+        block = heap_tlsf_allocate(*tlsf, size, alignment);
+        if (block == heap_tlsf_null)
+            return false;
+    }
+
+    HeapTlsf &tlsf = *allocator.heaps[heap_index];
+    tlsf.blocks[block].user = user;
+    allocation.heap_index = heap_index;
+    allocation.block = block;
+    allocation.heap = allocator.heap_objects[heap_index];
+    allocation.offset = tlsf.blocks[block].offset;
+    allocation.size = tlsf.blocks[block].size;
+    return true;
+}
+
+void heap_allocator_free(HeapAllocator &allocator, const HeapAllocation &allocation)
+{
+    if (allocation.heap_index < 0)
+        return;
+    heap_tlsf_free(*allocator.heaps[allocation.heap_index], allocation.block);
+}
+
+void heap_allocator_set_user(HeapAllocator &allocator, const HeapAllocation &allocation, void *user)
+{
+    if (allocation.heap_index < 0)
+        return;
+    allocator.heaps[allocation.heap_index]->blocks[allocation.block].user = user;
+}
+
+void heap_allocator_release_empty(HeapAllocator &allocator)
+{
+    for (size_t i = 1; i < allocator.heaps.size(); ++i)
+    {
+        if (allocator.heaps[i] && allocator.heaps[i]->allocation_count == 0)
+        {
+            allocator.destroy_heap(allocator.heap_objects[i]);
+            delete allocator.heaps[i];
+            allocator.heaps[i] = nullptr;
+            allocator.heap_objects[i] = nullptr;
+        }
+    }
+}
+
+HeapAllocatorStats heap_allocator_stats(const HeapAllocator &allocator)
+{
+    HeapAllocatorStats stats = {};
+    uint64_t free_bytes = 0, scattered_bytes = 0;
+    for (size_t i = 0; i < allocator.heaps.size(); ++i)
+    {
+        const HeapTlsf *tlsf = allocator.heaps[i];
+        if (!tlsf)
+            continue;
+        ++stats.heap_count;
+        stats.reserved_bytes += tlsf->size;
+        stats.used_bytes += tlsf->used_bytes;
+        stats.allocation_count += tlsf->allocation_count;
+        stats.free_block_count += tlsf->free_block_count;
+        uint64_t largest = heap_tlsf_largest_free(*tlsf);
+        stats.largest_free = std::max(stats.largest_free, largest);
+        free_bytes += tlsf->size - tlsf->used_bytes;
+        scattered_bytes += tlsf->size - tlsf->used_bytes - largest;
+    }
+    // Each heap's 1 - largest / free, weighted by its free bytes. Adding up one heap's largest block against every heap's free bytes
+    // would call a compaction that gives a heap back worse
+    stats.fragmentation = free_bytes ? (double)scattered_bytes / (double)free_bytes : 0.0;
+    return stats;
+}
+
+bool heap_allocator_moved_in_place(const HeapAllocation &from, const HeapAllocation &to)
+{
+    return from.heap_index == to.heap_index && from.block == to.block;
+}
+
+int heap_allocator_defragment(HeapAllocator &allocator, int max_moves, std::vector<HeapAllocation> &retired,
+                              const std::function<bool(const HeapAllocation &from, const HeapAllocation &to, void *user)> &move)
+{
+    int moves = 0;
+
+    // Blocks this pass moved things into or the callback would not move, they stay where they are. Retired ones wait for the caller to free them
+    std::vector<std::pair<int, uint32_t>> settled;
+    auto movable = [&](int heap, uint32_t block) {
+        const HeapTlsfBlock &candidate = allocator.heaps[heap]->blocks[block];
+        return candidate.size && !candidate.free && !candidate.retired &&
+               std::find(settled.begin(), settled.end(), std::make_pair(heap, block)) == settled.end();
+    };
+
+    // Fill the free block hole of heap t, at its start, with the biggest allocation behind it that fits there whole, then what is left of it
+    // the same way. If nothing fits anymore, slide the allocation right behind it down. Returns the last block that is now where the hole was
+    auto fill = [&](int t, uint32_t hole) -> uint32_t {
+        HeapTlsf &target = *allocator.heaps[t];
+        uint32_t last = hole;
+        while (hole != heap_tlsf_null && moves < max_moves)
+        {
+            const HeapTlsfBlock free_block = target.blocks[hole];
+            int best_heap = -1;
+            uint32_t best = heap_tlsf_null;
+            for (int h = t; h < (int)allocator.heaps.size(); ++h)
+            {
+                if (!allocator.heaps[h])
+                    continue;
+                const HeapTlsf &tlsf = *allocator.heaps[h];
+                for (uint32_t i = 0; i < (uint32_t)tlsf.blocks.size(); ++i)
+                {
+                    const HeapTlsfBlock &candidate = tlsf.blocks[i];
+                    if (!movable(h, i) || (h == t && candidate.offset < free_block.offset) ||
+                        align_up(free_block.offset, candidate.alignment) + candidate.size > free_block.offset + free_block.size)
+                        continue;
+                    if (best == heap_tlsf_null || candidate.size >= allocator.heaps[best_heap]->blocks[best].size)
+                    {
+                        best_heap = h;
+                        best = i;
+                    }
+                }
+            }
+            if (best == heap_tlsf_null)
+                break;
+
+            HeapTlsfBlock current = allocator.heaps[best_heap]->blocks[best];
+            uint32_t spot = tlsf_carve(target, hole, current.size, current.alignment);
+            HeapAllocation from = {best_heap, best, allocator.heap_objects[best_heap], current.offset, current.size};
+            HeapAllocation to = {t, spot, allocator.heap_objects[t], target.blocks[spot].offset, target.blocks[spot].size};
+            if (!move(from, to, current.user))
+            {
+                heap_tlsf_free(target, spot);
+                settled.push_back(std::make_pair(best_heap, best));
+                continue;
+            }
+            target.blocks[spot].user = current.user;
+            allocator.heaps[best_heap]->blocks[best].retired = true;
+            retired.push_back(from);
+            settled.push_back(std::make_pair(t, spot));
+            ++moves;
+
+            last = spot;
+            uint32_t rest = target.blocks[spot].next_physical;
+            hole = rest != heap_tlsf_null && target.blocks[rest].free ? rest : heap_tlsf_null;
+        }
+
+        // The allocation behind overlaps itself if it moves into the hole. It keeps its handle and the bytes it leaves at its end are retired
+        // like any old allocation
+        uint32_t next = hole != heap_tlsf_null ? target.blocks[hole].next_physical : heap_tlsf_null;
+        if (next != heap_tlsf_null && moves < max_moves && movable(t, next))
+        {
+            HeapTlsfBlock current = target.blocks[next];
+            uint64_t offset = align_up(target.blocks[hole].offset, current.alignment);
+            HeapAllocation from = {t, next, allocator.heap_objects[t], current.offset, current.size};
+            HeapAllocation to = {t, next, allocator.heap_objects[t], offset, current.size};
+            if (offset < current.offset && move(from, to, current.user))
+            {
+                uint32_t tail = tlsf_slide(target, next, offset);
+                retired.push_back({t, tail, allocator.heap_objects[t], target.blocks[tail].offset, target.blocks[tail].size});
+                settled.push_back(std::make_pair(t, next));
+                ++moves;
+                last = next;
+            }
+        }
+        return last;
+    };
+
+    // Go over the free blocks of every heap from the front, so allocations are packed toward the start of the first heaps and the last
+    // heaps empty out for heap_allocator_release_empty()
+    for (int t = 0; t < (int)allocator.heaps.size() && moves < max_moves; ++t)
+    {
+        if (!allocator.heaps[t])
+            continue;
+        for (uint32_t block = tlsf_first_block(*allocator.heaps[t]); block != heap_tlsf_null && moves < max_moves;
+             block = allocator.heaps[t]->blocks[block].next_physical)
+        {
+            if (allocator.heaps[t]->blocks[block].free)
+                block = fill(t, block);
+        }
+    }
+    return moves;
+}
+
+// -- Stress test -- //
+
+namespace
+{
+struct StressHeap
+{
+    uint64_t size;
+};
+
+struct StressAllocation
+{
+    HeapAllocation allocation;
+    uint64_t requested_size;
+    uint64_t alignment;
+};
+
+// Retired are the ranges a defragment pass moved things out of, the gpu may still read them so nothing may be placed there yet
+bool stress_check(const HeapAllocator &allocator, const std::vector<StressAllocation> &live, const std::vector<HeapAllocation> &retired, const char *when)
+{
+    uint64_t used = 0;
+    std::vector<const HeapAllocation *> sorted;
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        const HeapAllocation &allocation = live[i].allocation;
+        const StressHeap *heap = (const StressHeap *)allocation.heap;
+        if (allocation.offset % live[i].alignment != 0 || allocation.size < live[i].requested_size || allocation.offset + allocation.size > heap->size)
+        {
+            printf("heap allocator: %s, bad allocation of %llu bytes at %llu\n", when, (unsigned long long)live[i].requested_size, (unsigned long long)allocation.offset);
+            return false;
+        }
+        used += allocation.size;
+        sorted.push_back(&allocation);
+    }
+    for (size_t i = 0; i < retired.size(); ++i)
+    {
+        used += retired[i].size;
+        sorted.push_back(&retired[i]);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const HeapAllocation *a, const HeapAllocation *b) {
+        return a->heap_index != b->heap_index ? a->heap_index < b->heap_index : a->offset < b->offset;
+    });
+    for (size_t i = 1; i < sorted.size(); ++i)
+    {
+        const HeapAllocation &a = *sorted[i - 1];
+        const HeapAllocation &b = *sorted[i];
+        if (a.heap_index == b.heap_index && a.offset + a.size > b.offset)
+        {
+            printf("heap allocator: %s, allocations at %llu and %llu overlap\n", when, (unsigned long long)a.offset, (unsigned long long)b.offset);
+            return false;
+        }
+    }
+
+    HeapAllocatorStats stats = heap_allocator_stats(allocator);
+    if (stats.used_bytes != used || stats.allocation_count != live.size() + retired.size())
+    {
+        printf("heap allocator: %s, stats say %u allocations and %llu bytes, there are %u and %llu\n", when, stats.allocation_count,
+               (unsigned long long)stats.used_bytes, (unsigned)(live.size() + retired.size()), (unsigned long long)used);
+        return false;
+    }
+    return true;
+}
+
+void print_stats(const char *label, const HeapAllocatorStats &stats)
+{
+    printf("heap allocator: %-18s %d heaps, %.1f of %.1f MB used, %u allocations, %u free blocks, largest free %.1f MB, fragmentation %.0f%%\n", label,
+           stats.heap_count, stats.used_bytes / (1024.0 * 1024.0), stats.reserved_bytes / (1024.0 * 1024.0), stats.allocation_count, stats.free_block_count,
+           stats.largest_free / (1024.0 * 1024.0), stats.fragmentation * 100.0);
+}
+} // namespace
+
+bool heap_allocator_stress(int iterations, unsigned int seed)
+{
+    // Same numbers as the d3d12 heaps: 64 KB placement alignment, 4 MB for msaa textures
+    const uint64_t granularity = 64 * 1024;
+    const uint64_t heap_size = 64 * 1024 * 1024;
+
+    HeapAllocator allocator;
+    heap_allocator_init(allocator, heap_size, granularity,
+                        [](uint64_t size) -> void * { return new StressHeap{size}; },
+                        [](void *heap) { delete (StressHeap *)heap; });
+
+    std::mt19937 random(seed);
+    std::vector<StressAllocation> live;
+    std::vector<HeapAllocation> retired; // Waiting for the copies out of them to finish
+    std::chrono::steady_clock::duration alloc_time = {}, free_time = {};
+    uint64_t alloc_count = 0, free_count = 0, moves = 0;
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        // Grow to a few hundred allocations and then churn around that
+        bool allocate = live.empty() || random() % 100 < (live.size() < 400 ? 70u : 45u);
+        if (allocate)
+        {
+            StressAllocation stress;
+            unsigned int kind = random() % 16;
+            stress.requested_size = kind == 0 ? 1 + random() % (16 * 1024 * 1024) : 1 + random() % (512 * 1024);
+            stress.alignment = kind == 1 ? 4 * 1024 * 1024 : granularity;
+
+            auto start = std::chrono::steady_clock::now();
+            bool ok = heap_allocator_allocate(allocator, stress.requested_size, stress.alignment, nullptr, stress.allocation);
+            alloc_time += std::chrono::steady_clock::now() - start;
+            ++alloc_count;
+            if (!ok)
+            {
+                printf("heap allocator: could not allocate %llu bytes\n", (unsigned long long)stress.requested_size);
+                heap_allocator_shutdown(allocator);
+                return false;
+            }
+            live.push_back(stress);
+        }
+        else
+        {
+            size_t victim = random() % live.size();
+            auto start = std::chrono::steady_clock::now();
+            heap_allocator_free(allocator, live[victim].allocation);
+            free_time += std::chrono::steady_clock::now() - start;
+            ++free_count;
+            live[victim] = live.back();
+            live.pop_back();
+        }
+
+        // Pretend the fence of the last defragment passed every 1000 iterations, until then what it moved away from stays taken
+        if (i % 1000 == 999)
+        {
+            if (!stress_check(allocator, live, retired, "after random allocations"))
+            {
+                heap_allocator_shutdown(allocator);
+                return false;
+            }
+            for (size_t r = 0; r < retired.size(); ++r)
+                heap_allocator_free(allocator, retired[r]);
+            retired.clear();
+            heap_allocator_release_empty(allocator);
+        }
+
+        // Now and then compact. What it moved away from is freed 1000 iterations later, when the copies would be done on the gpu
+        if (i % 5000 == 4999)
+        {
+            for (size_t l = 0; l < live.size(); ++l)
+                allocator.heaps[live[l].allocation.heap_index]->blocks[live[l].allocation.block].user = (void *)(uintptr_t)(l + 1);
+
+            moves += heap_allocator_defragment(allocator, 32, retired, [&](const HeapAllocation &, const HeapAllocation &to, void *user) {
+                live[(uintptr_t)user - 1].allocation = to;
+                return true;
+            });
+
+            if (!stress_check(allocator, live, retired, "after defragmenting"))
+            {
+                heap_allocator_shutdown(allocator);
+                return false;
+            }
+        }
+    }
+
+    printf("heap allocator: %llu allocations %.0f ns each, %llu frees %.0f ns each, %llu moves while defragmenting\n",
+           (unsigned long long)alloc_count, alloc_count ? std::chrono::duration<double, std::nano>(alloc_time).count() / alloc_count : 0.0,
+           (unsigned long long)free_count, free_count ? std::chrono::duration<double, std::nano>(free_time).count() / free_count : 0.0,
+           (unsigned long long)moves);
+    for (size_t r = 0; r < retired.size(); ++r)
+        heap_allocator_free(allocator, retired[r]);
+    retired.clear();
+    heap_allocator_release_empty(allocator);
+    HeapAllocatorStats before = heap_allocator_stats(allocator);
+    print_stats("before defragment", before);
+
+    // Compact until nothing moves anymore to see how much it buys, one pass per frame with the fence passing in between. The heaps it
+    // empties are given back after comparing against the same heaps
+    int passes = 0;
+    for (;; ++passes)
+    {
+        for (size_t l = 0; l < live.size(); ++l)
+            allocator.heaps[live[l].allocation.heap_index]->blocks[live[l].allocation.block].user = (void *)(uintptr_t)(l + 1);
+
+        int moved = heap_allocator_defragment(allocator, 1 << 30, retired, [&](const HeapAllocation &, const HeapAllocation &to, void *user) {
+            live[(uintptr_t)user - 1].allocation = to;
+            return true;
+        });
+        if (!stress_check(allocator, live, retired, "while defragmenting"))
+        {
+            heap_allocator_shutdown(allocator);
+            return false;
+        }
+        for (size_t r = 0; r < retired.size(); ++r)
+            heap_allocator_free(allocator, retired[r]);
+        retired.clear();
+        if (!moved)
+            break;
+    }
+    bool ok = stress_check(allocator, live, retired, "after the last defragment");
+    HeapAllocatorStats after = heap_allocator_stats(allocator);
+    print_stats("after defragment", after);
+    if (ok && (after.fragmentation > before.fragmentation || after.largest_free < before.largest_free))
+    {
+        printf("heap allocator: defragmenting made it worse\n");
+        ok = false;
+    }
+    heap_allocator_release_empty(allocator);
+    print_stats("empty heaps freed", heap_allocator_stats(allocator));
+    printf("heap allocator: defragmenting took %d passes\n", passes);
+
+    for (size_t l = 0; l < live.size(); ++l)
+        heap_allocator_free(allocator, live[l].allocation);
+    live.clear();
+    ok = ok && stress_check(allocator, live, retired, "after freeing everything");
+    HeapAllocatorStats empty = heap_allocator_stats(allocator);
+    if (ok && empty.free_block_count != (uint32_t)empty.heap_count)
+    {
+        printf("heap allocator: %u free blocks left in %d empty heaps, freeing did not merge\n", empty.free_block_count, empty.heap_count);
+        ok = false;
+    }
+
+    heap_allocator_shutdown(allocator);
+    if (ok)
+        printf("heap allocator: %d iterations, no overlaps\n", iterations);
+    return ok;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+/*
+    Suballocator for placed resources: a few big heaps are created up front and buffers and textures are carved out of them, instead of
+    CreateCommittedResource making one implicit heap (64 KB at least) per resource.
+
+    Each heap is managed by a TLSF allocator (two level segregated fit). Free blocks are kept in lists by size class: the first level is the
+    power of two of the size, the second level splits that range in heap_tlsf_sl_count linear steps. Two bitmaps say which lists are non empty,
+    so finding a block that fits is a couple of bit scans and freeing merges with the physical neighbours in constant time. Nothing in here
+    knows about d3d12, the heaps are opaque pointers made by the callbacks in HeapAllocator, so the allocator runs the same on any platform.
+
+    Offsets and sizes are bytes, everything is rounded up to the granularity the allocator was made with (64 KB for d3d12 buffers, the
+    placement alignment). Larger alignments, like 4 MB msaa textures, are handled by allocating a little more and splitting off the front.
+*/
+
+const int heap_tlsf_sl_log2 = 4;
+const int heap_tlsf_sl_count = 1 << heap_tlsf_sl_log2; // Second level lists per power of two
+const int heap_tlsf_fl_count = 64;                      // First level lists, enough for any 64 bit size
+const uint32_t heap_tlsf_null = 0xffffffffu;
+
+struct HeapTlsfBlock
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t alignment;     // What the block was allocated with, so defragmenting can find it a new spot with the same alignment
+    uint32_t prev_physical; // Neighbours in the heap, by offset
+    uint32_t next_physical;
+    uint32_t prev_free;     // Neighbours in the free list of the block's size class
+    uint32_t next_free;
+    bool free;
+    bool retired; // Moved away from by defragmenting, in use until the caller frees it
+    void *user; // Whatever the owner wants to find again when the block is moved, e.g. the resource placed in it
+};
+
+// One heap's worth of offsets
+struct HeapTlsf
+{
+    uint64_t size;
+    uint64_t granularity;
+    std::vector<HeapTlsfBlock> blocks;  // Indexed by block handle
+    std::vector<uint32_t> unused_blocks; // Entries of blocks that can be reused for new splits
+    uint64_t fl_bitmap;
+    uint32_t sl_bitmap[heap_tlsf_fl_count];
+    uint32_t free_lists[heap_tlsf_fl_count][heap_tlsf_sl_count];
+
+    uint64_t used_bytes;
+    uint32_t allocation_count;
+    uint32_t free_block_count;
+};
+
+bool heap_tlsf_init(HeapTlsf &tlsf, uint64_t size, uint64_t granularity);
+uint32_t heap_tlsf_allocate(HeapTlsf &tlsf, uint64_t size, uint64_t alignment); // Block handle, heap_tlsf_null if nothing fits
+void heap_tlsf_free(HeapTlsf &tlsf, uint32_t block);
+uint64_t heap_tlsf_largest_free(const HeapTlsf &tlsf);
+
+// -- A growing set of heaps -- //
+
+struct HeapAllocation
+{
+    int heap_index;  // Which of the allocator's heaps, -1 for a failed allocation
+    uint32_t block;  // Block handle in that heap's tlsf
+    void *heap;      // What create_heap returned for it, e.g. the ID3D12Heap to place the resource in
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct HeapAllocatorStats
+{
+    int heap_count;
+    uint64_t reserved_bytes;    // Sum of all heap sizes
+    uint64_t used_bytes;
+    uint64_t largest_free;      // Biggest allocation that would fit without a new heap
+    uint32_t allocation_count;
+    uint32_t free_block_count;
+    double fragmentation;       // Share of the free bytes outside their heap's largest free block. 0 means every heap has one free block
+};
+
+struct HeapAllocator
+{
+    uint64_t heap_size;   // Size of every new heap, resources bigger than this get a heap of their own
+    uint64_t granularity;
+    std::vector<HeapTlsf *> heaps;
+    std::vector<void *> heap_objects;
+
+    // Create and destroy the api heaps. create_heap returns nullptr when it fails
+    std::function<void *(uint64_t size)> create_heap;
+    std::function<void(void *heap)> destroy_heap;
+};
+
+void heap_allocator_init(HeapAllocator &allocator, uint64_t heap_size, uint64_t granularity,
+                         const std::function<void *(uint64_t size)> &create_heap, const std::function<void(void *heap)> &destroy_heap);
+void heap_allocator_shutdown(HeapAllocator &allocator); // Destroys every heap, everything placed in them has to be gone already
+bool heap_allocator_allocate(HeapAllocator &allocator, uint64_t size, uint64_t alignment, void *user, HeapAllocation &allocation);
+void heap_allocator_free(HeapAllocator &allocator, const HeapAllocation &allocation);
+void heap_allocator_set_user(HeapAllocator &allocator, const HeapAllocation &allocation, void *user); // e.g. once the resource placed in it exists
+void heap_allocator_release_empty(HeapAllocator &allocator); // Give heaps with nothing in them back, keeps the first one
+HeapAllocatorStats heap_allocator_stats(const HeapAllocator &allocator);
+
+/*
+    Defragmentation hook. Packs the allocations toward the start of the first heap: it goes over the free blocks from the front and moves
+    the biggest allocation behind one (later in the same heap or in a later heap) that fits in it whole to its start, then fills what is
+    left of it the same way. The last heaps empty out and heap_allocator_release_empty() can give them back. For every move it allocates
+    the new spot and calls move with the old and new allocation and the block's user pointer. The callback does the actual work: place a
+    new resource at the new offset, record a copy from the old one and point everything at the new resource. If it returns false the new
+    spot is freed again and the block stays where it was. Returns how many allocations were moved, at most max_moves.
+
+    The gpu may still read what was moved away from, so nothing is freed here. The old allocations go into retired and the caller frees
+    them with heap_allocator_free() once the fence of the frame that recorded the copies has passed, just like the upload ring gives memory
+    back. Until then later passes leave them alone, so packing a heap takes a pass per frame for a few frames.
+
+    When nothing fits in a free block whole, the allocation right behind it slides down into it. Then from and to are the same block at an
+    overlapping lower offset (heap_allocator_moved_in_place() says so): the callback has to copy through a temporary, old to temporary
+    and temporary to new. The bytes the block leaves at its end are what goes into retired for it.
+*/
+int heap_allocator_defragment(HeapAllocator &allocator, int max_moves, std::vector<HeapAllocation> &retired,
+                              const std::function<bool(const HeapAllocation &from, const HeapAllocation &to, void *user)> &move);
+bool heap_allocator_moved_in_place(const HeapAllocation &from, const HeapAllocation &to);
+
+// Random allocate, free and defragment rounds checking that no two live allocations overlap and the stats add up. Returns false on the first problem
+bool heap_allocator_stress(int iterations, unsigned int seed);
@@ -0,0 +1,695 @@
+#include "job_system.h"
+#include "profiler.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Job
+{
+    JobFunction function;
+    void *data;
+    int begin;
+    int end;
+    JobCounter *counter;     // Counted down when the job is done
+    Job *next;               // In the list of jobs waiting for a counter
+    std::atomic<bool> free;  // Done, the slot may be used again by the thread it belongs to
+};
+
+namespace
+{
+const int job_counter_releasing = -1;
+const int job_spin_rounds = 64; // Rounds of stealing before an idle worker goes to sleep
+
+/*
+    Chase-Lev deque, with the memory orders of "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen,
+    Zappa Nardelli 2013). Fixed size, a push onto a full deque fails and the job runs right away instead.
+*/
+struct JobDeque
+{
+    std::atomic<int64_t> top;
+    uint8_t padding[64];     // Thieves write top, the owner writes bottom
+    std::atomic<int64_t> bottom;
+    std::atomic<Job *> jobs[job_thread_jobs];
+};
+
+struct JobThread
+{
+    JobDeque deque;
+    Job jobs[job_thread_jobs];
+    uint32_t next_job;       // Ring of jobs, only the owner allocates
+    uint32_t random;         // Where to start looking for a victim
+};
+
+std::vector<std::thread> job_workers;
+std::atomic<JobThread *> job_threads[job_max_threads];
+std::atomic<int> job_thread_count(0);
+int job_worker_count = 1;
+uint32_t job_generation = 1;   // Thread slots from before the last init are stale
+
+std::mutex job_sleep_mutex;
+std::condition_variable job_wake;
+std::atomic<int> job_sleepers(0);
+int job_wake_tokens;
+bool job_quit;
+
+thread_local int job_slot = -1;
+thread_local uint32_t job_slot_generation;
+
+bool deque_push(JobDeque &deque, Job *job)
+{
+    int64_t bottom = deque.bottom.load(std::memory_order_relaxed);
+    int64_t top = deque.top.load(std::memory_order_acquire);
+    if (bottom - top >= job_thread_jobs)
+        return false;
+    deque.jobs[bottom & (job_thread_jobs - 1)].store(job, std::memory_order_relaxed);
+    deque.bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+Job *deque_pop(JobDeque &deque)
+{
+    int64_t bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+    deque.bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = deque.top.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Job *job = deque.jobs[bottom & (job_thread_jobs - 1)].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // The last one, a thief may be after it too
+        if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            job = nullptr;
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job *deque_steal(JobDeque &deque)
+{
+    int64_t top = deque.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = deque.bottom.load(std::memory_order_acquire);
+    if (top >= bottom)
+        return nullptr;
+
+    Job *job = deque.jobs[top & (job_thread_jobs - 1)].load(std::memory_order_relaxed);
+    if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return job;
+}
+
+JobThread *job_thread_create()
+{
+    JobThread *thread = new JobThread;
+    thread->deque.top.store(0);
+    thread->deque.bottom.store(0);
+    for (Job &job : thread->jobs)
+        job.free.store(true);
+    thread->next_job = 0;
+    thread->random = 0;
+    return thread;
+}
+
+// The calling thread's deque, a thread that has none gets one. Null without a job system or when every slot is taken
+JobThread *job_thread_self()
+{
+    if (job_slot >= 0 && job_slot_generation == job_generation)
+        return job_threads[job_slot].load(std::memory_order_relaxed);
+    if (job_workers.empty())
+        return nullptr;
+
+    int slot = job_thread_count.fetch_add(1);
+    if (slot >= job_max_threads)
+    {
+        job_thread_count.fetch_sub(1);
+        return nullptr;
+    }
+    JobThread *thread = job_thread_create();
+    thread->random = (uint32_t)slot * 2654435761u + 1;
+    job_threads[slot].store(thread, std::memory_order_release);
+    job_slot = slot;
+    job_slot_generation = job_generation;
+    return thread;
+}
+
+// Pop our own newest job, or steal the oldest job of somebody else
+Job *job_find(JobThread *self)
+{
+    if (self)
+    {
+        Job *job = deque_pop(self->deque);
+        if (job)
+            return job;
+    }
+
+    int count = std::min(job_thread_count.load(std::memory_order_acquire), job_max_threads);
+    if (count == 0)
+        return nullptr;
+    uint32_t start = 0;
+    if (self)
+    {
+        self->random ^= self->random << 13;
+        self->random ^= self->random >> 17;
+        self->random ^= self->random << 5;
+        start = self->random;
+    }
+    for (int i = 0; i < count; ++i)
+    {
+        JobThread *victim = job_threads[(start + i) % count].load(std::memory_order_acquire);
+        if (!victim || victim == self)
+            continue;
+        Job *job = deque_steal(victim->deque);
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+void job_counter_done(JobCounter &counter);
+
+void job_execute(Job *job)
+{
+    job->function(job->data, job->begin, job->end);
+
+    // Give the slot back before the counter, whoever waits for it may shut the job system down as soon as it is zero
+    JobCounter *counter = job->counter;
+    job->free.store(true, std::memory_order_release);
+    if (counter)
+        job_counter_done(*counter);
+}
+
+// Make the job available to every thread, or run it if there is nowhere to put it
+void job_push(Job *job)
+{
+    JobThread *self = job_thread_self();
+    if (!self || !deque_push(self->deque, job))
+    {
+        job_execute(job);
+        return;
+    }
+
+    // Either a worker that is going to sleep sees the job or we see it going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (job_sleepers.load(std::memory_order_relaxed) > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(job_sleep_mutex);
+            if (job_wake_tokens < job_sleepers.load(std::memory_order_relaxed))
+                ++job_wake_tokens;
+        }
+        job_wake.notify_one();
+    }
+}
+
+void job_counter_done(JobCounter &counter)
+{
+    // The job that brings the counter to zero marks it as releasing until the jobs waiting for it are taken off, so nobody
+    // stops waiting for the counter (and lets it go out of scope) while we still use it
+    int count = counter.count.load(std::memory_order_relaxed);
+    while (!counter.count.compare_exchange_weak(count, count == 1 ? job_counter_releasing : count - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+    {
+    }
+    if (count != 1)
+        return;
+
+    Job *waiting;
+    {
+        std::lock_guard<std::mutex> lock(counter.mutex);
+        waiting = counter.waiting;
+        counter.waiting = nullptr;
+    }
+    counter.count.store(0, std::memory_order_release);
+
+    while (waiting)
+    {
+        Job *next = waiting->next;
+        job_push(waiting);
+        waiting = next;
+    }
+}
+
+void job_worker(int index)
+{
+    std::string name = "worker " + std::to_string(index);
+    profiler_thread_name(name.c_str());
+    job_slot = index;
+    job_slot_generation = job_generation;
+    JobThread *self = job_threads[index].load();
+
+    int idle = 0;
+    for (;;)
+    {
+        Job *job = job_find(self);
+        if (job)
+        {
+            job_execute(job);
+            idle = 0;
+            continue;
+        }
+        if (++idle < job_spin_rounds)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Look once more after saying we are going to sleep, job_push() either wakes us or its job is found here
+        job_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        job = job_find(self);
+        if (job)
+        {
+            job_sleepers.fetch_sub(1);
+            job_execute(job);
+            idle = 0;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(job_sleep_mutex);
+        job_wake.wait(lock, [] { return job_quit || job_wake_tokens > 0; });
+        job_sleepers.fetch_sub(1);
+        if (job_quit)
+            return;
+        --job_wake_tokens;
+        idle = 0;
+    }
+}
+
+struct ParallelFor
+{
+    const std::function<void(int)> *body;
+    int grain;
+    JobCounter counter;
+};
+
+void parallel_for_job(void *data, int begin, int end)
+{
+    // Push the upper half for a thief while there is more than a grain left, then do the rest
+    ParallelFor &work = *(ParallelFor *)data;
+    while (end - begin > work.grain)
+    {
+        int middle = begin + (end - begin) / 2;
+        job_spawn(parallel_for_job, data, middle, end, &work.counter);
+        end = middle;
+    }
+    for (int index = begin; index < end; ++index)
+        (*work.body)(index);
+}
+} // namespace
+
+void job_system_init(int thread_count)
+{
+    job_system_shutdown();
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > job_max_threads)
+        thread_count = job_max_threads;
+
+    // The calling thread is slot 0, the workers the ones after it. Any other thread takes the next free one when it needs it
+    ++job_generation;
+    for (int i = 0; i < thread_count; ++i)
+        job_threads[i].store(job_thread_create());
+    job_thread_count.store(thread_count);
+    job_slot = 0;
+    job_slot_generation = job_generation;
+    job_worker_count = thread_count;
+
+    job_quit = false;
+    job_wake_tokens = 0;
+    for (int i = 1; i < thread_count; ++i)
+        job_workers.emplace_back(job_worker, i);
+}
+
+void job_system_shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(job_sleep_mutex);
+        job_quit = true;
+    }
+    job_wake.notify_all();
+
+    for (size_t i = 0; i < job_workers.size(); ++i)
+        job_workers[i].join();
+    job_workers.clear();
+
+    int count = std::min(job_thread_count.load(), job_max_threads);
+    for (int i = 0; i < count; ++i)
+        delete job_threads[i].exchange(nullptr);
+    job_thread_count.store(0);
+    job_worker_count = 1;
+    ++job_generation;
+}
+
+int job_system_size()
+{
+    return job_worker_count;
+}
+
+void job_spawn(JobFunction function, void *data, int begin, int end, JobCounter *counter, JobCounter *after)
+{
+    if (counter)
+        counter->count.fetch_add(1, std::memory_order_relaxed);
+
+    // Without a deque, or with plenty queued in ours for everybody else to steal, the job runs right away. A job that waits for
+    // a counter always gets a slot
+    JobThread *self = job_thread_self();
+    if (!self || (!after && self->deque.bottom.load(std::memory_order_relaxed) - self->deque.top.load(std::memory_order_relaxed) >= job_thread_jobs / 2))
+    {
+        Job job;
+        job.function = function;
+        job.data = data;
+        job.begin = begin;
+        job.end = end;
+        job.counter = counter;
+        job_execute(&job);
+        return;
+    }
+
+    // The next free slot of the ring, usually the oldest one. Parked jobs keep theirs until they ran, if every slot is taken help with
+    // the jobs in flight until one is free
+    Job *job = nullptr;
+    for (;;)
+    {
+        for (int i = 0; i < job_thread_jobs && !job; ++i)
+        {
+            Job *slot = &self->jobs[self->next_job++ % job_thread_jobs];
+            if (slot->free.load(std::memory_order_acquire))
+                job = slot;
+        }
+        if (job)
+            break;
+        Job *other = job_find(self);
+        if (other)
+            job_execute(other);
+        else
+            std::this_thread::yield();
+    }
+    job->free.store(false, std::memory_order_relaxed);
+    job->function = function;
+    job->data = data;
+    job->begin = begin;
+    job->end = end;
+    job->counter = counter;
+    job->next = nullptr;
+
+    // Park it on the counter it waits for unless that is done already. While the counter is releasing its jobs it will be zero soon
+    if (after)
+    {
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> lock(after->mutex);
+                int count = after->count.load(std::memory_order_acquire);
+                if (count > 0)
+                {
+                    job->next = after->waiting;
+                    after->waiting = job;
+                    return;
+                }
+                if (count == 0)
+                    break;
+            }
+            std::this_thread::yield();
+        }
+    }
+    job_push(job);
+}
+
+void job_wait(JobCounter &counter)
+{
+    JobThread *self = nullptr;
+    bool looked_up = false;
+    while (counter.count.load(std::memory_order_acquire) != 0)
+    {
+        if (!looked_up)
+        {
+            self = job_thread_self();
+            looked_up = true;
+        }
+        Job *job = job_find(self);
+        if (job)
+            job_execute(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void job_parallel_for(int count, int grain, const std::function<void(int index)> &body)
+{
+    PROFILE_SCOPE("job_parallel_for");
+    if (count <= 0)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    // Not worth waking anyone up
+    if (job_worker_count == 1 || count <= grain)
+    {
+        for (int i = 0; i < count; ++i)
+            body(i);
+        return;
+    }
+
+    ParallelFor work;
+    work.body = &body;
+    work.grain = grain;
+    parallel_for_job(&work, 0, count);
+    job_wait(work.counter);
+}
+
+namespace
+{
+/*
+    What the job system is measured against: one queue of std::function behind a mutex, every job is pushed and popped under it.
+    The thread that pushes the jobs pops them too until they are done.
+*/
+struct MutexPool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::queue<std::function<void()>> jobs;
+    std::atomic<int> pending;
+    bool quit;
+};
+
+bool mutex_pool_pop(MutexPool &pool, std::function<void()> &job, bool block)
+{
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    if (block)
+        pool.wake.wait(lock, [&] { return pool.quit || !pool.jobs.empty(); });
+    if (pool.jobs.empty())
+        return false;
+    job = std::move(pool.jobs.front());
+    pool.jobs.pop();
+    return true;
+}
+
+void mutex_pool_thread(MutexPool &pool)
+{
+    std::function<void()> job;
+    while (mutex_pool_pop(pool, job, true))
+    {
+        job();
+        pool.pending.fetch_sub(1);
+    }
+}
+
+void mutex_pool_init(MutexPool &pool, int thread_count)
+{
+    pool.pending = 0;
+    pool.quit = false;
+    for (int i = 1; i < thread_count; ++i)
+        pool.threads.emplace_back(mutex_pool_thread, std::ref(pool));
+}
+
+void mutex_pool_shutdown(MutexPool &pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.quit = true;
+    }
+    pool.wake.notify_all();
+    for (std::thread &thread : pool.threads)
+        thread.join();
+    pool.threads.clear();
+}
+
+void mutex_pool_spawn(MutexPool &pool, std::function<void()> job)
+{
+    pool.pending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.jobs.push(std::move(job));
+    }
+    pool.wake.notify_one();
+}
+
+void mutex_pool_wait(MutexPool &pool)
+{
+    std::function<void()> job;
+    while (pool.pending.load() != 0)
+    {
+        if (mutex_pool_pop(pool, job, false))
+        {
+            job();
+            pool.pending.fetch_sub(1);
+        }
+        else
+            std::this_thread::yield();
+    }
+}
+
+const int benchmark_jobs = 1 << 16;
+const int benchmark_work = 64;     // Rounds of arithmetic per job, a few hundred ns
+const int benchmark_rounds = 5;
+
+uint64_t benchmark_result[benchmark_jobs];
+
+void benchmark_job(int index)
+{
+    uint64_t value = (uint64_t)index + 1;
+    for (int round = 0; round < benchmark_work; ++round)
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+    benchmark_result[index] = value;
+}
+
+void benchmark_spawned_job(void *, int begin, int)
+{
+    benchmark_job(begin);
+}
+
+// A chain of links that each wait for the one before, every link spawns a fan of jobs that check the link before is done
+const int chain_links = 64;
+const int chain_fan = benchmark_jobs / chain_links;
+std::atomic<int> chain_errors;
+
+void chain_fan_job(void *, int begin, int)
+{
+    if (begin >= chain_fan && benchmark_result[begin - chain_fan] == 0)
+        chain_errors.fetch_add(1);
+    benchmark_job(begin);
+}
+
+void chain_link_job(void *data, int begin, int)
+{
+    JobCounter *counters = (JobCounter *)data;
+    for (int i = 0; i < chain_fan; ++i)
+        job_spawn(chain_fan_job, nullptr, begin * chain_fan + i, begin * chain_fan + i + 1, &counters[begin]);
+}
+
+uint64_t benchmark_checksum()
+{
+    uint64_t sum = 0;
+    for (uint64_t value : benchmark_result)
+        sum += value;
+    return sum;
+}
+
+// Best of a few rounds of every job, in seconds
+template <typename Run>
+double benchmark_time(Run run)
+{
+    double best = 1e30;
+    for (int round = 0; round < benchmark_rounds; ++round)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return best;
+}
+} // namespace
+
+bool job_system_benchmark(int max_threads)
+{
+    for (int i = 0; i < benchmark_jobs; ++i)
+        benchmark_job(i);
+    const uint64_t expected = benchmark_checksum();
+
+    struct Method
+    {
+        const char *name;
+        double single_thread_seconds;
+    } methods[] = {{"mutex queue", 0.0}, {"job_spawn", 0.0}, {"parallel_for grain 1", 0.0}, {"parallel_for grain 256", 0.0}};
+
+    bool ok = true;
+    printf("jobs: %d jobs of %d rounds each, best of %d\n", benchmark_jobs, benchmark_work, benchmark_rounds);
+    printf("threads, method, ms, ns per job, speedup\n");
+    for (int threads = 1; threads <= max_threads; ++threads)
+    {
+        double seconds[4];
+
+        MutexPool pool;
+        mutex_pool_init(pool, threads);
+        memset(benchmark_result, 0, sizeof(benchmark_result));
+        seconds[0] = benchmark_time([&] {
+            for (int i = 0; i < benchmark_jobs; ++i)
+                mutex_pool_spawn(pool, [i] { benchmark_job(i); });
+            mutex_pool_wait(pool);
+        });
+        mutex_pool_shutdown(pool);
+        ok = ok && benchmark_checksum() == expected;
+
+        job_system_init(threads);
+        memset(benchmark_result, 0, sizeof(benchmark_result));
+        seconds[1] = benchmark_time([] {
+            JobCounter counter;
+            for (int i = 0; i < benchmark_jobs; ++i)
+                job_spawn(benchmark_spawned_job, nullptr, i, i + 1, &counter);
+            job_wait(counter);
+        });
+        ok = ok && benchmark_checksum() == expected;
+
+        const int grains[] = {1, 256};
+        for (int g = 0; g < 2; ++g)
+        {
+            memset(benchmark_result, 0, sizeof(benchmark_result));
+            seconds[2 + g] = benchmark_time([&] { job_parallel_for(benchmark_jobs, grains[g], benchmark_job); });
+            ok = ok && benchmark_checksum() == expected;
+        }
+        job_system_shutdown();
+
+        for (int m = 0; m < 4; ++m)
+        {
+            if (threads == 1)
+                methods[m].single_thread_seconds = seconds[m];
+            printf("%d, %s, %.3f, %.1f, %.2f\n", threads, methods[m].name, seconds[m] * 1000.0, seconds[m] * 1e9 / benchmark_jobs,
+                   methods[m].single_thread_seconds / seconds[m]);
+        }
+    }
+
+    // Jobs waiting for jobs
+    job_system_init(max_threads);
+    memset(benchmark_result, 0, sizeof(benchmark_result));
+    chain_errors = 0;
+    std::vector<JobCounter> counters(chain_links);
+    double chain_seconds = benchmark_time([&] {
+        memset(benchmark_result, 0, sizeof(benchmark_result));
+        for (int link = 0; link < chain_links; ++link)
+            job_spawn(chain_link_job, counters.data(), link, link + 1, &counters[link], link > 0 ? &counters[link - 1] : nullptr);
+        job_wait(counters[chain_links - 1]);
+    });
+    job_system_shutdown();
+    printf("%d, chain of %d links of %d jobs, %.3f, %.1f\n", max_threads, chain_links, chain_fan, chain_seconds * 1000.0, chain_seconds * 1e9 / benchmark_jobs);
+    if (chain_errors.load() != 0 || benchmark_checksum() != expected)
+    {
+        printf("jobs: %d jobs started before the link they depend on was done\n", chain_errors.load());
+        ok = false;
+    }
+
+    if (!ok)
+        printf("jobs: a job did not run or ran twice\n");
+    return ok;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+/*
+    A work stealing job system, shared by everything that splits work across threads: command list recording, the rasterizer's
+    screen tiles, staging copies of texture uploads and whatever the engine update grows into.
+
+    A job is a function pointer, a data pointer and a range. job_spawn() pushes it onto the deque of the thread that spawned it:
+
+        - Every thread has a Chase-Lev deque of its own. The owner pushes and pops at the bottom without a lock (newest first, its
+          data is still in the cache), idle threads steal from the top of someone else's (the oldest job, usually the biggest piece).
+        - Threads that did not start the job system get a deque the first time they spawn or wait, up to job_max_threads of them.
+        - A thread that already has job_thread_jobs / 2 jobs queued runs the next one it spawns right away, there is enough to steal.
+        - Jobs come from a ring of job_thread_jobs in the spawning thread, a slot is used again once its job is done. A thread with that
+          many jobs in flight (parked ones included) runs other jobs until one is done.
+        - Workers with nothing to do steal for a while, then sleep until a job is spawned.
+
+    Every job may count down a JobCounter when it is done and may wait for another counter to reach zero before it starts
+    (a dependency: the job is parked on the counter and pushed by the job that brings it to zero). job_wait() does not block, it runs
+    other jobs until the counter is zero, so jobs may spawn and wait for jobs of their own. A waiting thread may run any job, so do
+    not wait while holding a lock another job takes.
+
+    job_parallel_for() runs a body for every index of a range in pieces of at least grain indices. It splits the range in halves,
+    pushes one and goes on with the other, so thieves take big pieces and the owner works through small ones.
+
+    Spawn onto a counter only from a job it counts or while nobody waits for it, a counter is done the moment it reaches zero.
+*/
+
+const int job_max_threads = 64;
+const int job_thread_jobs = 4096; // Jobs in flight per thread, and the size of every deque
+
+typedef void (*JobFunction)(void *data, int begin, int end);
+
+struct Job;
+
+struct JobCounter
+{
+    std::atomic<int> count;    // Jobs spawned onto it that are not done yet, negative while the job that brought it to zero pushes the jobs waiting for it
+    std::mutex mutex;          // Guards waiting
+    Job *waiting;              // Jobs that start once count is zero
+
+    JobCounter() : count(0), waiting(nullptr) {}
+    JobCounter(const JobCounter &) = delete;
+    JobCounter &operator=(const JobCounter &) = delete;
+};
+
+void job_system_init(int thread_count); // thread_count includes the calling thread, 1 means everything runs on the threads that wait
+void job_system_shutdown();             // Every job has to be done
+int job_system_size();
+
+// Run function(data, begin, end) on some thread. counter (may be null) counts down when it is done, after (may be null) has to reach
+// zero before it starts. Without a job system the job runs right away
+void job_spawn(JobFunction function, void *data, int begin, int end, JobCounter *counter, JobCounter *after = nullptr);
+void job_wait(JobCounter &counter); // Run jobs until counter is zero
+
+// body(index) for every index in 0..count-1, returns when all of them are done. grain is the fewest indices a job runs
+void job_parallel_for(int count, int grain, const std::function<void(int index)> &body);
+
+// Fine grained jobs on 1..max_threads threads: a pool with one mutex guarded queue against job_spawn() and job_parallel_for()
+bool job_system_benchmark(int max_threads);
@@ -1,3 +1,6 @@
+// The d3d12 renderer only exists on windows. Elsewhere the program is the cpu backend, see headless.cpp
+#ifdef _WIN32
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <d3d12.h>
@@ -6,7 +9,31 @@
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
 #include "d3dx12.h"
+#include "renderer_common.h"
+#include "headless.h"
+#include "frame_ring.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "gpu_timer.h"
+#include "upload_manager.h"
+#include "upload_ring.h"
+#include "heap_allocator.h"
+#include "shader_cache.h"
+#include "pso_cache.h"
+#include "root_signature_cache.h"
+#include "resource_state.h"
+#include "render_graph.h"
+#include "descriptor_allocator.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "vertex_format.h"
+#include "benchmark.h"
+#include "app_loop.h"
+#include <chrono>
+#include <thread>
 #include <string>
+#include <string.h>
+#include <stdio.h>
 
 #pragma comment(lib, "dxgi.lib") 
 #pragma comment(lib, "d3d12.lib") 
@@ -23,35 +50,301 @@ LPCTSTR window_title = "DirectX12 Demo Window";
 int width = 800;
 int height = 600;
 bool fullscreen = false;
-bool running = true; // exit when this becomes false
+AppLoop window_app;                            // The simulation and render threads window_loop() runs, app_loop_request_quit() stops them
+const UINT window_stopped_message = WM_APP;    // Posted to the window once they stopped
+
+//What every frame writes into the upload ring for the vertex shader, MeshConstants in vertex.hlsl. A constant buffer is a multiple of 256 bytes
+struct FrameConstants
+{
+    VertexDequantization dequantization;
+    uint8_t padding[D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT - sizeof(VertexDequantization)];
+};
 
 //D3D declarations
-const int framebuffer_count = 3; // triple buffering
 ID3D12Device *renderer_device;
 IDXGISwapChain3 *renderer_swapchain;      // Switching between render targets
 ID3D12CommandQueue *command_queue;        // container for command lists
-ID3D12DescriptorHeap *descriptorheap_rtv; // Holds resources like render targets
 ID3D12Resource *renderer_targets[framebuffer_count];
-ID3D12CommandAllocator *command_allocators[framebuffer_count]; // One per each framebuffer * thread (we only have one thread for now)
-ID3D12GraphicsCommandList *command_list;                       // A command list we can record commands into and then execute them to render a frame
-ID3D12Fence1 *renderer_fence[framebuffer_count];               // An object that is locked while command list is executed by the gpu. We need as many as we have allocators
+ID3D12CommandAllocator *command_allocators[frame_ring_max_frames][record_threads_max]; // One per each frame in flight * recording thread
+ID3D12GraphicsCommandList *command_lists[record_threads_max];  // One command list per recording thread, all of them are executed together to render a frame
+ID3D12CommandAllocator *command_allocators_barrier[frame_ring_max_frames]; // One per frame in flight for command_list_barrier
+ID3D12GraphicsCommandList *command_list_barrier;               // Runs before the first command list when that one needs its resources in other states than they are in, see resource_state.h
+ResourceStateTracker renderer_state_trackers[record_threads_max]; // Works out the barriers for each thread's command list
+ResourceStateRegistry renderer_resource_states;                // State of every resource after everything submitted so far
+RenderGraph renderer_frame_graph;                              // The frame's passes, compiled once in renderer_init(), see render_graph.h
+RenderGraphHandle renderer_graph_back_buffer;                  // The back buffer as the graph knows it, pointed at the current one every frame
+int renderer_record_threads = 1;                               // How many threads record the frame's command lists (1..record_threads_max), -record-threads N
+UINT renderer_draw_instances = 1;                              // Instances of the triangle per frame, split between the recording threads, -instances N
+UINT renderer_draw_calls = 1;                                  // Draw calls the instances are split into, at least one per recording thread
+const Mesh *renderer_scene_mesh = nullptr;                     // Drawn instead of the triangle if set (benchmark scenarios, see benchmark.h)
+double renderer_submit_seconds;                                // Cpu time the last frame took to record and submit its lists, waits for the gpu left out
+uint64_t renderer_frame_barriers;                              // Transition barriers the last frame's lists recorded, resolved ones included
+const BenchmarkScenario *renderer_benchmark = nullptr;         // Scenario window_loop() measures instead of running until the window closes, -benchmark NAME
+int renderer_benchmark_warmup = 10;                            // Frames rendered before it measures, -warmup N
+int renderer_benchmark_frames = 200;                           // And measured frames, -frames N
+BenchmarkResult renderer_benchmark_result;
+ID3D12Fence1 *renderer_fence;                                  // One timeline fence, every submission to the queue signals the next value
 HANDLE renderer_fence_event;                                   // A handle to our event for when the fence is unlocked by the gpu
-UINT64 renderer_fence_value[framebuffer_count];                // This value is incremented each frame. Each fence has their own value
-ID3D12PipelineState *renderer_pipeline;                        // Pso containing our default pipeline state
+FrameRing renderer_frame_ring;                                 // Hands out frame contexts and waits for the gpu before one is reused
+int renderer_frames_in_flight = 2;                             // How many frames the cpu may run ahead of the gpu (1..frame_ring_max_frames), -frames-in-flight N
+int frame_context;                                             // Frame context (command allocator) we are recording into
+ID3D12PipelineState *renderer_pipelines[VERTEX_FORMAT_COUNT];  // One pso per vertex format, same state except for the input layout and the vertex shader variant
 ID3D12RootSignature *renderer_rootsig;                         // We use it to say that the Input Assembler will be used, which means we will bind a vertex buffer containing info about each vertex
 D3D12_VIEWPORT renderer_viewport;                              // We only have one viewport because it will be drawing to a whole render target
 D3D12_RECT renderer_scissorRect;                               // Says where to draw and hwere not to draw.
 ID3D12Resource *renderer_vertexBuffer;                         // Where we store our vertices
+HeapAllocation renderer_vertexBuffer_allocation = {-1};       // The piece of a buffer heap the vertex buffer is placed in
+ID3D12Resource *renderer_indexBuffer;                          // Indices into the vertex buffer, 16 or 32 bit depending on how many vertices there are
+HeapAllocation renderer_indexBuffer_allocation = {-1};
+UINT renderer_index_count;                                     // Indices per instance of the draw
+HeapAllocator renderer_buffer_heaps;                           // Default heaps buffers are placed in, instead of a committed resource (and its own heap) each
+HeapAllocator renderer_texture_heaps;                          // Same for textures that are not render targets or depth buffers, heap tier 1 wants them apart from buffers
+const UINT64 renderer_heap_size = 16 * 1024 * 1024;            // Size of each of those heaps, bigger resources get a heap of their own
+ShaderCache renderer_shader_cache;                             // Compiled shaders from earlier runs, see shader_cache.h
+PsoCache renderer_pso_cache;                                   // Pipeline state objects, deduplicated and kept in a pipeline library on disk, see pso_cache.h
+RootSignatureCache renderer_root_signature_cache;              // Serialized root signatures kept next to the shaders, one object per distinct blob, see root_signature_cache.h
 D3D12_VERTEX_BUFFER_VIEW renderer_vertexBuffer_view;           // Describes the address, stride and total siez of our vertex buffer and a pointer to the vertex data in gpu memory
+D3D12_INDEX_BUFFER_VIEW renderer_indexBuffer_view;             // Same for the index buffer, plus the format of its indices
+VertexFormat renderer_vertex_format;                           // Format the triangle's vertices were uploaded in, picks the pso it is drawn with
+VertexDequantization renderer_vertex_dequantization;           // Its bounds, every frame copies them into its FrameConstants
+float renderer_vertex_tolerance = 0.0f;                        // Position error the triangle's format may have, 0 keeps floats. -quantize-vertices
+UINT renderer_mesh_constants_parameter;                        // Root parameter the frame constants' cbv goes to
+ID3D12Resource *renderer_upload_buffer;                        // One upload buffer for the data every frame writes, mapped for as long as it lives
+UploadRing renderer_upload_ring;                               // Hands out per frame pieces of renderer_upload_buffer and takes them back by fence value
+bool renderer_dynamic_vertices = false;                        // Write the vertices into the upload ring every frame and draw them from there, -dynamic-vertices
+std::vector<uint8_t> renderer_vertex_data;                     // The encoded vertices, what -dynamic-vertices writes every frame
+D3D12_GPU_VIRTUAL_ADDRESS renderer_frame_constants;            // This frame's FrameConstants in the upload ring
+D3D12_VERTEX_BUFFER_VIEW renderer_frame_vertex_view;           // What this frame draws from, renderer_vertexBuffer_view or this frame's copy in the upload ring
+bool renderer_barrier_list_used;                               // command_list_barrier was recorded this frame and goes in front of the other lists
 int frame_index;                                               // Current rtv we are on
-int descriptorSize_rtv;                                        // Size of the rtv descriptor on the device  (all front and back buffers will be the same size)
+ID3D12DescriptorHeap *renderer_descriptor_heaps[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES]; // Cpu only heaps every view is created in, one per type
+DescriptorPool renderer_descriptor_pools[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES];       // Hand out and take back the descriptors of those heaps, see descriptor_allocator.h
+const UINT renderer_descriptor_capacity[D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES] = {4096, 256, 64, 64}; // cbv/srv/uav, sampler, rtv, dsv
+ID3D12DescriptorHeap *renderer_shader_heap;                    // The shader visible cbv/srv/uav heap, frames copy the descriptor tables they bind into it
+DescriptorRing renderer_shader_ring;                           // Hands out per frame tables of renderer_shader_heap and takes them back by fence value
+const UINT renderer_shader_ring_capacity = 64 * 1024;          // Descriptors, enough for thousands of bindings per frame in flight
+uint32_t renderer_target_rtvs[framebuffer_count];              // Rtv of each swap chain buffer in the rtv pool
+bool renderer_bindless = false;                                // One root signature with unbounded descriptor ranges, draws find their resources by index, -bindless
+const UINT renderer_material_count = 1024;                     // Materials in bindless mode, each one a constant buffer view in the cbv/srv/uav pool
+ID3D12Resource *renderer_material_buffer;                      // The constants of every material, 256 bytes each
+HeapAllocation renderer_material_buffer_allocation = {-1};
+uint32_t renderer_material_cbvs[renderer_material_count];      // Their views in the cbv/srv/uav pool
+UINT renderer_material_base;                                   // Where this frame's copy of the material views starts in the shader visible heap
+ID3D12CommandQueue *renderer_copy_queue;                       // A COPY queue for asset uploads, it runs next to the direct queue instead of in front of the frame
+ID3D12Fence *renderer_copy_fence;                              // Its own timeline, every upload batch signals the next value and that value is the upload's ticket
+HANDLE renderer_copy_fence_event;
+ID3D12GraphicsCommandList *renderer_copy_command_list;         // Every upload batch is recorded into it
+std::deque<std::pair<ID3D12CommandAllocator *, uint64_t>> renderer_copy_allocators; // Allocators of submitted batches and the fence value each one waits for, oldest first
+UploadManager renderer_upload_manager;                         // Batches the copies and hands out tickets, see upload_manager.h
+const UINT64 renderer_upload_block_size = 4 * 1024 * 1024;     // Staging block size, bigger uploads get a block of their own
+const int renderer_upload_max_blocks = 8;                      // Staging memory the uploads may keep before a request waits for the copy queue
+uint64_t renderer_upload_required;                             // Copy fence value the next submission on the direct queue has to wait for
+uint64_t renderer_upload_waited;                               // Value the direct queue was last told to wait for
+std::vector<UploadTicket> renderer_upload_tickets;             // Tickets required since the last sync, checked for uploads that failed
+ID3D12QueryHeap *renderer_timestamp_heap;                      // gpu_timer_max_queries timestamps per frame context
+ID3D12Resource *renderer_timestamp_readback;                   // Where they are resolved to, mapped for as long as it lives
+GpuTimer renderer_gpu_timer;                                   // Times the passes on the gpu and hands the results to the profiler, see gpu_timer.h
+
+// The frame ring talks to our queue and fence through this
+struct D3D12FrameQueue : FrameQueue
+{
+    bool Signal(uint64_t value) override
+    {
+        return SUCCEEDED(command_queue->Signal(renderer_fence, value));
+    }
+
+    uint64_t GetCompletedValue() override
+    {
+        return renderer_fence->GetCompletedValue();
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        //Have the fence trigger our event once it reaches the value and sleep until then
+        if (FAILED(renderer_fence->SetEventOnCompletion(value, renderer_fence_event)))
+        {
+            return false;
+        }
+        return WaitForSingleObject(renderer_fence_event, INFINITE) == WAIT_OBJECT_0;
+    }
+};
+D3D12FrameQueue renderer_frame_queue;
+
+// The upload manager records its batches on the copy queue and keeps its staging blocks in upload heaps through this
+struct D3D12CopyQueue : UploadQueue
+{
+    ID3D12CommandAllocator *recorded = nullptr; // Allocator of the batch that was just executed, Signal() learns its fence value
+
+    bool Signal(uint64_t value) override
+    {
+        if (recorded)
+        {
+            renderer_copy_allocators.push_back(std::make_pair(recorded, value));
+            recorded = nullptr;
+        }
+        return SUCCEEDED(renderer_copy_queue->Signal(renderer_copy_fence, value));
+    }
+
+    uint64_t GetCompletedValue() override
+    {
+        return renderer_copy_fence->GetCompletedValue();
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        if (renderer_copy_fence->GetCompletedValue() >= value)
+        {
+            return true;
+        }
+        if (FAILED(renderer_copy_fence->SetEventOnCompletion(value, renderer_copy_fence_event)))
+        {
+            return false;
+        }
+        WaitForSingleObject(renderer_copy_fence_event, INFINITE);
+        return true;
+    }
+
+    bool CreateBlock(uint64_t size, UploadBlock &block) override
+    {
+        //A committed upload buffer, mapped for as long as it lives
+        ID3D12Resource *buffer = nullptr;
+        CD3DX12_HEAP_PROPERTIES heap(D3D12_HEAP_TYPE_UPLOAD);
+        CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(size);
+        if (FAILED(renderer_device->CreateCommittedResource(&heap, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&buffer))))
+        {
+            return false;
+        }
+        buffer->SetName(L"Upload Manager Staging Block");
+
+        void *memory;
+        CD3DX12_RANGE read_range(0, 0);
+        if (FAILED(buffer->Map(0, &read_range, &memory)))
+        {
+            buffer->Release();
+            return false;
+        }
+        block.cpu = (uint8_t *)memory;
+        block.resource = buffer;
+        return true;
+    }
+
+    void DestroyBlock(UploadBlock &block) override
+    {
+        ((ID3D12Resource *)block.resource)->Release();
+    }
+
+    bool Execute(const UploadBlock *blocks, const UploadCopy *copies, size_t count) override
+    {
+        //An allocator can be reset once the batch recorded into it is done, otherwise the queue gets another one
+        ID3D12CommandAllocator *allocator = nullptr;
+        if (!renderer_copy_allocators.empty() && renderer_copy_allocators.front().second <= renderer_copy_fence->GetCompletedValue())
+        {
+            allocator = renderer_copy_allocators.front().first;
+            renderer_copy_allocators.pop_front();
+            if (FAILED(allocator->Reset()))
+            {
+                allocator->Release();
+                return false;
+            }
+        }
+        else if (FAILED(renderer_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator))))
+        {
+            return false;
+        }
+        recorded = allocator;
+
+        if (FAILED(renderer_copy_command_list->Reset(allocator, nullptr)))
+        {
+            discard();
+            return false;
+        }
+
+        //The destinations are in the common state. Buffers and textures are promoted to copy dest by the copy itself and everything a
+        //copy queue touched decays back to common once the batch is done, so the copy queue records no barriers at all
+        for (size_t i = 0; i < count; ++i)
+        {
+            const UploadCopy &copy = copies[i];
+            ID3D12Resource *source = (ID3D12Resource *)blocks[copy.block].resource;
+            if (!copy.texture)
+            {
+                renderer_copy_command_list->CopyBufferRegion((ID3D12Resource *)copy.destination, copy.destination_offset, source, copy.source_offset, copy.size);
+                continue;
+            }
+
+            D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {};
+            footprint.Offset = copy.source_offset;
+            footprint.Footprint.Format = (DXGI_FORMAT)copy.footprint.format;
+            footprint.Footprint.Width = copy.footprint.width;
+            footprint.Footprint.Height = copy.footprint.height;
+            footprint.Footprint.Depth = copy.footprint.depth;
+            footprint.Footprint.RowPitch = (UINT)copy.row_pitch;
+            CD3DX12_TEXTURE_COPY_LOCATION destination((ID3D12Resource *)copy.destination, copy.subresource);
+            CD3DX12_TEXTURE_COPY_LOCATION staging(source, footprint);
+            renderer_copy_command_list->CopyTextureRegion(&destination, 0, 0, 0, &staging, nullptr);
+        }
+
+        if (FAILED(renderer_copy_command_list->Close()))
+        {
+            discard();
+            return false;
+        }
+        ID3D12CommandList *lists[] = { renderer_copy_command_list };
+        renderer_copy_queue->ExecuteCommandLists(1, lists);
+        return true;
+    }
 
-struct Vertex
+    //Nothing was submitted and the manager will not signal, the allocator can be reset right away. Value 0 keeps the deque oldest first
+    void discard()
+    {
+        renderer_copy_allocators.push_front(std::make_pair(recorded, (uint64_t)0));
+        recorded = nullptr;
+    }
+};
+D3D12CopyQueue renderer_upload_queue;
+
+// The gpu timer's timestamps, queries in renderer_timestamp_heap resolved into renderer_timestamp_readback
+struct D3D12TimerQueue : GpuTimerQueue
 {
-    Vertex(float x, float y, float z, float r, float g, float b, float a) : pos(x, y, z), color(r, g, b, a) {}
-    XMFLOAT3 pos;
-    XMFLOAT4 color;
+    const uint64_t *results = nullptr;
+    uint64_t frequency = 0;
+
+    void Timestamp(void *command_list, uint32_t query) override
+    {
+        ((ID3D12GraphicsCommandList *)command_list)->EndQuery(renderer_timestamp_heap, D3D12_QUERY_TYPE_TIMESTAMP, query);
+    }
+
+    void Resolve(void *command_list, uint32_t first_query, uint32_t count) override
+    {
+        ((ID3D12GraphicsCommandList *)command_list)->ResolveQueryData(renderer_timestamp_heap, D3D12_QUERY_TYPE_TIMESTAMP, first_query, count,
+                                                                      renderer_timestamp_readback, first_query * sizeof(uint64_t));
+    }
+
+    const uint64_t *Results() override
+    {
+        return results;
+    }
+
+    uint64_t Frequency() override
+    {
+        return frequency;
+    }
+
+    bool Calibrate(uint64_t &gpu_ticks, std::chrono::steady_clock::time_point &cpu_time) override
+    {
+        //The cpu side is a QueryPerformanceCounter value, which is what steady_clock counts in on windows
+        UINT64 gpu, cpu;
+        LARGE_INTEGER qpc_frequency;
+        if (FAILED(command_queue->GetClockCalibration(&gpu, &cpu)) || !QueryPerformanceFrequency(&qpc_frequency))
+        {
+            return false;
+        }
+        gpu_ticks = gpu;
+        std::chrono::duration<double> since_boot((double)cpu / (double)qpc_frequency.QuadPart);
+        cpu_time = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(since_boot));
+        return true;
+    }
 };
+D3D12TimerQueue renderer_timer_queue;
 
 //User made functions
 //Window window's handling
@@ -61,11 +354,41 @@ LRESULT CALLBACK window_Callback(HWND window_handle, UINT message, WPARAM WParam
 
 //D3D functions
 bool renderer_init();    // Init the d3d render context
+void general_event(const AppEvent &event); // Input from the window, before the update of the next frame
 void general_update();   // Update the engine logic
-void pipeline_update();  // update command lists
+bool pipeline_update();  // update command lists, false if the frame could not be recorded and must not be executed
 void renderer_render();  // execute command lists
+uint64_t renderer_barrier_total(); // Barriers all state trackers recorded so far
 void renderer_cleanup(); // release objects and clean up memory
-void renderer_wait();    // Wait until gpu is doen with command list
+bool renderer_wait();    // Wait until the gpu is done with the next frame context, false if the wait failed
+HRESULT pipeline_record(int thread); // Record one thread's share of the frame into its command list
+HRESULT pipeline_close(int count, bool &barrier_list_used); // Resolve the barriers between the first count command lists and close them
+void renderer_record_barriers(ID3D12GraphicsCommandList *command_list, const ResourceTransition *transitions, int count); // One ResourceBarrier call for the lot
+bool renderer_build_frame_graph();      // Describe the frame as render graph passes and compile it
+bool renderer_descriptor_init();        // Create the cpu only descriptor heaps and the shader visible ring
+D3D12_CPU_DESCRIPTOR_HANDLE renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE type, uint32_t index); // Handle of a descriptor in a cpu pool
+bool renderer_descriptor_table(const D3D12_CPU_DESCRIPTOR_HANDLE *sources, UINT count, DescriptorTable &table); // Copy a table into this frame's piece of the ring
+bool renderer_create_root_signature(ID3D12RootSignature **root_signature); // The classic root signature, or the bindless one with -bindless
+bool renderer_create_materials(ResourceStateTracker &tracker); // Bindless mode's material constants and their views
+bool renderer_create_index_buffer(const uint32_t *indices, UINT count, UINT vertex_count, ResourceStateTracker &tracker); // Pack, place and upload the indices, then fill renderer_indexBuffer_view
+bool renderer_timer_init();               // Create the timestamp query heap and its readback buffer and the gpu timer on top of them
+bool renderer_upload_init();              // Create the copy queue, its fence and command list and the upload manager on top of them
+void renderer_upload_require(UploadTicket ticket); // The next submission on the direct queue reads what this upload writes
+bool renderer_upload_sync();              // Submit the open upload batch and have the direct queue wait (on the gpu) for the required tickets, false if one failed
+UploadTicket renderer_upload_texture(ID3D12Resource *texture, UINT first_subresource, UINT count, const D3D12_SUBRESOURCE_DATA *data); // UpdateSubresources through the upload manager, rows copied by the job system
+void renderer_pass_clear(int thread, int share, int share_count); // Render graph passes, record their share of the work on the thread's command list
+void renderer_pass_triangles(int thread, int share, int share_count);
+UINT renderer_input_layout(const VertexFormatDesc &format, D3D12_INPUT_ELEMENT_DESC *elements); // The input layout that reads a vertex format, returns the element count
+bool renderer_upload_ring_init(UINT64 frame_bytes); // Create the upload buffer and the ring on top of it, big enough for frame_bytes per frame in flight
+bool renderer_stream_frame_data();        // Write this frame's constants (and vertices) into the upload ring
+
+//Placed resources
+void *renderer_create_heap(UINT64 size, D3D12_HEAP_FLAGS flags); // Callback for the heap allocators
+HRESULT renderer_create_placed_resource(HeapAllocator &heaps, const D3D12_RESOURCE_DESC &desc, D3D12_RESOURCE_STATES state, ID3D12Resource **resource, HeapAllocation &allocation);
+void renderer_release_placed_resource(HeapAllocator &heaps, ID3D12Resource **resource, HeapAllocation &allocation); // Only once the gpu is done with it
+
+//Shaders
+HRESULT renderer_compile_shader(const char *path, const D3D_SHADER_MACRO *defines, const char *entry, const char *target, UINT flags, ID3DBlob **bytecode, ID3DBlob **errors); // Compile or take it from the cache
 
 /*
     Main entry point for windows functions:
@@ -93,6 +416,101 @@ int CALLBACK WinMain(HINSTANCE hInstance,     //Handle to current program
                      LPSTR lpCmdLine,         //Command line for program, basically replaces argv and argc
                      int nShowCmd)            //No idea what this does seems to always be  10
 {
+    //Run the cpu backend instead when asked to, no window or gpu needed
+    if (strstr(lpCmdLine, "-headless"))
+    {
+        //We are a windows subsystem program so we have no console, borrow the one we were started from to print results
+        if (AttachConsole(ATTACH_PARENT_PROCESS))
+        {
+            FILE *console;
+            freopen_s(&console, "CONOUT$", "w", stdout);
+            freopen_s(&console, "CONOUT$", "w", stderr);
+        }
+        return headless_run_cmdline(lpCmdLine);
+    }
+
+    //How far the cpu may run ahead of the gpu. Lower is less latency, higher is more throughput
+    const char *frames_in_flight = strstr(lpCmdLine, "-frames-in-flight ");
+    if (frames_in_flight)
+    {
+        renderer_frames_in_flight = atoi(frames_in_flight + strlen("-frames-in-flight "));
+    }
+
+    //Recording threads and how much there is to record
+    const char *record_threads = strstr(lpCmdLine, "-record-threads ");
+    if (record_threads)
+    {
+        renderer_record_threads = atoi(record_threads + strlen("-record-threads "));
+    }
+    const char *instances = strstr(lpCmdLine, "-instances ");
+    if (instances)
+    {
+        renderer_draw_instances = (UINT)atoi(instances + strlen("-instances "));
+    }
+    renderer_bindless = strstr(lpCmdLine, "-bindless") != nullptr;
+    renderer_dynamic_vertices = strstr(lpCmdLine, "-dynamic-vertices") != nullptr;
+
+    //Benchmark a fixed scene for a fixed number of frames instead, the scenario sets the window size and what is drawn
+    //The result paths run up to the next space
+    Mesh benchmark_mesh;
+    std::string benchmark_json, benchmark_csv;
+    const char *benchmark = strstr(lpCmdLine, "-benchmark ");
+    if (benchmark)
+    {
+        benchmark += strlen("-benchmark ");
+        std::string name(benchmark, strcspn(benchmark, " \t"));
+        renderer_benchmark = benchmark_find_scenario(name.c_str());
+        if (!renderer_benchmark)
+        {
+            MessageBox(0, "No such benchmark scenario!", "Error", MB_OK);
+            return 1;
+        }
+        width = renderer_benchmark->width;
+        height = renderer_benchmark->height;
+        renderer_draw_instances = renderer_benchmark->instances;
+        renderer_draw_calls = renderer_benchmark->draws;
+        benchmark_mesh = benchmark_scenario_mesh(*renderer_benchmark);
+        renderer_scene_mesh = &benchmark_mesh;
+
+        const char *warmup = strstr(lpCmdLine, "-warmup ");
+        if (warmup)
+        {
+            renderer_benchmark_warmup = atoi(warmup + strlen("-warmup "));
+        }
+        const char *frames = strstr(lpCmdLine, "-frames ");
+        if (frames)
+        {
+            renderer_benchmark_frames = atoi(frames + strlen("-frames "));
+        }
+        const char *json = strstr(lpCmdLine, "-benchmark-json ");
+        if (json)
+        {
+            json += strlen("-benchmark-json ");
+            benchmark_json.assign(json, strcspn(json, " \t"));
+        }
+        const char *csv = strstr(lpCmdLine, "-benchmark-csv ");
+        if (csv)
+        {
+            csv += strlen("-benchmark-csv ");
+            benchmark_csv.assign(csv, strcspn(csv, " \t"));
+        }
+    }
+    renderer_vertex_tolerance = strstr(lpCmdLine, "-quantize-vertices") ? vertex_format_default_tolerance : 0.0f;
+
+    //Time the profiler markers and write a chrome trace of them on exit, the path runs up to the next space
+    std::string profile_path;
+    const char *profile = strstr(lpCmdLine, "-profile ");
+    if (profile)
+    {
+        profile += strlen("-profile ");
+        profile_path.assign(profile, strcspn(profile, " \t"));
+        profiler_init(true);
+        profiler_thread_name("main");
+    }
+    //One job system for recording, uploads and whatever else goes wide: a thread per core, and at least one per recording thread
+    int cores = (int)std::thread::hardware_concurrency();
+    job_system_init(cores > renderer_record_threads ? cores : renderer_record_threads);
+
     //Initialize and create the window
     if (!window_init(hInstance, nShowCmd, width, height, fullscreen))
     {
@@ -115,15 +533,40 @@ int CALLBACK WinMain(HINSTANCE hInstance,     //Handle to current program
     window_loop();
 
     //we want to ait for hte gpu to finish executing commands before we release everything
-    renderer_wait();
+    //If the wait failed the device is most likely gone, everything is released anyway and the exit code says so
+    bool gpu_finished = frame_ring_flush(renderer_frame_ring);
 
     //close the fence event
     CloseHandle(renderer_fence_event);
 
     //clean up after ourselves
     renderer_cleanup();
+    job_system_shutdown();
+
+    //The report goes to the debugger's output window, the files are what a script compares between runs
+    if (renderer_benchmark)
+    {
+        std::vector<BenchmarkResult> results(1, renderer_benchmark_result);
+        OutputDebugStringA(benchmark_report(renderer_benchmark_result).c_str());
+        if ((!benchmark_json.empty() && !benchmark_write_json(benchmark_json.c_str(), "d3d12", renderer_record_threads, results)) ||
+            (!benchmark_csv.empty() && !benchmark_write_csv(benchmark_csv.c_str(), "d3d12", renderer_record_threads, results)))
+        {
+            MessageBox(0, "Could not write the benchmark results!", "Error", MB_OK);
+        }
+    }
+
+    //There is no console to print the summary to, it goes to the debugger's output window
+    if (!profile_path.empty())
+    {
+        OutputDebugStringA(profiler_summary().c_str());
+        if (!profiler_write_chrome_trace(profile_path.c_str()))
+        {
+            MessageBox(0, "Could not write the profile!", "Error", MB_OK);
+        }
+        profiler_shutdown();
+    }
 
-    return 0;
+    return gpu_finished ? 0 : 1;
 }
 
 /*
@@ -232,28 +675,64 @@ If bot of the filter values are zero then windows returns all of the messages
 */
 void window_loop()
 {
-    MSG msg;
-    ZeroMemory(&msg, sizeof(MSG));
-
-    while (running)
-    {
-        if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
-        {
-            if (msg.message == WM_QUIT)
-                break;
-
-            TranslateMessage(&msg); // Translate keyboard messages into more pproper messages ????
-            DispatchMessage(&msg);  // Actually deal with message
-        }
-        else
+    //Simulation and rendering run on threads of their own and this one only answers messages (see app_loop.h),
+    //so a modal loop here, like the escape key's MessageBox or dragging the window around, no longer stops the frame
+    AppLoopCallbacks callbacks;
+    callbacks.event = general_event;
+    callbacks.update = [](uint64_t) {
+        //run game code
+        general_update(); //Update engine logic
+        return true;
+    };
+    callbacks.render = [](uint64_t) {
         {
-            //run game code
-            general_update(); //Update engine logic
+            PROFILE_SCOPE("window_loop: frame");
 
             //Execute the commandqueue (rendering the scene is the result oft he gpu executing the command lists)
             renderer_render();
         }
+
+        //Collect the frame's profiler markers from every thread, outside the frame's scope so it is collected next frame
+        profiler_frame();
+        return true;
+    };
+    //Once both threads stopped nobody renders to the window anymore, this thread may destroy it
+    callbacks.stopped = [] { PostMessage(window_handle, window_stopped_message, 0, 0); };
+
+    //A benchmark renders its frames back to back on the render thread and stops when it has them all
+    if (renderer_benchmark)
+    {
+        callbacks.update = nullptr;
+        callbacks.render = [](uint64_t) {
+            renderer_benchmark_result = benchmark_run(*renderer_benchmark, renderer_benchmark_warmup, renderer_benchmark_frames, [](double &submit_seconds, uint64_t &barriers) {
+                {
+                    PROFILE_SCOPE("window_loop: frame");
+                    general_update();
+                    renderer_render();
+                }
+                profiler_frame();
+                submit_seconds = renderer_submit_seconds;
+                barriers = renderer_frame_barriers;
+                return !app_loop_quitting(window_app);
+            });
+            return false;
+        };
+    }
+    app_loop_start(window_app, callbacks);
+
+    //This thread has nothing else to do, GetMessage sleeps until there is a message. It returns 0 for WM_QUIT, after the window is destroyed
+    MSG msg;
+    ZeroMemory(&msg, sizeof(MSG));
+    while (GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        PROFILE_SCOPE("window_loop: message");
+        TranslateMessage(&msg); // Translate keyboard messages into more pproper messages ????
+        DispatchMessage(&msg);  // Actually deal with message
     }
+
+    //Normally the threads stopped before the window went, if it went some other way they stop now
+    app_loop_request_quit(window_app);
+    app_loop_join(window_app);
 }
 
 /*
@@ -269,18 +748,50 @@ LRESULT CALLBACK window_Callback(HWND window_handle, //Essentially like a pointe
     switch (message)
     { //React to all these different messages
 
+    //Input goes to the simulation thread, it sees it before the update of the next frame
     case WM_KEYDOWN:
         if (WParam == VK_ESCAPE)
         {
+            //The MessageBox runs a modal loop on this thread only, the frames go on behind it
             if (MessageBox(0, "Are you sure you want to exit?", "Really?", MB_YESNO | MB_ICONQUESTION) == IDYES)
             {
-                DestroyWindow(window_handle);
+                AppEvent quit = {APP_EVENT_QUIT, 0, 0, 0};
+                app_loop_post(window_app, quit);
             }
         }
+        else
+        {
+            AppEvent key = {APP_EVENT_KEY_DOWN, (uint32_t)WParam, 0, 0};
+            app_loop_post(window_app, key);
+        }
+        break;
+
+    case WM_KEYUP:
+    {
+        AppEvent key = {APP_EVENT_KEY_UP, (uint32_t)WParam, 0, 0};
+        app_loop_post(window_app, key);
+        break;
+    }
+
+    case WM_SIZE:
+    {
+        AppEvent size = {APP_EVENT_RESIZE, 0, LOWORD(LParam), HIWORD(LParam)};
+        app_loop_post(window_app, size);
+        break;
+    }
+
+    case WM_CLOSE: // The close button or alt-f4. The window has to outlive the threads rendering to it, so they stop first
+    {
+        AppEvent quit = {APP_EVENT_QUIT, 0, 0, 0};
+        app_loop_post(window_app, quit);
+        break;
+    }
+
+    case window_stopped_message: // Now it can go
+        DestroyWindow(window_handle);
         break;
 
     case WM_DESTROY: // After the window is destroyed
-        running = false;
         PostQuitMessage(0);
         break;
 
@@ -478,33 +989,18 @@ bool renderer_init()
         3. This is a handle to a cpu descriptor in a descriptor heap that will point to the render target resource
 
         To get to the next descriptor we can offest the descriptor by the type size. There is a helper structure we can call that will help us deal with this. 
+
+        We do not make a heap just for the back buffers though. renderer_descriptor_init() makes one cpu only heap per descriptor type, big enough for every
+        view the renderer will ever create, and a pool (descriptor_allocator.h) hands out and takes back single descriptors of it. The back buffer rtvs are
+        the first three descriptors of the rtv pool, and the handle of a descriptor is the heap start plus its index times the size of the type.
     */
 
-    //Describe the Render target views descriptor heap
-    D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {};
-    //Number of descriptors for this heap
-    heap_desc.NumDescriptors = framebuffer_count;
-    //This heap is a renter target view heap
-    heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-    //This heap will not be directly referenced by shaders, as this will just store the output of the pipeline.
-    //Otherwise we would set the flag  to visible
-    heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
-
-    result = renderer_device->CreateDescriptorHeap(&heap_desc, IID_PPV_ARGS(&descriptorheap_rtv));
-    if (FAILED(result))
+    //Create the descriptor heaps, the rtv one among them
+    if (!renderer_descriptor_init())
     {
         return false;
     }
 
-    // Get the size of the descriptor in this heap (this is a rtv heap so only the rtv descriptor heaps will be stored in it )
-    // descriptor sizes may vary from device to device, which is why there is no set seize and we msut ask the device to give us the size
-    // We will use this size to increment a descriptor handle offset
-    descriptorSize_rtv = renderer_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-
-    //Get a handle to the first descriptor in the descriptor heap. A handle is basically a pointer,
-    //But we cannot literally use it like a c++ pointer. Only directx can handle it like it deserves
-    CD3DX12_CPU_DESCRIPTOR_HANDLE handle_rtv(descriptorheap_rtv->GetCPUDescriptorHandleForHeapStart());
-
     // Create a RTV for each buffer (triple buffering will make 3 RTV)
     for (int i = 0; i < framebuffer_count; ++i)
     {
@@ -515,17 +1011,25 @@ bool renderer_init()
             return false;
         }
 
-        //Then we create arender target view which binds the swap chain buffer to the rtv handle
-        renderer_device->CreateRenderTargetView(renderer_targets[i], nullptr, handle_rtv);
+        //Then we take a descriptor out of the rtv pool and create a render target view in it which binds the swap chain buffer to the rtv handle
+        renderer_target_rtvs[i] = descriptor_pool_allocate(renderer_descriptor_pools[D3D12_DESCRIPTOR_HEAP_TYPE_RTV]);
+        if (renderer_target_rtvs[i] == descriptor_null)
+        {
+            return false;
+        }
+        renderer_device->CreateRenderTargetView(renderer_targets[i], nullptr, renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE_RTV, renderer_target_rtvs[i]));
 
-        handle_rtv.Offset(1, descriptorSize_rtv);
+        //Swap chain buffers start out in the present state, the state tracker needs to know that
+        resource_state_register(renderer_resource_states, renderer_targets[i], 1, resource_state_present);
     }
 
     // -- Creating Command Allocators -- //
     /*
         Command allocators allocate memory on the GPU for the commands we want to execute by calling execute on the command queue and providing a command list with the command we want to
-        execute. We are using triple buffering, so we need to create 3 command allocators. We need three because we cannot reset a command allocator while the GPU is executign a command list
-        that is associated with it. To create a command allocator we use the createcommandallocator of hte device interface. 
+        execute. We need one per frame that can be in flight, because we cannot reset a command allocator while the GPU is executign a command list
+        that is associated with it. How many that is does not depend on the number of back buffers, see frame_ring.h.
+        Every thread that records a command list for the frame needs its own allocator too, an allocator can only be recorded into by one list at a time.
+        So the allocators are a pool keyed by (frame context, thread), and a frame's allocators are only reset once the fence says the gpu is done with that frame. To create a command allocator we use the createcommandallocator of hte device interface. 
         1. The type of the allocator. We can have either a direct command, or a bndle command allocator. The direct command allocater can be associated with direct command lists, which are executed on the GPU
             by callign execute on a command queue with the command list. A bundle command allocator stores commands for bundles. Bundles are used multiple times for many frames, so we do not want bundles to be
             on the same command allocator as direct commands, because direct command allocators are reset every fra,e. We do not want to reset bundles, otherwise thta is wasteful
@@ -533,9 +1037,27 @@ bool renderer_init()
         3. pointer to a poitner to a command allocator interface
     */
 
-    for (int i = 0; i < framebuffer_count; ++i)
+    if (renderer_frames_in_flight < 1 || renderer_frames_in_flight > frame_ring_max_frames)
+    {
+        return false;
+    }
+    if (renderer_record_threads < 1 || renderer_record_threads > record_threads_max)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < renderer_frames_in_flight; ++i)
     {
-        result = renderer_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocators[i]));
+        for (int thread = 0; thread < renderer_record_threads; ++thread)
+        {
+            result = renderer_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocators[i][thread]));
+            if (FAILED(result))
+            {
+                return false;
+            }
+        }
+
+        result = renderer_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocators_barrier[i]));
         if (FAILED(result))
         {
             return false;
@@ -544,8 +1066,8 @@ bool renderer_init()
 
     // -- Creating the command lists -- //
     /*
-        You want as many command lists as you have threads recording commands. We are not making a multi threaded app, so we only need one. 
-        Command lists can be reset immediately after we call execute on a command queue with taht command lists. This is why we only need one command list but 3 allocators. 
+        You want as many command lists as you have threads recording commands, so we make one per recording thread.
+        Command lists can be reset immediately after we call execute on a command queue with taht command lists. This is why we only need one command list per thread but an allocator per frame and thread. 
         To create a command list we can call the createCommandlist method.
         1. This specifies which GPU to use
         2. A struct which specifies which type of command list we want to create
@@ -563,32 +1085,50 @@ bool renderer_init()
 
         We need to create a command list so that we can execute our clear render target command. 
         We do this by specifying the D3D12 command list type direct
-        Since we only need one command list which is reset each frame when we specify a command allocator, we jsut create this command list with the first command allocator
+        Since a command list is reset each frame when we specify a command allocator, we jsut create each command list with its thread's allocator of the first frame
         When a command list is created, it is created in the "recording " state. We do not want to record the command list yet so we close the command list after creating it.
     */
 
-    //Create the command list with the first allocator
-    result = renderer_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocators[0], NULL, IID_PPV_ARGS(&command_list));
+    //Create the command lists with the first frame's allocators
+    for (int thread = 0; thread < renderer_record_threads; ++thread)
+    {
+        result = renderer_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocators[0][thread], NULL, IID_PPV_ARGS(&command_lists[thread]));
+        if (FAILED(result))
+        {
+            return false;
+        }
+
+        // Command lists are created in a recording state. Our main loop will set up for recording again so let's close them for now.
+        // The first one stays open, we record the vertex buffer upload into it below
+        if (thread > 0)
+        {
+            command_lists[thread]->Close();
+        }
+
+        resource_state_tracker_init(renderer_state_trackers[thread], renderer_resource_states);
+    }
+
+    //The list that gets the first list's resources into the states it needs, it is only recorded and executed in frames that need it
+    result = renderer_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocators_barrier[0], NULL, IID_PPV_ARGS(&command_list_barrier));
     if (FAILED(result))
     {
         return false;
     }
-
-    // Command lists are created in a recording state. Our main loop will set up for recording again so let's close it for now.
+    command_list_barrier->Close();
 
     // -- Creating a Fence and a & Fence Event -- //
     /*
         The final initialization (woohoo!!)
         Requires creating a fence and a fence event
-        We are only using a single thread, so we only need one fence event, but since we are triple buffering, we need three fences, one for each frame buffer. We also have three current fence value
-        reprecented in the fence value array. 
+        We use a single fence as a timeline: every time we submit work we signal the next value, so a frame is just a fence value and waiting for
+        any older frame is waiting for a smaller value. The frame ring remembers the value of each frame context and waits for it before the context is reused.
 
-        The first thing we will do is create 3 fences by using the createfence function from the device interface (for each fence)
+        We create the fence by using the createfence function from the device interface
         1. initial value we want the fence to start with
         2. The flag is for a shared fence, we are not sharing fence, so we can set it to none.
         3 & 4 typical id type and pointer to pointer stuff 
 
-        Once we create all three fences and initialize the fence value array we create a fence event using the windows createevent function:
+        Once we create the fence we create a fence event using the windows createevent function:
         1. This is a pointer toa security attribute structure, setting this to null will use the default security structure
         2. If this is set to true we will have to atuomatically reset the even to not triggered by using the resetevent function 
             setting this to false will cause the even to automaticall reset to not tirggered after we have waited for hte fence event
@@ -597,14 +1137,10 @@ bool renderer_init()
     */
 
     //Creating the fence
-    for (int i = 0; i < framebuffer_count; ++i)
+    result = renderer_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&renderer_fence));
+    if (FAILED(result))
     {
-        result = renderer_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&renderer_fence[i]));
-        if (FAILED(result))
-        {
-            return false;
-        }
-        renderer_fence_value[i] = 0;
+        return false;
     }
 
     //create a handle to the fence event
@@ -614,6 +1150,24 @@ bool renderer_init()
         return false;
     }
 
+    //The ring starts at the fence's current value with every frame context free
+    if (!frame_ring_init(renderer_frame_ring, &renderer_frame_queue, renderer_frames_in_flight))
+    {
+        return false;
+    }
+
+    //Assets go up on a copy queue of their own with a fence of its own, see renderer_upload_init()
+    if (!renderer_upload_init())
+    {
+        return false;
+    }
+
+    //Timestamps around the passes, see gpu_timer.h
+    if (!renderer_timer_init())
+    {
+        return false;
+    }
+
     // -- Creating Root signature -- //
     /*
         we need to create a root signature usinc the root signature desc struct
@@ -640,30 +1194,32 @@ bool renderer_init()
         We will define and create the root signature in code at runtime. IT could also be defined in hlsl instead 
         The first thing we will do is fill ut a root signature desc  struct. We wnat the input assembler so we will specify that flag. 
         once we have that description we will serialize it into bytecode. We will use that bytecode to create a root signature object
-    */
+        Serializing is not free and every start would do it again for the same desc, so the root signature cache (root_signature_cache.h) keeps the bytecode
+        on disk next to the compiled shaders and only serializes descs it has not seen before. It also creates the root signature object, one per distinct bytecode.
 
-    //create the root signature
-    CD3DX12_ROOT_SIGNATURE_DESC rootSig_desc;
-    rootSig_desc.Init(0, nullptr, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+        With -bindless there is one root signature for every draw instead, built by renderer_create_root_signature(). Its only descriptor table covers the
+        whole shader visible heap with unbounded ranges, so it is set once per command list, and a draw says which descriptors it uses by passing their
+        heap indices as root constants. Nothing has to be copied or bound per draw, however many materials a scene has.
+    */
 
-    ID3D10Blob *signature;
-    result = D3D12SerializeRootSignature(&rootSig_desc, D3D_ROOT_SIGNATURE_VERSION_1, &signature, nullptr);
-    if (FAILED(result))
-    {
-        return false;
-    }
+    //The pso cache hashes root signatures by their serialized blob, the pointer changes every run. The root signature cache registers every blob with it
+    root_signature_cache_init(renderer_root_signature_cache, renderer_device, "DirectX12RenderDemo/shader_cache", &renderer_pso_cache);
+    pso_cache_init(renderer_pso_cache, renderer_device, "DirectX12RenderDemo/shader_cache/pipelines.bin");
 
-    result = renderer_device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&renderer_rootsig));
-    if (FAILED(result))
+    //create the root signature
+    if (!renderer_create_root_signature(&renderer_rootsig))
     {
         return false;
     }
+    OutputDebugStringA(root_signature_cache_summary(renderer_root_signature_cache).c_str());
 
     // -- Compiling vertex and pixel shaders -- //
     /*
         When creating a shader you msut provide a pointer to an ID3DBlob containing the sahder bytecode. When debugging, you want to compile the shaader files during runtime to catch any errors
         in the shader. We can compile shader code at runtime using the td3dcompilefromfile function. This function compiles the shader code to shader bytecode and stores it in an Id3dblob object.
         When you release you want to compile the shader to to compiled shader object files and load those raather than compiling shader code during runtime at initialization.
+        renderer_compile_shader() does a bit of both: it keeps the bytecode of every shader it compiles on disk and only calls d3dcompilefromfile again when the source,
+        its includes or any of the options below changed (see shader_cache.h).
         1. filename that contains the shader code
         2. an array of shader macro structures that define shader macros. set to nullptr if not shaders are used
         3. a pointer to an include interface which is used to handle #includes in the shader code. 
@@ -687,43 +1243,63 @@ bool renderer_init()
     GetCurrentDirectoryA(256, buf);
     OutputDebugStringA(buf);
 
-    ID3DBlob *shader_vertex; //vertex shader bytecode
-    ID3DBlob *shader_error;  //vertex shader bytecode
-    result = D3DCompileFromFile(L"DirectX12RenderDemo/vertex.hlsl",
-                                nullptr,
-                                nullptr,
-                                "main",
-                                "vs_5_0",
-                                D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
-                                0,
-                                &shader_vertex,
-                                &shader_error);
-    if (FAILED(result))
+    shader_cache_init(renderer_shader_cache, "DirectX12RenderDemo/shader_cache");
+
+    //Bindless shaders index arrays of resources of unknown size, that needs shader model 5.1
+    const D3D_SHADER_MACRO bindless_defines[] = {{"BINDLESS", "1"}, {nullptr, nullptr}};
+    const D3D_SHADER_MACRO *shader_defines = renderer_bindless ? bindless_defines : nullptr;
+
+    //One vertex shader variant per vertex format, each format says what it needs defined (see vertex_format.h)
+    ID3DBlob *shader_vertex[VERTEX_FORMAT_COUNT]; //vertex shader bytecode
+    ID3DBlob *shader_error;                       //vertex shader bytecode
+    D3D12_SHADER_BYTECODE shader_vertex_bytecode[VERTEX_FORMAT_COUNT] = {};
+    for (int format = 0; format < VERTEX_FORMAT_COUNT; ++format)
     {
-        return false;
-    }
+        D3D_SHADER_MACRO vertex_defines[3] = {};
+        int define_count = 0;
+        if (renderer_bindless)
+        {
+            vertex_defines[define_count++] = bindless_defines[0];
+        }
+        if (vertex_format_desc((VertexFormat)format).shader_define)
+        {
+            vertex_defines[define_count++] = {vertex_format_desc((VertexFormat)format).shader_define, "1"};
+        }
 
-    //Fill out the shader bytecode structure which is just a pointer to the shader bytecode and the size of the shader bytecode
-    D3D12_SHADER_BYTECODE shader_vertex_bytecode = {};
-    shader_vertex_bytecode.BytecodeLength = shader_vertex->GetBufferSize();
-    shader_vertex_bytecode.pShaderBytecode = shader_vertex->GetBufferPointer();
+        result = renderer_compile_shader("DirectX12RenderDemo/vertex.hlsl",
+                                         define_count ? vertex_defines : nullptr,
+                                         "main",
+                                         renderer_bindless ? "vs_5_1" : "vs_5_0",
+                                         D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
+                                         &shader_vertex[format],
+                                         &shader_error);
+        if (FAILED(result))
+        {
+            return false;
+        }
+
+        //Fill out the shader bytecode structure which is just a pointer to the shader bytecode and the size of the shader bytecode
+        shader_vertex_bytecode[format].BytecodeLength = shader_vertex[format]->GetBufferSize();
+        shader_vertex_bytecode[format].pShaderBytecode = shader_vertex[format]->GetBufferPointer();
+    }
 
     //compile pixel shader
     ID3DBlob *shader_pixel; //vertex shader bytecode
-    result = D3DCompileFromFile(L"DirectX12RenderDemo/pixel.hlsl",
-                                nullptr,
-                                nullptr,
-                                "main",
-                                "ps_5_0",
-                                D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
-                                0,
-                                &shader_pixel,
-                                &shader_error);
+    result = renderer_compile_shader("DirectX12RenderDemo/pixel.hlsl",
+                                     shader_defines,
+                                     "main",
+                                     renderer_bindless ? "ps_5_1" : "ps_5_0",
+                                     D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
+                                     &shader_pixel,
+                                     &shader_error);
     if (FAILED(result))
     {
         return false;
     }
 
+    //How much the cache saved us, shows up in the debugger's output window
+    OutputDebugStringA(shader_cache_summary(renderer_shader_cache).c_str());
+
     //Fill out the shader bytecode structure which is just a pointer to the shader bytecode and the size of the shader bytecode
     D3D12_SHADER_BYTECODE shader_pixel_bytecode = {};
     shader_pixel_bytecode.BytecodeLength = shader_pixel->GetBufferSize();
@@ -748,19 +1324,19 @@ bool renderer_init()
         We can get the size / number of elements of an array in c++ by using the sizeof(array) and divide that by the sizeof element to get the elemetns isnsde. 
     */
 
-    //Creating the input layout
-    D3D12_INPUT_ELEMENT_DESC rendererer_layout[] =
-        {
-            {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
-            {"COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
-        };
+    //Creating the input layouts, one per vertex format. The float one is
+    //    {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
+    //    {"COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
+    //renderer_input_layout() fills them out from the format's VertexFormatDesc
+    D3D12_INPUT_ELEMENT_DESC rendererer_layout[VERTEX_FORMAT_COUNT][2];
 
-    // fill out an input layout description structure
-    D3D12_INPUT_LAYOUT_DESC renderer_input_layout_Desc = {};
-
-    // We get the number of elemeents in an array by sizeof(array) / sizeof(arrayelementtype)
-    renderer_input_layout_Desc.NumElements = sizeof(rendererer_layout) / sizeof(D3D12_INPUT_ELEMENT_DESC);
-    renderer_input_layout_Desc.pInputElementDescs = rendererer_layout;
+    // fill out an input layout description structure for each of them
+    D3D12_INPUT_LAYOUT_DESC renderer_input_layout_Desc[VERTEX_FORMAT_COUNT] = {};
+    for (int format = 0; format < VERTEX_FORMAT_COUNT; ++format)
+    {
+        renderer_input_layout_Desc[format].NumElements = renderer_input_layout(vertex_format_desc((VertexFormat)format), rendererer_layout[format]);
+        renderer_input_layout_Desc[format].pInputElementDescs = rendererer_layout[format];
+    }
 
     // -- Creating a Pipeline State Object PSO -- //
     /*
@@ -785,16 +1361,14 @@ bool renderer_init()
         17. NOT REQUIRED: an array of dxgi format enums explaining the format of each depth/stencil buffer. must be the same format as the depth stencil buffers used
         18. REQUIRED: the sample coutn and quality for multi-sampling 
         19. NOT REQUIRED: a bit mask saying which gpu adapter to use, we are only using one gpu so this is zero
-        20. NOT REQUIRED: a way to cache PSO's into files
+        20. NOT REQUIRED: a way to cache PSO's into files (a cached blob). We use a pipeline library instead, see pso_cache.h
         21. NOT REQUIRED: a way to put debug info into the pipeline stat object
     */
 
     // Create a pipeline state object
 
     D3D12_GRAPHICS_PIPELINE_STATE_DESC pso_desc = {};
-    pso_desc.InputLayout = renderer_input_layout_Desc;
     pso_desc.pRootSignature = renderer_rootsig;
-    pso_desc.VS = shader_vertex_bytecode;
     pso_desc.PS = shader_pixel_bytecode;
     pso_desc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
     pso_desc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -804,12 +1378,18 @@ bool renderer_init()
     pso_desc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
     pso_desc.NumRenderTargets = 1;
 
-    //create the pso
-    result = renderer_device->CreateGraphicsPipelineState(&pso_desc, IID_PPV_ARGS(&renderer_pipeline));
-    if (FAILED(result))
+    //create a pso per vertex format, or get it from the cache if an equal desc was created before (this run or, through the pipeline library, an earlier one)
+    for (int format = 0; format < VERTEX_FORMAT_COUNT; ++format)
     {
-        return false;
-    }
+        pso_desc.InputLayout = renderer_input_layout_Desc[format];
+        pso_desc.VS = shader_vertex_bytecode[format];
+        result = pso_cache_get(renderer_pso_cache, pso_desc, &renderer_pipelines[format]);
+        if (FAILED(result))
+        {
+            return false;
+        }
+    }
+    OutputDebugStringA(pso_cache_summary(renderer_pso_cache).c_str());
 
     // -- Creating a vertex Buffer -- //
     /*
@@ -820,6 +1400,10 @@ bool renderer_init()
         and it is the way we will do it.
 
         We create a list of vertices and store them in the vList array. Here we reate 3 vertices, defined already in view sapce which make up a triangle
+        The default heap memory does not get created for just this buffer. A committed resource would get a heap of its own, at least 64 KB, for every buffer.
+        Instead we create a few big heaps and place resources in them, heap_allocator.h keeps track of which parts of them are in use, and
+        renderer_create_placed_resource() asks it for a spot and calls CreatePlacedResource with the heap and the offset.
+        The upload buffer below is still a committed resource, there is only one of it and it lives as long as the renderer.
         to create a resource heap we use the create commited resource method of the device interface
         1. A structure defining the heap properties we will use a helper struc to create the type of heap we want
         2. A heap flag enumeration. WE will not have any flags
@@ -833,22 +1417,22 @@ bool renderer_init()
 
 
         We can set the name of the heap usign the setname method of the interface. This is useful for graphics debugging.
-        Once we create a vertex buffer (list of vertices ) we create an upload it to the default heap. The upload heap is used to upload the vertex buffer to the gpu so we can copy the data
+        Once we create a vertex buffer (list of vertices ) we upload it to the default heap. The upload heap is used to upload the vertex buffer to the gpu so we can copy the data
         to the default heap which will stay in memory until we either overwrite or release it
+
+        We do not create an upload heap just for this. Assets like this vertex buffer go through the upload manager (upload_manager.h):
+        it writes them into big staging blocks, which are upload heaps, and records the copies for many of them at once on a copy queue of its own.
         
-        WE can copy the data from the upload heap to the default heap using the update subresources function
-        1. This is the command list we will use to creat thsi command which will copy the contents oft he upload heap to the defualt heap
-        2. This is the destination of the coy command. in our case it will be the default heap but it could bea readback hap
-        3. This is where we will copy the data from. here the upload heap but could also be default heap
-        4. number of bytes we want to offeset the start from. We want the whole vertex buffer to be copied so we will not offset at all
-        5. The index of the first subresource to start copying. Only have one so this will be zero
-        6. number of subresources we want to copy. We only have one so we set this to 1
-        7. Pointer to a d3d12 subresource data structue. This struc contains a pointer to the memory where our data is and the size in bytes of the resource
-
-        Once we create a copy command our command list stores it in its command allocator. waiting to be executed. Before we can use the vertex buffer stored in the default heap we must
-        make sure it is finished uploading and copying to the default heap
-        we close the command list tehn execuite it with the command queue we increment the fence value for this frame and tell the command queue to increment the fence on the gpu side.
-        Incrementing a fence is again a command which will ge exectued once the command list finish executing
+        The copies are copy buffer region commands
+        1. This is the destination of the coy command. in our case it will be the default heap but it could bea readback hap
+        2. the offset in the destination, we copy to the start
+        3. This is where we will copy the data from. here the staging block but could also be default heap
+        4. the offset of our piece in the staging block
+        5. number of bytes to copy
+
+        Before we can use the vertex buffer stored in the default heap we must make sure it is finished uploading and copying to the default heap.
+        The copy queue signals its own fence after every batch and the upload manager hands us that value as a ticket. We do not wait for it on the cpu,
+        the direct queue is told to wait for it (ID3D12CommandQueue::Wait) before it runs the command list that uses the vertex buffer, and the cpu goes on
 
         After we execute the copy command and set the fence we need to fill out the vertex buffer view. This isa d3d12 vertex buffer view. 
     */
@@ -856,76 +1440,125 @@ bool renderer_init()
     // Create the vertex buffer
 
     //a triangle
-    Vertex vertex_list[] = {
+    Mesh triangle;
+    triangle.vertices = {
         { 0.0f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f },
         { 0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f },
         { -0.5f, -0.5f, 0.5f, 0.0f, 1.0f, 1.0f, 1.0f },
     };
+    triangle.indices = { 0, 1, 2 };
+
+    //or whatever the benchmark scenario draws in its place
+    if (renderer_scene_mesh)
+    {
+        triangle = *renderer_scene_mesh;
+    }
+
+    //reorder it for the vertex cache, overdraw and vertex fetch before anything is uploaded (see mesh_optimizer.h). One triangle stays as it is,
+    //but every mesh goes through the same steps
+    mesh_optimize(triangle);
+
+    //then pick the smallest vertex format that is exact enough and convert it. The format decides which pso draws it
+    triangle.vertex_format = vertex_format_choose(triangle.vertices.data(), triangle.vertices.size(), renderer_vertex_tolerance);
+    VertexBufferData vertex_data;
+    vertex_format_encode(triangle.vertices.data(), triangle.vertices.size(), triangle.vertex_format, vertex_data);
+    renderer_vertex_format = vertex_data.format;
+    renderer_vertex_dequantization = vertex_data.dequantization;
+
+    int vertex_buffer_size = (int)vertex_data.data.size();
 
-    int vertex_buffer_size = sizeof(vertex_list);
+    //What every frame writes into the upload ring: its constants, and with -dynamic-vertices the vertices too
+    UINT64 frame_bytes = sizeof(FrameConstants);
+    if (renderer_dynamic_vertices)
+    {
+        renderer_vertex_data = vertex_data.data;
+        frame_bytes += vertex_buffer_size + D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+    }
+    if (!renderer_upload_ring_init(frame_bytes))
+    {
+        return false;
+    }
+
+    //the heaps are only created once something is placed in them
+    heap_allocator_init(renderer_buffer_heaps, renderer_heap_size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
+                        [](uint64_t size) { return renderer_create_heap(size, D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS); },
+                        [](void *heap) { ((ID3D12Heap *)heap)->Release(); });
+    heap_allocator_init(renderer_texture_heaps, renderer_heap_size, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT,
+                        [](uint64_t size) { return renderer_create_heap(size, D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES); },
+                        [](void *heap) { ((ID3D12Heap *)heap)->Release(); });
 
-    //create default heap
+    //create the vertex buffer in a default heap
     //default heapa is memory on the gpu only the gpu has accessto this memory.
     //to get data into this heap we will have to upload the data using an upload heap
+    //it starts out in the common state, the only one a copy queue can write to it in
     {
-		CD3DX12_HEAP_PROPERTIES heap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
 		CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(vertex_buffer_size);
-		renderer_device->CreateCommittedResource(&heap,
-												  D3D12_HEAP_FLAG_NONE,
-												  &desc,
-												  D3D12_RESOURCE_STATE_COPY_DEST,
-												  nullptr,
-												  IID_PPV_ARGS(&renderer_vertexBuffer));
+		result = renderer_create_placed_resource(renderer_buffer_heaps, desc, D3D12_RESOURCE_STATE_COMMON, &renderer_vertexBuffer, renderer_vertexBuffer_allocation);
+        if (FAILED(result))
+        {
+            return false;
+        }
     }
 
     renderer_vertexBuffer->SetName(L"Vertex Buffer Resource Heap");
 
-    //create upload heap
-    //used to upload data to teh gpu, cpu can write and gpu can read
-    //we upload the vertex buffer using this heap
-    ID3D12Resource *buffer_vertex_upload_heap;
+    //Hand the vertices to the upload manager. They are copied into a staging block before it returns, the copy queue copies them into the
+    //vertex buffer with the next batch and the ticket tells us when that is done
+    UploadTicket vertex_upload = upload_manager_buffer(renderer_upload_manager, renderer_vertexBuffer, 0, vertex_data.data.data(), vertex_buffer_size);
+    if (!vertex_upload.fence_value)
     {
-		CD3DX12_HEAP_PROPERTIES heap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-		CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(vertex_buffer_size);
-		renderer_device->CreateCommittedResource(&heap,
-												 D3D12_HEAP_FLAG_NONE,
-												 &desc,
-												 D3D12_RESOURCE_STATE_GENERIC_READ,
-												 nullptr,
-												 IID_PPV_ARGS(&buffer_vertex_upload_heap));
+        return false;
     }
-    
-    buffer_vertex_upload_heap->SetName(L"Vertex Buffer Upload Resource Heap");
+    renderer_upload_require(vertex_upload);
 
-    //Store vertex buffer in upload heap[
-    D3D12_SUBRESOURCE_DATA vertex_data = {};
-    vertex_data.pData       = reinterpret_cast<BYTE*>(vertex_list);
-    vertex_data.RowPitch    = vertex_buffer_size;
-    vertex_data.SlicePitch  = vertex_buffer_size;
+    //The copy leaves the vertex buffer in the common state and it has to be in vertex buffer state before the first frame. This is the
+    //first time the init command list uses it, so the tracker only keeps the transition as pending and records nothing here.
+    //pipeline_close() below resolves it against the registry and records the barrier into command_list_barrier, which the direct
+    //queue only runs once the copy queue is done with the upload
+    ResourceStateTracker &tracker = renderer_state_trackers[0];
+    resource_state_transition(tracker, renderer_vertexBuffer, resource_all_subresources, resource_state_vertex_and_constant_buffer);
 
-    //We now create a command with the command list to copy data from.
-    UpdateSubresources(command_list, renderer_vertexBuffer, buffer_vertex_upload_heap, 0, 0, 1, &vertex_data);
-
-    //transition the vertex buffer dat from copy destination state to vertex buffer state
-    CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(renderer_vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
-    command_list->ResourceBarrier(1, &barrier);
+    //The indices go up the same way, packed to 16 bit since three vertices do not need more
+    if (!renderer_create_index_buffer(triangle.indices.data(), (UINT)triangle.indices.size(), (UINT)triangle.vertices.size(), tracker))
+    {
+        return false;
+    }
 
-    //now we execute the command list to upload the initial assets
-    command_list->Close();
-    ID3D12CommandList *p_command_lists[] = { command_list };
-    command_queue->ExecuteCommandLists(_countof(p_command_lists), p_command_lists);
+    //The bindless materials too, all of it ends up in one batch on the copy queue
+    if (renderer_bindless && !renderer_create_materials(tracker))
+    {
+        return false;
+    }
 
-    // increment the fence value now, otherwise the buffer might not be uploaded by the time we start drawing
-    renderer_fence_value[frame_index]++;
-    result = command_queue->Signal(renderer_fence[frame_index], renderer_fence_value[frame_index]);
-    if (FAILED(result)){
-        running = false;
+    //now we execute the command list with the barriers that make the initial assets usable
+    bool barrier_list_used;
+    result = pipeline_close(1, barrier_list_used);
+    if (FAILED(result))
+    {
+        return false;
+    }
+    if (!renderer_upload_sync())
+    {
+        return false;
     }
+    ID3D12CommandList *p_command_lists[] = { command_list_barrier, command_lists[0] };
+    command_queue->ExecuteCommandLists(barrier_list_used ? 2 : 1, barrier_list_used ? p_command_lists : p_command_lists + 1);
+
+    // signal the timeline after the barriers. The queue runs in order so the first frame's draw can only start after them,
+    // but the command list was recorded into the first frame context's allocator, so that context has to wait for this value before it is reset
+    //If the signal failed nothing would ever tell us when the gpu is done with that allocator
+    uint64_t fence_value = frame_ring_signal(renderer_frame_ring);
+    if (fence_value == 0)
+    {
+        return false;
+    }
+    renderer_frame_ring.frame_fence[0] = fence_value;
 
     // create a vertex buffer view for the triangle
     renderer_vertexBuffer_view.BufferLocation = renderer_vertexBuffer->GetGPUVirtualAddress();
-    renderer_vertexBuffer_view.StrideInBytes  = sizeof(Vertex);
+    renderer_vertexBuffer_view.StrideInBytes  = vertex_data.stride;
     renderer_vertexBuffer_view.SizeInBytes    = vertex_buffer_size;
+    renderer_frame_vertex_view = renderer_vertexBuffer_view;
 
     //Fill out viewport
     // The viewport will cover our entire  render target. commonly depth is between 0.0 and 1.0 in the screen space. The viewport will stretch the scene from viewpsace to screen space
@@ -942,12 +1575,25 @@ bool renderer_init()
     renderer_scissorRect.right  = width;
     renderer_scissorRect.bottom = height;
 
+    //Everything the frame uses exists now, describe the frame
+    if (!renderer_build_frame_graph())
+    {
+        return false;
+    }
+
     return true;
 }
 
+//Currently does nothing either, keys and window sizes will end up in the engine's state here. Runs on the simulation thread like general_update()
+void general_event(const AppEvent &event)
+{
+    (void)event;
+}
+
 //Currently does nothing, but we will add logic to this function that can run while the gpu is executign a command queue. We could have changed the render target color here if we wanted to change each frame
 void general_update()
 {
+    PROFILE_SCOPE("general_update");
 }
 
 //This function is where we will add command to the command list.
@@ -955,8 +1601,10 @@ void general_update()
 //Setting the root signature
 //Clearing the render target
 //Here we will be setting vertex buffers and calling draw in this function
-void pipeline_update()
+//The allocators are reset early on, so if anything after that fails the lists hold nothing valid and the frame must not be executed
+bool pipeline_update()
 {
+    PROFILE_SCOPE("pipeline_update");
     HRESULT result;
 
     /*
@@ -973,15 +1621,142 @@ void pipeline_update()
     */
 
     //We have to wait fro the gpu to finish with the command allocator before we reset it
-    renderer_wait();
+    //If the wait failed the gpu may still be using it, so nothing is reset or recorded
+    if (!renderer_wait())
+    {
+        return false;
+    }
 
-    //We can only reset an allocator once the gpu is done with it
+    //The upload ring has room again for what the finished frames wrote, this frame's constants go in first
+    if (!renderer_stream_frame_data())
+    {
+        return false;
+    }
+
+    //We can only reset an allocator once the gpu is done with it, renderer_wait() just made sure of that for every thread's allocator of this frame context
     //Resetting an allocator frees the memory that the command list was stored in
-    result = command_allocators[frame_index]->Reset();
+    for (int thread = 0; thread < renderer_record_threads; ++thread)
+    {
+        result = command_allocators[frame_context][thread]->Reset();
+        if (FAILED(result))
+        {
+            return false;
+        }
+    }
+    result = command_allocators_barrier[frame_context]->Reset();
     if (FAILED(result))
     {
-        running = false;
+        return false;
+    }
+
+    //The graph needs to know which back buffer this frame draws to before anyone records
+    render_graph_set_physical(renderer_frame_graph, renderer_graph_back_buffer, renderer_targets[frame_index]);
+
+    //Bindless: this frame's copy of every material view, in one CopyDescriptors call. Draws index it with renderer_material_base + their material
+    if (renderer_bindless)
+    {
+        D3D12_CPU_DESCRIPTOR_HANDLE sources[renderer_material_count];
+        for (UINT i = 0; i < renderer_material_count; ++i)
+        {
+            sources[i] = renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, renderer_material_cbvs[i]);
+        }
+        DescriptorTable materials;
+        if (!renderer_descriptor_table(sources, renderer_material_count, materials))
+        {
+            return false;
+        }
+        renderer_material_base = materials.index;
+    }
+
+    //Every thread records its own command list with its own allocator, so they do not have to wait on each other
+    HRESULT record_results[record_threads_max];
+    job_parallel_for(renderer_record_threads, 1, [&record_results](int thread) { record_results[thread] = pipeline_record(thread); });
+    for (int thread = 0; thread < renderer_record_threads; ++thread)
+    {
+        if (FAILED(record_results[thread]))
+        {
+            return false;
+        }
+    }
+
+    //Only now that every list is recorded do we know which barriers have to go between them
+    result = pipeline_close(renderer_record_threads, renderer_barrier_list_used);
+    return SUCCEEDED(result);
+}
+
+HRESULT pipeline_close(int count, bool &barrier_list_used)
+{
+    /*
+        Each recording thread had its own state tracker, and a tracker only knows the state of a resource after its list transitioned it.
+        The state the list needs a resource in at its start was left pending. Now the lists are going to the queue in thread order, so we can
+        compare those with the state the lists before left the resources in (resource_state_resolve() does that) and record the barriers at the end
+        of the list before. The lists are still open, pipeline_record() does not close them. The first list has no list before it this frame, its
+        barriers go into command_list_barrier, which is executed in front of it.
+    */
+    HRESULT result = S_OK;
+    std::vector<ResourceTransition> barriers;
+    barrier_list_used = false;
+    for (int thread = 0; thread < count; ++thread)
+    {
+        barriers.clear();
+        if (resource_state_resolve(renderer_resource_states, renderer_state_trackers[thread], barriers))
+        {
+            if (thread == 0)
+            {
+                result = command_list_barrier->Reset(command_allocators_barrier[frame_context], nullptr);
+                if (FAILED(result))
+                {
+                    return result;
+                }
+                {
+                    GpuTimerScope timer(renderer_gpu_timer, command_list_barrier, "gpu: barriers");
+                    renderer_record_barriers(command_list_barrier, barriers.data(), (int)barriers.size());
+                }
+                result = command_list_barrier->Close();
+                if (FAILED(result))
+                {
+                    return result;
+                }
+                barrier_list_used = true;
+            }
+            else
+            {
+                GpuTimerScope timer(renderer_gpu_timer, command_lists[thread - 1], "gpu: barriers");
+                renderer_record_barriers(command_lists[thread - 1], barriers.data(), (int)barriers.size());
+            }
+        }
+
+        //Recording errors show up here, see pipeline_record()
+        if (thread > 0)
+        {
+            result = command_lists[thread - 1]->Close();
+            if (FAILED(result))
+            {
+                return result;
+            }
+        }
+    }
+    //Every timestamp of the frame is recorded now, the last list resolves them into this frame context's part of the readback buffer
+    gpu_timer_end_frame(renderer_gpu_timer, command_lists[count - 1]);
+    return command_lists[count - 1]->Close();
+}
+
+void renderer_record_barriers(ID3D12GraphicsCommandList *command_list, const ResourceTransition *transitions, int count)
+{
+    std::vector<D3D12_RESOURCE_BARRIER> barriers(count);
+    for (int i = 0; i < count; ++i)
+    {
+        barriers[i] = CD3DX12_RESOURCE_BARRIER::Transition((ID3D12Resource *)transitions[i].resource, (D3D12_RESOURCE_STATES)transitions[i].before,
+                                                           (D3D12_RESOURCE_STATES)transitions[i].after, transitions[i].subresource);
     }
+    command_list->ResourceBarrier(count, barriers.data());
+}
+
+HRESULT pipeline_record(int thread)
+{
+    PROFILE_SCOPE("pipeline_record");
+    HRESULT result;
+    ID3D12GraphicsCommandList *command_list = command_lists[thread];
 
     /*
         Reset the command list
@@ -993,10 +1768,10 @@ void pipeline_update()
         Here you will pass an initial pipeline state object as the second parameter
         In the tutorial we are onyl clearing the rtv and do not need anything but an initial default pipeline, which is what we get by setting the second parameter to null
     */
-    result = command_list->Reset(command_allocators[frame_index], renderer_pipeline);
+    result = command_list->Reset(command_allocators[frame_context][thread], renderer_pipelines[VERTEX_FORMAT_FLOAT]);
     if (FAILED(result))
     {
-        running = false;
+        return result;
     }
 
     /*
@@ -1017,8 +1792,8 @@ void pipeline_update()
         So the swap chain can present it
         We want to clear the render target
         So we get a handle to the render target
-        We use the descriptor handle structure and provide it with the first description in the rtv heap the index of the current frame and the size of each rtv descriptor
-        basically get a pointer to the beginning of the descriptor heap and then increment taht pointer frame index times rtv descriptor size
+        We ask the rtv pool for the handle of the current back buffer's rtv (renderer_descriptor_cpu())
+        basically get a pointer to the beginning of the descriptor heap and then increment taht pointer the rtv's index times rtv descriptor size
         Once we hava descriptor handle we need to set the current render target to be the output of the ouput merger, 
         1. number of redner target descriptor handles
         2. a pointer to an array of render target descriptor handles
@@ -1039,55 +1814,158 @@ void pipeline_update()
         Once we are finished with recording our commands, we need to close the command list. If we do not close it before we try to execute it the application will break. 
         Another note on closing: if you do something ilegal during hte command list your program will continue to run until you call close where it will fail. You must enable the debug layer
         in order to see what exactly failed when calling close. 
+
+        We do not write the barriers by hand though. Every command list has a resource state tracker (see resource_state.h): we tell it the state we need
+        the render target in and it records a barrier only if the target is not in that state already, all of a pass's barriers in one ResourceBarrier call.
+
+        With several recording threads the lists are executed in thread order, so only the first one clears the render target and only the last
+        one transitions it back to present. Every list asks for the render target state, only the first one gets a barrier for it, which pipeline_close()
+        works out once all of them are recorded. It also closes the lists, so this function does not.
+        No state carries over between command lists, so each of them sets the render target and the rest of the pipeline state itself.
+
+        What gets recorded is not written out here anymore, the frame is a render graph (renderer_build_frame_graph()) and the passes record themselves.
     */
 
     // Here we start recordign commands into the commandlist (which all the commands will be stored in the command allocator
 
-    //transition the frame index render target from the present state to the render target state, so the command list draws it starting from here
+    //The frame is a render graph (see renderer_build_frame_graph()): it runs the passes in order and transitions what each pass uses through the
+    //thread's state tracker, the last list also hands the render target back in the present state.
+    //If the debug layer is enabled you receive a warning if present is called on a render target taht is not in the present state
+    ResourceStateTracker &tracker = renderer_state_trackers[thread];
+    resource_state_tracker_reset(tracker);
+    auto flush = [command_list](const ResourceTransition *transitions, int count) {
+        GpuTimerScope timer(renderer_gpu_timer, command_list, "gpu: barriers");
+        renderer_record_barriers(command_list, transitions, count);
+    };
+    auto alias = [command_list](void *before, void *after) {
+        CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Aliasing((ID3D12Resource *)before, (ID3D12Resource *)after);
+        command_list->ResourceBarrier(1, &barrier);
+    };
+    render_graph_execute(renderer_frame_graph, tracker, flush, alias, thread, renderer_record_threads);
+
+    return S_OK;
+}
+
+bool renderer_build_frame_graph()
+{
+    /*
+        The passes say what they read and write, the graph orders them, drops the ones nobody needs and works out the barriers (see render_graph.h).
+        The back buffer and the vertex and index buffers live outside the graph so they are imported, the back buffer changes every frame so pipeline_update()
+        tells the graph which one it is. This frame has no transient targets yet, once it does the graph places them in one heap where they share memory, and records
+        the passes from the first one that uses them on the last command list (see render_graph_execute()).
+    */
+    render_graph_reset(renderer_frame_graph);
+    renderer_graph_back_buffer = render_graph_import(renderer_frame_graph, "back buffer", nullptr, resource_state_present, resource_state_present);
+    RenderGraphHandle vertex_buffer = render_graph_import(renderer_frame_graph, "vertex buffer", renderer_vertexBuffer, resource_state_vertex_and_constant_buffer,
+                                                          resource_state_vertex_and_constant_buffer);
+
+    int clear = render_graph_add_pass(renderer_frame_graph, "clear", renderer_pass_clear);
+    RenderGraphHandle cleared = render_graph_write(renderer_frame_graph, clear, renderer_graph_back_buffer, resource_state_render_target);
+
+    RenderGraphHandle index_buffer = render_graph_import(renderer_frame_graph, "index buffer", renderer_indexBuffer, resource_state_index_buffer, resource_state_index_buffer);
+
+    int triangles = render_graph_add_pass(renderer_frame_graph, "triangles", renderer_pass_triangles);
+    render_graph_read(renderer_frame_graph, triangles, vertex_buffer, resource_state_vertex_and_constant_buffer);
+    render_graph_read(renderer_frame_graph, triangles, index_buffer, resource_state_index_buffer);
+    if (renderer_bindless)
     {
-		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(renderer_targets[frame_index], D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET);
-		command_list->ResourceBarrier(1, &barrier);
+        RenderGraphHandle materials = render_graph_import(renderer_frame_graph, "materials", renderer_material_buffer, resource_state_vertex_and_constant_buffer,
+                                                          resource_state_vertex_and_constant_buffer);
+        render_graph_read(renderer_frame_graph, triangles, materials, resource_state_vertex_and_constant_buffer);
     }
+    render_graph_output(renderer_frame_graph, render_graph_write(renderer_frame_graph, triangles, cleared, resource_state_render_target));
+
+    if (!render_graph_compile(renderer_frame_graph))
+    {
+        OutputDebugStringA(("render graph: " + renderer_frame_graph.error + "\n").c_str());
+        return false;
+    }
+    OutputDebugStringA(render_graph_report(renderer_frame_graph).c_str());
+    return true;
+}
+
+void renderer_pass_clear(int thread, int share, int)
+{
+    //The lists run in thread order, so only the first share clears
+    if (share != 0)
+    {
+        return;
+    }
+
+    ID3D12GraphicsCommandList *command_list = command_lists[thread];
 
     // here we again get the handle to our current render target view so we can set it as the render target in the output merger state of the pipeline
-    CD3DX12_CPU_DESCRIPTOR_HANDLE handle_rtv(descriptorheap_rtv->GetCPUDescriptorHandleForHeapStart(), frame_index, descriptorSize_rtv);
+    D3D12_CPU_DESCRIPTOR_HANDLE handle_rtv = renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE_RTV, renderer_target_rtvs[frame_index]);
 
     // Set the render target for the output merger stage (the ouput of the pipeline)
     command_list->OMSetRenderTargets(1, &handle_rtv, FALSE, nullptr);
 
     //Clear the render target by using the ClearRenderTargetView command
+    GpuTimerScope timer(renderer_gpu_timer, command_list, "gpu: clear");
     const float clearColor[] = {0.0f, 0.2f, 0.4f, 1.0f};
     command_list->ClearRenderTargetView(handle_rtv, clearColor, 0, nullptr);
+}
+
+void renderer_pass_triangles(int thread, int share, int share_count)
+{
+    ID3D12GraphicsCommandList *command_list = command_lists[thread];
+    GpuTimerScope timer(renderer_gpu_timer, command_list, "gpu: triangles");
 
-    //Drawing a triangle
+    // No state carries over between command lists, so every thread sets the render target itself
+    D3D12_CPU_DESCRIPTOR_HANDLE handle_rtv = renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE_RTV, renderer_target_rtvs[frame_index]);
+    command_list->OMSetRenderTargets(1, &handle_rtv, FALSE, nullptr);
+
+    //Drawing a triangle, with the pso that reads its vertex format
+    command_list->SetPipelineState(renderer_pipelines[renderer_vertex_format]);
     command_list->SetGraphicsRootSignature(renderer_rootsig);
+    command_list->SetGraphicsRootConstantBufferView(renderer_mesh_constants_parameter, renderer_frame_constants);
+    //Shaders see the shader visible ring, every descriptor table made with renderer_descriptor_table() points into it. Lists do not inherit it either
+    command_list->SetDescriptorHeaps(1, &renderer_shader_heap);
+    if (renderer_bindless)
+    {
+        //The whole heap is the table, set once. The draw only passes the index of its material
+        command_list->SetGraphicsRootDescriptorTable(1, renderer_shader_heap->GetGPUDescriptorHandleForHeapStart());
+        command_list->SetGraphicsRoot32BitConstant(0, renderer_material_base + (UINT)share % renderer_material_count, 0);
+    }
     command_list->RSSetViewports(1, &renderer_viewport);
     command_list->RSSetScissorRects(1, &renderer_scissorRect);
     command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    command_list->IASetVertexBuffers(0, 1, &renderer_vertexBuffer_view);
-    command_list->DrawInstanced(3,1,0,0);
-
-    //Transition the frameindex render target from the render target state to the present state.
-    //If the debug layer is enabled you receive a warning if present is called on a render target taht is not in the present state
+    command_list->IASetVertexBuffers(0, 1, &renderer_frame_vertex_view);
+    command_list->IASetIndexBuffer(&renderer_indexBuffer_view);
+
+    //This thread's share of the draws and each draw's share of the instances. With one draw per thread every thread draws its share in one call
+    UINT draws = renderer_draw_calls > (UINT)share_count ? renderer_draw_calls : (UINT)share_count;
+    UINT draw_begin = (UINT)((UINT64)draws * share / share_count);
+    UINT draw_end = (UINT)((UINT64)draws * (share + 1) / share_count);
+    for (UINT draw = draw_begin; draw < draw_end; ++draw)
     {
-		CD3DX12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(renderer_targets[frame_index], D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT);
-		command_list->ResourceBarrier(1, &barrier);
+        UINT instance_begin = (UINT)((UINT64)renderer_draw_instances * draw / draws);
+        UINT instance_end = (UINT)((UINT64)renderer_draw_instances * (draw + 1) / draws);
+        if (instance_end > instance_begin)
+        {
+            command_list->DrawIndexedInstanced(renderer_index_count, instance_end - instance_begin, 0, 0, instance_begin);
+        }
     }
+}
 
-    result = command_list->Close();
-    if (FAILED(result))
+uint64_t renderer_barrier_total()
+{
+    uint64_t barriers = 0;
+    for (int thread = 0; thread < record_threads_max; ++thread)
     {
-        running = false;
+        barriers += renderer_state_trackers[thread].barriers;
     }
+    return barriers;
 }
 
 void renderer_render()
 {
+    PROFILE_SCOPE("renderer_render");
     /*
         First thing we do is update the pipeline, that is record the command list by calling the update pipeline function 
         once the command list has been recorded we create an array of our command lists
-        we conly have one command list but if we had multiple threads we would have a command list for each thread here we would organize our command list in the array in the order
-        we want to execute them
+        there is a command list for each recording thread, organized in the array in the order we want to execute them. Submitting them all in one ExecuteCommandLists
+        call is cheaper than one call per list
 
         we can execute command lists by calling execute command lists on the command queue and provide the number of command lists to execute and a pointer to the command list array
         1. number of command lists to execute
@@ -1101,39 +1979,93 @@ void renderer_render()
     */
     HRESULT result;
 
+    //What the cpu pays for the frame is recording and submitting it, without the time renderer_wait() spends waiting for the gpu
+    auto submit_start = std::chrono::steady_clock::now();
+    double waited = renderer_frame_ring.wait_seconds;
+    uint64_t barriers = renderer_barrier_total();
+
     //Update the pipeline by sending commands to the commandQueue
-    pipeline_update();
+    //If that failed the lists were reset and not recorded again, executing them is invalid, so nothing is executed or presented and we quit
+    if (!pipeline_update())
+    {
+        app_loop_request_quit(window_app);
+        return;
+    }
+    renderer_frame_barriers = renderer_barrier_total() - barriers;
+
+    //Create an array of command lists, one per recording thread, behind the barrier list if the first one needs it
+    ID3D12CommandList *command_temp_list[record_threads_max + 1];
+    int count = 0;
+    if (renderer_barrier_list_used)
+    {
+        command_temp_list[count++] = command_list_barrier;
+    }
+    for (int thread = 0; thread < renderer_record_threads; ++thread)
+    {
+        command_temp_list[count++] = command_lists[thread];
+    }
 
-    //Create an array of command lists (only one for us sadly)
-    ID3D12CommandList *command_temp_list[] = {command_list};
+    //hand this frame's uploads to the copy queue, and if the frame reads any of them have the direct queue wait for them first
+    //If one of those never makes it to the copy queue the frame would read garbage, so it is not executed either
+    if (!renderer_upload_sync())
+    {
+        app_loop_request_quit(window_app);
+        return;
+    }
 
     //execute the array of command lists
-    command_queue->ExecuteCommandLists(_countof(command_temp_list), command_temp_list);
-
-    //This command goes in at the end of our command queue. we will know when our command queeu has finished becasuse the fence value will be set to fenceValue from the GPU since the command
-    //queue is being executed on the GPU
-    result = command_queue->Signal(renderer_fence[frame_index], renderer_fence_value[frame_index]);
-    if (FAILED(result))
+    command_queue->ExecuteCommandLists(count, command_temp_list);
+    renderer_submit_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - submit_start).count() - (renderer_frame_ring.wait_seconds - waited);
+
+    //This command goes in at the end of our command queue. we will know when our command queeu has finished becasuse the fence will reach this frame's value
+    //The ring remembers it for the frame context we just used
+    //The descriptor tables the frame copied into the shader visible ring are freed once the gpu reaches the same value, and so is what it wrote into the upload ring
+    //If the signal failed we cannot tell when the gpu is done with this frame, so none of its memory is handed back and we quit
+    uint64_t fence_value = frame_ring_end(renderer_frame_ring);
+    if (fence_value == 0)
     {
-        running = false;
+        app_loop_request_quit(window_app);
+        return;
     }
+    descriptor_ring_end_frame(renderer_shader_ring, fence_value);
+    upload_ring_end_frame(renderer_upload_ring, fence_value);
 
     //present the current backbuffer
-    result = renderer_swapchain->Present(0, 0);
+    {
+        PROFILE_SCOPE("Present");
+        result = renderer_swapchain->Present(0, 0);
+    }
     if (FAILED(result))
     {
-        running = false;
+        app_loop_request_quit(window_app);
     }
 }
 
 //Just releases all the interface objects we have claimed. Before we release we want to make sure that the gpu has finished with everything before we start releasing things
 void renderer_cleanup()
 {
-    //Wait for the gpu to finish all frames
-    for (int i = 0; i < framebuffer_count; ++i)
+    //Wait for the gpu to finish all frames, the ring is only set up once the fence exists
+    //If that failed the device is most likely gone and nothing is running anymore, release everything anyway
+    if (renderer_frame_ring.queue && !frame_ring_flush(renderer_frame_ring))
+    {
+        OutputDebugStringA("renderer: waiting for the gpu failed, releasing everything anyway\n");
+    }
+
+    //How many barriers the state trackers recorded per frame, against how many transitions were asked for
+    uint64_t requested = 0, barriers = 0, flushes = 0;
+    for (int thread = 0; thread < record_threads_max; ++thread)
+    {
+        requested += renderer_state_trackers[thread].requested;
+        barriers += renderer_state_trackers[thread].barriers;
+        flushes += renderer_state_trackers[thread].flushes;
+    }
+    if (renderer_frame_ring.frame_number)
     {
-        frame_index = i;
-        renderer_wait();
+        double frames = (double)renderer_frame_ring.frame_number;
+        char line[256];
+        snprintf(line, sizeof(line), "state tracker: %.1f barriers per frame in %.1f ResourceBarrier calls, %.1f transitions asked for\n",
+                 barriers / frames, flushes / frames, requested / frames);
+        OutputDebugStringA(line);
     }
 
     //Get swapchain out of fullscreen before exiting
@@ -1143,65 +2075,638 @@ void renderer_cleanup()
         renderer_swapchain->SetFullscreenState(false, NULL);
     }
 
+    //The readback buffer is unmapped when it is released
+    gpu_timer_shutdown(renderer_gpu_timer);
+    SAFE_RELEASE(renderer_timestamp_heap);
+    SAFE_RELEASE(renderer_timestamp_readback);
+
+    //Waits for the copy queue to finish and releases the staging blocks
+    upload_manager_shutdown(renderer_upload_manager);
+    for (auto &allocator : renderer_copy_allocators)
+    {
+        SAFE_RELEASE(allocator.first);
+    }
+    renderer_copy_allocators.clear();
+    SAFE_RELEASE(renderer_copy_command_list);
+    SAFE_RELEASE(renderer_copy_queue);
+    SAFE_RELEASE(renderer_copy_fence);
+    if (renderer_copy_fence_event)
+    {
+        CloseHandle(renderer_copy_fence_event);
+        renderer_copy_fence_event = nullptr;
+    }
+
     SAFE_RELEASE(renderer_device);
     SAFE_RELEASE(renderer_swapchain);
     SAFE_RELEASE(command_queue);
-    SAFE_RELEASE(descriptorheap_rtv);
-    SAFE_RELEASE(command_list);
+    for (int type = 0; type < D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES; ++type)
+    {
+        SAFE_RELEASE(renderer_descriptor_heaps[type]);
+    }
+    SAFE_RELEASE(renderer_shader_heap);
 
     for (int i = 0; i < framebuffer_count; ++i)
     {
         SAFE_RELEASE(renderer_targets[i]);
-        SAFE_RELEASE(command_allocators[i]);
-        SAFE_RELEASE(renderer_fence[i]);
     }
 
-    SAFE_RELEASE(renderer_pipeline);
+    for (int thread = 0; thread < record_threads_max; ++thread)
+    {
+        SAFE_RELEASE(command_lists[thread]);
+        for (int i = 0; i < frame_ring_max_frames; ++i)
+        {
+            SAFE_RELEASE(command_allocators[i][thread]);
+        }
+    }
+    SAFE_RELEASE(command_list_barrier);
+    for (int i = 0; i < frame_ring_max_frames; ++i)
+    {
+        SAFE_RELEASE(command_allocators_barrier[i]);
+    }
+    render_graph_reset(renderer_frame_graph);
+    renderer_resource_states.resources.clear();
+    SAFE_RELEASE(renderer_fence);
+
+    //Save the pipelines created this run so the next start loads them instead of compiling
+    pso_cache_save(renderer_pso_cache);
+    pso_cache_shutdown(renderer_pso_cache);
+    for (int format = 0; format < VERTEX_FORMAT_COUNT; ++format)
+    {
+        SAFE_RELEASE(renderer_pipelines[format]);
+    }
     SAFE_RELEASE(renderer_rootsig);
-    SAFE_RELEASE(renderer_vertexBuffer);
+    root_signature_cache_shutdown(renderer_root_signature_cache);
+    renderer_release_placed_resource(renderer_buffer_heaps, &renderer_vertexBuffer, renderer_vertexBuffer_allocation);
+    SAFE_RELEASE(renderer_upload_buffer); // releasing unmaps it
+    renderer_release_placed_resource(renderer_buffer_heaps, &renderer_indexBuffer, renderer_indexBuffer_allocation);
+    if (renderer_material_buffer)
+    {
+        for (UINT i = 0; i < renderer_material_count; ++i)
+        {
+            descriptor_pool_free(renderer_descriptor_pools[D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV], renderer_material_cbvs[i]);
+        }
+        renderer_release_placed_resource(renderer_buffer_heaps, &renderer_material_buffer, renderer_material_buffer_allocation);
+    }
+    heap_allocator_shutdown(renderer_buffer_heaps);
+    heap_allocator_shutdown(renderer_texture_heaps);
+}
+
+void *renderer_create_heap(UINT64 size, D3D12_HEAP_FLAGS flags)
+{
+    //A default heap, the resources in it will only be used by the gpu
+    D3D12_HEAP_DESC desc = {};
+    desc.SizeInBytes = size;
+    desc.Properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+    desc.Alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+    desc.Flags = flags;
+
+    ID3D12Heap *heap = nullptr;
+    if (FAILED(renderer_device->CreateHeap(&desc, IID_PPV_ARGS(&heap))))
+    {
+        return nullptr;
+    }
+    heap->SetName(L"Placed Resource Heap");
+    return heap;
+}
+
+HRESULT renderer_create_placed_resource(HeapAllocator &heaps, const D3D12_RESOURCE_DESC &desc, D3D12_RESOURCE_STATES state, ID3D12Resource **resource, HeapAllocation &allocation)
+{
+    //The device tells us how big the resource is and how it has to be aligned (64 KB for buffers and most textures, 4 MB for msaa textures)
+    D3D12_RESOURCE_ALLOCATION_INFO info = renderer_device->GetResourceAllocationInfo(0, 1, &desc);
+    if (!heap_allocator_allocate(heaps, info.SizeInBytes, info.Alignment, nullptr, allocation))
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    HRESULT result = renderer_device->CreatePlacedResource((ID3D12Heap *)allocation.heap, allocation.offset, &desc, state, nullptr, IID_PPV_ARGS(resource));
+    if (FAILED(result))
+    {
+        heap_allocator_free(heaps, allocation);
+        allocation.heap_index = -1;
+        return result;
+    }
+
+    //Tell the state tracker what state it starts in
+    UINT subresources = desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER ? 1 : desc.MipLevels * (desc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE3D ? 1 : desc.DepthOrArraySize);
+    resource_state_register(renderer_resource_states, *resource, subresources, state);
+    return S_OK;
+}
+
+void renderer_release_placed_resource(HeapAllocator &heaps, ID3D12Resource **resource, HeapAllocation &allocation)
+{
+    resource_state_unregister(renderer_resource_states, *resource);
+    SAFE_RELEASE(*resource);
+    heap_allocator_free(heaps, allocation);
+    allocation.heap_index = -1;
 }
 
-void renderer_wait()
+bool renderer_descriptor_init()
 {
     /*
-        Finally we have the wait for previous frame function
-        This function is where the fencer and fence event are needed 
-        The first thing we do is check the current value of the current frames fence
-        If the current value is less than the value we wanted it to be we know the GPU is still executing commands for htis frame and we must enter the if block where we set the fence event which will
-        get triggered once the fence value equals what we wnat it to equal
+        One cpu only heap per descriptor type. These heaps are not directly referenced by shaders so they are not constrained in size like the shader visible
+        ones, views are created in them once and stay where they are for as long as their resource lives.
+        Descriptor sizes vary from device to device, which is why there is no set size and we must ask the device with GetDescriptorHandleIncrementSize.
+
+        Shaders only see the cbv/srv/uav heap that is set on the command list with SetDescriptorHeaps, and switching it can flush the gpu. So there is one shader
+        visible heap for everything and it is a ring: every frame copies the tables it binds into its own piece of it with CopyDescriptors, and the piece is
+        reused once the fence says the gpu is done with that frame, the same way the upload ring (upload_ring.h) works. Samplers do not get a ring, nothing uses them yet.
+    */
+    for (int type = 0; type < D3D12_DESCRIPTOR_HEAP_TYPE_NUM_TYPES; ++type)
+    {
+        D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {};
+        heap_desc.NumDescriptors = renderer_descriptor_capacity[type];
+        heap_desc.Type = (D3D12_DESCRIPTOR_HEAP_TYPE)type;
+        heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+        if (FAILED(renderer_device->CreateDescriptorHeap(&heap_desc, IID_PPV_ARGS(&renderer_descriptor_heaps[type]))))
+        {
+            return false;
+        }
+
+        UINT increment = renderer_device->GetDescriptorHandleIncrementSize(heap_desc.Type);
+        if (!descriptor_pool_init(renderer_descriptor_pools[type], renderer_descriptor_heaps[type]->GetCPUDescriptorHandleForHeapStart().ptr, increment, heap_desc.NumDescriptors))
+        {
+            return false;
+        }
+    }
+
+    D3D12_DESCRIPTOR_HEAP_DESC heap_desc = {};
+    heap_desc.NumDescriptors = renderer_shader_ring_capacity;
+    heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+    heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+    if (FAILED(renderer_device->CreateDescriptorHeap(&heap_desc, IID_PPV_ARGS(&renderer_shader_heap))))
+    {
+        return false;
+    }
+    renderer_shader_heap->SetName(L"Shader Visible Descriptor Ring");
 
-        We do this with the setevent on completion method of the fence interface
-        1. this is the fvalue we want the fence to equal
-        2. This is the event we want triggered when the fence equals value
+    return descriptor_ring_init(renderer_shader_ring, renderer_shader_heap->GetCPUDescriptorHandleForHeapStart().ptr, renderer_shader_heap->GetGPUDescriptorHandleForHeapStart().ptr,
+                                renderer_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV), heap_desc.NumDescriptors);
+}
 
-        After we set up the even, we wait for it to be triggered. We do this with the windows wait for single object function
-        1. this is the fence event we wnat to be triggered. IF it happens to be triggered in the very small amount of time between this funcion call and the time we set the fence event this function will trigger immediately
-        2. this is the number of milliseconds we want to wait for hte fence event to be triggered. We can use the infinite macro which means this emthod will block forever or until the fence event is triggered.
+D3D12_CPU_DESCRIPTOR_HANDLE renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE type, uint32_t index)
+{
+    D3D12_CPU_DESCRIPTOR_HANDLE handle;
+    handle.ptr = (SIZE_T)descriptor_pool_cpu(renderer_descriptor_pools[type], index);
+    return handle;
+}
 
-        Once the GPU has finished executing the frames command list we increment our fence value for this frame and set the current back buffer in the swap chain and continue
+bool renderer_descriptor_table(const D3D12_CPU_DESCRIPTOR_HANDLE *sources, UINT count, DescriptorTable &table)
+{
+    //The sources can be anywhere in the cpu pool, one CopyDescriptors call gathers all of them into the table. Null range sizes mean each source is one descriptor
+    //table.gpu is what SetGraphicsRootDescriptorTable wants, table.index is what a bindless shader indexes the heap with
+    if (!descriptor_ring_allocate(renderer_shader_ring, count, table))
+    {
+        return false;
+    }
+
+    D3D12_CPU_DESCRIPTOR_HANDLE destination;
+    destination.ptr = (SIZE_T)table.cpu;
+    renderer_device->CopyDescriptors(1, &destination, &count, count, sources, nullptr, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+    return true;
+}
+
+bool renderer_create_root_signature(ID3D12RootSignature **root_signature)
+{
+    //Both have a root cbv for the frame constants (FrameConstants, the mesh's dequantization), only the vertex shader reads them.
+    //It points into the upload ring, a root cbv needs no descriptor so the frame just sets the address it wrote them to
+    if (!renderer_bindless)
+    {
+        CD3DX12_ROOT_PARAMETER parameter;
+        parameter.InitAsConstantBufferView(1, 0, D3D12_SHADER_VISIBILITY_VERTEX);
+        renderer_mesh_constants_parameter = 0;
+
+        CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSig_desc;
+        rootSig_desc.Init_1_0(1, &parameter, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+        return SUCCEEDED(root_signature_cache_get(renderer_root_signature_cache, rootSig_desc, D3D_ROOT_SIGNATURE_VERSION_1_0, root_signature));
+    }
+
+    /*
+        Constant buffer views anywhere in a table need resource binding tier 3, tier 2 only allows 14 of them. Without it we fall back to the classic
+        root signature. Root signature 1.1 lets us say the descriptors are volatile, which they are: the table spans the whole ring and the next frame
+        copies its descriptors into it while this one runs. The data they point at does not change while the gpu uses it, that lets the driver prefetch.
+        Older runtimes only know 1.0, the cache serializes the desc for the highest version the device has and converts it down if it has to.
     */
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    D3D12_FEATURE_DATA_ROOT_SIGNATURE version = {D3D_ROOT_SIGNATURE_VERSION_1_1};
+    if (FAILED(renderer_device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options))) ||
+        options.ResourceBindingTier < D3D12_RESOURCE_BINDING_TIER_3)
+    {
+        OutputDebugStringA("bindless: needs resource binding tier 3, using the classic root signature\n");
+        renderer_bindless = false;
+        return renderer_create_root_signature(root_signature);
+    }
+    if (FAILED(renderer_device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &version, sizeof(version))))
+    {
+        version.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+    }
 
-    HRESULT result;
+    //Every range starts at the beginning of the table, which is the beginning of the heap, so a descriptor's index in the heap is its index in every array.
+    //Each resource type gets its own register space, the shaders see them as unbounded arrays (see vertex.hlsl)
+    const D3D12_DESCRIPTOR_RANGE_FLAGS range_flags = D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE | D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE;
+    CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
+    ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, UINT_MAX, 0, 1, range_flags, 0);
+    ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 2, range_flags, 0);
+
+    //Root constants change with every draw so they come first, a draw's are the heap indices of what it uses (DrawConstants in vertex.hlsl)
+    CD3DX12_ROOT_PARAMETER1 parameters[3];
+    parameters[0].InitAsConstants(1, 0, 0, D3D12_SHADER_VISIBILITY_ALL);
+    parameters[1].InitAsDescriptorTable(2, ranges, D3D12_SHADER_VISIBILITY_ALL);
+    parameters[2].InitAsConstantBufferView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE, D3D12_SHADER_VISIBILITY_VERTEX);
+    renderer_mesh_constants_parameter = 2;
+
+    CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSig_desc;
+    rootSig_desc.Init_1_1(3, parameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+    return SUCCEEDED(root_signature_cache_get(renderer_root_signature_cache, rootSig_desc, version.HighestVersion, root_signature));
+}
 
-    //swap the current rtv buffer index so we draw on the correct buffer
-    frame_index = renderer_swapchain->GetCurrentBackBufferIndex();
+bool renderer_create_materials(ResourceStateTracker &tracker)
+{
+    //Constant buffer views have to start at a multiple of 256 bytes, so every material gets 256 of them even though it only uses a tint.
+    //Material 0 is white so one recording thread draws exactly what the classic path does, every other thread's draw uses a material of its own
+    const UINT material_size = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT;
+    const UINT64 buffer_size = (UINT64)material_size * renderer_material_count;
 
-    // if the current fence value is still less than "fence value", then we know that the gpu has not finished executing
-    // the command queue since it has not reached the command que command
-    if (renderer_fence[frame_index]->GetCompletedValue() < renderer_fence_value[frame_index])
+    CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(buffer_size);
+    if (FAILED(renderer_create_placed_resource(renderer_buffer_heaps, desc, D3D12_RESOURCE_STATE_COMMON, &renderer_material_buffer, renderer_material_buffer_allocation)))
     {
-        //we have the fence create an event which is signaled once the fence's current value is the fencevalue
-        result = renderer_fence[frame_index]->SetEventOnCompletion(renderer_fence_value[frame_index], renderer_fence_event);
-        if (FAILED(result))
+        return false;
+    }
+    renderer_material_buffer->SetName(L"Material Constants");
+
+    //One upload request per material, like a loader finishing them one at a time. They land back to back in the staging block and go to
+    //back to back places in the buffer, so the upload manager merges them into a single copy
+    for (UINT i = 0; i < renderer_material_count; ++i)
+    {
+        float constants[material_size / sizeof(float)] = {};
+        constants[0] = i == 0 ? 1.0f : 0.25f + 0.75f * ((i * 37) % 16) / 15.0f;
+        constants[1] = i == 0 ? 1.0f : 0.25f + 0.75f * ((i * 59) % 16) / 15.0f;
+        constants[2] = i == 0 ? 1.0f : 0.25f + 0.75f * ((i * 83) % 16) / 15.0f;
+        constants[3] = 1.0f;
+        UploadTicket upload = upload_manager_buffer(renderer_upload_manager, renderer_material_buffer, (UINT64)i * material_size, constants, material_size);
+        if (!upload.fence_value)
+        {
+            return false;
+        }
+        renderer_upload_require(upload);
+    }
+
+    //Pending like the vertex buffer's, pipeline_close() records the barrier
+    resource_state_transition(tracker, renderer_material_buffer, resource_all_subresources, resource_state_vertex_and_constant_buffer);
+
+    //One view per material in the cpu pool, pipeline_update() copies all of them into the ring in one go every frame
+    for (UINT i = 0; i < renderer_material_count; ++i)
+    {
+        renderer_material_cbvs[i] = descriptor_pool_allocate(renderer_descriptor_pools[D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV]);
+        if (renderer_material_cbvs[i] == descriptor_null)
+        {
+            return false;
+        }
+
+        D3D12_CONSTANT_BUFFER_VIEW_DESC view = {};
+        view.BufferLocation = renderer_material_buffer->GetGPUVirtualAddress() + (UINT64)i * material_size;
+        view.SizeInBytes = material_size;
+        renderer_device->CreateConstantBufferView(&view, renderer_descriptor_cpu(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, renderer_material_cbvs[i]));
+    }
+    return true;
+}
+
+HRESULT renderer_compile_shader(const char *path, const D3D_SHADER_MACRO *defines, const char *entry, const char *target, UINT flags, ID3DBlob **bytecode, ID3DBlob **errors)
+{
+    *errors = nullptr;
+
+    //D3D_SHADER_MACRO and ShaderDefine have the same layout, both end with a null name
+    uint64_t hash;
+    bool hashed = shader_cache_hash(path, (const ShaderDefine *)defines, entry, target, flags, D3D_COMPILER_VERSION, hash);
+
+    //A hit only needs the bytecode copied into a blob
+    std::vector<uint8_t> cached;
+    if (hashed && shader_cache_load(renderer_shader_cache, hash, cached))
+    {
+        HRESULT result = D3DCreateBlob(cached.size(), bytecode);
+        if (SUCCEEDED(result))
         {
-            running = false;
+            memcpy((*bytecode)->GetBufferPointer(), cached.data(), cached.size());
         }
+        return result;
+    }
 
-        //We will wiat until the fence has triggered the event that it's current value has reached "fenceValue". once it's value has
-        //reached the fence value we know the command queue has finished executing
-        WaitForSingleObject(renderer_fence_event, INFINITE);
+    //A miss compiles like before and keeps the result for next time
+    std::wstring wide_path(path, path + strlen(path));
+    auto start = std::chrono::steady_clock::now();
+    HRESULT result = D3DCompileFromFile(wide_path.c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, entry, target, flags, 0, bytecode, errors);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (FAILED(result))
+    {
+        if (*errors)
+        {
+            OutputDebugStringA((const char *)(*errors)->GetBufferPointer());
+        }
+        return result;
     }
 
-    //increment fencevalue for next frame
-    ++renderer_fence_value[frame_index];
+    if (hashed)
+    {
+        shader_cache_store(renderer_shader_cache, hash, (*bytecode)->GetBufferPointer(), (*bytecode)->GetBufferSize(), seconds);
+    }
+    return result;
 }
+
+UINT renderer_input_layout(const VertexFormatDesc &format, D3D12_INPUT_ELEMENT_DESC *elements)
+{
+    //Every element comes from slot 0 once per vertex, the format says what it is called, how it is stored and where
+    for (UINT i = 0; i < format.element_count; ++i)
+    {
+        elements[i].SemanticName = format.elements[i].semantic;
+        elements[i].SemanticIndex = 0;
+        elements[i].Format = (DXGI_FORMAT)format.elements[i].format;
+        elements[i].InputSlot = 0;
+        elements[i].AlignedByteOffset = format.elements[i].offset;
+        elements[i].InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA;
+        elements[i].InstanceDataStepRate = 0;
+    }
+    return format.element_count;
+}
+
+bool renderer_create_index_buffer(const uint32_t *indices, UINT count, UINT vertex_count, ResourceStateTracker &tracker)
+{
+    //16 bit indices take half the memory and bandwidth of 32 bit ones, they are enough as long as the mesh has at most 65535 vertices
+    MeshIndexBuffer packed;
+    mesh_pack_indices(indices, count, vertex_count, packed);
+    const UINT64 buffer_size = packed.data.size();
+
+    //Same steps as the vertex buffer: a placed buffer in a default heap, the data through the upload manager, a barrier on the init command list
+    CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(buffer_size);
+    if (FAILED(renderer_create_placed_resource(renderer_buffer_heaps, desc, D3D12_RESOURCE_STATE_COMMON, &renderer_indexBuffer, renderer_indexBuffer_allocation)))
+    {
+        return false;
+    }
+    renderer_indexBuffer->SetName(L"Index Buffer Resource Heap");
+
+    UploadTicket upload = upload_manager_buffer(renderer_upload_manager, renderer_indexBuffer, 0, packed.data.data(), buffer_size);
+    if (!upload.fence_value)
+    {
+        return false;
+    }
+    renderer_upload_require(upload);
+
+    //Pending like the vertex buffer's, pipeline_close() records the barrier
+    resource_state_transition(tracker, renderer_indexBuffer, resource_all_subresources, resource_state_index_buffer);
+
+    renderer_indexBuffer_view.BufferLocation = renderer_indexBuffer->GetGPUVirtualAddress();
+    renderer_indexBuffer_view.SizeInBytes = (UINT)buffer_size;
+    renderer_indexBuffer_view.Format = (DXGI_FORMAT)packed.format;
+    renderer_index_count = count;
+    return true;
+}
+
+bool renderer_upload_init()
+{
+    //A queue of type COPY only runs copies, on most gpus that is the dma engine, so uploads go on while the direct queue renders
+    D3D12_COMMAND_QUEUE_DESC description = {};
+    description.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+    description.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+    if (FAILED(renderer_device->CreateCommandQueue(&description, IID_PPV_ARGS(&renderer_copy_queue))))
+    {
+        return false;
+    }
+    renderer_copy_queue->SetName(L"Upload Copy Queue");
+
+    if (FAILED(renderer_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&renderer_copy_fence))))
+    {
+        return false;
+    }
+    renderer_copy_fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (renderer_copy_fence_event == nullptr)
+    {
+        return false;
+    }
+
+    //The list is created with an allocator that is only used for that, every batch resets it with an allocator of its own
+    ID3D12CommandAllocator *allocator;
+    if (FAILED(renderer_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&allocator))))
+    {
+        return false;
+    }
+    HRESULT result = renderer_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, allocator, nullptr, IID_PPV_ARGS(&renderer_copy_command_list));
+    if (SUCCEEDED(result))
+    {
+        result = renderer_copy_command_list->Close();
+    }
+    renderer_copy_allocators.push_back(std::make_pair(allocator, 0ull));
+    if (FAILED(result))
+    {
+        return false;
+    }
+
+    //A batch is submitted once it holds half a block, and at the latest at the end of the frame
+    renderer_upload_required = 0;
+    renderer_upload_waited = 0;
+    renderer_upload_tickets.clear();
+    return upload_manager_init(renderer_upload_manager, &renderer_upload_queue, renderer_upload_block_size, renderer_upload_max_blocks,
+                               renderer_upload_block_size / 2);
+}
+
+UploadTicket renderer_upload_texture(ID3D12Resource *texture, UINT first_subresource, UINT count, const D3D12_SUBRESOURCE_DATA *data)
+{
+    //The device says where every subresource goes in the upload, the same call UpdateSubresources starts with
+    D3D12_RESOURCE_DESC desc = texture->GetDesc();
+    std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> layouts(count);
+    std::vector<UINT> row_counts(count);
+    std::vector<UINT64> row_sizes(count);
+    renderer_device->GetCopyableFootprints(&desc, first_subresource, count, 0, layouts.data(), row_counts.data(), row_sizes.data(), nullptr);
+
+    std::vector<SubresourceFootprint> footprints(count);
+    std::vector<SubresourceData> sources(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        footprints[i].offset = layouts[i].Offset;
+        footprints[i].format = layouts[i].Footprint.Format;
+        footprints[i].width = layouts[i].Footprint.Width;
+        footprints[i].height = layouts[i].Footprint.Height;
+        footprints[i].depth = layouts[i].Footprint.Depth;
+        footprints[i].row_pitch = layouts[i].Footprint.RowPitch;
+        footprints[i].row_size = row_sizes[i];
+        footprints[i].row_count = row_counts[i];
+        sources[i].data = data[i].pData;
+        sources[i].row_pitch = (uint64_t)data[i].RowPitch;
+        sources[i].slice_pitch = (uint64_t)data[i].SlicePitch;
+    }
+
+    //Unlike UpdateSubresources the rows of the mips and slices are copied by every worker thread at once, the copies still go to the
+    //copy queue in subresource order. The texture has to be in the common state, like the buffers
+    return upload_manager_subresources(renderer_upload_manager, texture, first_subresource, count, footprints.data(), sources.data(), job_system_size());
+}
+
+bool renderer_upload_ring_init(UINT64 frame_bytes)
+{
+    /*
+        Data the cpu writes every frame, the frame constants and with -dynamic-vertices the vertices, goes through the upload ring (upload_ring.h):
+        one upload buffer created here and mapped forever, of which every frame takes pieces. A piece is reused once the fence value of the frame
+        that wrote it has passed, so nothing is created or mapped per frame. Every frame in flight and the one being recorded may hold a frame's worth,
+        plus what is skipped when an allocation wraps around. The ring wants a power of two.
+    */
+    UINT64 size = 64 * 1024;
+    while (size < frame_bytes * (renderer_frames_in_flight + 2))
+    {
+        size *= 2;
+    }
+
+    CD3DX12_HEAP_PROPERTIES heap = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+    CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(size);
+    HRESULT result = renderer_device->CreateCommittedResource(&heap, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, nullptr,
+                                                              IID_PPV_ARGS(&renderer_upload_buffer));
+    if (FAILED(result))
+    {
+        return false;
+    }
+    renderer_upload_buffer->SetName(L"Upload Ring Resource Heap");
+
+    //we never read from it on the cpu, so the read range is empty
+    void *memory;
+    CD3DX12_RANGE read_range(0, 0);
+    result = renderer_upload_buffer->Map(0, &read_range, &memory);
+    return SUCCEEDED(result) && upload_ring_init(renderer_upload_ring, (uint8_t *)memory, renderer_upload_buffer->GetGPUVirtualAddress(), size);
+}
+
+bool renderer_stream_frame_data()
+{
+    //The constants, 256 byte aligned like every constant buffer. renderer_render() tags them with this frame's fence value
+    UploadAllocation constants;
+    if (!upload_ring_allocate(renderer_upload_ring, sizeof(FrameConstants), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, constants))
+    {
+        return false;
+    }
+    FrameConstants frame = {};
+    frame.dequantization = renderer_vertex_dequantization;
+    memcpy(constants.cpu, &frame, sizeof(frame));
+    renderer_frame_constants = constants.gpu;
+
+    //The vertices straight from the ring, an upload heap is always in the generic read state so a vertex buffer view may point into it
+    if (renderer_dynamic_vertices)
+    {
+        UploadAllocation vertices;
+        if (!upload_ring_allocate(renderer_upload_ring, renderer_vertex_data.size(), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, vertices))
+        {
+            return false;
+        }
+        memcpy(vertices.cpu, renderer_vertex_data.data(), renderer_vertex_data.size());
+        renderer_frame_vertex_view.BufferLocation = vertices.gpu;
+    }
+    return true;
+}
+
+bool renderer_timer_init()
+{
+    //One range of queries per frame context, a frame only reads its results back once the ring has waited for its fence anyway
+    UINT query_count = (UINT)renderer_frames_in_flight * gpu_timer_max_queries;
+    D3D12_QUERY_HEAP_DESC heap_desc = {};
+    heap_desc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    heap_desc.Count = query_count;
+    if (FAILED(renderer_device->CreateQueryHeap(&heap_desc, IID_PPV_ARGS(&renderer_timestamp_heap))))
+    {
+        return false;
+    }
+
+    //ResolveQueryData writes into a readback buffer, the cpu reads it where it is
+    CD3DX12_HEAP_PROPERTIES heap(D3D12_HEAP_TYPE_READBACK);
+    CD3DX12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(query_count * sizeof(uint64_t));
+    if (FAILED(renderer_device->CreateCommittedResource(&heap, D3D12_HEAP_FLAG_NONE, &desc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr,
+                                                        IID_PPV_ARGS(&renderer_timestamp_readback))))
+    {
+        return false;
+    }
+    renderer_timestamp_readback->SetName(L"Timestamp Readback Buffer");
+    void *results;
+    if (FAILED(renderer_timestamp_readback->Map(0, nullptr, &results)))
+    {
+        return false;
+    }
+    renderer_timer_queue.results = (const uint64_t *)results;
+
+    UINT64 frequency;
+    if (FAILED(command_queue->GetTimestampFrequency(&frequency)))
+    {
+        return false;
+    }
+    renderer_timer_queue.frequency = frequency;
+    return gpu_timer_init(renderer_gpu_timer, &renderer_timer_queue, renderer_frames_in_flight);
+}
+
+void renderer_upload_require(UploadTicket ticket)
+{
+    renderer_upload_tickets.push_back(ticket);
+    if (ticket.fence_value > renderer_upload_required)
+    {
+        renderer_upload_required = ticket.fence_value;
+    }
+}
+
+bool renderer_upload_sync()
+{
+    PROFILE_SCOPE("renderer_upload_sync");
+    //Whatever was asked for since the last frame goes to the copy queue now, so the wait below is for something that was submitted
+    upload_manager_submit(renderer_upload_manager);
+
+    //A batch the copy queue could not execute is never signaled, waiting for it on the gpu could hang the direct queue
+    for (const UploadTicket &ticket : renderer_upload_tickets)
+    {
+        if (upload_manager_failed(renderer_upload_manager, ticket))
+        {
+            OutputDebugStringA("upload manager: a copy the frame needs failed\n");
+            renderer_upload_tickets.clear();
+            return false;
+        }
+    }
+    renderer_upload_tickets.clear();
+
+    //Only work that reads the uploads waits for them, and only the gpu waits. Frames that need nothing new never wait at all
+    if (renderer_upload_required > renderer_upload_waited)
+    {
+        command_queue->Wait(renderer_copy_fence, renderer_upload_required);
+        renderer_upload_waited = renderer_upload_required;
+    }
+    return true;
+}
+
+bool renderer_wait()
+{
+    PROFILE_SCOPE("renderer_wait");
+    /*
+        Finally we have the wait for previous frame function
+        The frame ring does the fence work (see frame_ring.h): the frame context we are about to record into was last used renderer_frames_in_flight
+        frames ago, and the ring remembers which fence value that frame signaled. If the fence has not reached that value yet the GPU is still
+        executing that frame's command list, so the ring has our D3D12FrameQueue set the fence event with SetEventOnCompletion and waits on it
+        with WaitForSingleObject.
+
+        Once the GPU has finished with that frame we know its command allocator can be reset, and we pick up the back buffer the swap chain wants
+        us to draw into. The back buffer and the frame context are separate on purpose: how far we run ahead is set by renderer_frames_in_flight,
+        not by how many buffers the swap chain has.
+    */
+
+    //wait until the gpu is done with the oldest frame and take over its frame context
+    //the ring does not hand the context out if the wait failed
+    int context = frame_ring_begin(renderer_frame_ring);
+    if (context < 0)
+    {
+        return false;
+    }
+    frame_context = context;
+
+    //so are the timestamps that frame resolved, the gpu timer hands them to the profiler
+    gpu_timer_begin_frame(renderer_gpu_timer, frame_context);
+
+    //hand the descriptor tables of every finished frame in the shader visible heap back
+    descriptor_ring_retire(renderer_shader_ring, frame_ring_completed(renderer_frame_ring));
+
+    //and the upload ring memory of every finished frame
+    upload_ring_retire(renderer_upload_ring, frame_ring_completed(renderer_frame_ring));
+
+    //and the staging blocks of every upload batch the copy queue has finished
+    upload_manager_retire(renderer_upload_manager);
+
+    //swap the current rtv buffer index so we draw on the correct buffer
+    frame_index = renderer_swapchain->GetCurrentBackBufferIndex();
+    return true;
+}
+
+#endif // _WIN32
@@ -0,0 +1,277 @@
+#include "mesh.h"
+#include "hash.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace
+{
+const float pi = 3.14159265f;
+
+// Colour from position, so vertices at the same place are equal in every byte and welding finds them
+Vertex make_vertex(float x, float y, float z)
+{
+    return Vertex(x, y, z, 0.5f + 0.5f * x, 0.5f + 0.5f * y, z, 1.0f);
+}
+
+bool same_vertex(const Vertex &a, const Vertex &b)
+{
+    return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z &&
+           a.color.x == b.color.x && a.color.y == b.color.y && a.color.z == b.color.z && a.color.w == b.color.w;
+}
+
+void add_triangle(Mesh &mesh, uint32_t a, uint32_t b, uint32_t c)
+{
+    mesh.indices.push_back(a);
+    mesh.indices.push_back(b);
+    mesh.indices.push_back(c);
+}
+} // namespace
+
+uint64_t mesh_hash_vertex(const Vertex &vertex)
+{
+    uint64_t hash = hash_offset;
+    hash_value(hash, vertex.pos.x);
+    hash_value(hash, vertex.pos.y);
+    hash_value(hash, vertex.pos.z);
+    hash_value(hash, vertex.color.x);
+    hash_value(hash, vertex.color.y);
+    hash_value(hash, vertex.color.z);
+    hash_value(hash, vertex.color.w);
+    return hash;
+}
+
+uint32_t mesh_index_format(size_t vertex_count)
+{
+    //0xffff is left out on purpose, with strip cuts enabled it means "restart" and never reaches the vertex shader
+    return vertex_count <= 0xffff ? mesh_index_format_16 : mesh_index_format_32;
+}
+
+void mesh_pack_indices(const uint32_t *indices, size_t count, size_t vertex_count, MeshIndexBuffer &buffer)
+{
+    buffer.format = mesh_index_format(vertex_count);
+    buffer.index_size = buffer.format == mesh_index_format_16 ? 2 : 4;
+    buffer.count = (uint32_t)count;
+    buffer.data.resize(count * buffer.index_size);
+
+    if (buffer.index_size == 4)
+    {
+        memcpy(buffer.data.data(), indices, count * 4);
+        return;
+    }
+
+    uint16_t *packed = (uint16_t *)buffer.data.data();
+    for (size_t i = 0; i < count; ++i)
+        packed[i] = (uint16_t)indices[i];
+}
+
+void mesh_weld(const Vertex *vertices, size_t count, Mesh &mesh)
+{
+    mesh.vertices.clear();
+    mesh.indices.clear();
+    mesh.indices.reserve(count);
+
+    //Hash to the first vertex with that hash, collisions fall back to searching the ones added since
+    std::unordered_multimap<uint64_t, uint32_t> seen;
+    seen.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t hash = mesh_hash_vertex(vertices[i]);
+        uint32_t index = 0xffffffffu;
+        auto range = seen.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (same_vertex(mesh.vertices[it->second], vertices[i]))
+            {
+                index = it->second;
+                break;
+            }
+        }
+
+        if (index == 0xffffffffu)
+        {
+            index = (uint32_t)mesh.vertices.size();
+            mesh.vertices.push_back(vertices[i]);
+            seen.emplace(hash, index);
+        }
+        mesh.indices.push_back(index);
+    }
+}
+
+void mesh_unweld(const Mesh &mesh, std::vector<Vertex> &vertices)
+{
+    vertices.clear();
+    vertices.reserve(mesh.indices.size());
+    for (uint32_t index : mesh.indices)
+        vertices.push_back(mesh.vertices[index]);
+}
+
+Mesh mesh_make_grid(uint32_t columns, uint32_t rows)
+{
+    Mesh mesh;
+    mesh.name = "grid " + std::to_string(columns) + "x" + std::to_string(rows);
+
+    for (uint32_t y = 0; y <= rows; ++y)
+    {
+        for (uint32_t x = 0; x <= columns; ++x)
+            mesh.vertices.push_back(make_vertex(-0.9f + 1.8f * x / columns, -0.9f + 1.8f * y / rows, 0.5f));
+    }
+
+    //Two triangles per cell, clockwise seen from the front: bottom left, top left, top right and bottom left, top right, bottom right
+    uint32_t stride = columns + 1;
+    for (uint32_t y = 0; y < rows; ++y)
+    {
+        for (uint32_t x = 0; x < columns; ++x)
+        {
+            uint32_t corner = y * stride + x;
+            add_triangle(mesh, corner, corner + stride, corner + stride + 1);
+            add_triangle(mesh, corner, corner + stride + 1, corner + 1);
+        }
+    }
+    return mesh;
+}
+
+Mesh mesh_make_sphere(uint32_t slices, uint32_t stacks)
+{
+    Mesh mesh;
+    mesh.name = "sphere " + std::to_string(slices) + "x" + std::to_string(stacks);
+
+    //One ring of vertices per stack, the poles are a single vertex each
+    mesh.vertices.push_back(make_vertex(0.0f, 0.8f, 0.5f));
+    for (uint32_t stack = 1; stack < stacks; ++stack)
+    {
+        float phi = pi * stack / stacks;
+        for (uint32_t slice = 0; slice < slices; ++slice)
+        {
+            float theta = 2.0f * pi * slice / slices;
+            mesh.vertices.push_back(make_vertex(0.8f * sinf(phi) * cosf(theta), 0.8f * cosf(phi), 0.5f + 0.4f * sinf(phi) * sinf(theta)));
+        }
+    }
+    uint32_t bottom = (uint32_t)mesh.vertices.size();
+    mesh.vertices.push_back(make_vertex(0.0f, -0.8f, 0.5f));
+
+    auto ring = [slices](uint32_t stack, uint32_t slice) { return 1 + (stack - 1) * slices + slice % slices; };
+    for (uint32_t slice = 0; slice < slices; ++slice)
+        add_triangle(mesh, 0, ring(1, slice + 1), ring(1, slice));
+    for (uint32_t stack = 1; stack + 1 < stacks; ++stack)
+    {
+        for (uint32_t slice = 0; slice < slices; ++slice)
+        {
+            add_triangle(mesh, ring(stack, slice), ring(stack, slice + 1), ring(stack + 1, slice + 1));
+            add_triangle(mesh, ring(stack, slice), ring(stack + 1, slice + 1), ring(stack + 1, slice));
+        }
+    }
+    for (uint32_t slice = 0; slice < slices; ++slice)
+        add_triangle(mesh, bottom, ring(stacks - 1, slice), ring(stacks - 1, slice + 1));
+    return mesh;
+}
+
+Mesh mesh_make_torus(uint32_t rings, uint32_t sides)
+{
+    Mesh mesh;
+    mesh.name = "torus " + std::to_string(rings) + "x" + std::to_string(sides);
+
+    const float major = 0.6f, minor = 0.25f;
+    for (uint32_t ring = 0; ring < rings; ++ring)
+    {
+        float theta = 2.0f * pi * ring / rings;
+        for (uint32_t side = 0; side < sides; ++side)
+        {
+            float phi = 2.0f * pi * side / sides;
+            float radius = major + minor * cosf(phi);
+            mesh.vertices.push_back(make_vertex(radius * cosf(theta), radius * sinf(theta), 0.5f + minor * sinf(phi)));
+        }
+    }
+
+    //Both directions wrap around, so there is no seam and every vertex is shared by six triangles
+    auto at = [rings, sides](uint32_t ring, uint32_t side) { return (ring % rings) * sides + side % sides; };
+    for (uint32_t ring = 0; ring < rings; ++ring)
+    {
+        for (uint32_t side = 0; side < sides; ++side)
+        {
+            add_triangle(mesh, at(ring, side), at(ring + 1, side + 1), at(ring, side + 1));
+            add_triangle(mesh, at(ring, side), at(ring + 1, side), at(ring + 1, side + 1));
+        }
+    }
+    return mesh;
+}
+
+uint32_t mesh_vertex_shader_invocations(const uint32_t *indices, size_t count, uint32_t vertex_count, int cache_size)
+{
+    //A FIFO cache holds the last cache_size misses, so a vertex is still in it if fewer than cache_size misses happened since its own.
+    //Remembering when each vertex last missed makes the lookup O(1)
+    std::vector<uint32_t> missed_at(vertex_count, 0xffffffffu);
+    uint32_t misses = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t index = indices[i];
+        if (index >= vertex_count)
+            continue;
+        if (missed_at[index] != 0xffffffffu && misses - missed_at[index] < (uint32_t)cache_size)
+            continue;
+        missed_at[index] = misses++;
+    }
+    return misses;
+}
+
+bool mesh_benchmark()
+{
+    const int cache_size = 32;
+
+    std::vector<Mesh> meshes;
+    meshes.push_back(mesh_make_grid(16, 16));
+    meshes.push_back(mesh_make_grid(100, 100));
+    meshes.push_back(mesh_make_sphere(64, 32));
+    meshes.push_back(mesh_make_torus(96, 48));
+    meshes.push_back(mesh_make_grid(300, 300)); // More than 65535 vertices, needs 32 bit indices
+
+    printf("mesh, vertices, triangles, index format, bytes without indices, bytes indexed (vb + ib), memory saved, "
+           "vs invocations without indices, vs invocations indexed (fifo %d), invocations saved\n", cache_size);
+
+    bool ok = true;
+    for (const Mesh &mesh : meshes)
+    {
+        MeshIndexBuffer index_buffer;
+        mesh_pack_indices(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size(), index_buffer);
+
+        //What drawing it with DrawInstanced takes: every corner of every triangle is its own vertex
+        std::vector<Vertex> soup;
+        mesh_unweld(mesh, soup);
+
+        uint64_t soup_bytes = soup.size() * sizeof(Vertex);
+        uint64_t indexed_bytes = mesh.vertices.size() * sizeof(Vertex) + index_buffer.data.size();
+        uint32_t soup_invocations = (uint32_t)soup.size();
+        uint32_t indexed_invocations = mesh_vertex_shader_invocations(mesh.indices.data(), mesh.indices.size(), (uint32_t)mesh.vertices.size(), cache_size);
+
+        printf("%s, %zu, %zu, %d bit, %llu, %llu, %.0f%%, %u, %u, %.0f%%\n", mesh.name.c_str(), mesh.vertices.size(), mesh.indices.size() / 3,
+               index_buffer.index_size * 8, (unsigned long long)soup_bytes, (unsigned long long)indexed_bytes,
+               100.0 * (1.0 - (double)indexed_bytes / soup_bytes), soup_invocations, indexed_invocations,
+               100.0 * (1.0 - (double)indexed_invocations / soup_invocations));
+
+        //Welding the soup has to give back the same vertices and the same triangles
+        Mesh welded;
+        mesh_weld(soup.data(), soup.size(), welded);
+        std::vector<Vertex> rewelded_soup;
+        mesh_unweld(welded, rewelded_soup);
+        if (welded.vertices.size() != mesh.vertices.size() || rewelded_soup.size() != soup.size() ||
+            memcmp(rewelded_soup.data(), soup.data(), soup.size() * sizeof(Vertex)) != 0)
+        {
+            printf("%s: welding gave %zu vertices instead of %zu\n", mesh.name.c_str(), welded.vertices.size(), mesh.vertices.size());
+            ok = false;
+        }
+
+        //The packed indices have to read back as the original ones
+        for (size_t i = 0; i < mesh.indices.size(); ++i)
+        {
+            uint32_t packed = index_buffer.index_size == 2 ? ((const uint16_t *)index_buffer.data.data())[i] : ((const uint32_t *)index_buffer.data.data())[i];
+            if (packed != mesh.indices[i])
+            {
+                printf("%s: index %zu packed as %u instead of %u\n", mesh.name.c_str(), i, packed, mesh.indices[i]);
+                ok = false;
+                break;
+            }
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "renderer_common.h"
+#include "vertex_format.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+    Indexed meshes.
+
+    A triangle list without indices repeats every vertex once per triangle that uses it, six times for the inside of a regular grid. With an
+    index buffer each vertex is stored once and triangles refer to it by index, and the gpu only runs the vertex shader again for an index
+    that is no longer in its post transform cache.
+
+    Indices are kept as 32 bit while a mesh is built. mesh_pack_indices() picks the smallest format for the upload: 16 bit whenever the mesh
+    has at most 65535 vertices, 32 bit otherwise. The format values are DXGI_FORMAT_R16_UINT and DXGI_FORMAT_R32_UINT, so the result goes
+    straight into a D3D12_INDEX_BUFFER_VIEW or a SoftwareIndexBufferView.
+*/
+
+const uint32_t mesh_index_format_16 = 57; // DXGI_FORMAT_R16_UINT
+const uint32_t mesh_index_format_32 = 42; // DXGI_FORMAT_R32_UINT
+
+struct Mesh
+{
+    std::string name;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices; // Triangle list, clockwise
+    VertexFormat vertex_format = VERTEX_FORMAT_FLOAT; // What the vertices are uploaded as, see vertex_format_choose()
+};
+
+// An index buffer ready to upload
+struct MeshIndexBuffer
+{
+    uint32_t format;     // mesh_index_format_16 or mesh_index_format_32
+    uint32_t index_size; // Bytes per index
+    uint32_t count;
+    std::vector<uint8_t> data;
+};
+
+uint64_t mesh_hash_vertex(const Vertex &vertex); // Every field, so equal hashes almost always mean the same vertex
+uint32_t mesh_index_format(size_t vertex_count); // 16 bit if every index fits, 32 bit otherwise
+void mesh_pack_indices(const uint32_t *indices, size_t count, size_t vertex_count, MeshIndexBuffer &buffer);
+
+// Turn a triangle soup (every three vertices a triangle) into an indexed mesh, vertices equal in every byte become one
+void mesh_weld(const Vertex *vertices, size_t count, Mesh &mesh);
+void mesh_unweld(const Mesh &mesh, std::vector<Vertex> &vertices); // The other way around, what drawing it without indices needs
+
+// Sample meshes, all of them fit in clip space
+Mesh mesh_make_grid(uint32_t columns, uint32_t rows);
+Mesh mesh_make_sphere(uint32_t slices, uint32_t stacks);
+Mesh mesh_make_torus(uint32_t rings, uint32_t sides);
+
+// Vertex shader invocations of a draw through a FIFO post transform cache of cache_size entries. A draw without indices runs it once per index
+uint32_t mesh_vertex_shader_invocations(const uint32_t *indices, size_t count, uint32_t vertex_count, int cache_size);
+
+// Memory and vertex shader invocations of the sample meshes drawn with and without indices. Returns false if welding does not give back the mesh
+bool mesh_benchmark();
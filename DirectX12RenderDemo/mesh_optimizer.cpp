@@ -0,0 +1,534 @@
+#include "mesh_optimizer.h"
+#include "hash.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+namespace
+{
+const uint32_t never = 0xffffffffu;
+
+// FIFO post transform cache, see mesh_vertex_shader_invocations(). reset() empties it without touching every vertex
+struct FifoCache
+{
+    std::vector<uint32_t> missed_at;
+    uint32_t misses;
+    uint32_t reset_at; // Misses before this do not count as being in the cache
+    uint32_t size;
+
+    FifoCache(uint32_t vertex_count, int cache_size) : missed_at(vertex_count, never), misses(0), reset_at(0), size((uint32_t)cache_size) {}
+
+    void reset()
+    {
+        reset_at = misses;
+    }
+
+    // 1 if the vertex shader has to run for this index
+    uint32_t access(uint32_t index)
+    {
+        uint32_t at = missed_at[index];
+        if (at != never && at >= reset_at && misses - at < size)
+            return 0;
+        missed_at[index] = misses++;
+        return 1;
+    }
+};
+
+struct Float3
+{
+    double x, y, z;
+};
+
+Float3 position(const Vertex &vertex)
+{
+    return {vertex.pos.x, vertex.pos.y, vertex.pos.z};
+}
+
+Float3 sub(const Float3 &a, const Float3 &b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+// Clockwise triangles are the front faces, so with d3d's left handed coordinates (b - a) x (c - a) points out of the front
+Float3 cross(const Float3 &a, const Float3 &b)
+{
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+// Tipsify's next fanning vertex: the candidate that stays in the cache after its remaining triangles are drawn and has been in it the
+// longest, so it is used before it falls out. Without one, back up the stack of vertices used recently, then take the next unfinished one
+int64_t next_vertex(const std::vector<uint32_t> &candidates, const std::vector<uint32_t> &live, const std::vector<uint32_t> &cache_time, uint32_t time,
+                    int cache_size, std::vector<uint32_t> &dead_end, uint32_t &cursor, bool &jumped)
+{
+    int64_t best = -1;
+    int64_t best_priority = -1;
+    for (uint32_t vertex : candidates)
+    {
+        if (live[vertex] == 0)
+            continue;
+
+        int64_t priority = 0;
+        if ((int64_t)time - cache_time[vertex] + 2 * (int64_t)live[vertex] <= cache_size)
+            priority = (int64_t)time - cache_time[vertex];
+        if (priority > best_priority)
+        {
+            best_priority = priority;
+            best = vertex;
+        }
+    }
+    if (best >= 0)
+        return best;
+
+    jumped = true;
+    while (!dead_end.empty())
+    {
+        uint32_t vertex = dead_end.back();
+        dead_end.pop_back();
+        if (live[vertex] > 0)
+            return vertex;
+    }
+    while (cursor < live.size())
+    {
+        if (live[cursor] > 0)
+            return cursor;
+        ++cursor;
+    }
+    return -1;
+}
+
+// Vertex shader runs per triangle of indices[first, last) with a cache that starts out empty
+double cluster_acmr(const uint32_t *indices, size_t first, size_t last, FifoCache &cache)
+{
+    cache.reset();
+    uint32_t misses = 0;
+    for (size_t i = first; i < last; ++i)
+        misses += cache.access(indices[i]);
+    return last > first ? misses * 3.0 / (last - first) : 0.0;
+}
+
+// Pixels shaded per pixel covered with a depth test, the mesh rasterized orthographically along +-x, +-y and +-z into a 256x256 grid.
+// Back faces are culled like the pso does, so only a mesh that hides parts of itself from some direction has any
+double measure_overdraw(const uint32_t *indices, size_t count, const Vertex *vertices, uint32_t vertex_count)
+{
+    const int grid = 256;
+    if (vertex_count == 0 || count < 3)
+        return 0.0;
+
+    Float3 minimum = position(vertices[0]), maximum = minimum;
+    for (uint32_t i = 1; i < vertex_count; ++i)
+    {
+        Float3 p = position(vertices[i]);
+        minimum = {std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z)};
+        maximum = {std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z)};
+    }
+    double extent = std::max(maximum.x - minimum.x, std::max(maximum.y - minimum.y, maximum.z - minimum.z));
+    double scale = extent > 0.0 ? (grid - 1) / extent : 0.0;
+
+    uint64_t covered = 0, shaded = 0;
+    std::vector<float> depth(grid * grid);
+    for (int view = 0; view < 6; ++view)
+    {
+        int axis = view / 2;
+        double sign = view % 2 ? -1.0 : 1.0;
+        std::fill(depth.begin(), depth.end(), INFINITY);
+
+        for (size_t i = 0; i + 3 <= count; i += 3)
+        {
+            //Facing away from a camera looking down the axis
+            Float3 p0 = position(vertices[indices[i + 0]]);
+            Float3 n = cross(sub(position(vertices[indices[i + 1]]), p0), sub(position(vertices[indices[i + 2]]), p0));
+            double coordinates_n[3] = {n.x, n.y, n.z};
+            if (coordinates_n[axis] * sign >= 0.0)
+                continue;
+
+            double x[3], y[3], z[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                Float3 p = sub(position(vertices[indices[i + k]]), minimum);
+                double coordinates[3] = {p.x, p.y, p.z};
+                x[k] = coordinates[(axis + 1) % 3] * scale;
+                y[k] = coordinates[(axis + 2) % 3] * scale;
+                z[k] = coordinates[axis] * sign;
+            }
+
+            double area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+            if (area == 0.0)
+                continue;
+
+            int x0 = std::max(0, (int)floor(std::min(x[0], std::min(x[1], x[2]))));
+            int y0 = std::max(0, (int)floor(std::min(y[0], std::min(y[1], y[2]))));
+            int x1 = std::min(grid - 1, (int)ceil(std::max(x[0], std::max(x[1], x[2]))));
+            int y1 = std::min(grid - 1, (int)ceil(std::max(y[0], std::max(y[1], y[2]))));
+            for (int py = y0; py <= y1; ++py)
+            {
+                for (int px = x0; px <= x1; ++px)
+                {
+                    double cx = px + 0.5, cy = py + 0.5;
+                    double w0 = ((x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1])) / area;
+                    double w1 = ((x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2])) / area;
+                    double w2 = 1.0 - w0 - w1;
+                    if (w0 < 0.0 || w1 < 0.0 || w2 < 0.0)
+                        continue;
+
+                    float pixel_depth = (float)(w0 * z[0] + w1 * z[1] + w2 * z[2]);
+                    float &stored = depth[py * grid + px];
+                    if (pixel_depth < stored)
+                    {
+                        if (stored == INFINITY)
+                            ++covered;
+                        stored = pixel_depth;
+                        ++shaded;
+                    }
+                }
+            }
+        }
+    }
+    return covered ? (double)shaded / covered : 0.0;
+}
+
+// Bytes the input assembler reads through a 16 KB direct mapped cache of 64 byte lines, per byte of vertex buffer
+double measure_overfetch(const uint32_t *indices, size_t count, uint32_t vertex_count)
+{
+    const uint32_t line_size = 64, line_count = 256;
+    std::vector<uint64_t> tags(line_count, ~0ull);
+    uint64_t fetched = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t begin = (uint64_t)indices[i] * sizeof(Vertex);
+        uint64_t end = begin + sizeof(Vertex);
+        for (uint64_t line = begin / line_size; line * line_size < end; ++line)
+        {
+            uint64_t &tag = tags[line % line_count];
+            if (tag != line)
+            {
+                tag = line;
+                fetched += line_size;
+            }
+        }
+    }
+    return vertex_count ? (double)fetched / ((uint64_t)vertex_count * sizeof(Vertex)) : 0.0;
+}
+
+// One entry per triangle, independent of the order of triangles and vertices but not of the winding, to check a step changed nothing else
+std::vector<uint64_t> triangle_signature(const Mesh &mesh)
+{
+    std::vector<uint64_t> signature;
+    signature.reserve(mesh.indices.size() / 3);
+    for (size_t i = 0; i + 3 <= mesh.indices.size(); i += 3)
+    {
+        uint64_t corner[3];
+        for (int k = 0; k < 3; ++k)
+            corner[k] = mesh_hash_vertex(mesh.vertices[mesh.indices[i + k]]);
+
+        //Rotate the smallest one to the front, a rotation is the same triangle with the same winding
+        int first = 0;
+        for (int k = 1; k < 3; ++k)
+        {
+            if (corner[k] < corner[first])
+                first = k;
+        }
+        uint64_t hash = hash_offset;
+        for (int k = 0; k < 3; ++k)
+            hash_value(hash, corner[(first + k) % 3]);
+        signature.push_back(hash);
+    }
+    std::sort(signature.begin(), signature.end());
+    return signature;
+}
+
+// What an exporter that does not care hands us: triangles in random order, vertices numbered at random
+void shuffle_mesh(Mesh &mesh, std::mt19937 &random)
+{
+    size_t triangle_count = mesh.indices.size() / 3;
+    std::vector<uint32_t> order(triangle_count);
+    for (size_t i = 0; i < triangle_count; ++i)
+        order[i] = (uint32_t)i;
+    std::shuffle(order.begin(), order.end(), random);
+
+    std::vector<uint32_t> remap(mesh.vertices.size());
+    for (size_t i = 0; i < remap.size(); ++i)
+        remap[i] = (uint32_t)i;
+    std::shuffle(remap.begin(), remap.end(), random);
+
+    std::vector<uint32_t> indices(mesh.indices.size());
+    for (size_t t = 0; t < triangle_count; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+            indices[t * 3 + k] = remap[mesh.indices[order[t] * 3 + k]];
+    }
+    std::vector<Vertex> vertices(mesh.vertices);
+    for (size_t i = 0; i < remap.size(); ++i)
+        vertices[remap[i]] = mesh.vertices[i];
+
+    mesh.indices.swap(indices);
+    mesh.vertices.swap(vertices);
+}
+} // namespace
+
+void mesh_optimize_vertex_cache(const uint32_t *indices, size_t count, uint32_t vertex_count, int cache_size, std::vector<uint32_t> &result,
+                                std::vector<uint32_t> *clusters)
+{
+    size_t triangle_count = count / 3;
+    result.clear();
+    result.reserve(triangle_count * 3);
+    if (clusters)
+        clusters->clear();
+
+    //Triangles of every vertex, all in one array. live counts the ones not drawn yet
+    std::vector<uint32_t> live(vertex_count, 0);
+    for (size_t i = 0; i < triangle_count * 3; ++i)
+        ++live[indices[i]];
+    std::vector<uint32_t> first_triangle(vertex_count + 1, 0);
+    for (uint32_t vertex = 0; vertex < vertex_count; ++vertex)
+        first_triangle[vertex + 1] = first_triangle[vertex] + live[vertex];
+    std::vector<uint32_t> adjacency(triangle_count * 3);
+    std::vector<uint32_t> filled(first_triangle.begin(), first_triangle.end() - 1);
+    for (size_t i = 0; i < triangle_count * 3; ++i)
+        adjacency[filled[indices[i]]++] = (uint32_t)(i / 3);
+
+    //Time stamps start one cache size in, so every vertex starts out of the cache
+    std::vector<uint32_t> cache_time(vertex_count, 0);
+    uint32_t time = (uint32_t)cache_size + 1;
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+    uint32_t cursor = 0;
+
+    bool jumped = true;
+    int64_t fan = next_vertex(candidates, live, cache_time, time, cache_size, dead_end, cursor, jumped);
+    while (fan >= 0)
+    {
+        if (jumped && clusters)
+            clusters->push_back((uint32_t)(result.size() / 3));
+        jumped = false;
+
+        //Draw every triangle around the fanning vertex that is left
+        candidates.clear();
+        for (uint32_t a = first_triangle[fan]; a < first_triangle[fan + 1]; ++a)
+        {
+            uint32_t triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t vertex = indices[triangle * 3 + k];
+                result.push_back(vertex);
+                dead_end.push_back(vertex);
+                candidates.push_back(vertex);
+                --live[vertex];
+                if (time - cache_time[vertex] > (uint32_t)cache_size)
+                    cache_time[vertex] = time++;
+            }
+            emitted[triangle] = true;
+        }
+        fan = next_vertex(candidates, live, cache_time, time, cache_size, dead_end, cursor, jumped);
+    }
+}
+
+void mesh_optimize_overdraw(const uint32_t *indices, size_t count, const Vertex *vertices, uint32_t vertex_count, const std::vector<uint32_t> &hard_clusters,
+                            int cache_size, double threshold, std::vector<uint32_t> &result)
+{
+    size_t triangle_count = count / 3;
+    result.clear();
+    if (triangle_count == 0)
+        return;
+
+    //Soft boundaries: inside every hard cluster start a new one as soon as the triangles since the last cut reuse vertices about as
+    //well as the whole cluster does. Each cut empties the cache, which is what drawing clusters in another order does at worst
+    FifoCache cache(vertex_count, cache_size);
+    std::vector<uint32_t> clusters;
+    for (size_t h = 0; h < hard_clusters.size(); ++h)
+    {
+        size_t first = hard_clusters[h];
+        size_t last = h + 1 < hard_clusters.size() ? hard_clusters[h + 1] : triangle_count;
+        double target = cluster_acmr(indices, first * 3, last * 3, cache) * threshold;
+
+        clusters.push_back((uint32_t)first);
+        cache.reset();
+        size_t start = first;
+        uint32_t misses = 0;
+        for (size_t t = first; t + 1 < last; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+                misses += cache.access(indices[t * 3 + k]);
+            if (misses <= target * (t + 1 - start))
+            {
+                clusters.push_back((uint32_t)(t + 1));
+                cache.reset();
+                start = t + 1;
+                misses = 0;
+            }
+        }
+    }
+    if (clusters.empty() || clusters[0] != 0)
+        clusters.insert(clusters.begin(), 0);
+
+    //Sort by how much each cluster faces away from the middle of the mesh. Seen from outside, the clusters facing the camera are in
+    //front of the ones facing away, so drawing the outward facing ones first lets the depth test reject more of the rest
+    std::vector<Float3> centroid(clusters.size()), normal(clusters.size());
+    Float3 center = {0.0, 0.0, 0.0};
+    double total_area = 0.0;
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        size_t first = clusters[c];
+        size_t last = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        Float3 sum = {0.0, 0.0, 0.0}, direction = {0.0, 0.0, 0.0};
+        double area = 0.0;
+        for (size_t t = first; t < last; ++t)
+        {
+            Float3 p0 = position(vertices[indices[t * 3 + 0]]);
+            Float3 p1 = position(vertices[indices[t * 3 + 1]]);
+            Float3 p2 = position(vertices[indices[t * 3 + 2]]);
+            Float3 n = cross(sub(p1, p0), sub(p2, p0));
+            double triangle_area = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+            sum.x += (p0.x + p1.x + p2.x) * triangle_area;
+            sum.y += (p0.y + p1.y + p2.y) * triangle_area;
+            sum.z += (p0.z + p1.z + p2.z) * triangle_area;
+            direction.x += n.x;
+            direction.y += n.y;
+            direction.z += n.z;
+            area += triangle_area;
+        }
+
+        //Centroids are area weighted so a few big triangles count as much as many small ones
+        center.x += sum.x;
+        center.y += sum.y;
+        center.z += sum.z;
+        total_area += area;
+        double weight = area > 0.0 ? 1.0 / (3.0 * area) : 0.0;
+        centroid[c] = {sum.x * weight, sum.y * weight, sum.z * weight};
+
+        double length = sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+        double scale = length > 0.0 ? 1.0 / length : 0.0;
+        normal[c] = {direction.x * scale, direction.y * scale, direction.z * scale};
+    }
+    double weight = total_area > 0.0 ? 1.0 / (3.0 * total_area) : 0.0;
+    center = {center.x * weight, center.y * weight, center.z * weight};
+
+    std::vector<double> facing(clusters.size());
+    std::vector<uint32_t> order(clusters.size());
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        Float3 offset = sub(centroid[c], center);
+        facing[c] = offset.x * normal[c].x + offset.y * normal[c].y + offset.z * normal[c].z;
+        order[c] = (uint32_t)c;
+    }
+    std::stable_sort(order.begin(), order.end(), [&facing](uint32_t a, uint32_t b) { return facing[a] > facing[b]; });
+
+    result.reserve(triangle_count * 3);
+    for (uint32_t c : order)
+    {
+        size_t first = clusters[c];
+        size_t last = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        result.insert(result.end(), indices + first * 3, indices + last * 3);
+    }
+}
+
+uint32_t mesh_optimize_vertex_fetch(std::vector<uint32_t> &indices, std::vector<Vertex> &vertices)
+{
+    std::vector<uint32_t> remap(vertices.size(), never);
+    std::vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (uint32_t &index : indices)
+    {
+        if (remap[index] == never)
+        {
+            remap[index] = (uint32_t)ordered.size();
+            ordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(ordered);
+    return (uint32_t)vertices.size();
+}
+
+void mesh_optimize(Mesh &mesh)
+{
+    std::vector<uint32_t> cache_order, clusters, overdraw_order;
+    mesh_optimize_vertex_cache(mesh.indices.data(), mesh.indices.size(), (uint32_t)mesh.vertices.size(), mesh_cache_size, cache_order, &clusters);
+    mesh_optimize_overdraw(cache_order.data(), cache_order.size(), mesh.vertices.data(), (uint32_t)mesh.vertices.size(), clusters, mesh_cache_size, 1.05,
+                           overdraw_order);
+    mesh.indices.swap(overdraw_order);
+    mesh_optimize_vertex_fetch(mesh.indices, mesh.vertices);
+}
+
+MeshStats mesh_analyze(const Mesh &mesh, int cache_size)
+{
+    MeshStats stats = {};
+    size_t triangle_count = mesh.indices.size() / 3;
+    uint32_t vertex_count = (uint32_t)mesh.vertices.size();
+    if (triangle_count == 0 || vertex_count == 0)
+        return stats;
+
+    uint32_t invocations = mesh_vertex_shader_invocations(mesh.indices.data(), mesh.indices.size(), vertex_count, cache_size);
+    stats.acmr = (double)invocations / triangle_count;
+    stats.atvr = (double)invocations / vertex_count;
+    stats.overdraw = measure_overdraw(mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), vertex_count);
+    stats.overfetch = measure_overfetch(mesh.indices.data(), mesh.indices.size(), vertex_count);
+    return stats;
+}
+
+bool mesh_optimizer_benchmark()
+{
+    std::vector<Mesh> meshes;
+    meshes.push_back(mesh_make_grid(100, 100));
+    meshes.push_back(mesh_make_sphere(64, 32));
+    meshes.push_back(mesh_make_torus(96, 48));
+    meshes.push_back(mesh_make_grid(300, 300));
+
+    std::mt19937 random(1);
+    bool ok = true;
+    printf("mesh, step, acmr, atvr, overdraw, overfetch, ms\n");
+    for (Mesh &mesh : meshes)
+    {
+        auto report = [&mesh](const char *step, double seconds)
+        {
+            MeshStats stats = mesh_analyze(mesh, mesh_cache_size);
+            printf("%s, %s, %.3f, %.3f, %.3f, %.3f, %.3f\n", mesh.name.c_str(), step, stats.acmr, stats.atvr, stats.overdraw, stats.overfetch, seconds * 1000.0);
+        };
+        auto check = [&mesh, &ok](const char *step, const std::vector<uint64_t> &expected)
+        {
+            if (triangle_signature(mesh) != expected)
+            {
+                printf("%s: %s changed the triangles\n", mesh.name.c_str(), step);
+                ok = false;
+            }
+        };
+
+        report("generated", 0.0);
+        shuffle_mesh(mesh, random);
+        report("shuffled", 0.0);
+        std::vector<uint64_t> expected = triangle_signature(mesh);
+        uint32_t vertex_count = (uint32_t)mesh.vertices.size();
+
+        std::vector<uint32_t> cache_order, clusters, overdraw_order;
+        auto start = std::chrono::steady_clock::now();
+        mesh_optimize_vertex_cache(mesh.indices.data(), mesh.indices.size(), vertex_count, mesh_cache_size, cache_order, &clusters);
+        auto end = std::chrono::steady_clock::now();
+        mesh.indices = cache_order;
+        report("vertex cache", std::chrono::duration<double>(end - start).count());
+        check("vertex cache", expected);
+
+        start = std::chrono::steady_clock::now();
+        mesh_optimize_overdraw(cache_order.data(), cache_order.size(), mesh.vertices.data(), vertex_count, clusters, mesh_cache_size, 1.05, overdraw_order);
+        end = std::chrono::steady_clock::now();
+        mesh.indices = overdraw_order;
+        report("overdraw", std::chrono::duration<double>(end - start).count());
+        check("overdraw", expected);
+
+        start = std::chrono::steady_clock::now();
+        mesh_optimize_vertex_fetch(mesh.indices, mesh.vertices);
+        end = std::chrono::steady_clock::now();
+        report("vertex fetch", std::chrono::duration<double>(end - start).count());
+        check("vertex fetch", expected);
+        if (mesh.vertices.size() != vertex_count)
+        {
+            printf("%s: vertex fetch kept %zu of %u vertices\n", mesh.name.c_str(), mesh.vertices.size(), vertex_count);
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "mesh.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+    Reordering a mesh for the gpu, run on the indices before they are uploaded. Nothing changes what is drawn, only the order it is drawn in.
+
+    1. Vertex cache: the gpu keeps the last few transformed vertices around, an index that hits them skips the vertex shader. Triangles are
+       reordered with Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007): fan
+       around a vertex until it has no triangles left, then move on to the neighbour that is still in the cache, so triangles that share
+       vertices are drawn close together. It is linear in the number of indices.
+    2. Overdraw: with early depth a pixel covered by something drawn before it costs nothing. The Tipsify order is cut into clusters, at the
+       places it had to jump (hard boundaries) and wherever starting over costs little cache efficiency (soft boundaries, threshold is how
+       much worse than the cluster's own ACMR a cut may make it), and the clusters are sorted so the ones facing out are drawn first.
+       Seen from outside those are the ones in front, whatever the view.
+    3. Vertex fetch: vertices are renumbered in the order the indices first use them, so the input assembler reads the vertex buffer front
+       to back instead of jumping around in it. Vertices no triangle uses are dropped.
+
+    The numbers it is judged by:
+        ACMR       average cache miss ratio, vertex shader runs per triangle. 3 without any reuse, 0.5 is the best a large regular grid can do
+        ATVR       average transformed vertex ratio, vertex shader runs per vertex. 1 is perfect
+        overdraw   pixels shaded per pixel covered, rasterized with a depth test from six directions
+        overfetch  bytes read from the vertex buffer per byte in it, through a small model of a cache in front of memory
+*/
+
+const int mesh_cache_size = 32; // Entries of the post transform cache the optimizer targets and the stats simulate, FIFO
+
+struct MeshStats
+{
+    double acmr;
+    double atvr;
+    double overdraw;
+    double overfetch;
+};
+
+// Triangles reordered for the post transform cache. clusters (optional) gets the index of the first triangle of every run Tipsify drew
+// without jumping, the hard boundaries mesh_optimize_overdraw() starts from
+void mesh_optimize_vertex_cache(const uint32_t *indices, size_t count, uint32_t vertex_count, int cache_size, std::vector<uint32_t> &result,
+                                std::vector<uint32_t> *clusters);
+
+// Clusters of a vertex cache optimized order sorted front to back, threshold 1.05 lets the ACMR get at most 5% worse
+void mesh_optimize_overdraw(const uint32_t *indices, size_t count, const Vertex *vertices, uint32_t vertex_count, const std::vector<uint32_t> &hard_clusters,
+                            int cache_size, double threshold, std::vector<uint32_t> &result);
+
+// Renumber the vertices in the order the indices use them, returns how many are left
+uint32_t mesh_optimize_vertex_fetch(std::vector<uint32_t> &indices, std::vector<Vertex> &vertices);
+
+// All three in order, what a mesh goes through before it is uploaded
+void mesh_optimize(Mesh &mesh);
+
+MeshStats mesh_analyze(const Mesh &mesh, int cache_size);
+
+// Shuffle the triangles and vertices of the sample meshes like an exporter might, then print the stats after every step and its time.
+// Returns false if a step lost or changed a triangle
+bool mesh_optimizer_benchmark();
@@ -0,0 +1,434 @@
+#include "profiler.h"
+#include "job_system.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <unordered_map>
+#include <vector>
+
+std::atomic<bool> profiler_enabled(false);
+thread_local ProfilerThread *profiler_current_thread = nullptr;
+
+namespace
+{
+struct TraceEvent
+{
+    const char *name;
+    uint32_t thread;
+    double begin;    // ns since profiler_init()
+    double duration; // ns
+};
+
+struct ScopeStats
+{
+    std::string name;
+    std::vector<double> samples; // Rolling window of durations in ns, count % profiler_window_samples is the next one to replace
+    uint64_t count;
+};
+
+std::atomic<ProfilerThread *> profiler_threads(nullptr);
+std::atomic<uint32_t> profiler_next_thread(0);
+
+// Everything below is only touched with the mutex held, recording never takes it
+std::mutex profiler_mutex;
+bool profiler_tracing;
+uint64_t profiler_base_ticks;
+std::chrono::steady_clock::time_point profiler_base_time;
+double profiler_ns_per_tick = 1.0;
+uint64_t profiler_frame_count;
+std::vector<TraceEvent> profiler_trace;
+uint64_t profiler_trace_dropped;
+std::vector<ScopeStats> profiler_scopes;
+std::unordered_map<const char *, uint32_t> profiler_scope_index; // By pointer, the quick way
+std::map<std::string, uint32_t> profiler_scope_names;           // By text, the same literal can have another address in another file
+std::map<uint32_t, std::string> profiler_thread_names;
+
+// Gives the calling thread's ring back when the thread exits
+struct ProfilerThreadOwner
+{
+    ~ProfilerThreadOwner()
+    {
+        if (profiler_current_thread)
+        {
+            profiler_current_thread->owned.store(false, std::memory_order_release);
+            profiler_current_thread = nullptr;
+        }
+    }
+};
+thread_local ProfilerThreadOwner profiler_thread_owner;
+
+// How many ns a tick is, measured from profiler_init() to now. Longer spans give a better rate
+void calibrate_locked()
+{
+    uint64_t ticks = profiler_ticks() - profiler_base_ticks;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - profiler_base_time).count();
+    if (ticks > 0)
+        profiler_ns_per_tick = ns / (double)ticks;
+}
+
+ScopeStats &scope_locked(const char *name)
+{
+    auto found = profiler_scope_index.find(name);
+    if (found != profiler_scope_index.end())
+        return profiler_scopes[found->second];
+
+    auto named = profiler_scope_names.find(name);
+    uint32_t index;
+    if (named != profiler_scope_names.end())
+    {
+        index = named->second;
+    }
+    else
+    {
+        index = (uint32_t)profiler_scopes.size();
+        ScopeStats stats;
+        stats.name = name;
+        stats.samples.reserve(profiler_window_samples);
+        stats.count = 0;
+        profiler_scopes.push_back(stats);
+        profiler_scope_names[name] = index;
+    }
+    profiler_scope_index[name] = index;
+    return profiler_scopes[index];
+}
+
+// Into the scope's rolling window and the trace, begin and duration in ns
+void add_event_locked(uint32_t thread, const char *name, double begin, double duration)
+{
+    ScopeStats &stats = scope_locked(name);
+    if (stats.samples.size() < profiler_window_samples)
+        stats.samples.push_back(duration);
+    else
+        stats.samples[stats.count % profiler_window_samples] = duration;
+    ++stats.count;
+
+    if (!profiler_tracing)
+        return;
+    if (profiler_trace.size() < profiler_trace_max_events)
+        profiler_trace.push_back(TraceEvent{name, thread, begin, duration});
+    else
+        ++profiler_trace_dropped;
+}
+
+// Forget whatever the rings hold, nobody collects events recorded while the profiler was off
+void skip_recorded_locked()
+{
+    for (ProfilerThread *thread = profiler_threads.load(std::memory_order_acquire); thread; thread = thread->next)
+        thread->read.store(thread->write.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void reset_locked()
+{
+    profiler_frame_count = 0;
+    profiler_trace.clear();
+    profiler_trace.shrink_to_fit();
+    profiler_trace_dropped = 0;
+    profiler_scopes.clear();
+    profiler_scope_index.clear();
+    profiler_scope_names.clear();
+    for (ProfilerThread *thread = profiler_threads.load(std::memory_order_acquire); thread; thread = thread->next)
+        thread->dropped.store(0, std::memory_order_relaxed);
+}
+
+void write_json_string(FILE *file, const char *text)
+{
+    fputc('"', file);
+    for (const char *c = text; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if ((unsigned char)*c >= 0x20)
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+} // namespace
+
+ProfilerThread *profiler_claim_thread()
+{
+    // Touching the owner makes sure its destructor runs when this thread exits
+    (void)&profiler_thread_owner;
+
+    // A ring a finished thread gave back, or a new one
+    ProfilerThread *thread = profiler_threads.load(std::memory_order_acquire);
+    for (; thread; thread = thread->next)
+    {
+        bool expected = false;
+        if (!thread->owned.load(std::memory_order_relaxed) && thread->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            break;
+    }
+    if (!thread)
+    {
+        thread = new ProfilerThread();
+        thread->write.store(0, std::memory_order_relaxed);
+        thread->read.store(0, std::memory_order_relaxed);
+        thread->dropped.store(0, std::memory_order_relaxed);
+        thread->owned.store(true, std::memory_order_relaxed);
+        thread->id = profiler_next_thread.fetch_add(1);
+        thread->next = profiler_threads.load(std::memory_order_relaxed);
+        while (!profiler_threads.compare_exchange_weak(thread->next, thread, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+    else
+    {
+        // The name was the last owner's
+        std::lock_guard<std::mutex> lock(profiler_mutex);
+        profiler_thread_names.erase(thread->id);
+    }
+    profiler_current_thread = thread;
+    return thread;
+}
+
+void profiler_init(bool trace)
+{
+    profiler_enabled.store(false);
+    {
+        std::lock_guard<std::mutex> lock(profiler_mutex);
+        skip_recorded_locked();
+        reset_locked();
+        profiler_tracing = trace;
+
+        // A first rate for the tick counter, profiler_frame() refines it as time goes by
+        profiler_base_ticks = profiler_ticks();
+        profiler_base_time = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - profiler_base_time < std::chrono::milliseconds(2))
+        {
+        }
+        calibrate_locked();
+    }
+    profiler_enabled.store(true);
+}
+
+void profiler_shutdown()
+{
+    profiler_enabled.store(false);
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    skip_recorded_locked();
+    reset_locked();
+}
+
+void profiler_thread_name(const char *name)
+{
+    ProfilerThread *thread = profiler_current_thread ? profiler_current_thread : profiler_claim_thread();
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    profiler_thread_names[thread->id] = name;
+}
+
+uint32_t profiler_track(const char *name)
+{
+    // Tracks take an id from the same counter as the rings, so they get a tid of their own in the trace
+    uint32_t track = profiler_next_thread.fetch_add(1);
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    profiler_thread_names[track] = name;
+    return track;
+}
+
+void profiler_record_time(uint32_t track, const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    if (!profiler_enabled.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    double duration = std::chrono::duration<double, std::nano>(end - begin).count();
+    add_event_locked(track, name, std::chrono::duration<double, std::nano>(begin - profiler_base_time).count(), duration);
+}
+
+void profiler_frame()
+{
+    if (!profiler_enabled.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    calibrate_locked();
+    for (ProfilerThread *thread = profiler_threads.load(std::memory_order_acquire); thread; thread = thread->next)
+    {
+        uint64_t read = thread->read.load(std::memory_order_relaxed);
+        uint64_t write = thread->write.load(std::memory_order_acquire);
+        for (; read != write; ++read)
+        {
+            // Signed, an event begun just before profiler_init() is still collected
+            const ProfilerEvent &event = thread->events[read & (profiler_thread_events - 1)];
+            double begin = (double)(int64_t)(event.begin - profiler_base_ticks) * profiler_ns_per_tick;
+            double duration = (double)(event.end - event.begin) * profiler_ns_per_tick;
+            add_event_locked(thread->id, event.name, begin, duration);
+        }
+        // Only now may the thread write over the slots
+        thread->read.store(write, std::memory_order_release);
+    }
+    ++profiler_frame_count;
+}
+
+std::string profiler_summary()
+{
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+
+    struct Line
+    {
+        const ScopeStats *stats;
+        double min, avg, p99, max;
+    };
+    std::vector<Line> lines;
+    std::vector<double> sorted;
+    for (const ScopeStats &stats : profiler_scopes)
+    {
+        if (stats.samples.empty())
+            continue;
+        sorted = stats.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (double sample : sorted)
+            sum += sample;
+        size_t p99 = (sorted.size() * 99 + 99) / 100 - 1;
+        lines.push_back(Line{&stats, sorted.front(), sum / sorted.size(), sorted[p99], sorted.back()});
+    }
+
+    // Where most of the time goes first
+    std::sort(lines.begin(), lines.end(), [](const Line &a, const Line &b) {
+        return a.avg * a.stats->count > b.avg * b.stats->count;
+    });
+
+    uint64_t dropped = 0;
+    for (ProfilerThread *thread = profiler_threads.load(std::memory_order_acquire); thread; thread = thread->next)
+        dropped += thread->dropped.load(std::memory_order_relaxed);
+
+    std::string summary = "scope, calls per frame, min ms, avg ms, p99 ms, max ms\n";
+    char line[256];
+    for (const Line &l : lines)
+    {
+        snprintf(line, sizeof(line), "%s, %.2f, %.4f, %.4f, %.4f, %.4f\n", l.stats->name.c_str(),
+                 profiler_frame_count ? (double)l.stats->count / profiler_frame_count : 0.0, l.min * 1e-6, l.avg * 1e-6, l.p99 * 1e-6, l.max * 1e-6);
+        summary += line;
+    }
+    snprintf(line, sizeof(line), "profiler: %llu frames, min, avg and p99 over the last %u calls of every scope, %llu events dropped by full rings\n",
+             (unsigned long long)profiler_frame_count, profiler_window_samples, (unsigned long long)dropped);
+    summary += line;
+    return summary;
+}
+
+bool profiler_write_chrome_trace(const char *path)
+{
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    // Complete events ("X") with times in us, one tid per ring and the thread names as metadata
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto &thread : profiler_thread_names)
+    {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", thread.first);
+        write_json_string(file, thread.second.c_str());
+        fprintf(file, "}}");
+        first = false;
+    }
+    for (const TraceEvent &event : profiler_trace)
+    {
+        fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+        write_json_string(file, event.name);
+        fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.thread, event.begin * 1e-3, event.duration * 1e-3);
+        first = false;
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = ferror(file) == 0;
+    ok = fclose(file) == 0 && ok;
+    if (profiler_trace_dropped)
+        fprintf(stderr, "profiler: the trace is missing %llu events, it only keeps %llu\n", (unsigned long long)profiler_trace_dropped,
+                (unsigned long long)profiler_trace_max_events);
+    return ok;
+}
+
+// -- Benchmark --
+
+namespace
+{
+const int benchmark_scopes = 10000; // Per round, fits in a ring with room to spare
+const int benchmark_rounds = 101;
+
+// ns per scope of one round of empty scopes
+double scope_round(int scopes)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < scopes; ++i)
+    {
+        PROFILE_SCOPE("profiler_benchmark");
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / scopes;
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+} // namespace
+
+bool profiler_overhead_benchmark(int max_threads)
+{
+    // Off
+    profiler_shutdown();
+    std::vector<double> off;
+    for (int round = 0; round < benchmark_rounds; ++round)
+        off.push_back(scope_round(benchmark_scopes));
+
+    // On, collecting between the rounds like a frame would
+    profiler_init(false);
+    std::vector<double> on, collect;
+    for (int round = 0; round < benchmark_rounds; ++round)
+    {
+        on.push_back(scope_round(benchmark_scopes));
+        auto start = std::chrono::steady_clock::now();
+        profiler_frame();
+        auto end = std::chrono::steady_clock::now();
+        collect.push_back(std::chrono::duration<double, std::nano>(end - start).count() / benchmark_scopes);
+    }
+
+    // Every thread recording at once, the rings share nothing so it should cost the same. Any thread may end up running every job,
+    // so all of them have to fit in one ring
+    int job_scopes = std::min(benchmark_scopes, (int)(profiler_thread_events / max_threads) - 1);
+    job_system_init(max_threads);
+    std::vector<double> threaded;
+    std::vector<double> thread_times(max_threads);
+    for (int round = 0; round < benchmark_rounds; ++round)
+    {
+        job_parallel_for(max_threads, 1, [&](int index) { thread_times[index] = scope_round(job_scopes); });
+        profiler_frame();
+        for (double time : thread_times)
+            threaded.push_back(time);
+    }
+    job_system_shutdown();
+
+    // Every event made it into the stats
+    uint64_t recorded = 0;
+    {
+        std::lock_guard<std::mutex> lock(profiler_mutex);
+        recorded = scope_locked("profiler_benchmark").count;
+    }
+    uint64_t expected = (uint64_t)benchmark_rounds * (benchmark_scopes + (uint64_t)job_scopes * max_threads);
+    profiler_shutdown();
+
+    double scope = median(on);
+    printf("profiler: ticks from %s\n",
+#ifdef PROFILER_RDTSC
+           "rdtsc"
+#else
+           "steady_clock"
+#endif
+    );
+    printf("profiler: %.1f ns per scope off, %.1f ns per scope on (%.1f ns per marker), %.1f ns per scope on %d threads at once, %.1f ns per event to collect\n",
+           median(off), scope, scope / 2, median(threaded), max_threads, median(collect));
+    if (recorded != expected)
+    {
+        printf("profiler: collected %llu events, expected %llu\n", (unsigned long long)recorded, (unsigned long long)expected);
+        return false;
+    }
+    if (scope / 2 > 50.0)
+    {
+        printf("profiler: a marker costs more than 50 ns\n");
+        return false;
+    }
+    return true;
+}
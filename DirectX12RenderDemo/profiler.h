@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PROFILER_RDTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+/*
+    Where the milliseconds of a frame go, on the cpu.
+
+    PROFILE_SCOPE("name") times the rest of the block it is in. The name has to be a string literal (or live as long as the profiler),
+    only the pointer is kept. A scope costs two timestamps and one store into a buffer that belongs to the calling thread:
+
+        - Timestamps are the cpu's time stamp counter (rdtsc) where there is one, a few ns to read against tens of ns for
+          steady_clock. They are turned into nanoseconds when they are collected, with a rate measured against steady_clock.
+        - Every thread gets a ring of events of its own the first time it records one. Only that thread writes it and only
+          profiler_frame() reads it, so recording takes no lock and the only cache line another thread writes to is read, once a frame.
+          A thread that exits gives its ring back for the next new thread (job systems come and go in the benchmarks).
+        - If a thread records more than profiler_thread_events between two profiler_frame() calls the newest events are dropped
+          and counted, never the ones being collected.
+
+    Timings measured some other way (the gpu's) are added with profiler_record_time() on a track of their own.
+
+    profiler_frame() is called once a frame by one thread. It drains every ring into a rolling window of the last
+    profiler_window_samples durations of every scope (profiler_summary() gives min, avg, p99 and max of those) and, when the profiler
+    was started with trace on, into a list of events that profiler_write_chrome_trace() writes as Chrome trace event JSON
+    (open it in chrome://tracing or https://ui.perfetto.dev).
+
+    Before profiler_init() and after profiler_shutdown() a scope costs a load and a branch.
+*/
+
+const uint32_t profiler_thread_events = 16384;      // Events a thread may record between two profiler_frame() calls, a power of two
+const uint32_t profiler_window_samples = 1024;      // Durations per scope the summary is computed over
+const uint64_t profiler_trace_max_events = 1 << 22; // Events kept for the trace, about 100 MB, later ones are counted as dropped
+
+struct ProfilerEvent
+{
+    const char *name;
+    uint64_t begin; // Ticks
+    uint64_t end;
+};
+
+// One thread's events, a single producer single consumer ring
+struct ProfilerThread
+{
+    ProfilerEvent events[profiler_thread_events];
+    std::atomic<uint64_t> write;   // Events recorded so far, only the owning thread moves it
+    std::atomic<uint64_t> dropped; // Events that did not fit, only the owning thread adds to it
+    uint8_t padding[64];           // Keeps read off the cache line the owning thread writes
+    std::atomic<uint64_t> read;    // Events collected so far, only profiler_frame() moves it
+    std::atomic<bool> owned;       // A live thread records into it
+    uint32_t id;                   // tid in the trace
+    ProfilerThread *next;          // Every ring ever made, newest first, never unlinked
+};
+
+extern std::atomic<bool> profiler_enabled;
+extern thread_local ProfilerThread *profiler_current_thread;
+
+ProfilerThread *profiler_claim_thread(); // Find or make the calling thread's ring
+
+inline uint64_t profiler_ticks()
+{
+#ifdef PROFILER_RDTSC
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline void profiler_record(const char *name, uint64_t begin, uint64_t end)
+{
+    ProfilerThread *thread = profiler_current_thread;
+    if (!thread)
+        thread = profiler_claim_thread();
+
+    // Full means profiler_frame() has not been by in a while, drop the new event rather than overwrite one it may be reading
+    uint64_t write = thread->write.load(std::memory_order_relaxed);
+    if (write - thread->read.load(std::memory_order_acquire) >= profiler_thread_events)
+    {
+        thread->dropped.store(thread->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    ProfilerEvent &event = thread->events[write & (profiler_thread_events - 1)];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    thread->write.store(write + 1, std::memory_order_release);
+}
+
+struct ProfileScope
+{
+    const char *name; // nullptr when the profiler was off at the start of the scope
+    uint64_t begin;
+
+    explicit ProfileScope(const char *scope_name)
+    {
+        name = profiler_enabled.load(std::memory_order_relaxed) ? scope_name : nullptr;
+        begin = name ? profiler_ticks() : 0;
+    }
+    ~ProfileScope()
+    {
+        if (name)
+            profiler_record(name, begin, profiler_ticks());
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+void profiler_init(bool trace);              // Start recording, trace keeps every event for profiler_write_chrome_trace()
+void profiler_shutdown();                    // Stop recording and forget the stats and the trace, the rings stay for the next init
+void profiler_thread_name(const char *name); // Name the calling thread in the trace
+void profiler_frame();                       // Collect what every thread recorded since the last call
+
+// Events that do not come from a cpu thread, like the gpu's (see gpu_timer.h), go on a track of their own. They are added with their
+// steady_clock times, after the fact and from one thread, so they take the profiler's lock
+uint32_t profiler_track(const char *name);
+void profiler_record_time(uint32_t track, const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+std::string profiler_summary();              // One line per scope: calls per frame, min, avg, p99 and max ms over the rolling window
+bool profiler_write_chrome_trace(const char *path);
+
+// ns per scope with the profiler off, on, and on every job system thread at once (max_threads), and what collecting costs per event.
+// Returns false if a marker (half a scope) costs more than 50 ns
+bool profiler_overhead_benchmark(int max_threads);
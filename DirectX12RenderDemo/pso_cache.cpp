@@ -0,0 +1,272 @@
+// Pipeline state objects only exist with d3d12, see main.cpp
+#ifdef _WIN32
+
+#include "pso_cache.h"
+#include "hash.h"
+#include "file_io.h"
+#include <chrono>
+#include <stdio.h>
+
+namespace
+{
+const uint32_t pso_cache_version = 1;
+
+void hash_shader(uint64_t &hash, const D3D12_SHADER_BYTECODE &shader)
+{
+    hash_value(hash, (uint64_t)shader.BytecodeLength);
+    hash_bytes(hash, shader.pShaderBytecode, shader.BytecodeLength);
+}
+
+void hash_render_target_blend(uint64_t &hash, const D3D12_RENDER_TARGET_BLEND_DESC &blend)
+{
+    hash_value(hash, blend.BlendEnable);
+    hash_value(hash, blend.LogicOpEnable);
+    if (blend.BlendEnable)
+    {
+        hash_value(hash, blend.SrcBlend);
+        hash_value(hash, blend.DestBlend);
+        hash_value(hash, blend.BlendOp);
+        hash_value(hash, blend.SrcBlendAlpha);
+        hash_value(hash, blend.DestBlendAlpha);
+        hash_value(hash, blend.BlendOpAlpha);
+    }
+    if (blend.LogicOpEnable)
+        hash_value(hash, blend.LogicOp);
+    hash_value(hash, blend.RenderTargetWriteMask);
+}
+
+void hash_stencil_op(uint64_t &hash, const D3D12_DEPTH_STENCILOP_DESC &op)
+{
+    hash_value(hash, op.StencilFailOp);
+    hash_value(hash, op.StencilDepthFailOp);
+    hash_value(hash, op.StencilPassOp);
+    hash_value(hash, op.StencilFunc);
+}
+
+std::wstring pipeline_name(uint64_t hash)
+{
+    wchar_t name[32];
+    swprintf(name, 32, L"%016llx", (unsigned long long)hash);
+    return name;
+}
+} // namespace
+
+void pso_cache_add_root_signature(PsoCache &cache, ID3D12RootSignature *root_signature, const void *serialized, size_t size)
+{
+    uint64_t hash = hash_offset;
+    hash_bytes(hash, serialized, size);
+    cache.root_signatures[root_signature] = hash;
+}
+
+uint64_t pso_cache_hash(const PsoCache &cache, const D3D12_GRAPHICS_PIPELINE_STATE_DESC &desc)
+{
+    uint64_t hash = hash_offset;
+    hash_value(hash, pso_cache_version);
+
+    auto root_signature = cache.root_signatures.find(desc.pRootSignature);
+    if (root_signature != cache.root_signatures.end())
+        hash_value(hash, root_signature->second);
+    else
+        hash_value(hash, desc.pRootSignature);
+    hash_shader(hash, desc.VS);
+    hash_shader(hash, desc.PS);
+    hash_shader(hash, desc.DS);
+    hash_shader(hash, desc.HS);
+    hash_shader(hash, desc.GS);
+
+    // Stream output
+    hash_value(hash, desc.StreamOutput.NumEntries);
+    for (UINT i = 0; i < desc.StreamOutput.NumEntries; ++i)
+    {
+        const D3D12_SO_DECLARATION_ENTRY &entry = desc.StreamOutput.pSODeclaration[i];
+        hash_value(hash, entry.Stream);
+        hash_string(hash, entry.SemanticName);
+        hash_value(hash, entry.SemanticIndex);
+        hash_value(hash, entry.StartComponent);
+        hash_value(hash, entry.ComponentCount);
+        hash_value(hash, entry.OutputSlot);
+    }
+    hash_value(hash, desc.StreamOutput.NumStrides);
+    hash_bytes(hash, desc.StreamOutput.pBufferStrides, desc.StreamOutput.NumStrides * sizeof(UINT));
+    if (desc.StreamOutput.NumEntries)
+        hash_value(hash, desc.StreamOutput.RasterizedStream);
+
+    // Blend, only the targets that exist. Without independent blend every target uses the first one's state
+    hash_value(hash, desc.BlendState.AlphaToCoverageEnable);
+    hash_value(hash, desc.BlendState.IndependentBlendEnable);
+    UINT blend_targets = desc.BlendState.IndependentBlendEnable ? desc.NumRenderTargets : (desc.NumRenderTargets ? 1 : 0);
+    for (UINT i = 0; i < blend_targets; ++i)
+        hash_render_target_blend(hash, desc.BlendState.RenderTarget[i]);
+    hash_value(hash, desc.SampleMask);
+
+    // Rasterizer
+    const D3D12_RASTERIZER_DESC &rasterizer = desc.RasterizerState;
+    hash_value(hash, rasterizer.FillMode);
+    hash_value(hash, rasterizer.CullMode);
+    hash_value(hash, rasterizer.FrontCounterClockwise);
+    hash_value(hash, rasterizer.DepthBias);
+    hash_value(hash, rasterizer.DepthBiasClamp);
+    hash_value(hash, rasterizer.SlopeScaledDepthBias);
+    hash_value(hash, rasterizer.DepthClipEnable);
+    hash_value(hash, rasterizer.MultisampleEnable);
+    hash_value(hash, rasterizer.AntialiasedLineEnable);
+    hash_value(hash, rasterizer.ForcedSampleCount);
+    hash_value(hash, rasterizer.ConservativeRaster);
+
+    // Depth and stencil, the ops only matter when the test is on
+    const D3D12_DEPTH_STENCIL_DESC &depth = desc.DepthStencilState;
+    hash_value(hash, depth.DepthEnable);
+    if (depth.DepthEnable)
+    {
+        hash_value(hash, depth.DepthWriteMask);
+        hash_value(hash, depth.DepthFunc);
+    }
+    hash_value(hash, depth.StencilEnable);
+    if (depth.StencilEnable)
+    {
+        hash_value(hash, depth.StencilReadMask);
+        hash_value(hash, depth.StencilWriteMask);
+        hash_stencil_op(hash, depth.FrontFace);
+        hash_stencil_op(hash, depth.BackFace);
+    }
+
+    // Input layout by value, the semantic names are usually string literals that live at different addresses
+    hash_value(hash, desc.InputLayout.NumElements);
+    for (UINT i = 0; i < desc.InputLayout.NumElements; ++i)
+    {
+        const D3D12_INPUT_ELEMENT_DESC &element = desc.InputLayout.pInputElementDescs[i];
+        hash_string(hash, element.SemanticName);
+        hash_value(hash, element.SemanticIndex);
+        hash_value(hash, element.Format);
+        hash_value(hash, element.InputSlot);
+        hash_value(hash, element.AlignedByteOffset);
+        hash_value(hash, element.InputSlotClass);
+        hash_value(hash, element.InstanceDataStepRate);
+    }
+    hash_value(hash, desc.IBStripCutValue);
+    hash_value(hash, desc.PrimitiveTopologyType);
+
+    // Outputs
+    hash_value(hash, desc.NumRenderTargets);
+    for (UINT i = 0; i < desc.NumRenderTargets; ++i)
+        hash_value(hash, desc.RTVFormats[i]);
+    hash_value(hash, desc.DSVFormat);
+    hash_value(hash, desc.SampleDesc.Count);
+    hash_value(hash, desc.SampleDesc.Quality);
+    hash_value(hash, desc.NodeMask);
+    hash_value(hash, desc.Flags);
+    return hash;
+}
+
+bool pso_cache_init(PsoCache &cache, ID3D12Device *device, const char *path)
+{
+    cache.device = device;
+    cache.library = nullptr;
+    cache.library_data.clear();
+    cache.path = path;
+    cache.pipelines.clear();
+    cache.root_signatures.clear();
+    cache.dirty = false;
+    cache.hits = 0;
+    cache.library_hits = 0;
+    cache.misses = 0;
+    cache.seconds_creating = 0.0;
+
+    // Pipeline libraries need ID3D12Device1, without it the cache only dedups in memory
+    ID3D12Device1 *device1 = nullptr;
+    if (FAILED(device->QueryInterface(IID_PPV_ARGS(&device1))))
+        return true;
+
+    // Load what the last run saved. A library from another driver or adapter is refused, start over with an empty one then
+    HRESULT result = E_FAIL;
+    if (file_read(cache.path, cache.library_data) && !cache.library_data.empty())
+        result = device1->CreatePipelineLibrary(cache.library_data.data(), cache.library_data.size(), IID_PPV_ARGS(&cache.library));
+    if (FAILED(result))
+    {
+        cache.library_data.clear();
+        result = device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&cache.library));
+        if (FAILED(result))
+            cache.library = nullptr;
+    }
+    device1->Release();
+    return true;
+}
+
+void pso_cache_shutdown(PsoCache &cache)
+{
+    for (auto &pipeline : cache.pipelines)
+        pipeline.second->Release();
+    cache.pipelines.clear();
+    cache.root_signatures.clear();
+    if (cache.library)
+        cache.library->Release();
+    cache.library = nullptr;
+    cache.library_data.clear();
+}
+
+HRESULT pso_cache_get(PsoCache &cache, const D3D12_GRAPHICS_PIPELINE_STATE_DESC &desc, ID3D12PipelineState **pipeline)
+{
+    uint64_t hash = pso_cache_hash(cache, desc);
+
+    auto found = cache.pipelines.find(hash);
+    if (found != cache.pipelines.end())
+    {
+        ++cache.hits;
+        found->second->AddRef();
+        *pipeline = found->second;
+        return S_OK;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::wstring name = pipeline_name(hash);
+    HRESULT result = E_FAIL;
+    if (cache.library)
+        result = cache.library->LoadGraphicsPipeline(name.c_str(), &desc, IID_PPV_ARGS(pipeline));
+
+    if (SUCCEEDED(result))
+    {
+        ++cache.library_hits;
+    }
+    else
+    {
+        result = cache.device->CreateGraphicsPipelineState(&desc, IID_PPV_ARGS(pipeline));
+        if (FAILED(result))
+            return result;
+        ++cache.misses;
+
+        if (cache.library && SUCCEEDED(cache.library->StorePipeline(name.c_str(), *pipeline)))
+            cache.dirty = true;
+    }
+    cache.seconds_creating += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The cache keeps one reference, the caller gets the other
+    (*pipeline)->AddRef();
+    cache.pipelines[hash] = *pipeline;
+    return S_OK;
+}
+
+bool pso_cache_save(PsoCache &cache)
+{
+    if (!cache.library || !cache.dirty)
+        return true;
+
+    std::vector<uint8_t> data(cache.library->GetSerializedSize());
+    if (FAILED(cache.library->Serialize(data.data(), data.size())))
+        return false;
+
+    // Same as the shader cache, never leave a half written file where the next run would load it
+    if (!file_write_atomic(cache.path, nullptr, 0, data.data(), data.size()))
+        return false;
+    cache.dirty = false;
+    return true;
+}
+
+std::string pso_cache_summary(const PsoCache &cache)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "pso cache: %u hits, %u from the pipeline library, %u compiled, %.1f ms creating%s\n",
+             cache.hits, cache.library_hits, cache.misses, cache.seconds_creating * 1000.0, cache.library ? "" : " (no pipeline library)");
+    return line;
+}
+
+#endif // _WIN32
@@ -0,0 +1,55 @@
+#pragma once
+
+// Pipeline state objects only exist with d3d12, see main.cpp
+#ifdef _WIN32
+
+#include <d3d12.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Cache of pipeline state objects keyed by a hash of their desc.
+
+    The desc is hashed in a canonical form: shaders by a hash of their bytecode instead of the pointer, the input layout by the semantic
+    names instead of the string pointers, and state that cannot matter is left out (blend factors of targets with blending off, the blend
+    state of targets past NumRenderTargets, depth and stencil ops when the test is off, ...). Two descs built in different places for the
+    same pipeline so end up with the same hash and get the same object back. Root signatures are hashed by the serialized blob they were
+    created from, register them with pso_cache_add_root_signature() (an unregistered one is hashed by pointer, which still dedups but
+    changes every run, so its pipelines never come back from the library).
+
+    On a miss the pipeline is looked up in an ID3D12PipelineLibrary loaded from disk, which skips the driver compile, and only created
+    from scratch when the library does not have it either. pso_cache_save() writes the library back so the next start is warm. A library
+    written by another driver or gpu is rejected when it is loaded and the cache starts over with an empty one.
+*/
+
+struct PsoCache
+{
+    ID3D12Device *device;
+    ID3D12PipelineLibrary *library; // nullptr if the device cannot do pipeline libraries, the cache still works in memory
+    std::vector<uint8_t> library_data; // The library reads from this, it has to live as long as the library
+    std::string path;
+    std::unordered_map<uint64_t, ID3D12PipelineState *> pipelines;
+    std::unordered_map<ID3D12RootSignature *, uint64_t> root_signatures; // Hash of each root signature's serialized blob
+    bool dirty; // Pipelines were added to the library since it was loaded
+
+    uint32_t hits;         // Found in memory
+    uint32_t library_hits; // Loaded from the library on disk
+    uint32_t misses;       // Compiled
+    double seconds_creating; // Spent in LoadGraphicsPipeline and CreateGraphicsPipelineState
+};
+
+bool pso_cache_init(PsoCache &cache, ID3D12Device *device, const char *path);
+void pso_cache_shutdown(PsoCache &cache); // Releases every pipeline, save first if you want to keep them
+
+void pso_cache_add_root_signature(PsoCache &cache, ID3D12RootSignature *root_signature, const void *serialized, size_t size);
+uint64_t pso_cache_hash(const PsoCache &cache, const D3D12_GRAPHICS_PIPELINE_STATE_DESC &desc);
+
+// Same as CreateGraphicsPipelineState: pipeline gets a reference the caller releases
+HRESULT pso_cache_get(PsoCache &cache, const D3D12_GRAPHICS_PIPELINE_STATE_DESC &desc, ID3D12PipelineState **pipeline);
+
+bool pso_cache_save(PsoCache &cache); // Write the library to disk if anything new went into it
+std::string pso_cache_summary(const PsoCache &cache);
+
+#endif // _WIN32
@@ -0,0 +1,621 @@
+#include "rasterizer.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// The simd kernels only exist on x86. Intrinsics for a newer instruction set than the one the file is compiled for need a target attribute on gcc and clang,
+// msvc lets us use them anywhere. Either way they only run after cpuid said they are there
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RASTERIZER_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RASTERIZER_TARGET_SSE2
+#define RASTERIZER_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define RASTERIZER_TARGET_SSE2 __attribute__((target("sse2")))
+#define RASTERIZER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+const int64_t subpixel_one = 1 << rasterizer_subpixel_bits;
+
+/*
+    The simd kernels evaluate 8 pixels of an edge as one 32 bit start value plus a 32 bit offset per lane (lane * A).
+    Edge values themselves need 64 bits, but we only care about their sign. If |7 * A| < 2^30 we can clamp the start value to +-2^30:
+    when it was bigger than that, adding an offset cannot change its sign either way, and the sum stays below 2^30 + 2^30 = 2^31 so it
+    still fits in 32 bits. A is the edge's height in 16.8 fixed point times 256, height * 65536 in pixels, so this holds for edges up to
+    ~2340 pixels tall (2^30 / 7 / 65536), taller than a 2160p back buffer. Anything taller goes to the scalar kernel.
+    rasterizer_stress() draws triangles right around that height with every kernel.
+*/
+const int64_t span_clamp = (int64_t)1 << 30;
+const int64_t span_offset_limit = (int64_t)1 << 30;
+
+int64_t floor_div(int64_t a, int64_t b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+uint32_t count_bits(uint32_t bits)
+{
+    bits = bits - ((bits >> 1) & 0x55555555u);
+    bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+    return (((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+}
+
+bool fits_span(const RasterizerTriangle &triangle)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        int64_t a = triangle.edge_a[i] < 0 ? -triangle.edge_a[i] : triangle.edge_a[i];
+        if (a * 7 >= span_offset_limit)
+            return false;
+    }
+    return true;
+}
+
+int32_t clamp_span(int64_t e)
+{
+    return (int32_t)(e > span_clamp ? span_clamp : (e < -span_clamp ? -span_clamp : e));
+}
+
+// -- Scalar -- //
+
+uint32_t kernel_scalar(const RasterizerTriangle &triangle, uint32_t *pixels, int pitch, int x0, int y0, int x1, int y1)
+{
+    uint32_t written = 0;
+    for (int py = y0; py <= y1; ++py)
+    {
+        int64_t e0 = triangle.edge_a[0] * x0 + triangle.edge_b[0] * py + triangle.edge_c[0];
+        int64_t e1 = triangle.edge_a[1] * x0 + triangle.edge_b[1] * py + triangle.edge_c[1];
+        int64_t e2 = triangle.edge_a[2] * x0 + triangle.edge_b[2] * py + triangle.edge_c[2];
+        uint32_t *row = pixels + (size_t)py * pitch;
+
+        float fy = (float)(py - triangle.y0);
+        float row_color[4];
+        for (int k = 0; k < 4; ++k)
+            row_color[k] = triangle.color_origin[k] + triangle.color_dy[k] * fy;
+
+        for (int px = x0; px <= x1; ++px)
+        {
+            // The sign bit of the or is set if any of the three is negative
+            if ((e0 | e1 | e2) >= 0)
+            {
+                float fx = (float)(px - triangle.x0);
+                row[px] = to_unorm8(row_color[0] + triangle.color_dx[0] * fx) |
+                          (to_unorm8(row_color[1] + triangle.color_dx[1] * fx) << 8) |
+                          (to_unorm8(row_color[2] + triangle.color_dx[2] * fx) << 16) |
+                          (to_unorm8(row_color[3] + triangle.color_dx[3] * fx) << 24);
+                ++written;
+            }
+            e0 += triangle.edge_a[0];
+            e1 += triangle.edge_a[1];
+            e2 += triangle.edge_a[2];
+        }
+    }
+    return written;
+}
+
+#ifdef RASTERIZER_X86
+
+// -- SSE2 -- //
+
+RASTERIZER_TARGET_SSE2
+__m128i pack_sse2(const __m128 row_color[4], const __m128 color_dx[4], __m128 fx)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    // max(c, 0) returns 0 when c is NaN because maxps hands back the second operand
+    __m128 r = _mm_min_ps(_mm_max_ps(_mm_add_ps(row_color[0], _mm_mul_ps(color_dx[0], fx)), zero), one);
+    __m128 g = _mm_min_ps(_mm_max_ps(_mm_add_ps(row_color[1], _mm_mul_ps(color_dx[1], fx)), zero), one);
+    __m128 b = _mm_min_ps(_mm_max_ps(_mm_add_ps(row_color[2], _mm_mul_ps(color_dx[2], fx)), zero), one);
+    __m128 a = _mm_min_ps(_mm_max_ps(_mm_add_ps(row_color[3], _mm_mul_ps(color_dx[3], fx)), zero), one);
+
+    __m128i ri = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half));
+    __m128i gi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half));
+    __m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+    __m128i ai = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), half));
+
+    return _mm_or_si128(_mm_or_si128(ri, _mm_slli_epi32(gi, 8)), _mm_or_si128(_mm_slli_epi32(bi, 16), _mm_slli_epi32(ai, 24)));
+}
+
+RASTERIZER_TARGET_SSE2
+uint32_t kernel_sse2(const RasterizerTriangle &triangle, uint32_t *pixels, int pitch, int x0, int y0, int x1, int y1)
+{
+    if (!fits_span(triangle))
+        return kernel_scalar(triangle, pixels, pitch, x0, y0, x1, y1);
+
+    // No 32 bit multiply in sse2, the lane offsets are cheap enough to set up by hand
+    __m128i offset_lo[3], offset_hi[3];
+    int64_t step[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        int32_t a = (int32_t)triangle.edge_a[i];
+        offset_lo[i] = _mm_setr_epi32(0, a, a * 2, a * 3);
+        offset_hi[i] = _mm_setr_epi32(a * 4, a * 5, a * 6, a * 7);
+        step[i] = triangle.edge_a[i] * 8;
+    }
+
+    const __m128i lane_lo = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i lane_hi = _mm_setr_epi32(4, 5, 6, 7);
+    __m128 color_dx[4];
+    for (int k = 0; k < 4; ++k)
+        color_dx[k] = _mm_set1_ps(triangle.color_dx[k]);
+
+    uint32_t written = 0;
+    for (int py = y0; py <= y1; ++py)
+    {
+        int64_t e[3];
+        for (int i = 0; i < 3; ++i)
+            e[i] = triangle.edge_a[i] * x0 + triangle.edge_b[i] * py + triangle.edge_c[i];
+        uint32_t *row = pixels + (size_t)py * pitch;
+
+        float fy = (float)(py - triangle.y0);
+        __m128 row_color[4];
+        for (int k = 0; k < 4; ++k)
+            row_color[k] = _mm_set1_ps(triangle.color_origin[k] + triangle.color_dy[k] * fy);
+
+        for (int px = x0; px <= x1; px += 8)
+        {
+            __m128i start0 = _mm_set1_epi32(clamp_span(e[0]));
+            __m128i start1 = _mm_set1_epi32(clamp_span(e[1]));
+            __m128i start2 = _mm_set1_epi32(clamp_span(e[2]));
+            __m128i outside_lo = _mm_or_si128(_mm_or_si128(_mm_add_epi32(start0, offset_lo[0]), _mm_add_epi32(start1, offset_lo[1])), _mm_add_epi32(start2, offset_lo[2]));
+            __m128i outside_hi = _mm_or_si128(_mm_or_si128(_mm_add_epi32(start0, offset_hi[0]), _mm_add_epi32(start1, offset_hi[1])), _mm_add_epi32(start2, offset_hi[2]));
+
+            // Lanes past the end of the rect count as outside
+            __m128i remaining = _mm_set1_epi32(x1 - px + 1);
+            __m128i mask_lo = _mm_andnot_si128(_mm_srai_epi32(outside_lo, 31), _mm_cmpgt_epi32(remaining, lane_lo));
+            __m128i mask_hi = _mm_andnot_si128(_mm_srai_epi32(outside_hi, 31), _mm_cmpgt_epi32(remaining, lane_hi));
+            uint32_t bits = (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(mask_lo)) | ((uint32_t)_mm_movemask_ps(_mm_castsi128_ps(mask_hi)) << 4);
+
+            if (bits)
+            {
+                __m128i base = _mm_set1_epi32(px - triangle.x0);
+                __m128i packed_lo = pack_sse2(row_color, color_dx, _mm_cvtepi32_ps(_mm_add_epi32(base, lane_lo)));
+                __m128i packed_hi = pack_sse2(row_color, color_dx, _mm_cvtepi32_ps(_mm_add_epi32(base, lane_hi)));
+
+                if (bits == 0xff)
+                {
+                    _mm_storeu_si128((__m128i *)(row + px), packed_lo);
+                    _mm_storeu_si128((__m128i *)(row + px + 4), packed_hi);
+                }
+                else
+                {
+                    // Edges of the triangle, sse2 has no masked store so write the covered lanes one by one
+                    alignas(16) uint32_t span[8];
+                    _mm_store_si128((__m128i *)span, packed_lo);
+                    _mm_store_si128((__m128i *)(span + 4), packed_hi);
+                    for (int lane = 0; lane < 8; ++lane)
+                    {
+                        if (bits & (1u << lane))
+                            row[px + lane] = span[lane];
+                    }
+                }
+                written += count_bits(bits);
+            }
+
+            e[0] += step[0];
+            e[1] += step[1];
+            e[2] += step[2];
+        }
+    }
+    return written;
+}
+
+// -- AVX2 -- //
+
+RASTERIZER_TARGET_AVX2
+uint32_t kernel_avx2(const RasterizerTriangle &triangle, uint32_t *pixels, int pitch, int x0, int y0, int x1, int y1)
+{
+    if (!fits_span(triangle))
+        return kernel_scalar(triangle, pixels, pitch, x0, y0, x1, y1);
+
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i offset[3];
+    int64_t step[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        offset[i] = _mm256_mullo_epi32(_mm256_set1_epi32((int32_t)triangle.edge_a[i]), lane);
+        step[i] = triangle.edge_a[i] * 8;
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256 color_dx[4];
+    for (int k = 0; k < 4; ++k)
+        color_dx[k] = _mm256_set1_ps(triangle.color_dx[k]);
+
+    uint32_t written = 0;
+    for (int py = y0; py <= y1; ++py)
+    {
+        int64_t e[3];
+        for (int i = 0; i < 3; ++i)
+            e[i] = triangle.edge_a[i] * x0 + triangle.edge_b[i] * py + triangle.edge_c[i];
+        uint32_t *row = pixels + (size_t)py * pitch;
+
+        float fy = (float)(py - triangle.y0);
+        __m256 row_color[4];
+        for (int k = 0; k < 4; ++k)
+            row_color[k] = _mm256_set1_ps(triangle.color_origin[k] + triangle.color_dy[k] * fy);
+
+        for (int px = x0; px <= x1; px += 8)
+        {
+            __m256i outside = _mm256_or_si256(_mm256_or_si256(_mm256_add_epi32(_mm256_set1_epi32(clamp_span(e[0])), offset[0]),
+                                                              _mm256_add_epi32(_mm256_set1_epi32(clamp_span(e[1])), offset[1])),
+                                              _mm256_add_epi32(_mm256_set1_epi32(clamp_span(e[2])), offset[2]));
+
+            // Lanes past the end of the rect count as outside
+            __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(x1 - px + 1), lane);
+            __m256i mask = _mm256_andnot_si256(_mm256_srai_epi32(outside, 31), valid);
+            uint32_t bits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(mask));
+
+            if (bits)
+            {
+                __m256 fx = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(px - triangle.x0), lane));
+
+                // max(c, 0) returns 0 when c is NaN because maxps hands back the second operand
+                __m256 r = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(row_color[0], _mm256_mul_ps(color_dx[0], fx)), zero), one);
+                __m256 g = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(row_color[1], _mm256_mul_ps(color_dx[1], fx)), zero), one);
+                __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(row_color[2], _mm256_mul_ps(color_dx[2], fx)), zero), one);
+                __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(row_color[3], _mm256_mul_ps(color_dx[3], fx)), zero), one);
+
+                __m256i ri = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(r, scale), half));
+                __m256i gi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(g, scale), half));
+                __m256i bi = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(b, scale), half));
+                __m256i ai = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(a, scale), half));
+                __m256i packed = _mm256_or_si256(_mm256_or_si256(ri, _mm256_slli_epi32(gi, 8)), _mm256_or_si256(_mm256_slli_epi32(bi, 16), _mm256_slli_epi32(ai, 24)));
+
+                // Masked lanes are not touched at all, so this never writes outside the rect
+                _mm256_maskstore_epi32((int *)(row + px), mask, packed);
+                written += count_bits(bits);
+            }
+
+            e[0] += step[0];
+            e[1] += step[1];
+            e[2] += step[2];
+        }
+    }
+    return written;
+}
+
+// -- CPUID -- //
+
+void cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; ++i)
+        regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Which register states the os saves on a context switch. avx needs both the sse (bit 1) and the avx (bit 2) state
+uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+bool cpu_has_sse2()
+{
+    unsigned int regs[4];
+    cpuid(1, 0, regs);
+    return (regs[3] & (1u << 26)) != 0;
+}
+
+bool cpu_has_avx2()
+{
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return false;
+
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (!osxsave || !avx || (xgetbv0() & 6) != 6)
+        return false;
+
+    cpuid(7, 0, regs);
+    return (regs[1] & (1u << 5)) != 0;
+}
+
+#endif // RASTERIZER_X86
+} // namespace
+
+bool rasterizer_setup(const int64_t x[3], const int64_t y[3], const float color[3][4],
+                      int clip_x0, int clip_y0, int clip_x1, int clip_y1, RasterizerTriangle &triangle)
+{
+    // Twice the signed area. With y pointing down a clockwise triangle has positive area, anything else is a back face (or has no area at all)
+    int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area <= 0)
+        return false;
+
+    // Pixel bounds of the triangle, a pixel is only touched if its center is inside
+    int64_t min_x = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2]) : (x[1] < x[2] ? x[1] : x[2]);
+    int64_t max_x = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2]) : (x[1] > x[2] ? x[1] : x[2]);
+    int64_t min_y = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+    int64_t max_y = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+
+    int64_t x0 = floor_div(min_x - subpixel_one / 2 + subpixel_one - 1, subpixel_one);
+    int64_t x1 = floor_div(max_x - subpixel_one / 2, subpixel_one);
+    int64_t y0 = floor_div(min_y - subpixel_one / 2 + subpixel_one - 1, subpixel_one);
+    int64_t y1 = floor_div(max_y - subpixel_one / 2, subpixel_one);
+
+    if (x0 < clip_x0) x0 = clip_x0;
+    if (y0 < clip_y0) y0 = clip_y0;
+    if (x1 > clip_x1) x1 = clip_x1;
+    if (y1 > clip_y1) y1 = clip_y1;
+    if (x0 > x1 || y0 > y1)
+        return false;
+
+    /*
+        Edge functions, one per edge, evaluated at pixel centers. Edge i is the one opposite vertex i so its value is the (scaled) barycentric weight of vertex i.
+        In pixel coordinates each one is E(px, py) = A * px + B * py + C
+        The top-left rule: a pixel exactly on an edge is only drawn if that edge is a top or a left edge. For clockwise triangles in y down
+        a left edge goes up and a top edge is flat and goes right. We fold the rule into C by subtracting one from the other edges so a single >= 0 test works
+    */
+    int64_t edge_c[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        int64_t dx = x[b] - x[a];
+        int64_t dy = y[b] - y[a];
+        triangle.edge_a[i] = -dy * subpixel_one;
+        triangle.edge_b[i] = dx * subpixel_one;
+        edge_c[i] = dx * (subpixel_one / 2 - y[a]) - dy * (subpixel_one / 2 - x[a]);
+        bool top_left = dy < 0 || (dy == 0 && dx > 0);
+        triangle.edge_c[i] = edge_c[i] + (top_left ? 0 : -1);
+    }
+
+    // The color is a plane over the triangle: color(px, py) = sum(E_i * color_i) / area. Set it up relative to the first pixel so floats keep their precision
+    for (int k = 0; k < 4; ++k)
+    {
+        double dx = 0.0, dy = 0.0, origin = 0.0;
+        for (int i = 0; i < 3; ++i)
+        {
+            double e = (double)(triangle.edge_a[i] * x0 + triangle.edge_b[i] * y0 + edge_c[i]);
+            dx += (double)triangle.edge_a[i] * color[i][k];
+            dy += (double)triangle.edge_b[i] * color[i][k];
+            origin += e * color[i][k];
+        }
+        triangle.color_dx[k] = (float)(dx / (double)area);
+        triangle.color_dy[k] = (float)(dy / (double)area);
+        triangle.color_origin[k] = (float)(origin / (double)area);
+    }
+
+    triangle.x0 = (int)x0;
+    triangle.y0 = (int)y0;
+    triangle.x1 = (int)x1;
+    triangle.y1 = (int)y1;
+    return true;
+}
+
+bool rasterizer_isa_supported(RasterizerIsa isa)
+{
+    switch (isa)
+    {
+    case RASTERIZER_ISA_SCALAR:
+        return true;
+#ifdef RASTERIZER_X86
+    case RASTERIZER_ISA_SSE2:
+        return cpu_has_sse2();
+    case RASTERIZER_ISA_AVX2:
+        return cpu_has_avx2();
+#endif
+    default:
+        return false;
+    }
+}
+
+RasterizerIsa rasterizer_detect_isa()
+{
+    // Cpuid is not free, ask once
+    static RasterizerIsa best = rasterizer_isa_supported(RASTERIZER_ISA_AVX2) ? RASTERIZER_ISA_AVX2
+                                : rasterizer_isa_supported(RASTERIZER_ISA_SSE2) ? RASTERIZER_ISA_SSE2
+                                                                                 : RASTERIZER_ISA_SCALAR;
+    return best;
+}
+
+const char *rasterizer_isa_name(RasterizerIsa isa)
+{
+    switch (isa)
+    {
+    case RASTERIZER_ISA_SCALAR: return "scalar";
+    case RASTERIZER_ISA_SSE2: return "sse2";
+    case RASTERIZER_ISA_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+RasterizerKernel rasterizer_kernel(RasterizerIsa isa)
+{
+    switch (isa)
+    {
+#ifdef RASTERIZER_X86
+    case RASTERIZER_ISA_SSE2:
+        return kernel_sse2;
+    case RASTERIZER_ISA_AVX2:
+        return kernel_avx2;
+#endif
+    default:
+        return kernel_scalar;
+    }
+}
+
+void rasterizer_benchmark(int triangle_count, double seconds_per_isa)
+{
+    const int size = 1024;
+
+    // Random clockwise triangles of all sizes over a 1024x1024 target, the same ones for every isa
+    std::vector<RasterizerTriangle> triangles;
+    uint32_t seed = 12345;
+    auto random = [&seed](int range) {
+        seed = seed * 1664525u + 1013904223u;
+        return (int64_t)((seed >> 8) % (uint32_t)range);
+    };
+    while ((int)triangles.size() < triangle_count)
+    {
+        int64_t extent = (random(4) + 1) * 64 * subpixel_one; // up to 256 pixels across
+        int64_t cx = random(size * (int)subpixel_one);
+        int64_t cy = random(size * (int)subpixel_one);
+        int64_t x[3], y[3];
+        float color[3][4];
+        for (int i = 0; i < 3; ++i)
+        {
+            x[i] = cx + random((int)extent) - extent / 2;
+            y[i] = cy + random((int)extent) - extent / 2;
+            for (int k = 0; k < 4; ++k)
+                color[i][k] = (float)random(1001) / 1000.0f;
+        }
+        RasterizerTriangle triangle;
+        if (rasterizer_setup(x, y, color, 0, 0, size - 1, size - 1, triangle))
+            triangles.push_back(triangle);
+        else
+        {
+            // Counter clockwise, flip it around
+            int64_t tx = x[1], ty = y[1];
+            x[1] = x[2]; y[1] = y[2];
+            x[2] = tx; y[2] = ty;
+            if (rasterizer_setup(x, y, color, 0, 0, size - 1, size - 1, triangle))
+                triangles.push_back(triangle);
+        }
+    }
+
+    std::vector<uint32_t> reference((size_t)size * size, 0);
+    std::vector<uint32_t> image((size_t)size * size, 0);
+    double scalar_rate = 0.0;
+
+    printf("isa, Mpixels/s, speedup, matches scalar\n");
+    for (int isa = 0; isa < RASTERIZER_ISA_COUNT; ++isa)
+    {
+        if (!rasterizer_isa_supported((RasterizerIsa)isa))
+        {
+            printf("%s, not supported\n", rasterizer_isa_name((RasterizerIsa)isa));
+            continue;
+        }
+        RasterizerKernel kernel = rasterizer_kernel((RasterizerIsa)isa);
+
+        // One pass to compare the output against the scalar kernel
+        std::fill(image.begin(), image.end(), 0);
+        for (size_t i = 0; i < triangles.size(); ++i)
+        {
+            const RasterizerTriangle &t = triangles[i];
+            kernel(t, image.data(), size, t.x0, t.y0, t.x1, t.y1);
+        }
+        if (isa == RASTERIZER_ISA_SCALAR)
+            reference = image;
+        bool matches = memcmp(reference.data(), image.data(), image.size() * sizeof(uint32_t)) == 0;
+
+        uint64_t pixels = 0;
+        double elapsed = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        while (elapsed < seconds_per_isa)
+        {
+            for (size_t i = 0; i < triangles.size(); ++i)
+            {
+                const RasterizerTriangle &t = triangles[i];
+                pixels += kernel(t, image.data(), size, t.x0, t.y0, t.x1, t.y1);
+            }
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double rate = pixels / elapsed / 1e6;
+        if (isa == RASTERIZER_ISA_SCALAR)
+            scalar_rate = rate;
+        printf("%s, %.1f, %.2f, %s\n", rasterizer_isa_name((RasterizerIsa)isa), rate, rate / scalar_rate, matches ? "yes" : "NO");
+    }
+}
+
+bool rasterizer_stress(int triangle_count, unsigned int seed)
+{
+    // Tall and narrow, so every triangle is close to the height the simd kernels can still take and pixels far from an edge hit the clamp
+    const int width = 96;
+    const int height = 2400;
+    const int64_t limit_height = span_offset_limit / 7 / (subpixel_one * subpixel_one); // in pixels
+
+    uint32_t state = seed;
+    auto random = [&state](int range) {
+        state = state * 1664525u + 1013904223u;
+        return (int64_t)((state >> 8) % (uint32_t)range);
+    };
+
+    std::vector<uint32_t> reference((size_t)width * height);
+    std::vector<uint32_t> image((size_t)width * height);
+    int simd_triangles = 0;
+    int scalar_triangles = 0;
+    for (int n = 0; n < triangle_count; ++n)
+    {
+        // Tallest edge between 2200 and 2400 pixels, most of them below the limit
+        int64_t tall = (limit_height - 140 + random(200)) * subpixel_one + random((int)subpixel_one);
+        int64_t top = random((int)(height * subpixel_one - tall));
+        int64_t x[3] = {random(width * (int)subpixel_one), random(width * (int)subpixel_one), random(width * (int)subpixel_one)};
+        int64_t y[3] = {top, top + tall, top + random((int)tall)};
+        float color[3][4];
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int k = 0; k < 4; ++k)
+                color[i][k] = (float)random(1001) / 1000.0f;
+        }
+
+        RasterizerTriangle triangle;
+        if (!rasterizer_setup(x, y, color, 0, 0, width - 1, height - 1, triangle))
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            if (!rasterizer_setup(x, y, color, 0, 0, width - 1, height - 1, triangle))
+                continue; // Degenerate
+        }
+        if (fits_span(triangle))
+            ++simd_triangles;
+        else
+            ++scalar_triangles;
+
+        std::fill(reference.begin(), reference.end(), 0);
+        uint32_t reference_written = kernel_scalar(triangle, reference.data(), width, triangle.x0, triangle.y0, triangle.x1, triangle.y1);
+        for (int isa = RASTERIZER_ISA_SCALAR + 1; isa < RASTERIZER_ISA_COUNT; ++isa)
+        {
+            if (!rasterizer_isa_supported((RasterizerIsa)isa))
+                continue;
+            std::fill(image.begin(), image.end(), 0);
+            uint32_t written = rasterizer_kernel((RasterizerIsa)isa)(triangle, image.data(), width, triangle.x0, triangle.y0, triangle.x1, triangle.y1);
+            if (written != reference_written || memcmp(reference.data(), image.data(), image.size() * sizeof(uint32_t)) != 0)
+            {
+                printf("rasterizer stress: %s and scalar differ on triangle %d, (%lld, %lld) (%lld, %lld) (%lld, %lld) in 16.8\n",
+                       rasterizer_isa_name((RasterizerIsa)isa), n, (long long)x[0], (long long)y[0], (long long)x[1], (long long)y[1],
+                       (long long)x[2], (long long)y[2]);
+                return false;
+            }
+        }
+    }
+
+    printf("rasterizer stress: %d triangles up to %d pixels tall matched scalar, %d of them were taller than the simd limit of %lld pixels\n",
+           simd_triangles + scalar_triangles, (int)(limit_height + 60), scalar_triangles, (long long)limit_height);
+    if (triangle_count >= 10 && simd_triangles == 0)
+    {
+        printf("rasterizer stress: no triangle went through the simd kernels\n");
+        return false;
+    }
+    return true;
+}
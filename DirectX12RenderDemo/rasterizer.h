@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Triangle setup and the pixel loops of the cpu backend.
+
+    rasterizer_setup() turns a snapped screen space triangle into edge functions and color planes.
+    A RasterizerKernel then walks a rectangle of pixels and writes every pixel whose center is inside the triangle.
+    Since pixel.hlsl only returns the interpolated color, a pixel costs three edge tests and four plane evaluations, so
+    the kernels do 8 pixels at a time:
+        scalar  one pixel at a time, works everywhere
+        sse2    two 4 wide halves
+        avx2    one 8 wide register, masked stores for the coverage
+    The best one the cpu supports is picked at runtime with cpuid. All of them produce exactly the same pixels.
+*/
+
+const int rasterizer_subpixel_bits = 8; // d3d snaps vertices to 16.8 fixed point
+
+// float -> UNORM8 like the output merger does it: clamp, scale, round to nearest. The simd kernels do exactly the same operations in the same
+// order, and the cpu backend packs its clear colors with it
+inline uint32_t to_unorm8(float value)
+{
+    if (!(value > 0.0f)) // also catches NaN, which d3d converts to 0
+        return 0;
+    if (value >= 1.0f)
+        return 255;
+    return (uint32_t)(value * 255.0f + 0.5f);
+}
+
+// A triangle ready to be rasterized: edge functions with the fill rule folded in, color planes and the pixel rect it can touch
+struct RasterizerTriangle
+{
+    int64_t edge_a[3]; // E(px, py) = A * px + B * py + C, a pixel is inside when all three are >= 0
+    int64_t edge_b[3];
+    int64_t edge_c[3];
+    float color_dx[4];
+    float color_dy[4];
+    float color_origin[4]; // color at (x0, y0)
+    int x0, y0, x1, y1;    // inclusive
+};
+
+// Pixels inside [x0, x1] x [y0, y1] get shaded, the rect must already be inside the triangle's. Returns the number of pixels written
+typedef uint32_t (*RasterizerKernel)(const RasterizerTriangle &triangle, uint32_t *pixels, int pitch, int x0, int y0, int x1, int y1);
+
+enum RasterizerIsa
+{
+    RASTERIZER_ISA_SCALAR,
+    RASTERIZER_ISA_SSE2,
+    RASTERIZER_ISA_AVX2,
+    RASTERIZER_ISA_COUNT
+};
+
+// Set up a triangle with 16.8 fixed point screen coordinates, clipped to the inclusive pixel rect. Returns false if there is nothing to draw
+bool rasterizer_setup(const int64_t x[3], const int64_t y[3], const float color[3][4],
+                      int clip_x0, int clip_y0, int clip_x1, int clip_y1, RasterizerTriangle &triangle);
+
+RasterizerIsa rasterizer_detect_isa();             // Best kernel the cpu and os support
+bool rasterizer_isa_supported(RasterizerIsa isa);
+const char *rasterizer_isa_name(RasterizerIsa isa);
+RasterizerKernel rasterizer_kernel(RasterizerIsa isa);
+
+// Runs every supported kernel over the same random triangles, prints Mpixels/s per isa and checks they all wrote the same image
+void rasterizer_benchmark(int triangle_count, double seconds_per_isa);
+
+// Draws triangles around the tallest edge the simd kernels handle (see span_offset_limit) with every supported kernel and checks they match scalar
+bool rasterizer_stress(int triangle_count, unsigned int seed);
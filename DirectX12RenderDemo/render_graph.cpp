@@ -0,0 +1,1003 @@
+#include "render_graph.h"
+#include "profiler.h"
+#include "align.h"
+#include <stdio.h>
+#include <algorithm>
+#include <queue>
+#include <random>
+
+namespace
+{
+const uint64_t default_alignment = 64 * 1024; // D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+
+// Barriers are computed before the physical resources exist, so they are keyed by resource index + 1 (0 would look like a null resource)
+void *resource_key(int resource)
+{
+    return (void *)(intptr_t)(resource + 1);
+}
+
+int key_resource(void *key)
+{
+    return (int)(intptr_t)key - 1;
+}
+
+bool lifetimes_overlap(const RenderGraphResource &a, const RenderGraphResource &b)
+{
+    return a.first_pass <= b.last_pass && b.first_pass <= a.last_pass;
+}
+
+bool memory_overlaps(const RenderGraphResource &a, const RenderGraphResource &b)
+{
+    return a.offset < b.offset + b.desc.size && b.offset < a.offset + a.desc.size;
+}
+
+// Kept: passes with side effects and the writers of outputs, then everything a kept pass reads or writes over
+void cull(RenderGraph &graph)
+{
+    std::vector<int> stack;
+    for (size_t p = 0; p < graph.passes.size(); ++p)
+    {
+        graph.passes[p].culled = true;
+        if (graph.passes[p].side_effects)
+            stack.push_back((int)p);
+    }
+    for (const RenderGraphVersion &version : graph.versions)
+    {
+        if (version.output && version.writer >= 0)
+            stack.push_back(version.writer);
+    }
+
+    while (!stack.empty())
+    {
+        RenderGraphPass &pass = graph.passes[stack.back()];
+        stack.pop_back();
+        if (!pass.culled)
+            continue;
+        pass.culled = false;
+
+        for (const RenderGraphAccess &access : pass.accesses)
+        {
+            int writer = graph.versions[access.version].writer;
+            if (writer >= 0 && graph.passes[writer].culled)
+                stack.push_back(writer);
+        }
+    }
+}
+
+// Kahn's algorithm over the passes that are left. A pass depends on the writer of every version it touches, and a write also waits for
+// the readers of the version it replaces. The ready pass that was added first goes next
+bool sort(RenderGraph &graph)
+{
+    size_t count = graph.passes.size();
+    std::vector<std::vector<int>> successors(count);
+    std::vector<int> predecessors(count, 0);
+    auto depend = [&](int before, int after) {
+        if (before < 0 || before == after || graph.passes[before].culled)
+            return;
+        successors[before].push_back(after);
+        ++predecessors[after];
+    };
+
+    size_t alive = 0;
+    for (size_t p = 0; p < count; ++p)
+    {
+        if (graph.passes[p].culled)
+            continue;
+        ++alive;
+        for (const RenderGraphAccess &access : graph.passes[p].accesses)
+        {
+            const RenderGraphVersion &version = graph.versions[access.version];
+            depend(version.writer, (int)p);
+            if (access.write)
+            {
+                for (int reader : version.readers)
+                    depend(reader, (int)p);
+            }
+        }
+    }
+
+    std::priority_queue<int, std::vector<int>, std::greater<int>> ready;
+    for (size_t p = 0; p < count; ++p)
+    {
+        if (!graph.passes[p].culled && predecessors[p] == 0)
+            ready.push((int)p);
+    }
+    while (!ready.empty())
+    {
+        int pass = ready.top();
+        ready.pop();
+        graph.order.push_back(pass);
+        for (int successor : successors[pass])
+        {
+            if (--predecessors[successor] == 0)
+                ready.push(successor);
+        }
+    }
+
+    if (graph.order.size() != alive)
+    {
+        graph.error = "the passes depend on each other in a cycle";
+        return false;
+    }
+    return true;
+}
+
+/*
+    Transients are placed biggest first, each at the lowest offset where it does not overlap anything already placed that is alive at the same
+    time. Anything that is not alive at the same time is free to share. Greedy, but for the handful of targets a frame has it gets close to the
+    best packing and it is deterministic.
+*/
+void place_transients(RenderGraph &graph)
+{
+    std::vector<int> transients;
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        const RenderGraphResource &resource = graph.resources[r];
+        if (!resource.imported && resource.first_pass >= 0)
+        {
+            transients.push_back((int)r);
+            graph.transient_size_unaliased = align_up(graph.transient_size_unaliased, resource.desc.alignment) + resource.desc.size;
+        }
+    }
+    std::stable_sort(transients.begin(), transients.end(), [&graph](int a, int b) { return graph.resources[a].desc.size > graph.resources[b].desc.size; });
+
+    std::vector<int> placed;
+    for (int r : transients)
+    {
+        RenderGraphResource &resource = graph.resources[r];
+
+        // The lowest offset that works is 0 or right behind one of the resources in the way
+        std::vector<uint64_t> candidates(1, 0);
+        for (int other : placed)
+        {
+            if (lifetimes_overlap(resource, graph.resources[other]))
+                candidates.push_back(align_up(graph.resources[other].offset + graph.resources[other].desc.size, resource.desc.alignment));
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (uint64_t offset : candidates)
+        {
+            resource.offset = offset;
+            bool fits = true;
+            for (int other : placed)
+            {
+                if (lifetimes_overlap(resource, graph.resources[other]) && memory_overlaps(resource, graph.resources[other]))
+                {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits)
+                break;
+        }
+        placed.push_back(r);
+        graph.transient_size = std::max(graph.transient_size, resource.offset + resource.desc.size);
+    }
+
+    // Greedy can lose to no aliasing at all when big alignments leave holes. Then just put them one after another
+    if (graph.transient_size > graph.transient_size_unaliased)
+    {
+        std::sort(transients.begin(), transients.end());
+        uint64_t offset = 0;
+        for (int r : transients)
+        {
+            graph.resources[r].offset = align_up(offset, graph.resources[r].desc.alignment);
+            offset = graph.resources[r].offset + graph.resources[r].desc.size;
+        }
+        graph.transient_size = offset;
+    }
+
+    // A transient sharing memory needs an aliasing barrier before its first pass, every frame: if nothing used the memory earlier in the
+    // frame, whatever used it last in the frame before did. With more than one candidate the barrier says "any" (before = -1)
+    for (int r : transients)
+    {
+        const RenderGraphResource &resource = graph.resources[r];
+        int before = -1;
+        int candidates = 0;
+        bool earlier = false;
+        for (int other : transients)
+        {
+            const RenderGraphResource &used = graph.resources[other];
+            if (other == r || !memory_overlaps(resource, used))
+                continue;
+            bool used_earlier = used.last_pass < resource.first_pass;
+            if (earlier && !used_earlier)
+                continue;
+            if (used_earlier && !earlier)
+            {
+                earlier = true;
+                candidates = 0;
+            }
+            ++candidates;
+            before = other;
+        }
+        if (candidates == 0)
+            continue;
+
+        RenderGraphAlias alias = {candidates == 1 ? before : -1, r};
+        graph.passes[graph.order[resource.first_pass]].aliases.push_back(alias);
+        ++graph.alias_count;
+    }
+}
+
+/*
+    The graph runs as one stream of passes, so the states can be worked out with a tracker that already knows where every resource starts.
+    Transients are created in the state the frame leaves them in, so the next frame finds them the same way the first one does and there is
+    never a barrier back at the end. That is the state of their last access, unless the tracker combined two read states on the way. Every
+    transient is written before it is read, so its final state does not depend on the one it starts in and a second run settles it.
+*/
+bool simulate_barriers(RenderGraph &graph)
+{
+    ResourceStateRegistry registry;
+    ResourceStateTracker tracker;
+    resource_state_tracker_init(tracker, registry);
+
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        const RenderGraphResource &resource = graph.resources[r];
+        if (resource.first_pass < 0)
+            continue;
+        resource_state_register(registry, resource_key((int)r), 1, resource.initial_state);
+        resource_state_assume(tracker, resource_key((int)r), resource.initial_state);
+    }
+
+    for (int p : graph.order)
+    {
+        RenderGraphPass &pass = graph.passes[p];
+        pass.barriers.clear();
+        for (const RenderGraphAccess &access : pass.accesses)
+            resource_state_transition(tracker, resource_key(graph.versions[access.version].resource), resource_all_subresources, access.state);
+        resource_state_flush(tracker, [&pass](const ResourceTransition *barriers, int count) { pass.barriers.assign(barriers, barriers + count); });
+    }
+
+    graph.final_barriers.clear();
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        if (graph.resources[r].imported && graph.resources[r].first_pass >= 0)
+            resource_state_transition_exact(tracker, resource_key((int)r), resource_all_subresources, graph.resources[r].final_state);
+    }
+    resource_state_flush(tracker, [&graph](const ResourceTransition *barriers, int count) { graph.final_barriers.assign(barriers, barriers + count); });
+    graph.barrier_count = (int)tracker.barriers;
+
+    bool settled = true;
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        RenderGraphResource &resource = graph.resources[r];
+        if (resource.imported || resource.first_pass < 0)
+            continue;
+        ResourceState final_state = tracker.resources[resource_key((int)r)][0];
+        settled = settled && final_state == resource.initial_state;
+        resource.initial_state = final_state;
+    }
+    return settled;
+}
+
+void compute_barriers(RenderGraph &graph)
+{
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        RenderGraphResource &resource = graph.resources[r];
+        if (resource.imported || resource.first_pass < 0)
+            continue;
+        const RenderGraphPass &last = graph.passes[graph.order[resource.last_pass]];
+        for (const RenderGraphAccess &access : last.accesses)
+        {
+            if (graph.versions[access.version].resource == (int)r)
+                resource.initial_state = access.state;
+        }
+    }
+
+    if (!simulate_barriers(graph))
+        simulate_barriers(graph);
+}
+} // namespace
+
+void render_graph_reset(RenderGraph &graph)
+{
+    graph.resources.clear();
+    graph.versions.clear();
+    graph.passes.clear();
+    graph.error.clear();
+    graph.order.clear();
+    graph.final_barriers.clear();
+    graph.transient_size_unaliased = 0;
+    graph.transient_size = 0;
+    graph.barrier_count = 0;
+    graph.alias_count = 0;
+}
+
+RenderGraphTextureDesc render_graph_texture_desc(uint32_t width, uint32_t height, uint32_t format, uint32_t bytes_per_pixel)
+{
+    RenderGraphTextureDesc desc = {width, height, format, bytes_per_pixel, 0, default_alignment};
+    desc.size = align_up((uint64_t)width * height * bytes_per_pixel, default_alignment);
+    return desc;
+}
+
+RenderGraphHandle render_graph_create(RenderGraph &graph, const char *name, const RenderGraphTextureDesc &desc)
+{
+    RenderGraphResource resource = {};
+    resource.name = name;
+    resource.desc = desc;
+    if (resource.desc.alignment == 0)
+        resource.desc.alignment = default_alignment;
+    graph.resources.push_back(resource);
+
+    RenderGraphVersion version = {(int)graph.resources.size() - 1, -1, -1, {}, false};
+    graph.versions.push_back(version);
+    return (RenderGraphHandle)graph.versions.size() - 1;
+}
+
+RenderGraphHandle render_graph_import(RenderGraph &graph, const char *name, void *physical, ResourceState initial_state, ResourceState final_state)
+{
+    RenderGraphResource resource = {};
+    resource.name = name;
+    resource.imported = true;
+    resource.physical = physical;
+    resource.initial_state = initial_state;
+    resource.final_state = final_state;
+    graph.resources.push_back(resource);
+
+    RenderGraphVersion version = {(int)graph.resources.size() - 1, -1, -1, {}, false};
+    graph.versions.push_back(version);
+    return (RenderGraphHandle)graph.versions.size() - 1;
+}
+
+void render_graph_set_physical(RenderGraph &graph, RenderGraphHandle handle, void *physical)
+{
+    graph.resources[graph.versions[handle].resource].physical = physical;
+}
+
+int render_graph_add_pass(RenderGraph &graph, const char *name, std::function<void(int, int, int)> execute, bool side_effects)
+{
+    RenderGraphPass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.side_effects = side_effects;
+    pass.culled = false;
+    pass.single_list = false;
+    graph.passes.push_back(pass);
+    return (int)graph.passes.size() - 1;
+}
+
+void render_graph_read(RenderGraph &graph, int pass, RenderGraphHandle handle, ResourceState state)
+{
+    RenderGraphVersion &version = graph.versions[handle];
+    if (version.writer < 0 && !graph.resources[version.resource].imported)
+        graph.error = graph.passes[pass].name + " reads " + graph.resources[version.resource].name + " before anything wrote it";
+
+    version.readers.push_back(pass);
+    graph.passes[pass].accesses.push_back({handle, state, false});
+}
+
+RenderGraphHandle render_graph_write(RenderGraph &graph, int pass, RenderGraphHandle handle, ResourceState state)
+{
+    if (graph.versions[handle].next >= 0)
+        graph.error = graph.passes[pass].name + " writes over a version of " + graph.resources[graph.versions[handle].resource].name + " somebody already wrote over";
+
+    RenderGraphVersion version = {graph.versions[handle].resource, pass, -1, {}, false};
+    graph.versions.push_back(version);
+    RenderGraphHandle written = (RenderGraphHandle)graph.versions.size() - 1;
+    graph.versions[handle].next = written;
+    graph.passes[pass].accesses.push_back({handle, state, true});
+    return written;
+}
+
+void render_graph_output(RenderGraph &graph, RenderGraphHandle handle)
+{
+    graph.versions[handle].output = true;
+}
+
+bool render_graph_compile(RenderGraph &graph)
+{
+    PROFILE_SCOPE("render_graph_compile");
+    graph.order.clear();
+    graph.final_barriers.clear();
+    graph.transient_size_unaliased = 0;
+    graph.transient_size = 0;
+    graph.barrier_count = 0;
+    graph.alias_count = 0;
+    for (RenderGraphPass &pass : graph.passes)
+    {
+        pass.aliases.clear();
+        pass.barriers.clear();
+        pass.single_list = false;
+    }
+    for (RenderGraphResource &resource : graph.resources)
+    {
+        resource.first_pass = -1;
+        resource.last_pass = -1;
+        resource.offset = 0;
+    }
+
+    //Mistakes made while building the graph
+    if (!graph.error.empty())
+        return false;
+
+    cull(graph);
+    if (!sort(graph))
+        return false;
+
+    //Lifetimes, as positions in the order. From the first pass that touches a transient on everything goes on one command list, see render_graph_execute()
+    bool single_list = false;
+    for (int position = 0; position < (int)graph.order.size(); ++position)
+    {
+        RenderGraphPass &pass = graph.passes[graph.order[position]];
+        for (const RenderGraphAccess &access : pass.accesses)
+        {
+            RenderGraphResource &resource = graph.resources[graph.versions[access.version].resource];
+            if (resource.first_pass < 0)
+                resource.first_pass = position;
+            resource.last_pass = position;
+            if (!resource.imported)
+                single_list = true;
+        }
+        pass.single_list = single_list;
+    }
+
+    place_transients(graph);
+    compute_barriers(graph);
+    return true;
+}
+
+void render_graph_realize(RenderGraph &graph, ResourceStateRegistry &registry, const std::function<void *(const RenderGraphResource &)> &create)
+{
+    for (RenderGraphResource &resource : graph.resources)
+    {
+        if (!resource.imported && resource.first_pass >= 0)
+        {
+            resource.physical = create(resource);
+            if (resource.physical)
+                resource_state_register(registry, resource.physical, 1, resource.initial_state);
+        }
+    }
+}
+
+void render_graph_execute(RenderGraph &graph, ResourceStateTracker &tracker, const std::function<void(const ResourceTransition *, int)> &flush,
+                          const std::function<void(void *, void *)> &alias, int thread, int thread_count)
+{
+    PROFILE_SCOPE("render_graph_execute");
+    //The last list of the frame is the only one that touches the transients and it knows where they are, every frame leaves them in the
+    //state they were created in. Saying so keeps their first barrier behind the aliasing barrier instead of in front of the whole list
+    bool last = thread == thread_count - 1;
+    if (last)
+    {
+        for (const RenderGraphResource &resource : graph.resources)
+        {
+            if (!resource.imported && resource.physical)
+                resource_state_assume(tracker, resource.physical, resource.initial_state);
+        }
+    }
+
+    for (int p : graph.order)
+    {
+        RenderGraphPass &pass = graph.passes[p];
+        if (pass.single_list && !last)
+            continue;
+        if (last && alias)
+        {
+            for (const RenderGraphAlias &aliasing : pass.aliases)
+                alias(aliasing.before >= 0 ? graph.resources[aliasing.before].physical : nullptr, graph.resources[aliasing.after].physical);
+        }
+
+        for (const RenderGraphAccess &access : pass.accesses)
+        {
+            void *physical = graph.resources[graph.versions[access.version].resource].physical;
+            if (physical)
+                resource_state_transition(tracker, physical, resource_all_subresources, access.state);
+        }
+        resource_state_flush(tracker, flush);
+        if (pass.single_list)
+            pass.execute(thread, 0, 1);
+        else
+            pass.execute(thread, thread, thread_count);
+    }
+
+    if (last)
+    {
+        for (const RenderGraphResource &resource : graph.resources)
+        {
+            if (resource.imported && resource.physical && resource.first_pass >= 0)
+                resource_state_transition_exact(tracker, resource.physical, resource_all_subresources, resource.final_state);
+        }
+        resource_state_flush(tracker, flush);
+    }
+}
+
+std::string render_graph_report(const RenderGraph &graph)
+{
+    char line[512];
+    std::string report;
+
+    int culled = (int)(graph.passes.size() - graph.order.size());
+    snprintf(line, sizeof(line), "render graph: %d passes, %d culled, %d barriers, %d aliasing barriers\n",
+             (int)graph.passes.size(), culled, graph.barrier_count, graph.alias_count);
+    report += line;
+
+    for (int position = 0; position < (int)graph.order.size(); ++position)
+    {
+        const RenderGraphPass &pass = graph.passes[graph.order[position]];
+        std::string writes;
+        for (const RenderGraphAccess &access : pass.accesses)
+        {
+            if (access.write)
+                writes += " " + graph.resources[graph.versions[access.version].resource].name;
+        }
+        snprintf(line, sizeof(line), "  %2d %-16s %d barriers %d aliasing, writes%s\n", position, pass.name.c_str(), (int)pass.barriers.size(),
+                 (int)pass.aliases.size(), writes.c_str());
+        report += line;
+    }
+    if (!graph.final_barriers.empty())
+    {
+        snprintf(line, sizeof(line), "     %-16s %d barriers\n", "(end)", (int)graph.final_barriers.size());
+        report += line;
+    }
+
+    for (const RenderGraphPass &pass : graph.passes)
+    {
+        if (pass.culled)
+            report += "  culled " + pass.name + "\n";
+    }
+
+    for (const RenderGraphResource &resource : graph.resources)
+    {
+        if (resource.imported || resource.first_pass < 0)
+            continue;
+        snprintf(line, sizeof(line), "  %-16s %6.2f MB at %6.2f MB, passes %d to %d\n", resource.name.c_str(), resource.desc.size / (1024.0 * 1024.0),
+                 resource.offset / (1024.0 * 1024.0), resource.first_pass, resource.last_pass);
+        report += line;
+    }
+
+    double saved = graph.transient_size_unaliased ? 100.0 * (1.0 - (double)graph.transient_size / graph.transient_size_unaliased) : 0.0;
+    snprintf(line, sizeof(line), "  peak transient memory %.2f MB without aliasing, %.2f MB aliased, %.0f%% saved\n",
+             graph.transient_size_unaliased / (1024.0 * 1024.0), graph.transient_size / (1024.0 * 1024.0), saved);
+    report += line;
+    return report;
+}
+
+namespace
+{
+// A deferred frame: what a real renderer's graph looks like. The debug view is not an output so it gets culled
+void build_example(RenderGraph &graph, int width, int height)
+{
+    auto nothing = [](int, int, int) {};
+    render_graph_reset(graph);
+    RenderGraphHandle back_buffer = render_graph_import(graph, "back buffer", nullptr, resource_state_present, resource_state_present);
+    RenderGraphHandle albedo = render_graph_create(graph, "albedo", render_graph_texture_desc(width, height, 28, 4));
+    RenderGraphHandle normal = render_graph_create(graph, "normal", render_graph_texture_desc(width, height, 10, 8));
+    RenderGraphHandle depth = render_graph_create(graph, "depth", render_graph_texture_desc(width, height, 40, 4));
+    RenderGraphHandle ao = render_graph_create(graph, "ao", render_graph_texture_desc(width, height, 61, 1));
+    RenderGraphHandle hdr = render_graph_create(graph, "hdr", render_graph_texture_desc(width, height, 10, 8));
+    RenderGraphHandle bloom_half = render_graph_create(graph, "bloom half", render_graph_texture_desc(width / 2, height / 2, 10, 8));
+    RenderGraphHandle bloom = render_graph_create(graph, "bloom", render_graph_texture_desc(width / 2, height / 2, 10, 8));
+    RenderGraphHandle ldr = render_graph_create(graph, "ldr", render_graph_texture_desc(width, height, 28, 4));
+    RenderGraphHandle debug = render_graph_create(graph, "debug", render_graph_texture_desc(width, height, 28, 4));
+
+    // Added out of order on purpose, the sort puts them right
+    int fxaa = render_graph_add_pass(graph, "fxaa", nothing);
+    int tonemap = render_graph_add_pass(graph, "tonemap", nothing);
+    int gbuffer = render_graph_add_pass(graph, "gbuffer", nothing);
+    int debug_view = render_graph_add_pass(graph, "debug view", nothing);
+    int ssao = render_graph_add_pass(graph, "ssao", nothing);
+    int lighting = render_graph_add_pass(graph, "lighting", nothing);
+    int bloom_down = render_graph_add_pass(graph, "bloom down", nothing);
+    int bloom_up = render_graph_add_pass(graph, "bloom up", nothing);
+
+    albedo = render_graph_write(graph, gbuffer, albedo, resource_state_render_target);
+    normal = render_graph_write(graph, gbuffer, normal, resource_state_render_target);
+    depth = render_graph_write(graph, gbuffer, depth, resource_state_depth_write);
+
+    render_graph_read(graph, ssao, normal, resource_state_non_pixel_shader_resource);
+    render_graph_read(graph, ssao, depth, resource_state_non_pixel_shader_resource);
+    ao = render_graph_write(graph, ssao, ao, resource_state_unordered_access);
+
+    render_graph_read(graph, lighting, albedo, resource_state_pixel_shader_resource);
+    render_graph_read(graph, lighting, normal, resource_state_pixel_shader_resource);
+    render_graph_read(graph, lighting, depth, resource_state_depth_read);
+    render_graph_read(graph, lighting, ao, resource_state_pixel_shader_resource);
+    hdr = render_graph_write(graph, lighting, hdr, resource_state_render_target);
+
+    render_graph_read(graph, bloom_down, hdr, resource_state_pixel_shader_resource);
+    bloom_half = render_graph_write(graph, bloom_down, bloom_half, resource_state_render_target);
+    render_graph_read(graph, bloom_up, bloom_half, resource_state_pixel_shader_resource);
+    bloom = render_graph_write(graph, bloom_up, bloom, resource_state_render_target);
+
+    render_graph_read(graph, debug_view, normal, resource_state_pixel_shader_resource);
+    debug = render_graph_write(graph, debug_view, debug, resource_state_render_target);
+
+    render_graph_read(graph, tonemap, hdr, resource_state_pixel_shader_resource);
+    render_graph_read(graph, tonemap, bloom, resource_state_pixel_shader_resource);
+    ldr = render_graph_write(graph, tonemap, ldr, resource_state_render_target);
+
+    render_graph_read(graph, fxaa, ldr, resource_state_pixel_shader_resource);
+    back_buffer = render_graph_write(graph, fxaa, back_buffer, resource_state_render_target);
+    render_graph_output(graph, back_buffer);
+}
+
+// A pass that wants a resource in wanted finds it usable in state: the same, or read states that include it
+bool state_allows(ResourceState state, ResourceState wanted)
+{
+    return state == wanted || (is_read_state(state) && is_read_state(wanted) && (wanted & ~state) == 0);
+}
+
+// Everything render_graph_compile() promises, checked the slow way
+bool check_compiled(const RenderGraph &graph, int index)
+{
+    std::vector<int> position(graph.passes.size(), -1);
+    for (int i = 0; i < (int)graph.order.size(); ++i)
+        position[graph.order[i]] = i;
+
+    for (size_t p = 0; p < graph.passes.size(); ++p)
+    {
+        const RenderGraphPass &pass = graph.passes[p];
+        if (pass.culled != (position[p] < 0))
+        {
+            printf("render graph %d: %s is culled but scheduled, or neither\n", index, pass.name.c_str());
+            return false;
+        }
+        if (pass.culled)
+            continue;
+
+        // Dependencies are alive and run first
+        bool needed = pass.side_effects;
+        for (const RenderGraphAccess &access : pass.accesses)
+        {
+            const RenderGraphVersion &version = graph.versions[access.version];
+            if (version.writer >= 0 && position[version.writer] < 0)
+            {
+                printf("render graph %d: %s needs %s, which was culled\n", index, pass.name.c_str(), graph.passes[version.writer].name.c_str());
+                return false;
+            }
+            if (version.writer >= 0 && position[version.writer] >= position[p])
+            {
+                printf("render graph %d: %s runs before %s, which writes what it uses\n", index, pass.name.c_str(), graph.passes[version.writer].name.c_str());
+                return false;
+            }
+            for (int reader : version.readers)
+            {
+                if (access.write && reader != (int)p && position[reader] >= position[p])
+                {
+                    printf("render graph %d: %s writes over what %s still reads\n", index, pass.name.c_str(), graph.passes[reader].name.c_str());
+                    return false;
+                }
+            }
+            if (access.write && graph.versions[version.next].output)
+                needed = true;
+        }
+
+        // And nothing survives that nobody needs
+        for (size_t q = 0; q < graph.passes.size() && !needed; ++q)
+        {
+            if (graph.passes[q].culled)
+                continue;
+            for (const RenderGraphAccess &access : graph.passes[q].accesses)
+            {
+                if (graph.versions[access.version].writer == (int)p)
+                    needed = true;
+            }
+        }
+        if (!needed)
+        {
+            printf("render graph %d: %s is kept but nothing needs it\n", index, pass.name.c_str());
+            return false;
+        }
+    }
+
+    // Transients alive at the same time never share memory, and the heap is no bigger than no aliasing at all
+    for (size_t a = 0; a < graph.resources.size(); ++a)
+    {
+        const RenderGraphResource &first = graph.resources[a];
+        if (first.imported || first.first_pass < 0)
+            continue;
+        if (first.offset % first.desc.alignment != 0 || first.offset + first.desc.size > graph.transient_size)
+        {
+            printf("render graph %d: %s is placed outside the heap or misaligned\n", index, first.name.c_str());
+            return false;
+        }
+        for (size_t b = a + 1; b < graph.resources.size(); ++b)
+        {
+            const RenderGraphResource &second = graph.resources[b];
+            if (!second.imported && second.first_pass >= 0 && lifetimes_overlap(first, second) && memory_overlaps(first, second))
+            {
+                printf("render graph %d: %s and %s are alive at the same time in the same memory\n", index, first.name.c_str(), second.name.c_str());
+                return false;
+            }
+        }
+    }
+    if (graph.transient_size > graph.transient_size_unaliased)
+    {
+        printf("render graph %d: aliasing made the heap bigger\n", index);
+        return false;
+    }
+
+    // Replay the barriers: every pass finds its resources in the states it asked for, and the frame ends where the next one starts
+    std::vector<ResourceState> states(graph.resources.size());
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+        states[r] = graph.resources[r].initial_state;
+    auto apply = [&states, index](const std::vector<ResourceTransition> &barriers) {
+        for (const ResourceTransition &barrier : barriers)
+        {
+            int r = key_resource(barrier.resource);
+            if (states[r] != barrier.before)
+            {
+                printf("render graph %d: barrier from a state the resource is not in\n", index);
+                return false;
+            }
+            states[r] = barrier.after;
+        }
+        return true;
+    };
+    for (int p : graph.order)
+    {
+        if (!apply(graph.passes[p].barriers))
+            return false;
+        for (const RenderGraphAccess &access : graph.passes[p].accesses)
+        {
+            if (!state_allows(states[graph.versions[access.version].resource], access.state))
+            {
+                printf("render graph %d: %s uses a resource in the wrong state\n", index, graph.passes[p].name.c_str());
+                return false;
+            }
+        }
+    }
+    if (!apply(graph.final_barriers))
+        return false;
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        const RenderGraphResource &resource = graph.resources[r];
+        if (resource.first_pass >= 0 && states[r] != (resource.imported ? resource.final_state : resource.initial_state))
+        {
+            printf("render graph %d: %s does not end the frame where the next one starts\n", index, resource.name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Run a compiled graph the way the renderers do, on several command lists with a tracker each, for a few frames. Then replay the lists in
+    submission order, every list behind the barriers resource_state_resolve() puts in front of it: each pass has to find its resources in the
+    states it asked for, run on the right lists, and every frame has to end where the next one starts
+*/
+bool check_execute(RenderGraph &graph, int index)
+{
+    const int thread_count = 3;
+    const int frames = 3;
+
+    // What a command list recorded, in order: a barrier batch (pass -1) or a pass and the share it was asked for
+    struct ListEvent
+    {
+        int pass;
+        int thread;
+        int share;
+        int share_count;
+        std::vector<ResourceTransition> barriers;
+    };
+    std::vector<ListEvent> lists[thread_count];
+    int recording = 0;
+
+    // The resources are their keys, the imported ones registered like the renderers do and the transients by render_graph_realize()
+    ResourceStateRegistry registry;
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+    {
+        if (graph.resources[r].imported)
+        {
+            graph.resources[r].physical = resource_key((int)r);
+            resource_state_register(registry, graph.resources[r].physical, 1, graph.resources[r].initial_state);
+        }
+    }
+    const RenderGraphResource *first = graph.resources.data();
+    render_graph_realize(graph, registry, [first](const RenderGraphResource &resource) { return resource_key((int)(&resource - first)); });
+    for (int p : graph.order)
+    {
+        graph.passes[p].execute = [&lists, &recording, p](int thread, int share, int count) {
+            lists[recording].push_back({p, thread, share, count, std::vector<ResourceTransition>()});
+        };
+    }
+    auto flush = [&lists, &recording](const ResourceTransition *barriers, int count) {
+        lists[recording].push_back({-1, 0, 0, 0, std::vector<ResourceTransition>(barriers, barriers + count)});
+    };
+
+    std::vector<ResourceState> states(graph.resources.size());
+    for (size_t r = 0; r < graph.resources.size(); ++r)
+        states[r] = graph.resources[r].initial_state;
+    auto apply = [&states, index](const std::vector<ResourceTransition> &barriers) {
+        for (const ResourceTransition &barrier : barriers)
+        {
+            int r = key_resource(barrier.resource);
+            if (states[r] != barrier.before)
+            {
+                printf("render graph %d: a command list has a barrier from a state the resource is not in\n", index);
+                return false;
+            }
+            states[r] = barrier.after;
+        }
+        return true;
+    };
+
+    ResourceStateTracker trackers[thread_count];
+    for (int thread = 0; thread < thread_count; ++thread)
+        resource_state_tracker_init(trackers[thread], registry);
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        for (int thread = 0; thread < thread_count; ++thread)
+        {
+            recording = thread;
+            lists[thread].clear();
+            resource_state_tracker_reset(trackers[thread]);
+            render_graph_execute(graph, trackers[thread], flush, nullptr, thread, thread_count);
+        }
+
+        std::vector<int> runs(graph.passes.size(), 0);
+        for (int thread = 0; thread < thread_count; ++thread)
+        {
+            std::vector<ResourceTransition> barriers;
+            resource_state_resolve(registry, trackers[thread], barriers);
+            if (!apply(barriers))
+                return false;
+
+            for (const ListEvent &event : lists[thread])
+            {
+                if (event.pass < 0)
+                {
+                    if (!apply(event.barriers))
+                        return false;
+                    continue;
+                }
+
+                const RenderGraphPass &pass = graph.passes[event.pass];
+                bool right_list = event.thread == thread && (pass.single_list ? thread == thread_count - 1 && event.share == 0 && event.share_count == 1
+                                                                              : event.share == thread && event.share_count == thread_count);
+                if (!right_list)
+                {
+                    printf("render graph %d: %s recorded the wrong share on list %d\n", index, pass.name.c_str(), thread);
+                    return false;
+                }
+                ++runs[event.pass];
+
+                for (const RenderGraphAccess &access : pass.accesses)
+                {
+                    // Whoever wrote what it uses has to be done on every list it records on, not just on this one. Shares of two shared passes
+                    // are the exception, they do not depend on each other (see render_graph_execute())
+                    int writer = graph.versions[access.version].writer;
+                    bool shared = !pass.single_list && writer >= 0 && !graph.passes[writer].single_list;
+                    if (writer >= 0 && !shared && runs[writer] != (graph.passes[writer].single_list ? 1 : thread_count))
+                    {
+                        printf("render graph %d: %s on list %d runs before all of %s\n", index, pass.name.c_str(), thread, graph.passes[writer].name.c_str());
+                        return false;
+                    }
+                    if (!state_allows(states[graph.versions[access.version].resource], access.state))
+                    {
+                        printf("render graph %d: %s on list %d uses a resource in the wrong state\n", index, pass.name.c_str(), thread);
+                        return false;
+                    }
+                }
+            }
+        }
+
+        for (int p : graph.order)
+        {
+            if (runs[p] != (graph.passes[p].single_list ? 1 : thread_count))
+            {
+                printf("render graph %d: %s was recorded %d times on %d lists\n", index, graph.passes[p].name.c_str(), runs[p], thread_count);
+                return false;
+            }
+        }
+        for (size_t r = 0; r < graph.resources.size(); ++r)
+        {
+            const RenderGraphResource &resource = graph.resources[r];
+            if (resource.first_pass >= 0 && states[r] != (resource.imported ? resource.final_state : resource.initial_state))
+            {
+                printf("render graph %d: executed on %d lists, %s does not end the frame where the next one starts\n", index, thread_count, resource.name.c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Random passes over random resources. The passes are added in a shuffled order, so the sort has to find the real one
+void build_random(RenderGraph &graph, std::mt19937 &random)
+{
+    auto nothing = [](int, int, int) {};
+    render_graph_reset(graph);
+
+    int resource_count = 2 + (int)(random() % 12);
+    std::vector<RenderGraphHandle> current;
+    std::vector<bool> written;
+    for (int r = 0; r < resource_count; ++r)
+    {
+        bool imported = random() % 5 == 0;
+        std::string name = "resource " + std::to_string(r);
+        if (imported)
+        {
+            current.push_back(render_graph_import(graph, name.c_str(), nullptr, resource_state_common, random() % 2 ? resource_state_common : resource_state_pixel_shader_resource));
+        }
+        else
+        {
+            RenderGraphTextureDesc desc = {};
+            desc.size = (1 + random() % 64) * default_alignment;
+            desc.alignment = random() % 4 == 0 ? 4 * 1024 * 1024 : default_alignment;
+            current.push_back(render_graph_create(graph, name.c_str(), desc));
+        }
+        written.push_back(imported);
+    }
+
+    int pass_count = 1 + (int)(random() % 24);
+    std::vector<int> passes;
+    for (int p = 0; p < pass_count; ++p)
+        passes.push_back(render_graph_add_pass(graph, ("pass " + std::to_string(p)).c_str(), nothing, random() % 10 == 0));
+    std::shuffle(passes.begin(), passes.end(), random);
+
+    const ResourceState read_states[] = {resource_state_pixel_shader_resource, resource_state_non_pixel_shader_resource, resource_state_copy_source};
+    const ResourceState write_states[] = {resource_state_render_target, resource_state_unordered_access, resource_state_copy_dest};
+    for (int pass : passes)
+    {
+        std::vector<bool> touched(resource_count, false);
+        int reads = (int)(random() % 4);
+        for (int i = 0; i < reads; ++i)
+        {
+            int r = (int)(random() % resource_count);
+            if (written[r] && !touched[r])
+            {
+                render_graph_read(graph, pass, current[r], read_states[random() % 3]);
+                touched[r] = true;
+            }
+        }
+        int writes = 1 + (int)(random() % 2);
+        for (int i = 0; i < writes; ++i)
+        {
+            int r = (int)(random() % resource_count);
+            if (!touched[r])
+            {
+                current[r] = render_graph_write(graph, pass, current[r], write_states[random() % 3]);
+                written[r] = true;
+                touched[r] = true;
+            }
+        }
+    }
+
+    for (int r = 0; r < resource_count; ++r)
+    {
+        if (written[r] && random() % 3 == 0)
+            render_graph_output(graph, current[r]);
+    }
+}
+} // namespace
+
+bool render_graph_stress(int graphs, unsigned int seed)
+{
+    RenderGraph graph;
+    build_example(graph, 1920, 1080);
+    if (!render_graph_compile(graph))
+    {
+        printf("render graph: the example frame did not compile: %s\n", graph.error.c_str());
+        return false;
+    }
+    if (!check_compiled(graph, -1) || !check_execute(graph, -1))
+        return false;
+    printf("%s", render_graph_report(graph).c_str());
+
+    std::mt19937 random(seed);
+    uint64_t passes = 0, culled = 0, unaliased = 0, aliased = 0;
+    for (int i = 0; i < graphs; ++i)
+    {
+        build_random(graph, random);
+        if (!render_graph_compile(graph))
+        {
+            printf("render graph %d: did not compile: %s\n", i, graph.error.c_str());
+            return false;
+        }
+        if (!check_compiled(graph, i) || !check_execute(graph, i))
+            return false;
+
+        passes += graph.passes.size();
+        culled += graph.passes.size() - graph.order.size();
+        unaliased += graph.transient_size_unaliased;
+        aliased += graph.transient_size;
+    }
+
+    printf("render graph: %d random graphs, %llu passes, %llu culled, transients %.0f%% smaller aliased, all correct\n", graphs,
+           (unsigned long long)passes, (unsigned long long)culled, unaliased ? 100.0 * (1.0 - (double)aliased / unaliased) : 0.0);
+    return true;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "resource_state.h"
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+    Render graph: the frame is described as passes that declare what they read and write, and the graph works out the rest.
+
+    Resources are versioned. Writing a resource gives back a new handle for its new contents, reading takes the handle of the contents the pass
+    wants. That is all the graph needs to know the order: a pass runs after whoever wrote what it reads (and what it writes over), and a write
+    runs after everybody who still reads the contents it replaces. So passes can be added in any order.
+
+    render_graph_compile() then
+        culls every pass nothing needs: only passes that write an output (render_graph_output()) or have side effects are kept, with whatever
+            they depend on
+        sorts the passes that are left topologically, ties go to the pass that was added first so the order is stable
+        works out the state every resource has to be in for each pass and the barriers that gets there, by running a ResourceStateTracker
+            over the passes in order, so the barriers are exactly the ones execution will record
+        places the transient resources (the ones the graph creates, not imported ones) in one heap: each one is only alive from its first
+            to its last pass, and resources that are never alive at the same time share memory. Every resource placed over another one gets
+            an aliasing barrier before its first pass
+
+    None of it needs a gpu. render_graph_report() prints what the compile did, render_graph_stress() compiles random graphs and checks the
+    result, main.cpp and software_renderer.cpp build the frame out of a graph and run it with render_graph_execute().
+*/
+
+typedef int RenderGraphHandle; // A version of a resource, -1 is none
+
+// What the graph needs to know to place a transient texture. size and alignment come from the device (GetResourceAllocationInfo),
+// without one render_graph_texture_desc() makes an estimate. alignment is a power of two like every placement alignment, 0 is the default
+struct RenderGraphTextureDesc
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t format; // DXGI_FORMAT
+    uint32_t bytes_per_pixel;
+    uint64_t size;
+    uint64_t alignment;
+};
+
+struct RenderGraphResource
+{
+    std::string name;
+    bool imported;       // Lives outside the graph (the back buffer, the vertex buffer), never aliased
+    void *physical;      // What barriers and passes use, the ID3D12Resource or SoftwareTarget. Transients get theirs from render_graph_realize()
+    RenderGraphTextureDesc desc;
+    ResourceState initial_state; // Imported: state it is in before the graph runs. Transient: state to create it in (its last state, see render_graph.cpp)
+    ResourceState final_state;   // Imported: state to leave it in after the graph
+
+    // Filled in by render_graph_compile()
+    int first_pass; // Position in the order of the first and last pass using it, -1 if no pass does
+    int last_pass;
+    uint64_t offset; // Where in the transient heap it lives
+};
+
+struct RenderGraphVersion
+{
+    int resource;
+    int writer;  // Pass that wrote it, -1 for the contents before the graph runs
+    int next;    // Version written over this one, -1 if none. A version can only be written over once
+    std::vector<int> readers;
+    bool output;
+};
+
+struct RenderGraphAccess
+{
+    RenderGraphHandle version; // Read: the version read. Write: the version written over
+    ResourceState state;
+    bool write;
+};
+
+// An aliasing barrier: after starts using memory before used last, null before means whatever was there
+struct RenderGraphAlias
+{
+    int before; // Resource indices
+    int after;
+};
+
+struct RenderGraphPass
+{
+    std::string name;
+    std::vector<RenderGraphAccess> accesses;
+    std::function<void(int, int, int)> execute; // Called with the recording thread, the share of the work to record and how many shares there are, see render_graph_execute()
+    bool side_effects; // Kept even if nothing reads what it writes
+
+    // Filled in by render_graph_compile()
+    bool culled;
+    bool single_list; // Recorded whole on the last command list, it touches a transient or comes after a pass that does
+    std::vector<RenderGraphAlias> aliases;     // Before the pass, for transients it is the first to use
+    std::vector<ResourceTransition> barriers;  // Before the pass, keyed by resource index + 1 (the physical resources may not exist yet)
+};
+
+struct RenderGraph
+{
+    std::vector<RenderGraphResource> resources;
+    std::vector<RenderGraphVersion> versions;
+    std::vector<RenderGraphPass> passes;
+    std::string error; // Why the last compile failed
+
+    // Filled in by render_graph_compile()
+    std::vector<int> order;                         // Passes that survived culling, in execution order
+    std::vector<ResourceTransition> final_barriers; // After the last pass, imported resources back to their final state
+    uint64_t transient_size_unaliased;              // Every transient in memory of its own
+    uint64_t transient_size;                        // Size of the heap the transients are placed in
+    int barrier_count;
+    int alias_count;
+};
+
+void render_graph_reset(RenderGraph &graph);
+RenderGraphTextureDesc render_graph_texture_desc(uint32_t width, uint32_t height, uint32_t format, uint32_t bytes_per_pixel);
+
+RenderGraphHandle render_graph_create(RenderGraph &graph, const char *name, const RenderGraphTextureDesc &desc);
+RenderGraphHandle render_graph_import(RenderGraph &graph, const char *name, void *physical, ResourceState initial_state, ResourceState final_state);
+void render_graph_set_physical(RenderGraph &graph, RenderGraphHandle handle, void *physical); // The back buffer changes every frame
+
+int render_graph_add_pass(RenderGraph &graph, const char *name, std::function<void(int, int, int)> execute, bool side_effects = false);
+void render_graph_read(RenderGraph &graph, int pass, RenderGraphHandle handle, ResourceState state);
+RenderGraphHandle render_graph_write(RenderGraph &graph, int pass, RenderGraphHandle handle, ResourceState state); // Returns the new version
+void render_graph_output(RenderGraph &graph, RenderGraphHandle handle); // Somebody outside the graph wants this version
+
+bool render_graph_compile(RenderGraph &graph); // false with graph.error set if it reads something nobody wrote, writes a version twice or has a cycle
+
+// Give every transient that is used a physical resource at its offset in a heap of transient_size bytes, and register it in the state it is
+// created in so resource_state_resolve() knows where it is between frames
+void render_graph_realize(RenderGraph &graph, ResourceStateRegistry &registry, const std::function<void *(const RenderGraphResource &)> &create);
+
+/*
+    Run the compiled passes on one of thread_count command lists, which are submitted in thread order. Every recording thread runs the passes
+    with its own tracker and each pass records the thread's share of its work on the thread's list (execute(thread, thread, thread_count)).
+    The transitions go through the tracker, so only the list that really changes a state gets the barrier (see resource_state.h), and each pass
+    flushes its barriers in one call.
+
+    That only works for passes whose shares do not depend on each other, like draws into the same target. A transient's contents only mean
+    something in the order the graph put the passes in and its memory is handed between resources with aliasing barriers: spread over several
+    lists, a pass on list 0 would read what the previous pass has not written on lists 1..N yet. So from the first pass that touches a transient
+    on, every pass is recorded whole on the last list (execute(thread_count - 1, 0, 1)), after every share of the passes before it. The aliasing
+    barriers (alias) go on that list too, and it knows the state the transients start the frame in. It also puts the imported resources in their
+    final state at the end.
+*/
+void render_graph_execute(RenderGraph &graph, ResourceStateTracker &tracker, const std::function<void(const ResourceTransition *, int)> &flush,
+                          const std::function<void(void *, void *)> &alias, int thread, int thread_count);
+
+std::string render_graph_report(const RenderGraph &graph); // Order, culled passes, barriers and transient memory before and after aliasing
+
+// Compile an example deferred frame and print its report, then compile random graphs and check the order, the culling, the barriers and that
+// no two transients alive at the same time share memory. Each graph is also executed on several command lists for a few frames, and the lists
+// replayed in submission order have to find every resource in the state its pass asked for. Returns false on the first graph that is wrong
+bool render_graph_stress(int graphs, unsigned int seed);
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+    Things both renderers need to agree on live here: the vertex format, the number of back buffers and how many threads may record a frame.
+    The d3d12 renderer in main.cpp and the cpu renderer in software_renderer.cpp both include this file,
+    so the cpu path can be built on machines without the windows sdk (no DirectXMath there either).
+*/
+
+#ifdef _WIN32
+#include <DirectXMath.h>
+#else
+// DirectXMath only ships with the windows sdk. The cpu backend only needs the storage types, so we declare
+// layout compatible versions of them here
+namespace DirectX
+{
+struct XMFLOAT3
+{
+    XMFLOAT3() = default;
+    XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+    float x, y, z;
+};
+
+struct XMFLOAT4
+{
+    XMFLOAT4() = default;
+    XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+    float x, y, z, w;
+};
+} // namespace DirectX
+#endif
+
+const int framebuffer_count = 3; // triple buffering
+const int record_threads_max = 8; // Upper limit for threads recording command lists for the same frame, sizes the per thread command pools
+
+// Matches the input layout in renderer_init(): POSITION is R32G32B32_FLOAT at offset 0, COLOR is R32G32B32A32_FLOAT at offset 12
+struct Vertex
+{
+    Vertex(float x, float y, float z, float r, float g, float b, float a) : pos(x, y, z), color(r, g, b, a) {}
+    DirectX::XMFLOAT3 pos;
+    DirectX::XMFLOAT4 color;
+};
@@ -0,0 +1,199 @@
+#include "resource_state.h"
+
+namespace
+{
+uint32_t subresource_count(const ResourceStateRegistry &registry, void *resource)
+{
+    auto found = registry.resources.find(resource);
+    return found == registry.resources.end() ? 1 : (uint32_t)found->second.size();
+}
+
+/*
+    The batch and the resolved barriers are kept one entry per subresource, so merging never has to split an all subresources barrier.
+    Before they are handed out, the entries of a resource that move every subresource from the same state to the same state are folded
+    back into one all subresources barrier, at the position of the first of them.
+*/
+void fold_subresources(const ResourceStateRegistry &registry, std::vector<ResourceTransition> &barriers, size_t first)
+{
+    std::vector<ResourceTransition> folded;
+    std::vector<bool> used(barriers.size() - first, false);
+    for (size_t i = first; i < barriers.size(); ++i)
+    {
+        if (used[i - first])
+            continue;
+
+        const ResourceTransition &barrier = barriers[i];
+        uint32_t matching = 0;
+        for (size_t j = i; j < barriers.size(); ++j)
+        {
+            if (barriers[j].resource == barrier.resource && barriers[j].before == barrier.before && barriers[j].after == barrier.after)
+                ++matching;
+        }
+
+        // Merging keeps a single entry per subresource, so as many matches as subresources means all of them
+        if (matching == subresource_count(registry, barrier.resource))
+        {
+            for (size_t j = i; j < barriers.size(); ++j)
+            {
+                if (barriers[j].resource == barrier.resource && barriers[j].before == barrier.before && barriers[j].after == barrier.after)
+                    used[j - first] = true;
+            }
+            folded.push_back({barrier.resource, resource_all_subresources, barrier.before, barrier.after});
+        }
+        else
+        {
+            folded.push_back(barrier);
+        }
+    }
+    barriers.resize(first);
+    barriers.insert(barriers.end(), folded.begin(), folded.end());
+}
+
+void transition_subresource(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState &current, ResourceState state, bool exact)
+{
+    //First use in this list, what state it is in is only known at submit
+    if (current == resource_state_unknown)
+    {
+        tracker.pending.push_back({resource, subresource, resource_state_unknown, state});
+        current = state;
+        return;
+    }
+
+    //Already there. A read state also covers any read states it includes
+    bool reads = !exact && is_read_state(current) && is_read_state(state);
+    if (current == state || (reads && (state & ~current) == 0))
+        return;
+
+    //Two reads in a row: keep both instead of flipping between them
+    ResourceState after = reads ? current | state : state;
+
+    //Not flushed yet means nothing used the state in between, so the barrier already in the batch can go straight to the new state
+    for (size_t i = 0; i < tracker.batch.size(); ++i)
+    {
+        ResourceTransition &barrier = tracker.batch[i];
+        if (barrier.resource == resource && barrier.subresource == subresource)
+        {
+            barrier.after = after;
+            if (barrier.before == barrier.after)
+                tracker.batch.erase(tracker.batch.begin() + i);
+            current = after;
+            return;
+        }
+    }
+
+    tracker.batch.push_back({resource, subresource, current, after});
+    current = after;
+}
+} // namespace
+
+void resource_state_register(ResourceStateRegistry &registry, void *resource, uint32_t subresources, ResourceState initial)
+{
+    registry.resources[resource].assign(subresources ? subresources : 1, initial);
+}
+
+void resource_state_unregister(ResourceStateRegistry &registry, void *resource)
+{
+    registry.resources.erase(resource);
+}
+
+void resource_state_tracker_init(ResourceStateTracker &tracker, ResourceStateRegistry &registry)
+{
+    tracker.registry = &registry;
+    tracker.requested = 0;
+    tracker.barriers = 0;
+    tracker.flushes = 0;
+    resource_state_tracker_reset(tracker);
+}
+
+void resource_state_tracker_reset(ResourceStateTracker &tracker)
+{
+    tracker.resources.clear();
+    tracker.pending.clear();
+    tracker.batch.clear();
+}
+
+void resource_state_assume(ResourceStateTracker &tracker, void *resource, ResourceState state)
+{
+    tracker.resources[resource].assign(subresource_count(*tracker.registry, resource), state);
+}
+
+namespace
+{
+void transition(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState state, bool exact)
+{
+    ++tracker.requested;
+
+    std::vector<ResourceState> &states = tracker.resources[resource];
+    if (states.empty())
+        states.assign(subresource_count(*tracker.registry, resource), resource_state_unknown);
+
+    if (subresource != resource_all_subresources)
+    {
+        if (subresource < states.size())
+            transition_subresource(tracker, resource, subresource, states[subresource], state, exact);
+        return;
+    }
+
+    for (uint32_t i = 0; i < (uint32_t)states.size(); ++i)
+        transition_subresource(tracker, resource, i, states[i], state, exact);
+}
+} // namespace
+
+void resource_state_transition(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState state)
+{
+    transition(tracker, resource, subresource, state, false);
+}
+
+void resource_state_transition_exact(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState state)
+{
+    transition(tracker, resource, subresource, state, true);
+}
+
+void resource_state_flush(ResourceStateTracker &tracker, const std::function<void(const ResourceTransition *, int)> &record)
+{
+    if (tracker.batch.empty())
+        return;
+
+    fold_subresources(*tracker.registry, tracker.batch, 0);
+    record(tracker.batch.data(), (int)tracker.batch.size());
+    tracker.barriers += tracker.batch.size();
+    ++tracker.flushes;
+    tracker.batch.clear();
+}
+
+int resource_state_resolve(ResourceStateRegistry &registry, ResourceStateTracker &tracker, std::vector<ResourceTransition> &barriers)
+{
+    //Whatever the list assumed its resources start in, get them there from where the lists before it left them
+    size_t first = barriers.size();
+    for (const ResourceTransition &needed : tracker.pending)
+    {
+        auto found = registry.resources.find(needed.resource);
+        if (found == registry.resources.end())
+            continue; // Not registered, nothing to compare with so trust the list
+
+        ResourceState current = found->second[needed.subresource];
+        if (current != needed.after)
+            barriers.push_back({needed.resource, needed.subresource, current, needed.after});
+    }
+    fold_subresources(registry, barriers, first);
+    tracker.pending.clear();
+
+    //The list leaves its resources in its final states
+    for (auto &resource : tracker.resources)
+    {
+        auto found = registry.resources.find(resource.first);
+        if (found == registry.resources.end())
+            continue;
+        for (size_t i = 0; i < resource.second.size() && i < found->second.size(); ++i)
+        {
+            if (resource.second[i] != resource_state_unknown)
+                found->second[i] = resource.second[i];
+        }
+    }
+
+    int count = (int)(barriers.size() - first);
+    tracker.barriers += count;
+    if (count)
+        ++tracker.flushes;
+    return count;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/*
+    Automatic resource state tracking, so nobody has to write transition barriers by hand.
+
+    Recording code only says which state it needs a resource in (resource_state_transition()) and the tracker works out the barrier.
+    A transition to the state the resource is already in costs nothing, two transitions of the same subresource before a flush are merged
+    into one (A -> B -> C becomes A -> C, and A -> B -> A disappears), and resource_state_flush() hands everything that is left to the
+    caller in one batch, so a pass does one ResourceBarrier call however many resources it touches. Flush before the first command that
+    uses the resources, it is the flush that puts them in their new state.
+
+    Every command list records on its own thread and does not know what the lists before it did, so a tracker belongs to one command list
+    and only knows the state of a resource once the list has transitioned it. The first transition of each subresource in a list is kept
+    as pending instead of becoming a barrier. When the lists are submitted, in order, resource_state_resolve() compares the pending states
+    with the registry, the state every resource is in after everything submitted so far, returns the barriers that have to run before the
+    list and then commits the list's final states to the registry.
+
+    States are D3D12_RESOURCE_STATES values and resources are just pointers, so the same code tracks ID3D12Resources in main.cpp and
+    SoftwareTargets in the cpu backend. Subresources are tracked one by one, a resource whose subresources are all in the same state is
+    transitioned with one all subresources barrier.
+*/
+
+// The D3D12_RESOURCE_STATES values the renderers use, the cpu backend cannot include d3d12.h
+typedef uint32_t ResourceState;
+const ResourceState resource_state_common = 0;
+const ResourceState resource_state_present = 0;
+const ResourceState resource_state_vertex_and_constant_buffer = 0x1;
+const ResourceState resource_state_index_buffer = 0x2;
+const ResourceState resource_state_render_target = 0x4;
+const ResourceState resource_state_unordered_access = 0x8;
+const ResourceState resource_state_depth_write = 0x10;
+const ResourceState resource_state_depth_read = 0x20;
+const ResourceState resource_state_non_pixel_shader_resource = 0x40;
+const ResourceState resource_state_pixel_shader_resource = 0x80;
+const ResourceState resource_state_copy_dest = 0x400;
+const ResourceState resource_state_copy_source = 0x800;
+const ResourceState resource_state_unknown = 0xffffffff; // Not used by this command list yet
+
+// States only read by the gpu, a resource can be in several of them at once and needs no barrier to go to a subset of them
+const ResourceState resource_state_read_mask = resource_state_vertex_and_constant_buffer | resource_state_index_buffer | resource_state_depth_read |
+                                               resource_state_non_pixel_shader_resource | resource_state_pixel_shader_resource | resource_state_copy_source;
+
+inline bool is_read_state(ResourceState state)
+{
+    return state != resource_state_common && (state & ~resource_state_read_mask) == 0;
+}
+
+const uint32_t resource_all_subresources = 0xffffffff; // Same as D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES
+
+// One transition barrier, what D3D12_RESOURCE_TRANSITION_BARRIER describes
+struct ResourceTransition
+{
+    void *resource;
+    uint32_t subresource; // Or resource_all_subresources
+    ResourceState before;
+    ResourceState after;
+};
+
+// State of every registered resource after everything submitted so far. Only touched by the thread that submits
+struct ResourceStateRegistry
+{
+    std::unordered_map<void *, std::vector<ResourceState>> resources; // One state per subresource
+};
+
+struct ResourceStateTracker
+{
+    ResourceStateRegistry *registry; // Only used for the subresource counts while recording
+    std::unordered_map<void *, std::vector<ResourceState>> resources; // State at this point of the list, resource_state_unknown until first used
+    std::vector<ResourceTransition> pending; // First use of each subresource, before is unknown until resolved
+    std::vector<ResourceTransition> batch;   // Barriers waiting for the next flush
+
+    // Stats, reset by the caller whenever it likes
+    uint64_t requested; // resource_state_transition() calls, what writing a barrier per transition by hand would have cost
+    uint64_t barriers;  // Barriers flushed
+    uint64_t flushes;   // Batches flushed, i.e. ResourceBarrier calls
+};
+
+void resource_state_register(ResourceStateRegistry &registry, void *resource, uint32_t subresources, ResourceState initial);
+void resource_state_unregister(ResourceStateRegistry &registry, void *resource);
+
+void resource_state_tracker_init(ResourceStateTracker &tracker, ResourceStateRegistry &registry);
+void resource_state_tracker_reset(ResourceStateTracker &tracker); // Forget everything, call it when the command list is reset. Keeps the stats
+
+// The list knows what state the resource is in when it starts, because nothing else touches it (the render graph knows that). Its first
+// transition becomes a barrier right away instead of waiting for resource_state_resolve(). Call it before the resource is used
+void resource_state_assume(ResourceStateTracker &tracker, void *resource, ResourceState state);
+
+// The resource has to be in state from here on. subresource can be resource_all_subresources
+void resource_state_transition(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState state);
+
+// Same, but the resource ends up in exactly state even if it is in a read state that includes it. For handing a resource over to someone
+// who expects that state, like the swap chain or the next frame
+void resource_state_transition_exact(ResourceStateTracker &tracker, void *resource, uint32_t subresource, ResourceState state);
+
+// Hand the batch to record, which records it with one ResourceBarrier call. Nothing is called if the batch is empty
+void resource_state_flush(ResourceStateTracker &tracker, const std::function<void(const ResourceTransition *, int)> &record);
+
+// At submit, in submission order: append the barriers that have to run before the tracker's command list to barriers, then move the registry on
+// to the states the list leaves its resources in. Returns how many barriers were appended
+int resource_state_resolve(ResourceStateRegistry &registry, ResourceStateTracker &tracker, std::vector<ResourceTransition> &barriers);
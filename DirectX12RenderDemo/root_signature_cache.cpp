@@ -0,0 +1,301 @@
+// Root signatures only exist with d3d12, see main.cpp
+#ifdef _WIN32
+
+#include "root_signature_cache.h"
+#include "pso_cache.h"
+#include "hash.h"
+#include "file_io.h"
+#include "d3dx12.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <direct.h>
+
+namespace
+{
+const uint32_t root_signature_cache_magic = 0x47495352; // "RSIG"
+const uint32_t root_signature_cache_version = 1;
+
+// What every entry starts with, the serialized root signature follows
+struct RootSignatureCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t size;
+};
+
+std::string entry_path(const RootSignatureCache &cache, uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.rootsig", (unsigned long long)hash);
+    return cache.directory + "/" + name;
+}
+
+bool load_entry(const RootSignatureCache &cache, uint64_t hash, std::vector<uint8_t> &blob)
+{
+    std::vector<uint8_t> contents;
+    RootSignatureCacheHeader header;
+    if (!file_read(entry_path(cache, hash), contents) || contents.size() < sizeof(header))
+        return false;
+
+    memcpy(&header, contents.data(), sizeof(header));
+    if (header.magic != root_signature_cache_magic || header.version != root_signature_cache_version || header.hash != hash ||
+        header.size != contents.size() - sizeof(header))
+        return false;
+
+    blob.assign(contents.begin() + sizeof(header), contents.end());
+    return true;
+}
+
+bool store_entry(const RootSignatureCache &cache, uint64_t hash, const std::vector<uint8_t> &blob)
+{
+    // Same as the shader cache, never leave a half written entry where the next run would load it
+    RootSignatureCacheHeader header = {root_signature_cache_magic, root_signature_cache_version, hash, (uint64_t)blob.size()};
+    return file_write_atomic(entry_path(cache, hash), &header, sizeof(header), blob.data(), blob.size());
+}
+
+void hash_static_samplers(uint64_t &hash, UINT count, const D3D12_STATIC_SAMPLER_DESC *samplers)
+{
+    hash_value(hash, count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        const D3D12_STATIC_SAMPLER_DESC &sampler = samplers[i];
+        hash_value(hash, sampler.Filter);
+        hash_value(hash, sampler.AddressU);
+        hash_value(hash, sampler.AddressV);
+        hash_value(hash, sampler.AddressW);
+        hash_value(hash, sampler.MipLODBias);
+        hash_value(hash, sampler.MaxAnisotropy);
+        hash_value(hash, sampler.ComparisonFunc);
+        hash_value(hash, sampler.BorderColor);
+        hash_value(hash, sampler.MinLOD);
+        hash_value(hash, sampler.MaxLOD);
+        hash_value(hash, sampler.ShaderRegister);
+        hash_value(hash, sampler.RegisterSpace);
+        hash_value(hash, sampler.ShaderVisibility);
+    }
+}
+
+void hash_desc_1_0(uint64_t &hash, const D3D12_ROOT_SIGNATURE_DESC &desc)
+{
+    hash_value(hash, desc.NumParameters);
+    for (UINT i = 0; i < desc.NumParameters; ++i)
+    {
+        const D3D12_ROOT_PARAMETER &parameter = desc.pParameters[i];
+        hash_value(hash, parameter.ParameterType);
+        hash_value(hash, parameter.ShaderVisibility);
+        switch (parameter.ParameterType)
+        {
+        case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            hash_value(hash, parameter.DescriptorTable.NumDescriptorRanges);
+            for (UINT r = 0; r < parameter.DescriptorTable.NumDescriptorRanges; ++r)
+            {
+                const D3D12_DESCRIPTOR_RANGE &range = parameter.DescriptorTable.pDescriptorRanges[r];
+                hash_value(hash, range.RangeType);
+                hash_value(hash, range.NumDescriptors);
+                hash_value(hash, range.BaseShaderRegister);
+                hash_value(hash, range.RegisterSpace);
+                hash_value(hash, range.OffsetInDescriptorsFromTableStart);
+            }
+            break;
+        case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+            hash_value(hash, parameter.Constants.ShaderRegister);
+            hash_value(hash, parameter.Constants.RegisterSpace);
+            hash_value(hash, parameter.Constants.Num32BitValues);
+            break;
+        default: // Root cbv, srv or uav
+            hash_value(hash, parameter.Descriptor.ShaderRegister);
+            hash_value(hash, parameter.Descriptor.RegisterSpace);
+            break;
+        }
+    }
+    hash_static_samplers(hash, desc.NumStaticSamplers, desc.pStaticSamplers);
+    hash_value(hash, desc.Flags);
+}
+
+// 1.1 is 1.0 plus the flags that say how volatile descriptors and data are
+void hash_desc_1_1(uint64_t &hash, const D3D12_ROOT_SIGNATURE_DESC1 &desc)
+{
+    hash_value(hash, desc.NumParameters);
+    for (UINT i = 0; i < desc.NumParameters; ++i)
+    {
+        const D3D12_ROOT_PARAMETER1 &parameter = desc.pParameters[i];
+        hash_value(hash, parameter.ParameterType);
+        hash_value(hash, parameter.ShaderVisibility);
+        switch (parameter.ParameterType)
+        {
+        case D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE:
+            hash_value(hash, parameter.DescriptorTable.NumDescriptorRanges);
+            for (UINT r = 0; r < parameter.DescriptorTable.NumDescriptorRanges; ++r)
+            {
+                const D3D12_DESCRIPTOR_RANGE1 &range = parameter.DescriptorTable.pDescriptorRanges[r];
+                hash_value(hash, range.RangeType);
+                hash_value(hash, range.NumDescriptors);
+                hash_value(hash, range.BaseShaderRegister);
+                hash_value(hash, range.RegisterSpace);
+                hash_value(hash, range.Flags);
+                hash_value(hash, range.OffsetInDescriptorsFromTableStart);
+            }
+            break;
+        case D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS:
+            hash_value(hash, parameter.Constants.ShaderRegister);
+            hash_value(hash, parameter.Constants.RegisterSpace);
+            hash_value(hash, parameter.Constants.Num32BitValues);
+            break;
+        default:
+            hash_value(hash, parameter.Descriptor.ShaderRegister);
+            hash_value(hash, parameter.Descriptor.RegisterSpace);
+            hash_value(hash, parameter.Descriptor.Flags);
+            break;
+        }
+    }
+    hash_static_samplers(hash, desc.NumStaticSamplers, desc.pStaticSamplers);
+    hash_value(hash, desc.Flags);
+}
+
+HRESULT serialize(RootSignatureCache &cache, const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, D3D_ROOT_SIGNATURE_VERSION version, std::vector<uint8_t> &blob)
+{
+    auto start = std::chrono::steady_clock::now();
+    ID3DBlob *serialized = nullptr;
+    ID3DBlob *errors = nullptr;
+    HRESULT result = D3DX12SerializeVersionedRootSignature(&desc, version, &serialized, &errors);
+    if (errors)
+    {
+        OutputDebugStringA((const char *)errors->GetBufferPointer());
+        errors->Release();
+    }
+    if (FAILED(result))
+        return result;
+
+    const uint8_t *bytes = (const uint8_t *)serialized->GetBufferPointer();
+    blob.assign(bytes, bytes + serialized->GetBufferSize());
+    serialized->Release();
+    ++cache.misses;
+    cache.seconds_serializing += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return S_OK;
+}
+} // namespace
+
+void root_signature_cache_init(RootSignatureCache &cache, ID3D12Device *device, const char *directory, PsoCache *pso_cache)
+{
+    cache.device = device;
+    cache.pso_cache = pso_cache;
+    cache.directory = directory;
+    cache.blobs.clear();
+    cache.root_signatures.clear();
+    cache.hits = 0;
+    cache.disk_hits = 0;
+    cache.misses = 0;
+    cache.shared = 0;
+    cache.seconds_loading = 0.0;
+    cache.seconds_serializing = 0.0;
+
+    //Fails when it already exists, which is fine
+    _mkdir(directory);
+}
+
+void root_signature_cache_shutdown(RootSignatureCache &cache)
+{
+    for (auto &root_signature : cache.root_signatures)
+        root_signature.second->Release();
+    cache.root_signatures.clear();
+    cache.blobs.clear();
+}
+
+uint64_t root_signature_cache_hash(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, D3D_ROOT_SIGNATURE_VERSION version)
+{
+    uint64_t hash = hash_offset;
+    hash_value(hash, root_signature_cache_version);
+    hash_value(hash, version);
+    hash_value(hash, desc.Version);
+    if (desc.Version == D3D_ROOT_SIGNATURE_VERSION_1_0)
+        hash_desc_1_0(hash, desc.Desc_1_0);
+    else
+        hash_desc_1_1(hash, desc.Desc_1_1);
+    return hash;
+}
+
+HRESULT root_signature_cache_get(RootSignatureCache &cache, const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, D3D_ROOT_SIGNATURE_VERSION version,
+                                 ID3D12RootSignature **root_signature)
+{
+    uint64_t hash = root_signature_cache_hash(desc, version);
+
+    auto known = cache.blobs.find(hash);
+    if (known != cache.blobs.end())
+    {
+        ++cache.hits;
+        *root_signature = cache.root_signatures[known->second];
+        (*root_signature)->AddRef();
+        return S_OK;
+    }
+
+    // Read the blob an earlier run serialized, or serialize it now and keep it for the next run
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> blob;
+    bool from_disk = load_entry(cache, hash, blob);
+    if (from_disk)
+    {
+        ++cache.disk_hits;
+        cache.seconds_loading += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    else
+    {
+        HRESULT result = serialize(cache, desc, version, blob);
+        if (FAILED(result))
+            return result;
+        store_entry(cache, hash, blob);
+    }
+
+    uint64_t blob_hash = hash_offset;
+    hash_bytes(blob_hash, blob.data(), blob.size());
+
+    ID3D12RootSignature *object = nullptr;
+    auto existing = cache.root_signatures.find(blob_hash);
+    if (existing != cache.root_signatures.end())
+    {
+        ++cache.shared;
+        object = existing->second;
+    }
+    else
+    {
+        HRESULT result = cache.device->CreateRootSignature(0, blob.data(), blob.size(), IID_PPV_ARGS(&object));
+
+        // A blob from disk the runtime does not take (damaged, or written by another version of it) is serialized again
+        if (FAILED(result) && from_disk)
+        {
+            --cache.disk_hits;
+            result = serialize(cache, desc, version, blob);
+            if (FAILED(result))
+                return result;
+            store_entry(cache, hash, blob);
+            blob_hash = hash_offset;
+            hash_bytes(blob_hash, blob.data(), blob.size());
+            result = cache.device->CreateRootSignature(0, blob.data(), blob.size(), IID_PPV_ARGS(&object));
+        }
+        if (FAILED(result))
+            return result;
+
+        cache.root_signatures[blob_hash] = object;
+        if (cache.pso_cache)
+            pso_cache_add_root_signature(*cache.pso_cache, object, blob.data(), blob.size());
+    }
+    cache.blobs[hash] = blob_hash;
+
+    // The cache keeps one reference, the caller gets the other
+    object->AddRef();
+    *root_signature = object;
+    return S_OK;
+}
+
+std::string root_signature_cache_summary(const RootSignatureCache &cache)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "root signature cache: %u hits, %u from disk (%.2f ms), %u serialized (%.2f ms), %u shared, %u root signatures\n",
+             cache.hits, cache.disk_hits, cache.seconds_loading * 1000.0, cache.misses, cache.seconds_serializing * 1000.0, cache.shared,
+             (unsigned int)cache.root_signatures.size());
+    return line;
+}
+
+#endif // _WIN32
@@ -0,0 +1,52 @@
+#pragma once
+
+// Root signatures only exist with d3d12, see main.cpp
+#ifdef _WIN32
+
+#include <d3d12.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+struct PsoCache;
+
+/*
+    Cache of serialized root signatures and the objects made from them.
+
+    A root signature is looked up by a hash of its versioned desc, taken field by field the way pso_cache_hash() does it: every parameter with
+    its ranges, constants or descriptor, the static samplers, the flags, and the version it is serialized for. The blob serializing it gives is
+    kept on disk next to the shader bytecode, so the next start reads it back instead of serializing again.
+
+    At runtime every blob is hashed again and root signatures with the same blob share one ID3D12RootSignature, even when their descs were
+    built differently (a 1.1 desc serialized for 1.0, ranges that say the same thing in another way). With a PsoCache the blob is also
+    registered with pso_cache_add_root_signature(), so pipelines using the root signature hash the same every run.
+*/
+
+struct RootSignatureCache
+{
+    ID3D12Device *device;
+    PsoCache *pso_cache; // Optional
+    std::string directory;
+    std::unordered_map<uint64_t, uint64_t> blobs;                          // Desc hash to blob hash, for descs seen before this run
+    std::unordered_map<uint64_t, ID3D12RootSignature *> root_signatures;   // Blob hash to the one object made from it
+
+    uint32_t hits;       // Desc seen before this run
+    uint32_t disk_hits;  // Blob read from disk
+    uint32_t misses;     // Serialized
+    uint32_t shared;     // A new desc whose blob an existing root signature already had
+    double seconds_loading;
+    double seconds_serializing;
+};
+
+void root_signature_cache_init(RootSignatureCache &cache, ID3D12Device *device, const char *directory, PsoCache *pso_cache); // Creates the directory if it is not there
+void root_signature_cache_shutdown(RootSignatureCache &cache); // Releases every root signature
+
+uint64_t root_signature_cache_hash(const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, D3D_ROOT_SIGNATURE_VERSION version);
+
+// Same as serializing desc for version (converted down if it is newer) and calling CreateRootSignature: root_signature gets a reference the caller releases
+HRESULT root_signature_cache_get(RootSignatureCache &cache, const D3D12_VERSIONED_ROOT_SIGNATURE_DESC &desc, D3D_ROOT_SIGNATURE_VERSION version,
+                                 ID3D12RootSignature **root_signature);
+
+std::string root_signature_cache_summary(const RootSignatureCache &cache);
+
+#endif // _WIN32
@@ -0,0 +1,149 @@
+#include "shader_cache.h"
+#include "hash.h"
+#include "file_io.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+const uint32_t shader_cache_magic = 0x43444853; // "SHDC"
+const uint32_t shader_cache_version = 1;
+
+// What every entry starts with, the bytecode follows
+struct ShaderCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint64_t size;
+    double compile_seconds;
+};
+
+std::string directory_of(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+// Hash a source file and, depth first, every file it includes with quotes. Includes are resolved relative to the including file like
+// D3D_COMPILE_STANDARD_FILE_INCLUDE does. depth stops include cycles
+bool hash_source(uint64_t &hash, const std::string &path, int depth)
+{
+    std::vector<uint8_t> source;
+    if (depth > 32 || !file_read(path, source))
+        return false;
+
+    hash_string(hash, path.c_str());
+    hash_bytes(hash, source.data(), source.size());
+
+    std::string text(source.begin(), source.end());
+    for (size_t at = text.find("#include"); at != std::string::npos; at = text.find("#include", at + 1))
+    {
+        size_t open = text.find_first_of("\"<\n", at + 8);
+        if (open == std::string::npos || text[open] != '"')
+            continue; // <...> includes are system headers the include handler has to provide, they do not live next to our files
+        size_t close = text.find('"', open + 1);
+        if (close == std::string::npos)
+            return false;
+
+        if (!hash_source(hash, directory_of(path) + text.substr(open + 1, close - open - 1), depth + 1))
+            return false;
+    }
+    return true;
+}
+
+std::string entry_path(const ShaderCache &cache, uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cso", (unsigned long long)hash);
+    return cache.directory + "/" + name;
+}
+} // namespace
+
+void shader_cache_init(ShaderCache &cache, const char *directory)
+{
+    cache.directory = directory;
+    cache.hits = 0;
+    cache.misses = 0;
+    cache.seconds_loading = 0.0;
+    cache.seconds_compiling = 0.0;
+    cache.seconds_saved = 0.0;
+
+    //Fails when it already exists, which is fine
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory, 0755);
+#endif
+}
+
+bool shader_cache_hash(const char *path, const ShaderDefine *defines, const char *entry, const char *target, uint32_t flags, uint32_t compiler_version, uint64_t &hash)
+{
+    hash = hash_offset;
+    hash_value(hash, shader_cache_version);
+    if (!hash_source(hash, path, 0))
+        return false;
+
+    for (const ShaderDefine *define = defines; define && define->name; ++define)
+    {
+        hash_string(hash, define->name);
+        hash_string(hash, define->value);
+    }
+    hash_string(hash, entry);
+    hash_string(hash, target);
+    hash_value(hash, flags);
+    hash_value(hash, compiler_version);
+    return true;
+}
+
+bool shader_cache_load(ShaderCache &cache, uint64_t hash, std::vector<uint8_t> &bytecode)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> contents;
+    ShaderCacheHeader header;
+    bool hit = file_read(entry_path(cache, hash), contents) && contents.size() >= sizeof(header);
+    if (hit)
+    {
+        memcpy(&header, contents.data(), sizeof(header));
+        hit = header.magic == shader_cache_magic && header.version == shader_cache_version && header.hash == hash &&
+              header.size == contents.size() - sizeof(header);
+    }
+
+    if (!hit)
+    {
+        ++cache.misses;
+        return false;
+    }
+
+    bytecode.assign(contents.begin() + sizeof(header), contents.end());
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ++cache.hits;
+    cache.seconds_loading += seconds;
+    cache.seconds_saved += header.compile_seconds - seconds;
+    return true;
+}
+
+bool shader_cache_store(ShaderCache &cache, uint64_t hash, const void *bytecode, size_t size, double compile_seconds)
+{
+    cache.seconds_compiling += compile_seconds;
+
+    // Written through a temporary file, so a crash or a second instance never leaves a half written entry behind
+    ShaderCacheHeader header = {shader_cache_magic, shader_cache_version, hash, (uint64_t)size, compile_seconds};
+    return file_write_atomic(entry_path(cache, hash), &header, sizeof(header), bytecode, size);
+}
+
+std::string shader_cache_summary(const ShaderCache &cache)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "shader cache: %u hits, %u misses, %.1f ms loading, %.1f ms compiling, %.1f ms saved\n",
+             cache.hits, cache.misses, cache.seconds_loading * 1000.0, cache.seconds_compiling * 1000.0, cache.seconds_saved * 1000.0);
+    return line;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+    On disk cache for compiled shader bytecode.
+
+    A shader is looked up by a hash of everything that changes its bytecode: the source, every file it #includes (found by scanning for
+    #include "..." and hashed recursively, whether or not the #if around it is taken, which can only cause extra misses), the defines,
+    the entry point, the target profile, the compile flags and the compiler version. If any of those changes the hash does too and the
+    shader is compiled again, so there is nothing to invalidate by hand. Old entries are just never looked up anymore, delete the directory
+    to get rid of them.
+
+    Each entry is one file named after the hash, it stores how long the compile took so a hit knows how much time it saved.
+    The cache does not compile anything itself, renderer_compile_shader() in main.cpp asks it first and calls D3DCompileFromFile on a miss.
+*/
+
+// Same layout as D3D_SHADER_MACRO, terminated by an entry with a null name
+struct ShaderDefine
+{
+    const char *name;
+    const char *value;
+};
+
+struct ShaderCache
+{
+    std::string directory;
+
+    uint32_t hits;
+    uint32_t misses;
+    double seconds_loading;   // Reading entries on hits
+    double seconds_compiling; // Compiling on misses
+    double seconds_saved;     // What the hits took to compile when they were stored, minus loading them
+};
+
+void shader_cache_init(ShaderCache &cache, const char *directory); // Creates the directory if it is not there
+
+// Hash of the shader and everything it depends on. False if the source or one of its includes cannot be read
+bool shader_cache_hash(const char *path, const ShaderDefine *defines, const char *entry, const char *target, uint32_t flags, uint32_t compiler_version, uint64_t &hash);
+
+bool shader_cache_load(ShaderCache &cache, uint64_t hash, std::vector<uint8_t> &bytecode); // Counts a hit or a miss
+bool shader_cache_store(ShaderCache &cache, uint64_t hash, const void *bytecode, size_t size, double compile_seconds);
+
+std::string shader_cache_summary(const ShaderCache &cache); // One line with hits, misses and time saved
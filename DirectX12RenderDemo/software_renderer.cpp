@@ -0,0 +1,1052 @@
+#include "software_renderer.h"
+#include "rasterizer.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "upload_manager.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+//Software globals
+SoftwareTarget software_targets[framebuffer_count];
+SoftwareCommandList software_command_lists[frame_ring_max_frames][record_threads_max];
+SoftwareCommandList software_barrier_command_lists[frame_ring_max_frames];
+ResourceStateTracker software_state_trackers[record_threads_max];
+ResourceStateRegistry software_resource_states;
+RenderGraph software_frame_graph;
+RenderGraphHandle software_graph_back_buffer;
+uint64_t software_barrier_errors = 0;
+int software_record_threads = 1;
+SoftwareViewport software_viewport;
+SoftwareRect software_scissorRect;
+SoftwareVertexBufferView software_vertexBuffer_view;
+SoftwareIndexBufferView software_indexBuffer_view;
+VertexFormat software_vertex_format = VERTEX_FORMAT_FLOAT;
+VertexDequantization software_vertex_dequantization;
+float software_vertex_tolerance = 0.0f;
+FrameRing software_frame_ring;
+FrameQueue *software_frame_queue = nullptr;
+int software_frames_in_flight = 2;
+int software_frame_context;
+int software_frame_index;
+int software_present_index;
+uint32_t software_draw_instances = 1;
+uint32_t software_draw_calls = 1;
+const Mesh *software_scene_mesh = nullptr;
+double software_submit_seconds;
+uint64_t software_frame_barriers;
+GpuTimer software_gpu_timer;
+RasterizerKernel software_raster_kernel = rasterizer_kernel(RASTERIZER_ISA_SCALAR);
+
+std::vector<uint8_t> software_vertexBuffer; // Where we store our vertices, plays the part of renderer_vertexBuffer
+std::vector<uint8_t> software_indexBuffer;  // And the indices into them, renderer_indexBuffer
+uint32_t software_index_count;              // Indices per instance of the draw, renderer_index_count
+
+namespace
+{
+// software_queue_execute() runs the command lists before it returns, so by the time a value is signaled the work is already done
+struct SoftwareFrameQueue : FrameQueue
+{
+    uint64_t completed_value = 0;
+
+    bool Signal(uint64_t value) override
+    {
+        completed_value = value;
+        return true;
+    }
+
+    uint64_t GetCompletedValue() override
+    {
+        return completed_value;
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        return completed_value >= value;
+    }
+};
+SoftwareFrameQueue software_cpu_queue;
+
+// The upload manager's copy queue. It copies a batch into the destination vectors as soon as it is executed, so like the frame queue
+// a value is done once it is signaled. The staging blocks are plain heap memory
+struct SoftwareCopyQueue : UploadQueue
+{
+    uint64_t completed_value = 0;
+
+    bool Signal(uint64_t value) override
+    {
+        completed_value = value;
+        return true;
+    }
+
+    uint64_t GetCompletedValue() override
+    {
+        return completed_value;
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        return completed_value >= value;
+    }
+
+    bool CreateBlock(uint64_t size, UploadBlock &block) override
+    {
+        block.cpu = new uint8_t[size];
+        block.resource = block.cpu;
+        return true;
+    }
+
+    void DestroyBlock(UploadBlock &block) override
+    {
+        delete[] block.cpu;
+    }
+
+    bool Execute(const UploadBlock *blocks, const UploadCopy *copies, size_t count) override
+    {
+        //There are no textures yet, buffers are the vectors the views point into
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i)
+        {
+            std::vector<uint8_t> *destination = (std::vector<uint8_t> *)copies[i].destination;
+            if (copies[i].texture || copies[i].destination_offset + copies[i].size > destination->size())
+            {
+                ok = false;
+                continue;
+            }
+            memcpy(destination->data() + copies[i].destination_offset, blocks[copies[i].block].cpu + copies[i].source_offset, copies[i].size);
+        }
+        return ok;
+    }
+};
+SoftwareCopyQueue software_copy_queue;
+UploadManager software_upload_manager;
+const uint64_t software_upload_block_size = 64 * 1024;
+
+// Timestamps are steady_clock nanoseconds written when the queue executes them, so the calibration is exact
+struct SoftwareTimerQueue : GpuTimerQueue
+{
+    std::vector<uint64_t> queries; // The query heap
+    std::vector<uint64_t> results; // Readback memory
+
+    static uint64_t now(std::chrono::steady_clock::time_point time)
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    void Timestamp(void *command_list, uint32_t query) override
+    {
+        ((SoftwareCommandList *)command_list)->EndQuery(query);
+    }
+
+    void Resolve(void *command_list, uint32_t first_query, uint32_t count) override
+    {
+        ((SoftwareCommandList *)command_list)->ResolveQueryData(first_query, count);
+    }
+
+    const uint64_t *Results() override
+    {
+        return results.data();
+    }
+
+    uint64_t Frequency() override
+    {
+        return 1000000000;
+    }
+
+    bool Calibrate(uint64_t &gpu_ticks, std::chrono::steady_clock::time_point &cpu_time) override
+    {
+        cpu_time = std::chrono::steady_clock::now();
+        gpu_ticks = now(cpu_time);
+        return true;
+    }
+};
+SoftwareTimerQueue software_timer_queue;
+} // namespace
+
+// -- Command list -- //
+
+void SoftwareCommandList::Reset()
+{
+    commands.clear();
+    barriers.clear();
+    recording = true;
+}
+
+void SoftwareCommandList::Close()
+{
+    recording = false;
+}
+
+void SoftwareCommandList::OMSetRenderTargets(SoftwareTarget *render_target)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_RENDER_TARGET;
+    command.render_target = render_target;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::ClearRenderTargetView(SoftwareTarget *render_target, const float color[4])
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_CLEAR;
+    command.clear.target = render_target;
+    memcpy(command.clear.color, color, sizeof(command.clear.color));
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::RSSetViewports(const SoftwareViewport *viewport)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_VIEWPORT;
+    command.viewport = *viewport;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::RSSetScissorRects(const SoftwareRect *rect)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_SCISSOR;
+    command.scissor = *rect;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::IASetVertexBuffers(const SoftwareVertexBufferView *view)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_VERTEX_BUFFER;
+    command.vertex_buffer = *view;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::IASetIndexBuffer(const SoftwareIndexBufferView *view)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_INDEX_BUFFER;
+    command.index_buffer = *view;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::IASetVertexFormat(VertexFormat format)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_VERTEX_FORMAT;
+    command.vertex_format = format;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::SetGraphicsRoot32BitConstants(uint32_t count, const void *data)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_SET_ROOT_CONSTANTS;
+    memset(command.root_constants, 0, sizeof(command.root_constants));
+    memcpy(command.root_constants, data, (count < 8 ? count : 8) * sizeof(float));
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::DrawInstanced(uint32_t vertex_count, uint32_t instance_count, uint32_t start_vertex, uint32_t start_instance)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_DRAW;
+    command.draw.vertex_count = vertex_count;
+    command.draw.instance_count = instance_count;
+    command.draw.start_vertex = start_vertex;
+    command.draw.start_instance = start_instance;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::DrawIndexedInstanced(uint32_t index_count, uint32_t instance_count, uint32_t start_index, int32_t base_vertex, uint32_t start_instance)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_DRAW_INDEXED;
+    command.draw_indexed.index_count = index_count;
+    command.draw_indexed.instance_count = instance_count;
+    command.draw_indexed.start_index = start_index;
+    command.draw_indexed.base_vertex = base_vertex;
+    command.draw_indexed.start_instance = start_instance;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::ResourceBarrier(uint32_t count, const ResourceTransition *transitions)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_RESOURCE_BARRIER;
+    command.barrier.first = (uint32_t)barriers.size();
+    command.barrier.count = count;
+    barriers.insert(barriers.end(), transitions, transitions + count);
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::EndQuery(uint32_t query)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_TIMESTAMP;
+    command.query = query;
+    commands.push_back(command);
+}
+
+void SoftwareCommandList::ResolveQueryData(uint32_t first_query, uint32_t count)
+{
+    SoftwareCommand command;
+    command.type = SOFTWARE_COMMAND_RESOLVE_QUERIES;
+    command.resolve.first = first_query;
+    command.resolve.count = count;
+    commands.push_back(command);
+}
+
+// -- Rasterizer -- //
+/*
+    This is the part of the pipeline the gpu does for us in fixed function hardware.
+    1. Vertex fetch: read POSITION and COLOR out of the vertex buffer using the stride, like the input layout describes
+    2. Vertex shader: vertex.hlsl, output.pos = float4(pos, 1)
+    3. Clipping: against the depth range (depth clip is on by default) and a guard band in x and y. Anything inside the guard band is left alone
+        and the scissor takes care of it, the same way the hardware works. The guard band only exists to keep the fixed point math from overflowing
+    4. Viewport transform and snapping to 16.8 fixed point
+    5. Culling: the default rasterizer state culls back faces and front faces are clockwise
+    6. Rasterization with edge functions, pixel centers are at .5 and the top-left rule decides who owns pixels exactly on an edge
+    7. Pixel shader: pixel.hlsl, return the interpolated color. Default blend state just writes it out converted to unorm
+    Setup (step 6) and the pixel loops (6 and 7) live in rasterizer.cpp
+
+    Steps 1 to 5 run on the thread executing the command list and produce set up triangles. Each one is binned into the 64x64 screen tiles it touches,
+    clears are binned into every tile. When the command list is done (or switches render target) the tiles are rasterized in parallel on the job system.
+    A tile only ever belongs to one worker and its bin is in submission order, so the result is the same as drawing everything in order on one thread.
+*/
+
+namespace
+{
+const int64_t subpixel_one = 1 << rasterizer_subpixel_bits;
+const float guard_band = 8.0f; // in multiples of w
+const int tile_size = 64;
+const uint32_t bin_clear_flag = 0x80000000u; // bin entries are triangle indices, or clear indices with this bit set
+
+struct ClipVertex
+{
+    float pos[4];
+    float color[4];
+};
+
+struct RasterState
+{
+    SoftwareTarget *target;
+    SoftwareViewport viewport;
+    SoftwareRect scissor;
+    SoftwareVertexBufferView vertex_buffer;
+    SoftwareIndexBufferView index_buffer;
+    VertexFormat vertex_format;
+    VertexDequantization dequantization; // The root constants
+};
+
+// Everything recorded for one render target since the last flush
+struct TileBins
+{
+    SoftwareTarget *target;
+    int tiles_x;
+    int tiles_y;
+    std::vector<RasterizerTriangle> triangles;
+    std::vector<uint32_t> clears;
+    std::vector<std::vector<uint32_t>> bins;
+};
+
+TileBins software_bins;
+
+uint32_t pack_rgba8(const float color[4])
+{
+    return to_unorm8(color[0]) | (to_unorm8(color[1]) << 8) | (to_unorm8(color[2]) << 16) | (to_unorm8(color[3]) << 24);
+}
+
+// Distance to each clip plane, positive means inside
+float clip_distance(const ClipVertex &v, int plane)
+{
+    switch (plane)
+    {
+    case 0: return v.pos[2];                           // near, z >= 0
+    case 1: return v.pos[3] - v.pos[2];                // far, z <= w
+    case 2: return v.pos[0] + guard_band * v.pos[3];   // left guard band
+    case 3: return guard_band * v.pos[3] - v.pos[0];   // right guard band
+    case 4: return v.pos[1] + guard_band * v.pos[3];   // bottom guard band
+    default: return guard_band * v.pos[3] - v.pos[1];  // top guard band
+    }
+}
+
+// Sutherland-Hodgman against the planes above. A triangle clipped by 6 planes has at most 9 vertices
+int clip_triangle(ClipVertex *polygon, int count)
+{
+    ClipVertex scratch[9];
+    for (int plane = 0; plane < 6 && count >= 3; ++plane)
+    {
+        int out_count = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const ClipVertex &a = polygon[i];
+            const ClipVertex &b = polygon[(i + 1) % count];
+            float da = clip_distance(a, plane);
+            float db = clip_distance(b, plane);
+
+            if (da >= 0.0f)
+                scratch[out_count++] = a;
+
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                ClipVertex &v = scratch[out_count++];
+                for (int k = 0; k < 4; ++k)
+                {
+                    v.pos[k] = a.pos[k] + (b.pos[k] - a.pos[k]) * t;
+                    v.color[k] = a.color[k] + (b.color[k] - a.color[k]) * t;
+                }
+            }
+        }
+        memcpy(polygon, scratch, sizeof(ClipVertex) * out_count);
+        count = out_count;
+    }
+    return count;
+}
+
+// -- Binning -- //
+
+void bins_begin(TileBins &bins, SoftwareTarget *target)
+{
+    bins.target = target;
+    bins.tiles_x = (target->width + tile_size - 1) / tile_size;
+    bins.tiles_y = (target->height + tile_size - 1) / tile_size;
+    bins.triangles.clear();
+    bins.clears.clear();
+    bins.bins.resize((size_t)bins.tiles_x * bins.tiles_y);
+    for (size_t i = 0; i < bins.bins.size(); ++i)
+        bins.bins[i].clear();
+}
+
+void bin_clear(TileBins &bins, const float color[4])
+{
+    // A clear covers every tile and hides everything drawn before it, so those entries can go
+    uint32_t index = (uint32_t)bins.clears.size() | bin_clear_flag;
+    bins.clears.push_back(pack_rgba8(color));
+    for (size_t i = 0; i < bins.bins.size(); ++i)
+    {
+        bins.bins[i].clear();
+        bins.bins[i].push_back(index);
+    }
+}
+
+void bin_triangle(TileBins &bins, const RasterizerTriangle &triangle)
+{
+    uint32_t index = (uint32_t)bins.triangles.size();
+    bins.triangles.push_back(triangle);
+
+    int tx0 = triangle.x0 / tile_size;
+    int ty0 = triangle.y0 / tile_size;
+    int tx1 = triangle.x1 / tile_size;
+    int ty1 = triangle.y1 / tile_size;
+    for (int ty = ty0; ty <= ty1; ++ty)
+    {
+        for (int tx = tx0; tx <= tx1; ++tx)
+        {
+            // Skip tiles that are completely outside one of the edges. The largest value of an edge function over a tile is at one of its corners
+            int64_t px0 = tx * tile_size, px1 = px0 + tile_size - 1;
+            int64_t py0 = ty * tile_size, py1 = py0 + tile_size - 1;
+            bool outside = false;
+            for (int i = 0; i < 3 && !outside; ++i)
+            {
+                int64_t px = triangle.edge_a[i] > 0 ? px1 : px0;
+                int64_t py = triangle.edge_b[i] > 0 ? py1 : py0;
+                outside = triangle.edge_a[i] * px + triangle.edge_b[i] * py + triangle.edge_c[i] < 0;
+            }
+            if (!outside)
+                bins.bins[(size_t)ty * bins.tiles_x + tx].push_back(index);
+        }
+    }
+}
+
+void raster_tile(const TileBins &bins, int tile)
+{
+    PROFILE_SCOPE("raster_tile");
+    SoftwareTarget *target = bins.target;
+    int x0 = (tile % bins.tiles_x) * tile_size;
+    int y0 = (tile / bins.tiles_x) * tile_size;
+    int x1 = (x0 + tile_size < target->width ? x0 + tile_size : target->width) - 1;
+    int y1 = (y0 + tile_size < target->height ? y0 + tile_size : target->height) - 1;
+
+    const std::vector<uint32_t> &bin = bins.bins[tile];
+    for (size_t i = 0; i < bin.size(); ++i)
+    {
+        if (bin[i] & bin_clear_flag)
+        {
+            uint32_t packed = bins.clears[bin[i] & ~bin_clear_flag];
+            for (int y = y0; y <= y1; ++y)
+            {
+                uint32_t *row = &target->pixels[(size_t)y * target->width];
+                for (int x = x0; x <= x1; ++x)
+                    row[x] = packed;
+            }
+        }
+        else
+        {
+            // Only the part of the triangle inside this tile
+            const RasterizerTriangle &triangle = bins.triangles[bin[i]];
+            int rect_x0 = triangle.x0 > x0 ? triangle.x0 : x0;
+            int rect_y0 = triangle.y0 > y0 ? triangle.y0 : y0;
+            int rect_x1 = triangle.x1 < x1 ? triangle.x1 : x1;
+            int rect_y1 = triangle.y1 < y1 ? triangle.y1 : y1;
+            software_raster_kernel(triangle, target->pixels.data(), target->width, rect_x0, rect_y0, rect_x1, rect_y1);
+        }
+    }
+}
+
+// Rasterize everything binned so far across the job system
+void bins_flush(TileBins &bins)
+{
+    if (!bins.target)
+        return;
+
+    job_parallel_for(bins.tiles_x * bins.tiles_y, 1, [&bins](int tile) { raster_tile(bins, tile); });
+    bins.target = nullptr;
+}
+
+// Make sure the bins are collecting for this target
+void bins_bind(TileBins &bins, SoftwareTarget *target)
+{
+    if (bins.target == target)
+        return;
+
+    bins_flush(bins);
+    bins_begin(bins, target);
+}
+
+// Input assembler index fetch, out of bounds reads return zero like on the gpu
+uint32_t fetch_index(const SoftwareIndexBufferView &view, uint32_t position)
+{
+    uint32_t size = view.Format == mesh_index_format_16 ? 2 : 4;
+    uint64_t offset = (uint64_t)position * size;
+    if (offset + size > view.SizeInBytes)
+        return 0;
+
+    if (size == 2)
+    {
+        uint16_t index;
+        memcpy(&index, view.BufferLocation + offset, sizeof(index));
+        return index;
+    }
+    uint32_t index;
+    memcpy(&index, view.BufferLocation + offset, sizeof(index));
+    return index;
+}
+
+// DrawInstanced() and DrawIndexedInstanced() in one. Without indices the n-th vertex is start + n, with them it is base_vertex plus the
+// n-th index from start on
+void draw_instanced(TileBins &bins, const RasterState &state, bool indexed, uint32_t count, uint32_t instance_count, uint32_t start, int32_t base_vertex)
+{
+    const SoftwareVertexBufferView &view = state.vertex_buffer;
+    if (!state.target || !view.BufferLocation || view.StrideInBytes == 0)
+        return;
+    const VertexFormatDesc &layout = vertex_format_desc(state.vertex_format);
+    if (indexed && (!state.index_buffer.BufferLocation || (state.index_buffer.Format != mesh_index_format_16 && state.index_buffer.Format != mesh_index_format_32)))
+        return;
+
+    bins_bind(bins, state.target);
+
+    // Pixels we are allowed to touch: the scissor rect, the viewport and the target
+    int clip_x0 = (int)state.scissor.left;
+    int clip_y0 = (int)state.scissor.top;
+    int clip_x1 = (int)state.scissor.right - 1;
+    int clip_y1 = (int)state.scissor.bottom - 1;
+    int viewport_x0 = (int)floorf(state.viewport.TopLeftX);
+    int viewport_y0 = (int)floorf(state.viewport.TopLeftY);
+    int viewport_x1 = (int)ceilf(state.viewport.TopLeftX + state.viewport.Width) - 1;
+    int viewport_y1 = (int)ceilf(state.viewport.TopLeftY + state.viewport.Height) - 1;
+    if (clip_x0 < viewport_x0) clip_x0 = viewport_x0;
+    if (clip_y0 < viewport_y0) clip_y0 = viewport_y0;
+    if (clip_x1 > viewport_x1) clip_x1 = viewport_x1;
+    if (clip_y1 > viewport_y1) clip_y1 = viewport_y1;
+    if (clip_x0 < 0) clip_x0 = 0;
+    if (clip_y0 < 0) clip_y0 = 0;
+    if (clip_x1 > state.target->width - 1) clip_x1 = state.target->width - 1;
+    if (clip_y1 > state.target->height - 1) clip_y1 = state.target->height - 1;
+    if (clip_x0 > clip_x1 || clip_y0 > clip_y1)
+        return;
+
+    // There is no per instance data in our input layout, so every instance draws the same triangles
+    for (uint32_t instance = 0; instance < instance_count; ++instance)
+    {
+        for (uint32_t first = 0; first + 3 <= count; first += 3)
+        {
+            ClipVertex polygon[9];
+            bool in_bounds = true;
+            for (int i = 0; i < 3; ++i)
+            {
+                // Input assembler: fetch POSITION and COLOR the way the input layout says with the stride from the view,
+                // out of bounds reads return zero like on the gpu
+                uint32_t vertex = indexed ? (uint32_t)(base_vertex + (int64_t)fetch_index(state.index_buffer, start + first + i)) : start + first + i;
+                uint64_t offset = (uint64_t)vertex * view.StrideInBytes;
+                float position[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                float color[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                if (offset + layout.stride <= view.SizeInBytes)
+                {
+                    vertex_element_fetch(layout.elements[0].format, view.BufferLocation + offset + layout.elements[0].offset, position);
+                    vertex_element_fetch(layout.elements[1].format, view.BufferLocation + offset + layout.elements[1].offset, color);
+                }
+                else
+                {
+                    in_bounds = false;
+                }
+
+                // Vertex shader: float4(input.pos, 1.0f), the quantized variant scales the position into the mesh's bounds first
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    polygon[i].pos[axis] = layout.dequantize ? position[axis] * state.dequantization.scale[axis] + state.dequantization.offset[axis]
+                                                             : position[axis];
+                }
+                polygon[i].pos[3] = 1.0f;
+                memcpy(polygon[i].color, color, sizeof(color));
+            }
+            if (!in_bounds)
+                continue;
+
+            int count = clip_triangle(polygon, 3);
+            if (count < 3)
+                continue;
+
+            // Perspective divide, viewport transform and snapping. Our vertex shader always writes w = 1 so colors stay linear in screen space
+            int64_t x[9], y[9];
+            for (int i = 0; i < count; ++i)
+            {
+                float inv_w = 1.0f / polygon[i].pos[3];
+                float sx = state.viewport.TopLeftX + (polygon[i].pos[0] * inv_w + 1.0f) * 0.5f * state.viewport.Width;
+                float sy = state.viewport.TopLeftY + (1.0f - polygon[i].pos[1] * inv_w) * 0.5f * state.viewport.Height;
+                x[i] = (int64_t)llroundf(sx * subpixel_one);
+                y[i] = (int64_t)llroundf(sy * subpixel_one);
+            }
+
+            // The clipped polygon is convex, draw it as a fan
+            for (int i = 1; i + 1 < count; ++i)
+            {
+                int64_t tx[3] = {x[0], x[i], x[i + 1]};
+                int64_t ty[3] = {y[0], y[i], y[i + 1]};
+                float tc[3][4];
+                memcpy(tc[0], polygon[0].color, sizeof(tc[0]));
+                memcpy(tc[1], polygon[i].color, sizeof(tc[1]));
+                memcpy(tc[2], polygon[i + 1].color, sizeof(tc[2]));
+
+                RasterizerTriangle triangle;
+                if (rasterizer_setup(tx, ty, tc, clip_x0, clip_y0, clip_x1, clip_y1, triangle))
+                    bin_triangle(bins, triangle);
+            }
+        }
+    }
+}
+} // namespace
+
+void software_queue_execute(SoftwareCommandList *const *lists, int count)
+{
+    PROFILE_SCOPE("software_queue_execute");
+    // Like on the gpu no state carries over from one command list to the next
+    for (int l = 0; l < count; ++l)
+    {
+        RasterState state = {};
+        const std::vector<SoftwareCommand> &commands = lists[l]->commands;
+        for (size_t i = 0; i < commands.size(); ++i)
+        {
+            const SoftwareCommand &command = commands[i];
+            switch (command.type)
+            {
+            case SOFTWARE_COMMAND_SET_RENDER_TARGET:
+                state.target = command.render_target;
+                break;
+            case SOFTWARE_COMMAND_CLEAR:
+                if (command.clear.target->state != resource_state_render_target)
+                    ++software_barrier_errors;
+                bins_bind(software_bins, command.clear.target);
+                bin_clear(software_bins, command.clear.color);
+                break;
+            case SOFTWARE_COMMAND_SET_VIEWPORT:
+                state.viewport = command.viewport;
+                break;
+            case SOFTWARE_COMMAND_SET_SCISSOR:
+                state.scissor = command.scissor;
+                break;
+            case SOFTWARE_COMMAND_SET_VERTEX_BUFFER:
+                state.vertex_buffer = command.vertex_buffer;
+                break;
+            case SOFTWARE_COMMAND_DRAW:
+                if (state.target && state.target->state != resource_state_render_target)
+                    ++software_barrier_errors;
+                draw_instanced(software_bins, state, false, command.draw.vertex_count, command.draw.instance_count, command.draw.start_vertex, 0);
+                break;
+            case SOFTWARE_COMMAND_SET_INDEX_BUFFER:
+                state.index_buffer = command.index_buffer;
+                break;
+            case SOFTWARE_COMMAND_SET_VERTEX_FORMAT:
+                state.vertex_format = command.vertex_format;
+                break;
+            case SOFTWARE_COMMAND_SET_ROOT_CONSTANTS:
+                memcpy(&state.dequantization, command.root_constants, sizeof(state.dequantization));
+                break;
+            case SOFTWARE_COMMAND_DRAW_INDEXED:
+                if (state.target && state.target->state != resource_state_render_target)
+                    ++software_barrier_errors;
+                draw_instanced(software_bins, state, true, command.draw_indexed.index_count, command.draw_indexed.instance_count, command.draw_indexed.start_index,
+                               command.draw_indexed.base_vertex);
+                break;
+            case SOFTWARE_COMMAND_RESOURCE_BARRIER:
+                //Targets only have one subresource, so a single one and all of them are the same thing
+                for (uint32_t b = 0; b < command.barrier.count; ++b)
+                {
+                    const ResourceTransition &barrier = lists[l]->barriers[command.barrier.first + b];
+                    SoftwareTarget *target = (SoftwareTarget *)barrier.resource;
+                    if (target->state != barrier.before)
+                        ++software_barrier_errors;
+                    target->state = barrier.after;
+                }
+                break;
+            case SOFTWARE_COMMAND_TIMESTAMP:
+                //The time the work before it is done, so the binned triangles are rasterized first. Splitting the bins does not change a pixel
+                bins_flush(software_bins);
+                software_timer_queue.queries[command.query] = SoftwareTimerQueue::now(std::chrono::steady_clock::now());
+                break;
+            case SOFTWARE_COMMAND_RESOLVE_QUERIES:
+                memcpy(&software_timer_queue.results[command.resolve.first], &software_timer_queue.queries[command.resolve.first],
+                       command.resolve.count * sizeof(uint64_t));
+                break;
+            }
+        }
+    }
+
+    // Everything is on screen once the queue is done
+    bins_flush(software_bins);
+}
+
+bool software_renderer_init(int width, int height)
+{
+    // -- Creating the back buffers -- //
+    // There is no swap chain, the back buffers are plain memory and presenting just flips which one is the front buffer
+    for (int i = 0; i < framebuffer_count; ++i)
+    {
+        software_targets[i].width = width;
+        software_targets[i].height = height;
+        software_targets[i].pixels.assign((size_t)width * height, 0);
+        software_targets[i].state = resource_state_present;
+        resource_state_register(software_resource_states, &software_targets[i], 1, resource_state_present);
+    }
+    software_barrier_errors = 0;
+    software_frame_index = 0;
+    software_present_index = framebuffer_count - 1;
+
+    //Pick the widest pixel loop this cpu can run
+    software_raster_kernel = rasterizer_kernel(rasterizer_detect_isa());
+
+    // -- Creating the command list and the fence -- //
+    // The queue runs the command list when it is executed, so the fence is complete as soon as it is signaled. A FakeFrameQueue can stand in
+    // for it to pretend there is a gpu that takes a while
+    if (software_record_threads < 1 || software_record_threads > record_threads_max)
+        return false;
+    for (int i = 0; i < frame_ring_max_frames; ++i)
+    {
+        for (int thread = 0; thread < record_threads_max; ++thread)
+        {
+            software_command_lists[i][thread].Reset();
+            software_command_lists[i][thread].Close();
+        }
+        software_barrier_command_lists[i].Reset();
+        software_barrier_command_lists[i].Close();
+    }
+    for (int thread = 0; thread < record_threads_max; ++thread)
+        resource_state_tracker_init(software_state_trackers[thread], software_resource_states);
+    if (!frame_ring_init(software_frame_ring, software_frame_queue ? software_frame_queue : &software_cpu_queue, software_frames_in_flight))
+        return false;
+
+    //Uploads go through the upload manager like renderer_init()'s do, see upload_manager.h
+    if (!upload_manager_init(software_upload_manager, &software_copy_queue, software_upload_block_size, 2, 0))
+        return false;
+
+    //A range of timestamp queries per frame context, the timer only records them while the profiler is on
+    software_timer_queue.queries.assign((size_t)software_frames_in_flight * gpu_timer_max_queries, 0);
+    software_timer_queue.results.assign(software_timer_queue.queries.size(), 0);
+    if (!gpu_timer_init(software_gpu_timer, &software_timer_queue, software_frames_in_flight))
+        return false;
+
+    // -- Creating a vertex Buffer -- //
+    //a triangle, the same one renderer_init() uploads
+    Mesh triangle;
+    triangle.vertices = {
+        { 0.0f, 0.5f, 0.5f, 1.0f, 0.0f, 0.0f, 1.0f },
+        { 0.5f, -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f },
+        { -0.5f, -0.5f, 0.5f, 0.0f, 1.0f, 1.0f, 1.0f },
+    };
+    triangle.indices = { 0, 1, 2 };
+
+    //A benchmark scenario can draw something else in its place
+    if (software_scene_mesh)
+        triangle = *software_scene_mesh;
+
+    //Every mesh is reordered for the vertex cache, overdraw and vertex fetch before it is uploaded, see mesh_optimizer.h
+    mesh_optimize(triangle);
+
+    //Then stored in the smallest vertex format that is exact enough, see vertex_format.h
+    triangle.vertex_format = vertex_format_choose(triangle.vertices.data(), triangle.vertices.size(), software_vertex_tolerance);
+    VertexBufferData vertices;
+    vertex_format_encode(triangle.vertices.data(), triangle.vertices.size(), triangle.vertex_format, vertices);
+    software_vertexBuffer.assign(vertices.data.size(), 0);
+    UploadTicket vertex_upload = upload_manager_buffer(software_upload_manager, &software_vertexBuffer, 0, vertices.data.data(), vertices.data.size());
+    software_vertex_format = vertices.format;
+    software_vertex_dequantization = vertices.dequantization;
+
+    software_vertexBuffer_view.BufferLocation = software_vertexBuffer.data();
+    software_vertexBuffer_view.StrideInBytes = vertices.stride;
+    software_vertexBuffer_view.SizeInBytes = (uint32_t)software_vertexBuffer.size();
+
+    // -- Creating an index Buffer -- //
+    //Three vertices fit 16 bit indices, mesh_pack_indices() picks the format the same way for every mesh
+    MeshIndexBuffer indices;
+    mesh_pack_indices(triangle.indices.data(), triangle.indices.size(), triangle.vertices.size(), indices);
+    software_indexBuffer.assign(indices.data.size(), 0);
+    UploadTicket index_upload = upload_manager_buffer(software_upload_manager, &software_indexBuffer, 0, indices.data.data(), indices.data.size());
+
+    software_indexBuffer_view.BufferLocation = software_indexBuffer.data();
+    software_indexBuffer_view.SizeInBytes = (uint32_t)software_indexBuffer.size();
+    software_indexBuffer_view.Format = indices.format;
+    software_index_count = indices.count;
+
+    //Both go to the copy queue as one batch. It is done as soon as it is submitted here, where renderer_init() has the direct queue wait for it
+    upload_manager_submit(software_upload_manager);
+    if (!upload_manager_done(software_upload_manager, vertex_upload) || !upload_manager_done(software_upload_manager, index_upload))
+        return false;
+
+    //Fill out viewport and scissor rect, same as the d3d12 ones
+    software_viewport.TopLeftX = 0;
+    software_viewport.TopLeftY = 0;
+    software_viewport.Width = (float)width;
+    software_viewport.Height = (float)height;
+    software_viewport.MinDepth = 0.0f;
+    software_viewport.MaxDepth = 1.0f;
+
+    software_scissorRect.left = 0;
+    software_scissorRect.top = 0;
+    software_scissorRect.right = width;
+    software_scissorRect.bottom = height;
+
+    //The frame as a render graph, see renderer_build_frame_graph(). The vertex and index buffers are plain memory the rasterizer reads, they have no state to track
+    render_graph_reset(software_frame_graph);
+    software_graph_back_buffer = render_graph_import(software_frame_graph, "back buffer", nullptr, resource_state_present, resource_state_present);
+    RenderGraphHandle vertex_buffer = render_graph_import(software_frame_graph, "vertex buffer", nullptr, resource_state_vertex_and_constant_buffer,
+                                                          resource_state_vertex_and_constant_buffer);
+
+    int clear = render_graph_add_pass(software_frame_graph, "clear", software_pass_clear);
+    RenderGraphHandle cleared = render_graph_write(software_frame_graph, clear, software_graph_back_buffer, resource_state_render_target);
+
+    RenderGraphHandle index_buffer = render_graph_import(software_frame_graph, "index buffer", nullptr, resource_state_index_buffer, resource_state_index_buffer);
+
+    int triangles = render_graph_add_pass(software_frame_graph, "triangles", software_pass_triangles);
+    render_graph_read(software_frame_graph, triangles, vertex_buffer, resource_state_vertex_and_constant_buffer);
+    render_graph_read(software_frame_graph, triangles, index_buffer, resource_state_index_buffer);
+    render_graph_output(software_frame_graph, render_graph_write(software_frame_graph, triangles, cleared, resource_state_render_target));
+
+    return render_graph_compile(software_frame_graph);
+}
+
+bool software_pipeline_update()
+{
+    PROFILE_SCOPE("software_pipeline_update");
+    //We have to wait for the queue to finish with the frame context before we record over it
+    //If the wait failed the queue may still be running its lists, so nothing is recorded
+    int context = frame_ring_begin(software_frame_ring);
+    if (context < 0)
+        return false;
+    software_frame_context = context;
+
+    //The queue is done with what this context timed last time, hand that to the profiler
+    gpu_timer_begin_frame(software_gpu_timer, software_frame_context);
+
+    //Every thread records its own list of this frame context, like pipeline_record() does with the d3d12 allocators
+    render_graph_set_physical(software_frame_graph, software_graph_back_buffer, &software_targets[software_frame_index]);
+    job_parallel_for(software_record_threads, 1, software_pipeline_record);
+
+    //Now that we know the order the lists run in, get every resource into the state each list expects it in when it starts.
+    //The first list's barriers go into a list of their own that runs before it, everybody else's at the end of the list before them.
+    //The lists are only closed after that
+    std::vector<ResourceTransition> barriers;
+    SoftwareCommandList &barrier_list = software_barrier_command_lists[software_frame_context];
+    barrier_list.Reset();
+    for (int thread = 0; thread < software_record_threads; ++thread)
+    {
+        barriers.clear();
+        if (resource_state_resolve(software_resource_states, software_state_trackers[thread], barriers))
+        {
+            SoftwareCommandList &before = thread == 0 ? barrier_list : software_command_lists[software_frame_context][thread - 1];
+            GpuTimerScope timer(software_gpu_timer, &before, "gpu: barriers");
+            before.ResourceBarrier((uint32_t)barriers.size(), barriers.data());
+        }
+        if (thread > 0)
+            software_command_lists[software_frame_context][thread - 1].Close();
+    }
+    //Everything timed is recorded, the last list resolves it
+    gpu_timer_end_frame(software_gpu_timer, &software_command_lists[software_frame_context][software_record_threads - 1]);
+    software_command_lists[software_frame_context][software_record_threads - 1].Close();
+    barrier_list.Close();
+    return true;
+}
+
+void software_pipeline_record(int thread)
+{
+    PROFILE_SCOPE("software_pipeline_record");
+    SoftwareCommandList &command_list = software_command_lists[software_frame_context][thread];
+    ResourceStateTracker &tracker = software_state_trackers[thread];
+    command_list.Reset();
+    resource_state_tracker_reset(tracker);
+
+    //The graph transitions what each pass uses through the tracker, so only the lists that really change a state get a barrier.
+    //The list is closed by software_pipeline_update() once its barriers are resolved
+    auto flush = [&command_list](const ResourceTransition *barriers, int count) {
+        GpuTimerScope timer(software_gpu_timer, &command_list, "gpu: barriers");
+        command_list.ResourceBarrier((uint32_t)count, barriers);
+    };
+    render_graph_execute(software_frame_graph, tracker, flush, nullptr, thread, software_record_threads);
+}
+
+void software_pass_clear(int thread, int share, int)
+{
+    //Clear the render target, same color as renderer_pass_clear(). The lists run in thread order so only the first share clears
+    if (share != 0)
+        return;
+
+    SoftwareCommandList &command_list = software_command_lists[software_frame_context][thread];
+    GpuTimerScope timer(software_gpu_timer, &command_list, "gpu: clear");
+    SoftwareTarget *target = &software_targets[software_frame_index];
+    const float clearColor[] = {0.0f, 0.2f, 0.4f, 1.0f};
+    command_list.OMSetRenderTargets(target);
+    command_list.ClearRenderTargetView(target, clearColor);
+}
+
+void software_pass_triangles(int thread, int share, int share_count)
+{
+    SoftwareCommandList &command_list = software_command_lists[software_frame_context][thread];
+    GpuTimerScope timer(software_gpu_timer, &command_list, "gpu: triangles");
+    command_list.OMSetRenderTargets(&software_targets[software_frame_index]);
+
+    //Drawing this thread's share of the triangles
+    command_list.RSSetViewports(&software_viewport);
+    command_list.RSSetScissorRects(&software_scissorRect);
+    command_list.IASetVertexBuffers(&software_vertexBuffer_view);
+    command_list.IASetIndexBuffer(&software_indexBuffer_view);
+    command_list.IASetVertexFormat(software_vertex_format);
+    command_list.SetGraphicsRoot32BitConstants(8, &software_vertex_dequantization);
+    //This thread's share of the draws and each draw's share of the instances. With one draw per thread every thread draws its share in one call
+    uint32_t draws = software_draw_calls > (uint32_t)share_count ? software_draw_calls : (uint32_t)share_count;
+    uint32_t draw_begin = (uint32_t)((uint64_t)draws * share / share_count);
+    uint32_t draw_end = (uint32_t)((uint64_t)draws * (share + 1) / share_count);
+    for (uint32_t draw = draw_begin; draw < draw_end; ++draw)
+    {
+        uint32_t instance_begin = (uint32_t)((uint64_t)software_draw_instances * draw / draws);
+        uint32_t instance_end = (uint32_t)((uint64_t)software_draw_instances * (draw + 1) / draws);
+        if (instance_end > instance_begin)
+            command_list.DrawIndexedInstanced(software_index_count, instance_end - instance_begin, 0, 0, instance_begin);
+    }
+}
+
+uint64_t software_barrier_total()
+{
+    uint64_t barriers = 0;
+    for (int thread = 0; thread < record_threads_max; ++thread)
+        barriers += software_state_trackers[thread].barriers;
+    return barriers;
+}
+
+bool software_renderer_render()
+{
+    PROFILE_SCOPE("software_renderer_render");
+    //Update the pipeline by recording the command list. The queue is the gpu here, so what the cpu pays for the frame is the recording
+    auto submit_start = std::chrono::steady_clock::now();
+    double waited = software_frame_ring.wait_seconds;
+    uint64_t barriers = software_barrier_total();
+    if (!software_pipeline_update())
+        return false;
+    software_frame_barriers = software_barrier_total() - barriers;
+
+    //execute the array of command lists
+    //all of the frame's lists go to the queue in one batch, in thread order
+    //the list with the first list's barriers only goes in front of them if there are any
+    SoftwareCommandList *command_temp_list[record_threads_max + 1];
+    int count = 0;
+    if (!software_barrier_command_lists[software_frame_context].commands.empty())
+        command_temp_list[count++] = &software_barrier_command_lists[software_frame_context];
+    for (int thread = 0; thread < software_record_threads; ++thread)
+        command_temp_list[count++] = &software_command_lists[software_frame_context][thread];
+    software_submit_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - submit_start).count() - (software_frame_ring.wait_seconds - waited);
+    software_queue_execute(command_temp_list, count);
+
+    //Presenting a target that is not in the present state is an error on the gpu too
+    if (software_targets[software_frame_index].state != resource_state_present)
+        ++software_barrier_errors;
+
+    //Signal this frame's fence value, with the cpu queue it completes right away
+    //Without one nobody can tell when the queue is done with the frame, it is not presented
+    if (!frame_ring_end(software_frame_ring))
+        return false;
+
+    //present the current backbuffer and move on to the next one (flip discard)
+    software_present_index = software_frame_index;
+    software_frame_index = (software_frame_index + 1) % framebuffer_count;
+    return true;
+}
+
+bool software_renderer_wait()
+{
+    return frame_ring_flush(software_frame_ring);
+}
+
+void software_renderer_cleanup()
+{
+    //Nothing was signaled if init failed before the ring was set up. If the wait fails nothing that was signaled can still finish,
+    //so there is nothing left to wait for either way
+    if (software_frame_ring.queue)
+        software_renderer_wait();
+    software_frame_ring.queue = nullptr;
+    software_frame_queue = nullptr;
+
+    for (int i = 0; i < framebuffer_count; ++i)
+    {
+        software_targets[i].pixels.clear();
+        software_targets[i].pixels.shrink_to_fit();
+    }
+    for (int i = 0; i < frame_ring_max_frames; ++i)
+    {
+        for (int thread = 0; thread < record_threads_max; ++thread)
+        {
+            software_command_lists[i][thread].commands.clear();
+            software_command_lists[i][thread].commands.shrink_to_fit();
+        }
+        software_barrier_command_lists[i].commands.clear();
+    }
+    render_graph_reset(software_frame_graph);
+    software_resource_states.resources.clear();
+    upload_manager_shutdown(software_upload_manager);
+    gpu_timer_shutdown(software_gpu_timer);
+    software_vertexBuffer.clear();
+    software_vertexBuffer_view = SoftwareVertexBufferView();
+    software_indexBuffer.clear();
+    software_indexBuffer_view = SoftwareIndexBufferView();
+}
+
+bool software_target_save_ppm(const SoftwareTarget &target, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    fprintf(file, "P6\n%d %d\n255\n", target.width, target.height);
+    std::vector<uint8_t> row((size_t)target.width * 3);
+    for (int y = 0; y < target.height; ++y)
+    {
+        for (int x = 0; x < target.width; ++x)
+        {
+            uint32_t pixel = target.pixels[(size_t)y * target.width + x];
+            row[x * 3 + 0] = (uint8_t)(pixel & 0xff);
+            row[x * 3 + 1] = (uint8_t)((pixel >> 8) & 0xff);
+            row[x * 3 + 2] = (uint8_t)((pixel >> 16) & 0xff);
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
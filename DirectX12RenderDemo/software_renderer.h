@@ -0,0 +1,215 @@
+#pragma once
+
+#include "renderer_common.h"
+#include "rasterizer.h"
+#include "frame_ring.h"
+#include "resource_state.h"
+#include "render_graph.h"
+#include "gpu_timer.h"
+#include "vertex_format.h"
+#include "mesh.h"
+#include <stdint.h>
+#include <vector>
+
+/*
+    CPU implementation of the same pipeline main.cpp builds with d3d12.
+    It follows the same init -> record -> execute -> present flow so the two read the same:
+        software_renderer_init()   creates the offscreen back buffers, the command list and the triangle with its index buffer
+        software_pipeline_update() records clear, viewport/scissor, vertex/index buffer and draw commands, split over one command list per recording thread.
+                                   Barriers come from a resource state tracker per list, like pipeline_record() (see resource_state.h)
+        software_renderer_render() executes the command list, signals the fence and presents (frame pacing is the frame ring, see frame_ring.h)
+
+    The fixed function state matches the PSO in renderer_init(): default rasterizer (solid, cull back, clockwise front faces, depth clip on),
+    default blend (overwrite), one R8G8B8A8_UNORM target. vertex.hlsl passes the position through with w = 1 (scaled into the mesh's bounds
+    first for quantized vertices, see vertex_format.h) and pixel.hlsl returns the interpolated color, so those two shaders are baked into the
+    rasterizer instead of being interpreted.
+
+    Coverage follows the d3d rules exactly (8 bits of sub pixel precision, pixel centers at .5, top-left fill rule), so the set of pixels touched
+    is the same as on the gpu. Colors are interpolated in float like the hardware does and can differ by one unorm step at most.
+
+    Timestamp queries are commands too: the queue rasterizes everything binned so far and writes the time, so software_gpu_timer
+    reports how long the rasterizer took for each pass the way renderer_gpu_timer does for the gpu.
+
+    Barriers do nothing to the pixels here, but the queue checks them the way the debug layer would: every target remembers the state the last
+    barrier left it in, and a barrier from another state, drawing to a target that is not a render target or presenting one that is not in the
+    present state counts as an error in software_barrier_errors.
+*/
+
+// Same fields as D3D12_VIEWPORT
+struct SoftwareViewport
+{
+    float TopLeftX;
+    float TopLeftY;
+    float Width;
+    float Height;
+    float MinDepth;
+    float MaxDepth;
+};
+
+// Same fields as D3D12_RECT
+struct SoftwareRect
+{
+    long left;
+    long top;
+    long right;
+    long bottom;
+};
+
+// Same fields as D3D12_VERTEX_BUFFER_VIEW, but the location is a cpu pointer
+struct SoftwareVertexBufferView
+{
+    const uint8_t *BufferLocation;
+    uint32_t SizeInBytes;
+    uint32_t StrideInBytes;
+};
+
+// Same fields as D3D12_INDEX_BUFFER_VIEW, Format is DXGI_FORMAT_R16_UINT or DXGI_FORMAT_R32_UINT (mesh_index_format_16/32 in mesh.h)
+struct SoftwareIndexBufferView
+{
+    const uint8_t *BufferLocation;
+    uint32_t SizeInBytes;
+    uint32_t Format;
+};
+
+// An offscreen RGBA8 render target. Pixels are stored row by row, R in the lowest byte like DXGI_FORMAT_R8G8B8A8_UNORM
+struct SoftwareTarget
+{
+    int width;
+    int height;
+    std::vector<uint32_t> pixels;
+    ResourceState state; // State the executed barriers left it in
+};
+
+enum SoftwareCommandType
+{
+    SOFTWARE_COMMAND_SET_RENDER_TARGET,
+    SOFTWARE_COMMAND_CLEAR,
+    SOFTWARE_COMMAND_SET_VIEWPORT,
+    SOFTWARE_COMMAND_SET_SCISSOR,
+    SOFTWARE_COMMAND_SET_VERTEX_BUFFER,
+    SOFTWARE_COMMAND_SET_INDEX_BUFFER,
+    SOFTWARE_COMMAND_SET_VERTEX_FORMAT,
+    SOFTWARE_COMMAND_SET_ROOT_CONSTANTS,
+    SOFTWARE_COMMAND_DRAW,
+    SOFTWARE_COMMAND_DRAW_INDEXED,
+    SOFTWARE_COMMAND_RESOURCE_BARRIER,
+    SOFTWARE_COMMAND_TIMESTAMP,
+    SOFTWARE_COMMAND_RESOLVE_QUERIES,
+};
+
+struct SoftwareCommand
+{
+    SoftwareCommandType type;
+    union
+    {
+        SoftwareTarget *render_target;
+        struct
+        {
+            SoftwareTarget *target;
+            float color[4];
+        } clear;
+        SoftwareViewport viewport;
+        SoftwareRect scissor;
+        SoftwareVertexBufferView vertex_buffer;
+        SoftwareIndexBufferView index_buffer;
+        VertexFormat vertex_format;
+        float root_constants[8];
+        struct
+        {
+            uint32_t vertex_count;
+            uint32_t instance_count;
+            uint32_t start_vertex;
+            uint32_t start_instance;
+        } draw;
+        struct
+        {
+            uint32_t index_count;
+            uint32_t instance_count;
+            uint32_t start_index;
+            int32_t base_vertex;
+            uint32_t start_instance;
+        } draw_indexed;
+        struct
+        {
+            uint32_t first; // Into SoftwareCommandList::barriers
+            uint32_t count;
+        } barrier;
+        uint32_t query; // Timestamp
+        struct
+        {
+            uint32_t first;
+            uint32_t count;
+        } resolve;
+    };
+};
+
+// Records commands the same way ID3D12GraphicsCommandList does, nothing runs until the list is executed
+struct SoftwareCommandList
+{
+    std::vector<SoftwareCommand> commands;
+    std::vector<ResourceTransition> barriers; // What the barrier commands point into
+    bool recording;
+
+    void Reset();
+    void Close();
+    void OMSetRenderTargets(SoftwareTarget *render_target);
+    void ClearRenderTargetView(SoftwareTarget *render_target, const float color[4]);
+    void RSSetViewports(const SoftwareViewport *viewport);
+    void RSSetScissorRects(const SoftwareRect *rect);
+    void IASetVertexBuffers(const SoftwareVertexBufferView *view);
+    void IASetIndexBuffer(const SoftwareIndexBufferView *view);
+    void IASetVertexFormat(VertexFormat format); // The input layout and vertex shader variant, the part of SetPipelineState() that changes anything here
+    void SetGraphicsRoot32BitConstants(uint32_t count, const void *data); // Up to 8, the vertex shader reads them as VertexDequantization
+    void DrawInstanced(uint32_t vertex_count, uint32_t instance_count, uint32_t start_vertex, uint32_t start_instance);
+    void DrawIndexedInstanced(uint32_t index_count, uint32_t instance_count, uint32_t start_index, int32_t base_vertex, uint32_t start_instance);
+    void ResourceBarrier(uint32_t count, const ResourceTransition *barriers);
+    void EndQuery(uint32_t query);                              // A timestamp, once everything before it is rasterized
+    void ResolveQueryData(uint32_t first_query, uint32_t count); // Into the readback memory of software_gpu_timer's queue
+};
+
+//Software globals, named after their d3d12 counterparts in main.cpp
+extern SoftwareTarget software_targets[framebuffer_count];
+extern SoftwareCommandList software_command_lists[frame_ring_max_frames][record_threads_max]; // Keyed by (frame context, thread), a frame's lists are only reused once the fence says it is done
+extern SoftwareCommandList software_barrier_command_lists[frame_ring_max_frames]; // Runs the barriers the first recording thread's list needs before it, see resource_state_resolve()
+extern ResourceStateTracker software_state_trackers[record_threads_max]; // One per recording thread, reset with its command list
+extern ResourceStateRegistry software_resource_states; // State of every target after everything executed so far
+extern RenderGraph software_frame_graph; // Same passes as renderer_frame_graph, compiled in software_renderer_init()
+extern RenderGraphHandle software_graph_back_buffer;
+extern uint64_t software_barrier_errors; // Barriers that did not match the state a target was in, and targets used in the wrong state
+extern int software_record_threads; // How many threads record command lists for a frame (1..record_threads_max), set before software_renderer_init()
+extern SoftwareViewport software_viewport;
+extern SoftwareRect software_scissorRect;
+extern SoftwareVertexBufferView software_vertexBuffer_view;
+extern SoftwareIndexBufferView software_indexBuffer_view;
+extern VertexFormat software_vertex_format;                  // Format the triangle was uploaded in, vertex_format_choose() picks it in software_renderer_init()
+extern VertexDequantization software_vertex_dequantization;  // Its dequantization constants
+extern float software_vertex_tolerance;                      // Position error the triangle's format may have, 0 keeps floats. Set before software_renderer_init()
+extern FrameRing software_frame_ring;     // Paces frames on the queue's timeline fence, same as renderer_frame_ring
+extern FrameQueue *software_frame_queue;  // Queue the ring signals, nullptr means the cpu queue which finishes as soon as it is signaled. Set before software_renderer_init(), cleanup clears it
+extern int software_frames_in_flight;     // How far the cpu may run ahead of the queue, set before software_renderer_init()
+extern int software_frame_context;        // Frame context being recorded
+extern int software_frame_index;
+extern int software_present_index; // The target that was presented last, i.e. the one you would see on screen
+extern RasterizerKernel software_raster_kernel; // Pixel loop the tiles are drawn with, software_renderer_init() picks the best one for the cpu
+extern GpuTimer software_gpu_timer; // Times the passes with timestamps the queue writes, like renderer_gpu_timer (see gpu_timer.h)
+extern uint32_t software_draw_instances; // Instance count software_pipeline_update() draws the triangle with, more instances means more rasterizer load for benchmarking
+extern uint32_t software_draw_calls;     // Draw calls the instances are split into, at least one per recording thread
+extern const Mesh *software_scene_mesh;  // Drawn instead of the triangle if set, before software_renderer_init() (benchmark scenarios, see benchmark.h)
+extern double software_submit_seconds;   // Cpu time the last frame took to record and submit its lists, waits for the queue left out
+extern uint64_t software_frame_barriers; // Transition barriers the last frame's lists recorded, resolved ones included
+
+bool software_renderer_init(int width, int height); // Create the offscreen targets and upload the triangle and its indices
+bool software_pipeline_update();                     // Record the frame's command lists on software_record_threads threads, then resolve their barriers in order. false if the wait for the frame context failed
+void software_pipeline_record(int thread);           // Record one thread's share of the frame
+void software_pass_clear(int thread, int share, int share_count); // Render graph passes, like renderer_pass_clear() and renderer_pass_triangles()
+void software_pass_triangles(int thread, int share, int share_count);
+uint64_t software_barrier_total();                   // Barriers all state trackers recorded so far
+bool software_renderer_render();                     // Execute the command list and present, false if the frame ring failed to wait or signal
+bool software_renderer_wait();                       // Wait until the queue is done with every frame submitted so far, false if the wait failed
+void software_renderer_cleanup();                    // Release everything
+
+// Runs the recorded commands, this is what ID3D12CommandQueue::ExecuteCommandLists does on the gpu
+void software_queue_execute(SoftwareCommandList *const *lists, int count);
+
+// Writes a target out as a binary ppm so it can be diffed against a capture of the d3d12 window
+bool software_target_save_ppm(const SoftwareTarget &target, const char *path);
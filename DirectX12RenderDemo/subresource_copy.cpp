@@ -0,0 +1,491 @@
+#include "subresource_copy.h"
+#include "profiler.h"
+#include "job_system.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Streaming stores need sse2, which every x64 cpu has. Anything else copies with memcpy
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SUBRESOURCE_COPY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+// The copy as runs of bytes: runs_per_slice runs in each of slice_count slices, each cut into pieces of at most piece_size for the jobs
+struct CopyLayout
+{
+    uint64_t run_size;
+    uint64_t runs_per_slice;
+    uint64_t slice_count;
+    uint64_t piece_size;
+    uint64_t pieces_per_run;
+};
+
+// Ordinary stores up to the first 16 byte boundary of the destination, then a cache line of movntdq per iteration
+void copy_streaming(uint8_t *destination, const uint8_t *source, size_t size)
+{
+#ifdef SUBRESOURCE_COPY_SSE2
+    size_t head = (16 - ((uintptr_t)destination & 15)) & 15;
+    if (head > size)
+        head = size;
+    memcpy(destination, source, head);
+    destination += head;
+    source += head;
+    size -= head;
+
+    while (size >= 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)source);
+        __m128i b = _mm_loadu_si128((const __m128i *)(source + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(source + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(source + 48));
+        _mm_stream_si128((__m128i *)destination, a);
+        _mm_stream_si128((__m128i *)(destination + 16), b);
+        _mm_stream_si128((__m128i *)(destination + 32), c);
+        _mm_stream_si128((__m128i *)(destination + 48), d);
+        destination += 64;
+        source += 64;
+        size -= 64;
+    }
+    while (size >= 16)
+    {
+        _mm_stream_si128((__m128i *)destination, _mm_loadu_si128((const __m128i *)source));
+        destination += 16;
+        source += 16;
+        size -= 16;
+    }
+#endif
+    memcpy(destination, source, size);
+}
+
+// Streaming stores are weakly ordered, they have to be visible before whoever waits for this thread looks at the memory (or the gpu reads it)
+void finish_streaming()
+{
+#ifdef SUBRESOURCE_COPY_SSE2
+    _mm_sfence();
+#endif
+}
+
+CopyLayout copy_layout(const SubresourceCopy &copy)
+{
+    CopyLayout layout;
+    layout.run_size = copy.row_size;
+    layout.runs_per_slice = copy.row_count;
+    layout.slice_count = copy.slice_count;
+
+    // No padding between the rows on either side, a slice is one block. And if the slices are packed as well, so is everything
+    if (copy.row_count == 1 || (copy.destination_row_pitch == copy.row_size && copy.source_row_pitch == copy.row_size))
+    {
+        layout.run_size = copy.row_size * copy.row_count;
+        layout.runs_per_slice = 1;
+        if (copy.slice_count == 1 || (copy.destination_slice_pitch == layout.run_size && copy.source_slice_pitch == layout.run_size))
+        {
+            layout.run_size *= copy.slice_count;
+            layout.slice_count = 1;
+        }
+    }
+    layout.piece_size = layout.run_size;
+    layout.pieces_per_run = 1;
+    return layout;
+}
+
+template <bool streaming>
+void copy_run(uint8_t *destination, const uint8_t *source, uint64_t size)
+{
+    if (streaming)
+        copy_streaming(destination, source, (size_t)size);
+    else
+        memcpy(destination, source, (size_t)size);
+}
+
+template <bool streaming>
+void copy_pieces(const SubresourceCopy &copy, const CopyLayout &layout, uint64_t first, uint64_t last)
+{
+    if (first >= last)
+        return;
+
+    uint64_t run = first / layout.pieces_per_run;
+    uint64_t part = first % layout.pieces_per_run;
+    uint64_t slice = run / layout.runs_per_slice;
+    uint64_t row = run % layout.runs_per_slice;
+    uint8_t *destination_row = copy.destination + slice * copy.destination_slice_pitch + row * copy.destination_row_pitch;
+    const uint8_t *source_row = copy.source + slice * copy.source_slice_pitch + row * copy.source_row_pitch;
+
+    // Whole runs, the usual case. Pointers step by the pitches like the reference loop, a run can be as short as a 16 byte row
+    if (layout.pieces_per_run == 1)
+    {
+        for (uint64_t piece = first; piece < last; ++piece)
+        {
+            copy_run<streaming>(destination_row, source_row, layout.run_size);
+            destination_row += copy.destination_row_pitch;
+            source_row += copy.source_row_pitch;
+            if (++row == layout.runs_per_slice)
+            {
+                row = 0;
+                ++slice;
+                destination_row = copy.destination + slice * copy.destination_slice_pitch;
+                source_row = copy.source + slice * copy.source_slice_pitch;
+            }
+        }
+    }
+    else
+    {
+        // Pieces of merged runs, a few per job
+        for (uint64_t piece = first; piece < last; ++piece)
+        {
+            uint64_t offset = part * layout.piece_size;
+            uint64_t size = layout.run_size - offset < layout.piece_size ? layout.run_size - offset : layout.piece_size;
+            copy_run<streaming>(destination_row + offset, source_row + offset, size);
+            if (++part == layout.pieces_per_run)
+            {
+                part = 0;
+                destination_row += copy.destination_row_pitch;
+                source_row += copy.source_row_pitch;
+                if (++row == layout.runs_per_slice)
+                {
+                    row = 0;
+                    ++slice;
+                    destination_row = copy.destination + slice * copy.destination_slice_pitch;
+                    source_row = copy.source + slice * copy.source_slice_pitch;
+                }
+            }
+        }
+    }
+    if (streaming)
+        finish_streaming();
+}
+
+void copy_pieces(const SubresourceCopy &copy, const CopyLayout &layout, uint64_t first, uint64_t last, bool streaming)
+{
+    if (streaming)
+        copy_pieces<true>(copy, layout, first, last);
+    else
+        copy_pieces<false>(copy, layout, first, last);
+}
+} // namespace
+
+void subresource_copy_reference(const SubresourceCopy &copy)
+{
+    for (uint32_t z = 0; z < copy.slice_count; ++z)
+    {
+        uint8_t *destination_slice = copy.destination + copy.destination_slice_pitch * z;
+        const uint8_t *source_slice = copy.source + copy.source_slice_pitch * z;
+        for (uint32_t y = 0; y < copy.row_count; ++y)
+            memcpy(destination_slice + copy.destination_row_pitch * y, source_slice + copy.source_row_pitch * y, (size_t)copy.row_size);
+    }
+}
+
+void subresource_copy(const SubresourceCopy &copy, bool write_combined, int max_jobs)
+{
+    if (copy.row_size == 0 || copy.row_count == 0 || copy.slice_count == 0)
+        return;
+
+    CopyLayout layout = copy_layout(copy);
+    uint64_t total = copy.row_size * copy.row_count * copy.slice_count;
+    bool streaming = (write_combined || total >= subresource_copy_stream_bytes) && layout.run_size >= subresource_copy_stream_run;
+
+    uint64_t jobs = total / subresource_copy_job_bytes;
+    if (jobs > (uint64_t)max_jobs)
+        jobs = (uint64_t)max_jobs;
+    if (jobs > (uint64_t)job_system_size())
+        jobs = (uint64_t)job_system_size();
+    if (jobs <= 1)
+    {
+        copy_pieces(copy, layout, 0, layout.runs_per_slice * layout.slice_count, streaming);
+        return;
+    }
+
+    // Too few runs to go around (merged rows are a handful of big ones), cut them into pieces of whole cache lines, a few per job
+    uint64_t runs = layout.runs_per_slice * layout.slice_count;
+    if (runs < jobs * 4)
+    {
+        uint64_t wanted = (jobs * 4 + runs - 1) / runs;
+        layout.piece_size = ((layout.run_size + wanted - 1) / wanted + 63) & ~(uint64_t)63;
+        layout.pieces_per_run = (layout.run_size + layout.piece_size - 1) / layout.piece_size;
+    }
+
+    uint64_t pieces = runs * layout.pieces_per_run;
+    job_parallel_for((int)jobs, 1, [&](int job) {
+        copy_pieces(copy, layout, pieces * job / jobs, pieces * (job + 1) / jobs, streaming);
+    });
+}
+
+uint64_t subresource_footprints(uint32_t width, uint32_t height, uint32_t depth, uint32_t array_size, uint32_t mip_levels, uint32_t texel_size,
+                                uint32_t format, SubresourceFootprint *footprints)
+{
+    // Every subresource starts at a multiple of 512 bytes and every row at a multiple of 256, the rules CopyTextureRegion has for its source
+    uint64_t offset = 0;
+    for (uint32_t slice = 0; slice < array_size; ++slice)
+    {
+        for (uint32_t mip = 0; mip < mip_levels; ++mip)
+        {
+            SubresourceFootprint &footprint = footprints[mip + slice * mip_levels];
+            footprint.offset = (offset + 511) & ~(uint64_t)511;
+            footprint.format = format;
+            footprint.width = width >> mip ? width >> mip : 1;
+            footprint.height = height >> mip ? height >> mip : 1;
+            footprint.depth = depth >> mip ? depth >> mip : 1;
+            footprint.row_size = (uint64_t)footprint.width * texel_size;
+            footprint.row_pitch = (footprint.row_size + 255) & ~(uint64_t)255;
+            footprint.row_count = footprint.height;
+            offset = footprint.offset + footprint.row_pitch * footprint.row_count * footprint.depth;
+        }
+    }
+    return offset;
+}
+
+void subresource_copy_all(uint8_t *upload, const SubresourceFootprint *footprints, const SubresourceData *data, uint32_t count, bool write_combined,
+                          int max_jobs)
+{
+    PROFILE_SCOPE("subresource_copy_all");
+    // Runs of rows of one slice of one subresource, about subresource_copy_job_bytes each. A mip small enough is a single run
+    struct Rows
+    {
+        uint32_t subresource;
+        uint32_t slice;
+        uint32_t first_row;
+        uint32_t row_count;
+    };
+    std::vector<Rows> work;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const SubresourceFootprint &footprint = footprints[i];
+        uint64_t rows_per_piece = footprint.row_size ? subresource_copy_job_bytes / footprint.row_size : 1;
+        if (rows_per_piece == 0)
+            rows_per_piece = 1;
+        for (uint32_t slice = 0; slice < footprint.depth; ++slice)
+        {
+            for (uint32_t row = 0; row < footprint.row_count; row += (uint32_t)rows_per_piece)
+            {
+                uint32_t rows = footprint.row_count - row < rows_per_piece ? footprint.row_count - row : (uint32_t)rows_per_piece;
+                work.push_back(Rows{i, slice, row, rows});
+            }
+        }
+    }
+
+    auto copy_rows = [&](int index) {
+        const Rows &rows = work[index];
+        const SubresourceFootprint &footprint = footprints[rows.subresource];
+        const SubresourceData &source = data[rows.subresource];
+        SubresourceCopy copy;
+        copy.destination = upload + footprint.offset + (rows.slice * (uint64_t)footprint.row_count + rows.first_row) * footprint.row_pitch;
+        copy.destination_row_pitch = footprint.row_pitch;
+        copy.destination_slice_pitch = footprint.row_pitch * rows.row_count;
+        copy.source = (const uint8_t *)source.data + rows.slice * source.slice_pitch + rows.first_row * source.row_pitch;
+        copy.source_row_pitch = source.row_pitch;
+        copy.source_slice_pitch = source.row_pitch * rows.row_count;
+        copy.row_size = footprint.row_size;
+        copy.row_count = rows.row_count;
+        copy.slice_count = 1;
+        subresource_copy(copy, write_combined, 1);
+    };
+
+    // The pool hands the runs out one at a time, whoever is free takes the next one
+    if (max_jobs > 1 && job_system_size() > 1 && work.size() > 1)
+        job_parallel_for((int)work.size(), 1, copy_rows);
+    else
+        for (size_t i = 0; i < work.size(); ++i)
+            copy_rows((int)i);
+}
+
+// -- Benchmark -- //
+
+namespace
+{
+// GB/s of a copy, run over and over for at least a fifth of a second
+template <typename Copy>
+double copy_rate(uint64_t bytes, const Copy &run)
+{
+    int iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds = 0.0;
+    do
+    {
+        run();
+        ++iterations;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < 0.2 || iterations < 3);
+    return (double)bytes * iterations / seconds / 1e9;
+}
+} // namespace
+
+bool subresource_copy_benchmark()
+{
+    struct Case
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t depth;
+    };
+    const Case cases[] = {
+        {16, 16, 1}, {4, 16384, 1}, {100, 100, 1}, {256, 256, 1}, {1000, 1000, 1}, {1024, 1024, 1}, {64, 64, 64}, {4096, 4096, 1},
+    };
+    const uint64_t texel_size = 4; // rgba8
+    const int threads = job_system_size();
+
+    printf("texture, destination pitch, MB, MemcpySubresource GB/s, subresource_copy GB/s, write combined (streaming) GB/s, %d threads GB/s, "
+           "best speedup, same bytes\n", threads);
+
+    bool ok = true;
+    for (const Case &size : cases)
+    {
+        // The pitch GetCopyableFootprints gives an upload buffer (rows at multiples of 256 bytes), and a packed one like a buffer or a readback
+        for (int packed = 0; packed < 2; ++packed)
+        {
+            SubresourceCopy copy;
+            copy.row_size = size.width * texel_size;
+            copy.row_count = size.height;
+            copy.slice_count = size.depth;
+            copy.source_row_pitch = copy.row_size;
+            copy.source_slice_pitch = copy.row_size * copy.row_count;
+            copy.destination_row_pitch = packed ? copy.row_size : (copy.row_size + 255) & ~(uint64_t)255;
+            copy.destination_slice_pitch = copy.destination_row_pitch * copy.row_count;
+
+            if (!packed && copy.destination_row_pitch == copy.row_size)
+                continue; // Already 256 byte rows, the packed line is the same copy
+
+            std::vector<uint8_t> source(copy.source_slice_pitch * copy.slice_count);
+            for (size_t i = 0; i < source.size(); ++i)
+                source[i] = (uint8_t)(i * 131 + (i >> 11));
+            std::vector<uint8_t> reference(copy.destination_slice_pitch * copy.slice_count, 0xcd);
+            std::vector<uint8_t> result(reference.size(), 0xcd);
+            copy.source = source.data();
+
+            // Every variant writes into memory prefilled the same way, so padding it should not touch is checked too
+            copy.destination = reference.data();
+            subresource_copy_reference(copy);
+
+            bool same = true;
+            auto check = [&]() {
+                if (memcmp(reference.data(), result.data(), result.size()) != 0)
+                    same = false;
+                memset(result.data(), 0xcd, result.size());
+            };
+            copy.destination = result.data();
+            subresource_copy(copy, false, 1);
+            check();
+            subresource_copy(copy, true, 1);
+            check();
+            subresource_copy(copy, false, threads);
+            check();
+
+            uint64_t bytes = copy.row_size * copy.row_count * copy.slice_count;
+            copy.destination = reference.data();
+            double reference_rate = copy_rate(bytes, [&]() { subresource_copy_reference(copy); });
+            copy.destination = result.data();
+            double rate = copy_rate(bytes, [&]() { subresource_copy(copy, false, 1); });
+            double streaming_rate = copy_rate(bytes, [&]() { subresource_copy(copy, true, 1); });
+            double threaded_rate = copy_rate(bytes, [&]() { subresource_copy(copy, false, threads); });
+
+            double best = rate > streaming_rate ? rate : streaming_rate;
+            best = best > threaded_rate ? best : threaded_rate;
+            std::string name = std::to_string(size.width) + "x" + std::to_string(size.height) + (size.depth > 1 ? "x" + std::to_string(size.depth) : "");
+            printf("%s, %s, %.2f, %.2f, %.2f, %.2f, %.2f, %.2fx, %s\n", name.c_str(), packed ? "packed" : "256 aligned", bytes / (1024.0 * 1024.0),
+                   reference_rate, rate, streaming_rate, threaded_rate, best / reference_rate, same ? "yes" : "NO");
+            if (!same)
+                ok = false;
+        }
+    }
+    return ok;
+}
+
+bool subresource_update_benchmark(int max_threads)
+{
+    struct Case
+    {
+        const char *name;
+        uint32_t width;
+        uint32_t height;
+        uint32_t depth;
+        uint32_t array_size;
+        uint32_t texel_size;
+    };
+    const Case cases[] = {
+        {"4096x4096 rgba8, full mip chain", 4096, 4096, 1, 1, 4},
+        {"4096x4096 rgba16f, full mip chain", 4096, 4096, 1, 1, 8},
+        {"1024x1024 rgba8 array of 64, full mip chains", 1024, 1024, 1, 64, 4},
+        {"2048x2048 rgba8 cube (array of 6), full mip chains", 2048, 2048, 1, 6, 4},
+        {"256x256x256 rgba8 volume, full mip chain", 256, 256, 256, 1, 4},
+    };
+
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    printf("texture, subresources, MB, UpdateSubresources loop GB/s");
+    for (int threads : thread_counts)
+        printf(", %d threads GB/s", threads);
+    printf(", best speedup, same bytes\n");
+
+    bool ok = true;
+    for (const Case &texture : cases)
+    {
+        uint32_t largest = texture.width > texture.height ? texture.width : texture.height;
+        largest = largest > texture.depth ? largest : texture.depth;
+        uint32_t mip_levels = 1;
+        while ((largest >> mip_levels) > 0)
+            ++mip_levels;
+        uint32_t count = mip_levels * texture.array_size;
+
+        std::vector<SubresourceFootprint> footprints(count);
+        uint64_t upload_size = subresource_footprints(texture.width, texture.height, texture.depth, texture.array_size, mip_levels, texture.texel_size,
+                                                      28, footprints.data());
+
+        // Every subresource tightly packed on the cpu, the way a loader has them after decoding
+        std::vector<std::vector<uint8_t>> pixels(count);
+        std::vector<SubresourceData> data(count);
+        uint64_t bytes = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const SubresourceFootprint &footprint = footprints[i];
+            pixels[i].resize(footprint.row_size * footprint.row_count * footprint.depth);
+            for (size_t b = 0; b < pixels[i].size(); ++b)
+                pixels[i][b] = (uint8_t)(b * 7 + i * 13 + (b >> 12));
+            data[i].data = pixels[i].data();
+            data[i].row_pitch = footprint.row_size;
+            data[i].slice_pitch = footprint.row_size * footprint.row_count;
+            bytes += pixels[i].size();
+        }
+
+        // What UpdateSubresources does: MemcpySubresource for one subresource after the other
+        std::vector<uint8_t> reference(upload_size, 0xcd);
+        auto serial = [&]() {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                SubresourceCopy copy = {reference.data() + footprints[i].offset, footprints[i].row_pitch, footprints[i].row_pitch * footprints[i].row_count,
+                                        (const uint8_t *)data[i].data, data[i].row_pitch, data[i].slice_pitch, footprints[i].row_size,
+                                        footprints[i].row_count, footprints[i].depth};
+                subresource_copy_reference(copy);
+            }
+        };
+        serial();
+        double serial_rate = copy_rate(bytes, serial);
+        printf("%s, %u, %.1f, %.2f", texture.name, count, bytes / (1024.0 * 1024.0), serial_rate);
+
+        std::vector<uint8_t> upload(upload_size);
+        double best = 0.0;
+        bool same = true;
+        for (int threads : thread_counts)
+        {
+            job_system_init(threads);
+            memset(upload.data(), 0xcd, upload.size());
+            subresource_copy_all(upload.data(), footprints.data(), data.data(), count, false, threads);
+            if (memcmp(upload.data(), reference.data(), upload.size()) != 0)
+                same = false;
+
+            double rate = copy_rate(bytes, [&]() { subresource_copy_all(upload.data(), footprints.data(), data.data(), count, false, threads); });
+            best = rate > best ? rate : best;
+            printf(", %.2f", rate);
+        }
+        printf(", %.2fx, %s\n", best / serial_rate, same ? "yes" : "NO");
+        if (!same)
+            ok = false;
+    }
+    job_system_shutdown();
+    return ok;
+}
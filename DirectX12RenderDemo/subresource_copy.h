@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Copying the rows of a subresource into upload memory, what d3dx12.h's MemcpySubresource does for UpdateSubresources.
+
+    MemcpySubresource calls memcpy once per row of every slice. That is a lot of calls for a texture with many short rows, and for a big
+    texture every byte goes through the cache on the way to memory the cpu never reads again. subresource_copy() does the same copy with:
+
+        - Rows merged: when both sides have no padding between rows (row pitch == row size) a slice is one block of memory, and when the
+          slices are packed too the whole subresource is. Then it is one copy instead of row_count * slice_count.
+        - Streaming stores: upload heaps are write combined, the cpu is meant to write them in whole cache lines and never read them.
+          Non temporal stores (movntdq) do exactly that and do not pull the destination into the cache first. They pay off for write
+          combined memory whatever the size, and for ordinary memory once the copy is bigger than the caches (subresource_copy_stream_bytes).
+          Rows shorter than subresource_copy_stream_run are copied with ordinary stores, they would only leave partly written lines behind.
+        - Threads: copies of more than subresource_copy_job_bytes are split into pieces run by job_parallel_for(), rows or, for merged
+          rows, ranges of bytes. One core seldom saturates the memory bus on its own.
+
+    The copy is byte for byte the same as the reference one, padding between the rows of the destination is never written.
+
+    A whole texture (UpdateSubresources) is many of these: every mip of every array slice goes to its own place in one upload buffer.
+    d3dx12.h walks them one after the other on the calling thread. subresource_copy_all() cuts them into runs of rows of about
+    subresource_copy_job_bytes and lets the job system take them in any order, so the big top mip is shared by every thread and the
+    tiny mips at the end of the chain do not get a thread each. Only the cpu copy goes wide, the copy commands are recorded afterwards
+    in subresource order by whoever called it.
+*/
+
+const uint64_t subresource_copy_stream_bytes = 4 * 1024 * 1024; // Streaming stores for ordinary memory from this size up
+const uint64_t subresource_copy_stream_run = 256;                // Shortest run of bytes that is streamed
+const uint64_t subresource_copy_job_bytes = 512 * 1024;         // Smallest piece worth handing to another thread
+
+// One subresource, the fields of D3D12_MEMCPY_DEST and D3D12_SUBRESOURCE_DATA plus the sizes MemcpySubresource takes
+struct SubresourceCopy
+{
+    uint8_t *destination;
+    uint64_t destination_row_pitch;
+    uint64_t destination_slice_pitch;
+    const uint8_t *source;
+    uint64_t source_row_pitch;
+    uint64_t source_slice_pitch;
+    uint64_t row_size; // Bytes of every row that are copied
+    uint32_t row_count;
+    uint32_t slice_count;
+};
+
+// Where a subresource goes in an upload buffer, what GetCopyableFootprints() says about it
+struct SubresourceFootprint
+{
+    uint64_t offset;    // From the start of the upload, a multiple of 512
+    uint32_t format;    // DXGI_FORMAT
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint64_t row_pitch; // A multiple of 256
+    uint64_t row_size;  // Bytes of a row that hold texels
+    uint32_t row_count; // Rows per slice
+};
+
+// The cpu side of one subresource, D3D12_SUBRESOURCE_DATA
+struct SubresourceData
+{
+    const void *data;
+    uint64_t row_pitch;
+    uint64_t slice_pitch;
+};
+
+// d3dx12.h's MemcpySubresource, one memcpy per row
+void subresource_copy_reference(const SubresourceCopy &copy);
+
+// The same copy. write_combined says the destination is an upload heap, max_jobs > 1 lets it use the job system
+void subresource_copy(const SubresourceCopy &copy, bool write_combined, int max_jobs);
+
+// GetCopyableFootprints() for uncompressed formats, for when there is no device: mip_levels mips of each of array_size slices (or one volume
+// with depth slices), in d3d12's subresource order (mip + slice * mip_levels). Fills footprints and returns the bytes of the whole upload
+uint64_t subresource_footprints(uint32_t width, uint32_t height, uint32_t depth, uint32_t array_size, uint32_t mip_levels, uint32_t texel_size,
+                                uint32_t format, SubresourceFootprint *footprints);
+
+// The cpu half of UpdateSubresources: copy count subresources into the upload buffer mapped at upload, with up to max_jobs threads of the
+// job system. Footprint offsets are from upload
+void subresource_copy_all(uint8_t *upload, const SubresourceFootprint *footprints, const SubresourceData *data, uint32_t count, bool write_combined,
+                          int max_jobs);
+
+// Both over texture sizes from tiny to 4096x4096 and rows that can and cannot be merged, prints GB/s of each and checks they wrote the
+// same bytes. Returns false if they did not
+bool subresource_copy_benchmark();
+
+// A 4096x4096 mip chain, texture arrays and a volume through the serial loop and subresource_copy_all() with 1 up to max_threads
+// threads. Prints GB/s and the speedup and returns false if any of them wrote different bytes
+bool subresource_update_benchmark(int max_threads);
@@ -0,0 +1,754 @@
+#include "upload_manager.h"
+#include "profiler.h"
+#include "align.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+
+namespace
+{
+const uint32_t no_block = 0xffffffffu;
+
+// Everything below runs with the manager's mutex held
+
+bool in_batch(const UploadManager &manager, uint32_t block)
+{
+    return std::find(manager.batch_blocks.begin(), manager.batch_blocks.end(), block) != manager.batch_blocks.end();
+}
+
+void retire_locked(UploadManager &manager, uint64_t completed)
+{
+    while (!manager.in_flight.empty() && manager.blocks[manager.in_flight.front()].fence_value <= completed)
+    {
+        uint32_t index = manager.in_flight.front();
+        manager.in_flight.pop_front();
+
+        UploadBlock &block = manager.blocks[index];
+        if (block.dedicated)
+        {
+            manager.queue->DestroyBlock(block);
+            block.resource = nullptr;
+            block.cpu = nullptr;
+        }
+        else
+        {
+            block.used = 0;
+            manager.free_blocks.push_back(index);
+        }
+    }
+}
+
+UploadTicket submit_locked(UploadManager &manager)
+{
+    if (manager.copies.empty())
+        return UploadTicket{manager.fence_value};
+
+    bool executed = manager.queue->Execute(manager.blocks.data(), manager.copies.data(), manager.copies.size());
+
+    // Every batch takes the next value, the tickets finish_request() handed out for it already say so. A batch that did not make it to
+    // the queue is not signaled: its value goes on the failed list so its tickets never report done, even once a later batch signals a
+    // bigger value. Its blocks were never read and only wait for what is in flight already. If the signal itself failed the copies may
+    // still run, so its blocks wait for the next value that is signaled, the queue runs in order
+    uint64_t value = ++manager.fence_value;
+    bool signaled = executed && manager.queue->Signal(value);
+    if (signaled)
+        manager.signaled_value = value;
+    else
+        manager.failed_values.push_back(value);
+    uint64_t block_value = executed ? value : manager.signaled_value;
+
+    // The current block stays current, the next batch packs into what is left of it. Every other block waits for this value
+    for (uint32_t index : manager.batch_blocks)
+    {
+        manager.blocks[index].fence_value = block_value;
+        if (index != manager.current)
+            manager.in_flight.push_back(index);
+    }
+
+    manager.copy_count += manager.copies.size();
+    ++manager.submit_count;
+    manager.copies.clear();
+    manager.batch_blocks.clear();
+    manager.batch_bytes = 0;
+    return UploadTicket{signaled ? value : 0};
+}
+
+bool failed_locked(const UploadManager &manager, UploadTicket ticket)
+{
+    return ticket.fence_value == 0 ||
+           std::find(manager.failed_values.begin(), manager.failed_values.end(), ticket.fence_value) != manager.failed_values.end();
+}
+
+uint32_t new_slot(UploadManager &manager)
+{
+    for (uint32_t i = 0; i < manager.blocks.size(); ++i)
+    {
+        if (!manager.blocks[i].resource)
+            return i;
+    }
+    manager.blocks.push_back(UploadBlock());
+    return (uint32_t)manager.blocks.size() - 1;
+}
+
+uint32_t create_block(UploadManager &manager, uint64_t size, bool dedicated)
+{
+    uint32_t index = new_slot(manager);
+    UploadBlock &block = manager.blocks[index];
+    block = UploadBlock();
+    block.size = size;
+    block.dedicated = dedicated;
+    block.fence_value = manager.signaled_value;
+    if (!manager.queue->CreateBlock(size, block) || !block.cpu || !block.resource)
+    {
+        block.resource = nullptr;
+        block.cpu = nullptr;
+        return no_block;
+    }
+    ++manager.blocks_created;
+    return index;
+}
+
+int reusable_blocks(const UploadManager &manager)
+{
+    int count = 0;
+    for (const UploadBlock &block : manager.blocks)
+    {
+        if (block.resource && !block.dedicated)
+            ++count;
+    }
+    return count;
+}
+
+// A free block, a new one while there are fewer than max_blocks, or the oldest one in flight once the copy queue is done with it
+uint32_t next_block(UploadManager &manager)
+{
+    retire_locked(manager, manager.queue->GetCompletedValue());
+    if (manager.free_blocks.empty() && reusable_blocks(manager) < manager.max_blocks)
+        return create_block(manager, manager.block_size, false);
+
+    if (manager.free_blocks.empty())
+    {
+        // Every block is in this batch, it has to go before anything can come back
+        if (manager.in_flight.empty())
+            submit_locked(manager);
+        // Blocks of a batch whose signal failed wait for a value nothing has signaled yet, waiting for them would never end
+        while (manager.free_blocks.empty() && !manager.in_flight.empty() &&
+               manager.blocks[manager.in_flight.front()].fence_value <= manager.signaled_value)
+        {
+            ++manager.wait_count;
+            manager.queue->WaitForValue(manager.blocks[manager.in_flight.front()].fence_value);
+            retire_locked(manager, manager.queue->GetCompletedValue());
+        }
+        if (manager.free_blocks.empty())
+            return no_block;
+    }
+
+    uint32_t index = manager.free_blocks.back();
+    manager.free_blocks.pop_back();
+    return index;
+}
+
+bool allocate_locked(UploadManager &manager, uint64_t size, uint64_t alignment, uint32_t &block, uint64_t &offset)
+{
+    if (size > manager.block_size)
+    {
+        block = create_block(manager, align_up(size, upload_texture_placement_alignment), true);
+        if (block == no_block)
+            return false;
+        offset = 0;
+        manager.blocks[block].used = size;
+        manager.batch_blocks.push_back(block);
+        return true;
+    }
+
+    if (manager.current != no_block)
+    {
+        UploadBlock &current = manager.blocks[manager.current];
+        uint64_t start = align_up(current.used, alignment);
+        if (start + size <= current.size)
+        {
+            current.used = start + size;
+            if (!in_batch(manager, manager.current))
+                manager.batch_blocks.push_back(manager.current);
+            block = manager.current;
+            offset = start;
+            return true;
+        }
+
+        // Full. If the open batch wrote to it, it goes in flight with the batch, otherwise it only waits for the last batch that did
+        if (!in_batch(manager, manager.current))
+            manager.in_flight.push_back(manager.current);
+        manager.current = no_block;
+    }
+
+    uint32_t index = next_block(manager);
+    if (index == no_block)
+        return false;
+
+    manager.current = index;
+    manager.blocks[index].used = size;
+    manager.batch_blocks.push_back(index);
+    block = index;
+    offset = 0;
+    return true;
+}
+
+UploadTicket finish_request(UploadManager &manager, uint64_t size)
+{
+    ++manager.request_count;
+    manager.upload_bytes += size;
+    manager.batch_bytes += size;
+
+    // The open batch will signal the next value, unless it is submitted right here, and then it does too
+    UploadTicket ticket = {manager.fence_value + 1};
+    if (manager.submit_threshold && manager.batch_bytes >= manager.submit_threshold)
+        submit_locked(manager);
+    return ticket;
+}
+} // namespace
+
+bool upload_manager_init(UploadManager &manager, UploadQueue *queue, uint64_t block_size, int max_blocks, uint64_t submit_threshold)
+{
+    if (!queue || block_size == 0 || block_size % upload_texture_placement_alignment != 0 || max_blocks < 1)
+        return false;
+
+    manager.queue = queue;
+    manager.block_size = block_size;
+    manager.max_blocks = max_blocks;
+    manager.submit_threshold = submit_threshold;
+    manager.fence_value = queue->GetCompletedValue();
+    manager.signaled_value = manager.fence_value;
+    manager.failed_values.clear();
+    manager.blocks.clear();
+    manager.free_blocks.clear();
+    manager.in_flight.clear();
+    manager.current = no_block;
+    manager.batch_blocks.clear();
+    manager.copies.clear();
+    manager.batch_bytes = 0;
+    manager.request_count = 0;
+    manager.copy_count = 0;
+    manager.submit_count = 0;
+    manager.upload_bytes = 0;
+    manager.blocks_created = 0;
+    manager.wait_count = 0;
+    return true;
+}
+
+void upload_manager_shutdown(UploadManager &manager)
+{
+    if (!manager.queue)
+        return;
+
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    submit_locked(manager);
+    manager.queue->WaitForValue(manager.signaled_value);
+    for (UploadBlock &block : manager.blocks)
+    {
+        if (block.resource)
+            manager.queue->DestroyBlock(block);
+    }
+    manager.blocks.clear();
+    manager.free_blocks.clear();
+    manager.in_flight.clear();
+    manager.batch_blocks.clear();
+    manager.current = no_block;
+    manager.queue = nullptr;
+}
+
+UploadTicket upload_manager_buffer(UploadManager &manager, void *destination, uint64_t offset, const void *data, uint64_t size)
+{
+    if (!destination || !data || size == 0)
+        return UploadTicket{0};
+
+    std::lock_guard<std::mutex> lock(manager.mutex);
+
+    // Packed with no gaps, CopyBufferRegion has no alignment rules and back to back pieces can be merged
+    uint32_t block;
+    uint64_t source_offset;
+    if (!allocate_locked(manager, size, 1, block, source_offset))
+        return UploadTicket{0};
+
+    // Staging blocks are write combined upload heaps, a buffer is a single row as far as the copy is concerned
+    SubresourceCopy staging = {manager.blocks[block].cpu + source_offset, size, size, (const uint8_t *)data, size, size, size, 1, 1};
+    subresource_copy(staging, true, 1);
+
+    UploadCopy *last = manager.copies.empty() ? nullptr : &manager.copies.back();
+    if (last && !last->texture && last->destination == destination && last->block == block &&
+        last->destination_offset + last->size == offset && last->source_offset + last->size == source_offset)
+    {
+        last->size += size;
+    }
+    else
+    {
+        UploadCopy copy = {};
+        copy.destination = destination;
+        copy.destination_offset = offset;
+        copy.block = block;
+        copy.source_offset = source_offset;
+        copy.size = size;
+        manager.copies.push_back(copy);
+    }
+    return finish_request(manager, size);
+}
+
+UploadTicket upload_manager_texture(UploadManager &manager, void *destination, uint32_t subresource, const UploadTextureFootprint &footprint,
+                                    const void *data, uint64_t source_pitch)
+{
+    if (!destination || !data || footprint.row_size == 0 || footprint.row_count == 0 || footprint.depth == 0 || source_pitch < footprint.row_size)
+        return UploadTicket{0};
+
+    std::lock_guard<std::mutex> lock(manager.mutex);
+
+    // The copy engine reads rows at multiples of 256 bytes, so the rows are spread out on the way into the block
+    uint64_t row_pitch = align_up(footprint.row_size, upload_texture_row_alignment);
+    uint64_t rows = (uint64_t)footprint.row_count * footprint.depth;
+    uint64_t size = row_pitch * rows;
+
+    uint32_t block;
+    uint64_t source_offset;
+    if (!allocate_locked(manager, size, upload_texture_placement_alignment, block, source_offset))
+        return UploadTicket{0};
+
+    // All the slices' rows as one run of rows, the pitch is the same between slices. Rows that happen to be 256 bytes are one copy
+    SubresourceCopy staging = {manager.blocks[block].cpu + source_offset, row_pitch, size, (const uint8_t *)data, source_pitch, source_pitch * rows,
+                               footprint.row_size, (uint32_t)rows, 1};
+    subresource_copy(staging, true, 1);
+
+    UploadCopy copy = {};
+    copy.destination = destination;
+    copy.subresource = subresource;
+    copy.texture = true;
+    copy.block = block;
+    copy.source_offset = source_offset;
+    copy.size = size;
+    copy.footprint = footprint;
+    copy.row_pitch = row_pitch;
+    manager.copies.push_back(copy);
+    return finish_request(manager, (uint64_t)footprint.row_size * rows);
+}
+
+UploadTicket upload_manager_subresources(UploadManager &manager, void *destination, uint32_t first_subresource, uint32_t count,
+                                         const SubresourceFootprint *footprints, const SubresourceData *data, int max_jobs)
+{
+    PROFILE_SCOPE("upload_manager_subresources");
+    if (!destination || !footprints || !data || count == 0)
+        return UploadTicket{0};
+
+    std::lock_guard<std::mutex> lock(manager.mutex);
+
+    // One piece of staging memory for all of them, laid out the way the footprints say
+    const SubresourceFootprint &last = footprints[count - 1];
+    uint64_t size = last.offset + last.row_pitch * last.row_count * last.depth - footprints[0].offset;
+    uint32_t block;
+    uint64_t source_offset;
+    if (!allocate_locked(manager, size, upload_texture_placement_alignment, block, source_offset))
+        return UploadTicket{0};
+
+    // Both the first offset and the piece are multiples of 512, so every subresource still starts at one
+    std::vector<SubresourceFootprint> staged(footprints, footprints + count);
+    uint64_t bytes = 0;
+    for (SubresourceFootprint &footprint : staged)
+    {
+        footprint.offset = footprint.offset - footprints[0].offset + source_offset;
+        bytes += footprint.row_size * footprint.row_count * footprint.depth;
+    }
+    subresource_copy_all(manager.blocks[block].cpu, staged.data(), data, count, true, max_jobs);
+
+    // The copies go in the batch in subresource order, whatever order the rows were copied in
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const SubresourceFootprint &footprint = staged[i];
+        UploadCopy copy = {};
+        copy.destination = destination;
+        copy.subresource = first_subresource + i;
+        copy.texture = true;
+        copy.block = block;
+        copy.source_offset = footprint.offset;
+        copy.size = footprint.row_pitch * footprint.row_count * footprint.depth;
+        copy.footprint.format = footprint.format;
+        copy.footprint.width = footprint.width;
+        copy.footprint.height = footprint.height;
+        copy.footprint.depth = footprint.depth;
+        copy.footprint.row_size = (uint32_t)footprint.row_size;
+        copy.footprint.row_count = footprint.row_count;
+        copy.row_pitch = footprint.row_pitch;
+        manager.copies.push_back(copy);
+    }
+    return finish_request(manager, bytes);
+}
+
+UploadTicket upload_manager_submit(UploadManager &manager)
+{
+    PROFILE_SCOPE("upload_manager_submit");
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    UploadTicket ticket = submit_locked(manager);
+    retire_locked(manager, manager.queue->GetCompletedValue());
+    return ticket;
+}
+
+bool upload_manager_done(UploadManager &manager, UploadTicket ticket)
+{
+    {
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        if (failed_locked(manager, ticket))
+            return false;
+    }
+    return manager.queue->GetCompletedValue() >= ticket.fence_value;
+}
+
+bool upload_manager_failed(UploadManager &manager, UploadTicket ticket)
+{
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    return failed_locked(manager, ticket);
+}
+
+bool upload_manager_wait(UploadManager &manager, UploadTicket ticket)
+{
+    {
+        // Still in the open batch, nothing would ever signal it
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        if (ticket.fence_value > manager.fence_value)
+            submit_locked(manager);
+        if (failed_locked(manager, ticket))
+            return false;
+    }
+    if (manager.queue->GetCompletedValue() >= ticket.fence_value)
+        return true;
+    return manager.queue->WaitForValue(ticket.fence_value);
+}
+
+void upload_manager_retire(UploadManager &manager)
+{
+    std::lock_guard<std::mutex> lock(manager.mutex);
+    retire_locked(manager, manager.queue->GetCompletedValue());
+}
+
+// -- Stress test -- //
+
+namespace
+{
+// A buffer or a texture the fake gpu copies into. Requests are checked per slot: a run of 256 bytes of a buffer or a whole texture subresource
+struct StressResource
+{
+    std::vector<uint8_t> memory;
+    std::vector<uint32_t> last_writer; // Request that wrote each slot last
+    uint64_t slot_size;
+    bool texture;
+    UploadTextureFootprint footprint;
+};
+
+struct StressRequest
+{
+    uint32_t id;
+    StressResource *resource;
+    uint32_t first_slot;
+    uint32_t slot_count;
+    UploadTicket ticket;
+};
+
+uint8_t stress_byte(uint32_t id, uint64_t position)
+{
+    uint64_t value = (id * 0x9e3779b97f4a7c15ull) ^ (position * 0xbf58476d1ce4e5b9ull);
+    return (uint8_t)(value >> 56);
+}
+
+// A copy queue that takes gpu_ms per batch and only does the copies once the batch completes, reading the staging blocks at that point.
+// If the manager reuses a block while its batch is still in flight, the request is overwritten before the "gpu" copies it.
+// Every fail_every-th batch fails to execute, the fence values of those are in failed
+struct StressQueue : UploadQueue
+{
+    struct Copy
+    {
+        UploadCopy copy;
+        const uint8_t *source;
+    };
+    struct Batch
+    {
+        uint64_t fence_value;
+        std::vector<Copy> copies;
+    };
+
+    StressQueue(double gpu_ms, int fail_every) : gpu(gpu_ms), live_blocks(0), fail_every(fail_every), batch_count(0) {}
+
+    bool Signal(uint64_t value) override
+    {
+        batches.push_back(Batch{value, std::move(recorded)});
+        recorded.clear();
+        return gpu.Signal(value);
+    }
+
+    uint64_t GetCompletedValue() override
+    {
+        uint64_t completed = gpu.GetCompletedValue();
+        run(completed);
+        return completed;
+    }
+
+    bool WaitForValue(uint64_t value) override
+    {
+        bool ok = gpu.WaitForValue(value);
+        run(gpu.GetCompletedValue());
+        return ok;
+    }
+
+    bool CreateBlock(uint64_t size, UploadBlock &block) override
+    {
+        block.cpu = new uint8_t[size];
+        block.resource = block.cpu;
+        ++live_blocks;
+        return true;
+    }
+
+    void DestroyBlock(UploadBlock &block) override
+    {
+        delete[] block.cpu;
+        --live_blocks;
+    }
+
+    bool Execute(const UploadBlock *blocks, const UploadCopy *copies, size_t count) override
+    {
+        // Batches take the fence values one after the other from 0 on, failed ones too
+        if (++batch_count % fail_every == 0)
+        {
+            failed.push_back(batch_count);
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i)
+            recorded.push_back(Copy{copies[i], blocks[copies[i].block].cpu + copies[i].source_offset});
+        return true;
+    }
+
+    void run(uint64_t completed)
+    {
+        while (!batches.empty() && batches.front().fence_value <= completed)
+        {
+            for (const Copy &copy : batches.front().copies)
+            {
+                StressResource *resource = (StressResource *)copy.copy.destination;
+                if (!copy.copy.texture)
+                {
+                    memcpy(resource->memory.data() + copy.copy.destination_offset, copy.source, copy.copy.size);
+                    continue;
+                }
+                const UploadTextureFootprint &footprint = copy.copy.footprint;
+                uint64_t rows = (uint64_t)footprint.row_count * footprint.depth;
+                uint8_t *subresource = resource->memory.data() + copy.copy.subresource * resource->slot_size;
+                for (uint64_t row = 0; row < rows; ++row)
+                    memcpy(subresource + row * footprint.row_size, copy.source + row * copy.copy.row_pitch, footprint.row_size);
+            }
+            batches.pop_front();
+        }
+    }
+
+    FakeFrameQueue gpu;
+    std::vector<Copy> recorded; // Executed, waiting for the signal that gives them a fence value
+    std::deque<Batch> batches;
+    int live_blocks;
+    int fail_every;
+    uint64_t batch_count;
+    std::vector<uint64_t> failed;
+};
+
+bool stress_check(const StressRequest &request)
+{
+    for (uint32_t slot = request.first_slot; slot < request.first_slot + request.slot_count; ++slot)
+    {
+        // A later request wrote over it, that one checks the slot
+        if (request.resource->last_writer[slot] != request.id)
+            continue;
+
+        const uint8_t *memory = request.resource->memory.data() + slot * request.resource->slot_size;
+        uint64_t position = (uint64_t)(slot - request.first_slot) * request.resource->slot_size;
+        for (uint64_t b = 0; b < request.resource->slot_size; ++b)
+        {
+            if (memory[b] != stress_byte(request.id, position + b))
+            {
+                printf("upload manager: request %u (%s, slot %u) has the wrong byte at %llu once its ticket %llu is done\n", request.id,
+                       request.resource->texture ? "texture" : "buffer", slot, (unsigned long long)b, (unsigned long long)request.ticket.fence_value);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+} // namespace
+
+bool upload_manager_stress(int frames, unsigned int seed)
+{
+    const uint64_t block_size = 64 * 1024;
+    const uint64_t slot_size = 256;
+    const uint32_t buffer_slots = 1024; // 256 KB buffers, a request can be bigger than a block
+
+    StressQueue queue(0.2, 23);
+    UploadManager manager;
+    if (!upload_manager_init(manager, &queue, block_size, 4, block_size / 2))
+        return false;
+
+    std::mt19937 random(seed);
+    std::vector<StressResource> resources(8);
+    for (size_t i = 0; i < resources.size(); ++i)
+    {
+        StressResource &resource = resources[i];
+        resource.texture = i >= 6;
+        if (resource.texture)
+        {
+            // Rows that are not a multiple of 256 bytes, so the staging pitch differs from the resource's
+            UploadTextureFootprint footprint = {28, 37 + 20 * (uint32_t)i, 29, 1 + (uint32_t)(i - 6), 0, 29};
+            footprint.row_size = footprint.width * 4;
+            resource.footprint = footprint;
+            resource.slot_size = (uint64_t)footprint.row_size * footprint.row_count * footprint.depth;
+            resource.last_writer.assign(6, 0); // Six subresources
+        }
+        else
+        {
+            resource.slot_size = slot_size;
+            resource.last_writer.assign(buffer_slots, 0);
+        }
+        resource.memory.assign(resource.slot_size * resource.last_writer.size(), 0);
+    }
+
+    std::vector<StressRequest> pending;
+    std::vector<StressRequest> failed; // Went with a batch that failed, must never report done
+    std::vector<uint8_t> data;
+    uint32_t next_id = 1;
+    uint32_t stream_resource = 0, stream_slot = 0;
+    uint64_t checked = 0;
+    UploadTicket last = {0};
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        int requests = 1 + (int)(random() % 32);
+        for (int r = 0; r < requests; ++r)
+        {
+            StressRequest request = {next_id++, nullptr, 0, 1, {0}};
+            if (random() % 4 == 0)
+            {
+                // A texture subresource, handed over with a source pitch of its own
+                request.resource = &resources[6 + random() % 2];
+                request.first_slot = (uint32_t)(random() % request.resource->last_writer.size());
+                const UploadTextureFootprint &footprint = request.resource->footprint;
+                uint64_t source_pitch = footprint.row_size + random() % 64;
+                uint64_t rows = (uint64_t)footprint.row_count * footprint.depth;
+                data.assign(source_pitch * rows, 0xee);
+                for (uint64_t row = 0; row < rows; ++row)
+                {
+                    for (uint64_t x = 0; x < footprint.row_size; ++x)
+                        data[row * source_pitch + x] = stress_byte(request.id, row * footprint.row_size + x);
+                }
+                request.ticket = upload_manager_texture(manager, request.resource, request.first_slot, footprint, data.data(), source_pitch);
+            }
+            else
+            {
+                // Half of them continue a stream through one buffer piece by piece, those are the ones merging turns into one copy
+                if (random() % 2 == 0)
+                {
+                    stream_resource = (uint32_t)(random() % 6);
+                    stream_slot = (uint32_t)(random() % buffer_slots);
+                }
+                request.resource = &resources[stream_resource];
+                request.slot_count = random() % 32 == 0 ? 1 + (uint32_t)(random() % 384) : 1 + (uint32_t)(random() % 16);
+                if (stream_slot + request.slot_count > buffer_slots)
+                    stream_slot = 0;
+                request.first_slot = stream_slot;
+                stream_slot += request.slot_count;
+
+                data.resize(request.slot_count * slot_size);
+                for (size_t b = 0; b < data.size(); ++b)
+                    data[b] = stress_byte(request.id, b);
+                request.ticket = upload_manager_buffer(manager, request.resource, request.first_slot * slot_size, data.data(), data.size());
+            }
+
+            if (request.ticket.fence_value == 0)
+            {
+                printf("upload manager: request %u failed\n", request.id);
+                return false;
+            }
+            if (request.ticket.fence_value < last.fence_value)
+            {
+                printf("upload manager: request %u got ticket %llu after one got %llu\n", request.id, (unsigned long long)request.ticket.fence_value, (unsigned long long)last.fence_value);
+                return false;
+            }
+            last = request.ticket;
+            for (uint32_t slot = request.first_slot; slot < request.first_slot + request.slot_count; ++slot)
+                request.resource->last_writer[slot] = request.id;
+            pending.push_back(request);
+        }
+
+        // The end of a frame, then look at every request whose ticket says it is there. The ones whose batch failed are put aside, their
+        // slots keep whatever the last good request wrote, which then is not the last writer anymore and does not check them
+        upload_manager_submit(manager);
+        for (size_t i = 0; i < pending.size();)
+        {
+            bool batch_failed = std::find(queue.failed.begin(), queue.failed.end(), pending[i].ticket.fence_value) != queue.failed.end();
+            if (batch_failed != upload_manager_failed(manager, pending[i].ticket) && pending[i].ticket.fence_value <= manager.fence_value)
+            {
+                printf("upload manager: request %u with ticket %llu %s\n", pending[i].id, (unsigned long long)pending[i].ticket.fence_value,
+                       batch_failed ? "went with a failed batch but is not failed" : "is failed but its batch was not");
+                return false;
+            }
+            if (batch_failed)
+            {
+                failed.push_back(pending[i]);
+                pending[i] = pending.back();
+                pending.pop_back();
+                continue;
+            }
+            if (!upload_manager_done(manager, pending[i].ticket))
+            {
+                ++i;
+                continue;
+            }
+            if (!stress_check(pending[i]))
+                return false;
+            ++checked;
+            pending[i] = pending.back();
+            pending.pop_back();
+        }
+
+        // Later batches signal bigger values, that must not make the failed ones done
+        for (const StressRequest &request : failed)
+        {
+            if (upload_manager_done(manager, request.ticket))
+            {
+                printf("upload manager: request %u reports done although its batch %llu failed\n", request.id, (unsigned long long)request.ticket.fence_value);
+                return false;
+            }
+        }
+    }
+
+    for (const StressRequest &request : pending)
+    {
+        if (!upload_manager_wait(manager, request.ticket))
+        {
+            printf("upload manager: waiting for request %u failed\n", request.id);
+            return false;
+        }
+        if (!stress_check(request))
+            return false;
+        ++checked;
+    }
+    for (const StressRequest &request : failed)
+    {
+        if (upload_manager_wait(manager, request.ticket))
+        {
+            printf("upload manager: waiting for request %u of failed batch %llu worked\n", request.id, (unsigned long long)request.ticket.fence_value);
+            return false;
+        }
+    }
+
+    printf("upload manager: %d frames, %llu requests, %.1f MB, %llu copies after merging (%.0f%% fewer), %llu batches (%u failed on purpose), "
+           "%llu blocks created, waited for the copy queue %llu times, %llu requests checked, %u failed with their batch\n",
+           frames, (unsigned long long)manager.request_count, manager.upload_bytes / (1024.0 * 1024.0), (unsigned long long)manager.copy_count,
+           100.0 * (1.0 - (double)manager.copy_count / manager.request_count), (unsigned long long)manager.submit_count, (unsigned)queue.failed.size(),
+           (unsigned long long)manager.blocks_created, (unsigned long long)manager.wait_count, (unsigned long long)checked, (unsigned)failed.size());
+
+    upload_manager_shutdown(manager);
+    if (queue.live_blocks != 0)
+    {
+        printf("upload manager: %d staging blocks were not destroyed\n", queue.live_blocks);
+        return false;
+    }
+    return true;
+}
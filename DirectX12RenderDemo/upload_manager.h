@@ -0,0 +1,145 @@
+#pragma once
+
+#include "frame_ring.h"
+#include "subresource_copy.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/*
+    Asset uploads on a queue of their own.
+
+    The upload ring (upload_ring.h) is for data that lives a frame, the d3d12 renderer streams its frame constants through it. Assets are
+    different: they are big, they arrive whenever a loader is done with them, and recording their copies on the frame's direct command list
+    makes the frame wait for them. The upload manager collects copy requests from any thread, writes their data into big staging blocks
+    (persistently mapped upload buffers) and hands the copies to a copy queue in batches. Every batch signals the next value of the copy
+    queue's fence, and that value is the request's UploadTicket.
+
+    The renderer never blocks on a ticket. Work that reads an uploaded resource makes its queue wait for the ticket on the gpu
+    (ID3D12CommandQueue::Wait), or checks upload_manager_done() and draws something else until then. The cpu only waits when
+    the staging memory is used up (max_blocks) and the oldest batch has to finish before its block can be reused.
+    A batch the queue could not execute is not signaled. Its tickets never report done, upload_manager_failed() says what happened.
+
+    Batching:
+        - Requests are packed back to back into the current staging block, a new one is started when it is full. Blocks come back once
+          the fence passes the last batch that used them, the same rule as the upload ring and the frame contexts.
+        - A request bigger than a block gets a block of its own that is destroyed once it retires.
+        - A buffer copy that continues the previous one, same destination right after it and right after it in the staging block, is
+          merged into it. Streaming a buffer in pieces costs one CopyBufferRegion instead of one per piece.
+        - upload_manager_submit() ends the batch. The renderer calls it once a frame, and a batch that grows past submit_threshold
+          bytes is submitted right away so the copy queue starts on it early.
+
+    Textures are copied with a placed footprint like CopyTextureRegion wants: rows start at multiples of 256 bytes and the footprint at a
+    multiple of 512 in the staging block. A whole texture (every mip of every slice, what UpdateSubresources uploads) is staged in one
+    go, its rows copied by the job system (subresource_copy_all()) and its copies recorded in subresource order.
+
+    The manager knows nothing about d3d12, the queue it is given (UploadQueue) creates the blocks and records the copies, so the same
+    code runs on the d3d12 copy queue, the cpu backend and the stress test's fake gpu.
+*/
+
+const uint64_t upload_texture_row_alignment = 256;       // D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+const uint64_t upload_texture_placement_alignment = 512; // D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+
+struct UploadTicket
+{
+    uint64_t fence_value; // Copy queue fence value that says the upload is done, 0 if the request failed right away
+};
+
+struct UploadBlock
+{
+    uint8_t *cpu;         // Mapped staging memory
+    void *resource;       // The upload buffer it belongs to, what the copies read from
+    uint64_t size;
+    uint64_t used;        // Bytes handed out since it was last free
+    uint64_t fence_value; // Last batch that read from it
+    bool dedicated;       // Made for one big request, destroyed instead of reused
+};
+
+// Rows of one subresource, the portable half of D3D12_PLACED_SUBRESOURCE_FOOTPRINT
+struct UploadTextureFootprint
+{
+    uint32_t format; // DXGI_FORMAT
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t row_size;  // Bytes of one row of texels (or of one row of blocks for compressed formats)
+    uint32_t row_count; // Rows per slice, height for plain formats and height / 4 for block compressed ones
+};
+
+struct UploadCopy
+{
+    void *destination;          // Resource the data goes to
+    uint64_t destination_offset; // Bytes for buffers, unused for textures
+    uint32_t subresource;        // Textures only
+    bool texture;
+    uint32_t block;             // Index into UploadManager::blocks
+    uint64_t source_offset;     // In the block
+    uint64_t size;              // Bytes for buffers, staging bytes for textures
+    UploadTextureFootprint footprint;
+    uint64_t row_pitch;         // Staging row pitch of a texture
+};
+
+// What the manager needs from a copy queue on top of its fence
+struct UploadQueue : FrameQueue
+{
+    virtual bool CreateBlock(uint64_t size, UploadBlock &block) = 0; // Fill in cpu and resource
+    virtual void DestroyBlock(UploadBlock &block) = 0;
+    virtual bool Execute(const UploadBlock *blocks, const UploadCopy *copies, size_t count) = 0; // Record the copies and submit them, the manager signals after if it worked
+};
+
+struct UploadManager
+{
+    UploadQueue *queue;
+    uint64_t block_size;
+    int max_blocks;            // Reusable blocks that may exist at once, more have to wait for the copy queue
+    uint64_t submit_threshold; // Batch bytes that submit it without waiting for upload_manager_submit(), 0 for never
+    uint64_t fence_value;      // Value of the last submitted batch
+    uint64_t signaled_value;   // Last value signaled on the copy queue's fence, behind fence_value when the last batches failed
+    std::vector<uint64_t> failed_values; // Batches that failed to execute or signal, their tickets never report done
+
+    std::vector<UploadBlock> blocks;    // Slots whose resource is null are free to be filled again
+    std::vector<uint32_t> free_blocks;  // Reusable blocks no batch is using
+    std::deque<uint32_t> in_flight;     // Blocks of submitted batches, in submission order
+    uint32_t current;                   // Block new requests are packed into, it carries over to the next batch until it is full
+    std::vector<uint32_t> batch_blocks; // Blocks the open batch wrote into
+    std::vector<UploadCopy> copies;     // The open batch
+    uint64_t batch_bytes;
+    std::mutex mutex;
+
+    // Stats, reset by the caller whenever it likes
+    uint64_t request_count;
+    uint64_t copy_count;    // Copies recorded after merging
+    uint64_t submit_count;
+    uint64_t upload_bytes;
+    uint64_t blocks_created;
+    uint64_t wait_count;    // Times a request had to wait for the copy queue to free a block
+};
+
+bool upload_manager_init(UploadManager &manager, UploadQueue *queue, uint64_t block_size, int max_blocks, uint64_t submit_threshold);
+void upload_manager_shutdown(UploadManager &manager); // Submits what is left, waits for all of it and destroys the blocks
+
+// Copy size bytes of data to offset in a buffer. The data is copied into staging memory before this returns
+UploadTicket upload_manager_buffer(UploadManager &manager, void *destination, uint64_t offset, const void *data, uint64_t size);
+
+// One subresource of a texture, data has footprint.row_count * footprint.depth rows that are source_pitch bytes apart
+UploadTicket upload_manager_texture(UploadManager &manager, void *destination, uint32_t subresource, const UploadTextureFootprint &footprint,
+                                    const void *data, uint64_t source_pitch);
+
+// Several subresources of a texture at once, footprints as GetCopyableFootprints() gives them for first_subresource on. The rows are
+// copied with up to max_jobs job system threads while the manager is locked. The thread waits for them by running jobs, so with max_jobs > 1
+// no job may use the manager while this runs
+UploadTicket upload_manager_subresources(UploadManager &manager, void *destination, uint32_t first_subresource, uint32_t count,
+                                         const SubresourceFootprint *footprints, const SubresourceData *data, int max_jobs);
+
+UploadTicket upload_manager_submit(UploadManager &manager); // Hand the open batch to the copy queue, returns the ticket of the last batch
+bool upload_manager_done(UploadManager &manager, UploadTicket ticket);   // Never blocks on the queue, false forever if the upload failed
+bool upload_manager_failed(UploadManager &manager, UploadTicket ticket); // The request or the batch it went with failed, the data never arrives
+bool upload_manager_wait(UploadManager &manager, UploadTicket ticket);   // Blocks, for tools and shutdown. False if the upload failed
+void upload_manager_retire(UploadManager &manager);                   // Take back the blocks of finished batches
+
+// Random buffer and texture uploads over a fake copy queue that only reads the staging blocks when its batches complete, so a block
+// reused too early shows up as wrong data. Checks every request once its ticket is done, prints how much merging saved and returns
+// false on the first bad byte
+bool upload_manager_stress(int frames, unsigned int seed);
@@ -0,0 +1,205 @@
+#include "upload_ring.h"
+#include "frame_ring.h"
+#include "align.h"
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+bool upload_ring_init(UploadRing &ring, uint8_t *cpu_base, uint64_t gpu_base, uint64_t size)
+{
+    if (!cpu_base || !is_power_of_two(size))
+        return false;
+
+    ring.cpu_base = cpu_base;
+    ring.gpu_base = gpu_base;
+    ring.size = size;
+    ring.head = 0;
+    ring.tail = 0;
+    ring.frames.clear();
+    ring.allocation_count = 0;
+    ring.failed_count = 0;
+    return true;
+}
+
+bool upload_ring_allocate(UploadRing &ring, uint64_t size, uint64_t alignment, UploadAllocation &allocation)
+{
+    if (size == 0 || size > ring.size || !is_power_of_two(alignment) || alignment > ring.size)
+        return false;
+
+    std::lock_guard<std::mutex> lock(ring.mutex);
+
+    uint64_t start = align_up(ring.head, alignment);
+
+    // Does not fit before the end of the buffer, skip the rest and start over at the beginning
+    if ((start & (ring.size - 1)) + size > ring.size)
+        start = align_up(ring.head, ring.size);
+
+    // Would run into memory a frame in flight is still reading
+    if (start + size - ring.tail > ring.size)
+    {
+        ++ring.failed_count;
+        return false;
+    }
+
+    ring.head = start + size;
+    ++ring.allocation_count;
+
+    allocation.offset = start & (ring.size - 1);
+    allocation.cpu = ring.cpu_base + allocation.offset;
+    allocation.gpu = ring.gpu_base + allocation.offset;
+    allocation.size = size;
+    return true;
+}
+
+void upload_ring_end_frame(UploadRing &ring, uint64_t fence_value)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    UploadRingFrame frame = {fence_value, ring.head};
+    ring.frames.push_back(frame);
+}
+
+void upload_ring_retire(UploadRing &ring, uint64_t completed_value)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    while (!ring.frames.empty() && ring.frames.front().fence_value <= completed_value)
+    {
+        ring.tail = ring.frames.front().end;
+        ring.frames.pop_front();
+    }
+}
+
+uint64_t upload_ring_used(UploadRing &ring)
+{
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    return ring.head - ring.tail;
+}
+
+// -- Stress test -- //
+
+namespace
+{
+struct StressAllocation
+{
+    uint64_t offset;
+    uint64_t size;
+    uint64_t fence_value; // 0 until the frame it was made in is submitted
+    uint8_t pattern;
+};
+
+bool ranges_overlap(uint64_t a, uint64_t a_size, uint64_t b, uint64_t b_size)
+{
+    return a < b + b_size && b < a + a_size;
+}
+
+// Retire the ring up to the fence and drop the allocations of those frames. If anything wrote over them while they were in flight the pattern is gone
+bool stress_retire(UploadRing &ring, FrameRing &frame_ring, std::vector<StressAllocation> &live, const std::vector<uint8_t> &memory)
+{
+    uint64_t completed = frame_ring_completed(frame_ring);
+    upload_ring_retire(ring, completed);
+
+    for (size_t i = 0; i < live.size();)
+    {
+        const StressAllocation &old = live[i];
+        if (old.fence_value != 0 && old.fence_value <= completed)
+        {
+            for (uint64_t b = 0; b < old.size; ++b)
+            {
+                if (memory[old.offset + b] != old.pattern)
+                {
+                    printf("upload ring: allocation at %llu was overwritten while in flight\n", (unsigned long long)old.offset);
+                    return false;
+                }
+            }
+            live[i] = live.back();
+            live.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+    return true;
+}
+} // namespace
+
+bool upload_ring_stress(int frames, unsigned int seed)
+{
+    const uint64_t ring_size = 64 * 1024;
+    const int frames_in_flight = 3;
+
+    std::vector<uint8_t> memory(ring_size);
+    UploadRing ring;
+    upload_ring_init(ring, memory.data(), 0x100000000ull, ring_size);
+
+    // A "gpu" that takes a millisecond per frame so the ring really has frames in flight
+    FakeFrameQueue queue(1.0);
+    FrameRing frame_ring;
+    frame_ring_init(frame_ring, &queue, frames_in_flight);
+
+    std::mt19937 random(seed);
+    std::vector<StressAllocation> live; // Everything the gpu may still be reading, plus this frame's allocations
+    uint64_t bytes = 0;
+    uint64_t full_waits = 0;
+
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        frame_ring_begin(frame_ring);
+        if (!stress_retire(ring, frame_ring, live, memory))
+            return false;
+
+        int allocations = 1 + (int)(random() % 64);
+        for (int a = 0; a < allocations; ++a)
+        {
+            // Mostly small constants and vertex data, now and then something big
+            uint64_t size = (random() % 8 == 0) ? 1 + random() % (ring_size / 8) : 1 + random() % 512;
+            uint64_t alignment = 1ull << (random() % 9); // 1 to 256, constant buffers want 256
+            UploadAllocation allocation;
+            if (!upload_ring_allocate(ring, size, alignment, allocation))
+            {
+                // Full, this is where a renderer would wait for the oldest frame and try again
+                ++full_waits;
+                if (ring.frames.empty())
+                    break;
+                frame_ring_wait(frame_ring, ring.frames.front().fence_value);
+                if (!stress_retire(ring, frame_ring, live, memory))
+                    return false;
+                if (!upload_ring_allocate(ring, size, alignment, allocation))
+                    continue;
+            }
+
+            if (allocation.offset % alignment != 0 || allocation.offset + size > ring_size || allocation.gpu != ring.gpu_base + allocation.offset)
+            {
+                printf("upload ring: bad allocation of %llu bytes aligned to %llu at %llu\n", (unsigned long long)size, (unsigned long long)alignment, (unsigned long long)allocation.offset);
+                return false;
+            }
+
+            for (size_t i = 0; i < live.size(); ++i)
+            {
+                if (ranges_overlap(allocation.offset, size, live[i].offset, live[i].size))
+                {
+                    printf("upload ring: frame %d allocation at %llu overlaps one still in flight at %llu\n", frame, (unsigned long long)allocation.offset, (unsigned long long)live[i].offset);
+                    return false;
+                }
+            }
+
+            StressAllocation stress = {allocation.offset, size, 0, (uint8_t)(1 + random() % 255)};
+            memset(allocation.cpu, stress.pattern, size);
+            live.push_back(stress);
+            bytes += size;
+        }
+
+        uint64_t fence_value = frame_ring_end(frame_ring);
+        upload_ring_end_frame(ring, fence_value);
+        for (size_t i = 0; i < live.size(); ++i)
+        {
+            if (live[i].fence_value == 0)
+                live[i].fence_value = fence_value;
+        }
+    }
+    frame_ring_flush(frame_ring);
+
+    printf("upload ring: %d frames, %llu allocations, %.1f MB, ring full %llu times, no overlaps\n",
+           frames, (unsigned long long)ring.allocation_count, bytes / (1024.0 * 1024.0), (unsigned long long)full_waits);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+
+/*
+    Linear allocator over one persistently mapped upload buffer, used as a ring.
+
+    Allocations are bumped off the head and never freed one by one. When a frame is submitted upload_ring_end_frame() remembers where the head
+    was together with the frame's fence value, and upload_ring_retire() moves the tail up to the end of every frame the gpu has finished.
+    So memory comes back a whole frame at a time and only once the fence says nothing reads it anymore, the same rule the frame ring uses for
+    command allocators (see frame_ring.h).
+
+    head and tail are byte counts that only ever grow, the position in the buffer is the count modulo the size. An allocation never wraps:
+    if it does not fit before the end of the buffer the rest is skipped and it starts at the beginning again.
+
+    The ring knows nothing about d3d12, cpu_base and gpu_base are whatever the buffer was mapped to. Allocating is thread safe so recording
+    threads can stream their data into the same ring, ending a frame and retiring are done by the thread that submits.
+*/
+
+struct UploadAllocation
+{
+    uint8_t *cpu;    // Where to write the data
+    uint64_t gpu;    // gpu_base + offset, what a vertex buffer view or root cbv points at
+    uint64_t offset; // Offset into the buffer, what CopyBufferRegion wants
+    uint64_t size;
+};
+
+struct UploadRingFrame
+{
+    uint64_t fence_value; // Fence value of the submission that used the frame's allocations
+    uint64_t end;         // Head when the frame was submitted, everything before it belongs to this frame or older ones
+};
+
+struct UploadRing
+{
+    uint8_t *cpu_base;
+    uint64_t gpu_base;
+    uint64_t size;   // Power of two multiple of the largest alignment anyone asks for, so alignment survives the modulo
+    uint64_t head;   // Bytes handed out so far, including the padding
+    uint64_t tail;   // Everything before this is free again
+    std::deque<UploadRingFrame> frames; // Submitted frames the gpu may still be reading, oldest first
+    std::mutex mutex;
+
+    // Stats, reset by the caller whenever it likes
+    uint64_t allocation_count;
+    uint64_t failed_count; // Allocations that did not fit because the gpu was too far behind
+};
+
+bool upload_ring_init(UploadRing &ring, uint8_t *cpu_base, uint64_t gpu_base, uint64_t size);
+bool upload_ring_allocate(UploadRing &ring, uint64_t size, uint64_t alignment, UploadAllocation &allocation); // false if there is no room until older frames retire
+void upload_ring_end_frame(UploadRing &ring, uint64_t fence_value); // Everything allocated since the last call is read by the submission that signals fence_value
+void upload_ring_retire(UploadRing &ring, uint64_t completed_value); // Free the frames whose fence value the gpu has reached
+uint64_t upload_ring_used(UploadRing &ring);                         // Bytes between tail and head, i.e. not available right now
+
+// Hammer a ring with random sizes and alignments over a FakeFrameQueue and check that no allocation ever overlaps one an unfinished frame is
+// still using. Prints what it did and returns false on the first overlap or corrupted allocation
+bool upload_ring_stress(int frames, unsigned int seed);
@@ -1,8 +1,41 @@
+#ifdef QUANTIZED_VERTICES
+//Quantized vertices (see vertex_format.h): the position is 16 bit unorm inside the mesh's bounds and the color 8 bit unorm.
+//The input assembler turns both into floats between 0 and 1, the mesh's dequantization constants scale the position back
+struct VS_INPUT
+{
+	float4 pos: POSITION;
+	float4 color: COLOR;
+};
+
+cbuffer MeshConstants : register(b1)
+{
+	float4 dequantize_scale;
+	float4 dequantize_offset;
+};
+#else
 struct VS_INPUT
 {
 	float3 pos: POSITION;
 	float4 color: COLOR;
 };
+#endif
+
+#ifdef BINDLESS
+//Bindless: the descriptor table is the whole shader visible heap and every kind of resource is an array over it, in a register space of its own.
+//A draw only passes the heap indices of what it uses (see renderer_create_root_signature() in main.cpp)
+struct Material
+{
+	float4 tint;
+};
+ConstantBuffer<Material> materials[] : register(b0, space1);
+Texture2D textures[] : register(t0, space2);
+
+struct DrawConstants
+{
+	uint material; //heap index of the draw's material
+};
+ConstantBuffer<DrawConstants> draw : register(b0);
+#endif
 
 struct VS_OUTPUT
 {
@@ -14,7 +47,14 @@ struct VS_OUTPUT
 VS_OUTPUT main(VS_INPUT input)
 {
 	VS_OUTPUT output;
+#ifdef QUANTIZED_VERTICES
+	output.pos   = float4(input.pos.xyz * dequantize_scale.xyz + dequantize_offset.xyz, 1.0f);
+#else
 	output.pos   = float4(input.pos, 1.0f);
+#endif
 	output.color = input.color;
+#ifdef BINDLESS
+	output.color *= materials[draw.material].tint;
+#endif
 	return output; 
 }
\ No newline at end of file
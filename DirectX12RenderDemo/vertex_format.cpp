@@ -0,0 +1,220 @@
+#include "vertex_format.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+const VertexFormatDesc vertex_formats[VERTEX_FORMAT_COUNT] = {
+    {"float", sizeof(Vertex), 2, {{"POSITION", vertex_element_float3, 0}, {"COLOR", vertex_element_float4, 12}}, nullptr, false},
+    {"quantized", sizeof(QuantizedVertex), 2, {{"POSITION", vertex_element_unorm16x4, 0}, {"COLOR", vertex_element_unorm8x4, 8}}, "QUANTIZED_VERTICES", true},
+};
+
+struct Bounds
+{
+    float minimum[3];
+    float maximum[3];
+};
+
+Bounds position_bounds(const Vertex *vertices, size_t count)
+{
+    Bounds bounds = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float position[3] = {vertices[i].pos.x, vertices[i].pos.y, vertices[i].pos.z};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (i == 0 || position[axis] < bounds.minimum[axis])
+                bounds.minimum[axis] = position[axis];
+            if (i == 0 || position[axis] > bounds.maximum[axis])
+                bounds.maximum[axis] = position[axis];
+        }
+    }
+    return bounds;
+}
+
+// Half a quantization step, the most rounding can move a position
+float quantization_error(const Bounds &bounds)
+{
+    float error = 0.0f;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float half_step = (bounds.maximum[axis] - bounds.minimum[axis]) / (2.0f * 65535.0f);
+        if (half_step > error)
+            error = half_step;
+    }
+    return error;
+}
+
+uint16_t quantize_unorm16(float value, float minimum, float extent)
+{
+    if (extent <= 0.0f)
+        return 0;
+    float scaled = (value - minimum) / extent * 65535.0f + 0.5f;
+    return (uint16_t)(scaled < 0.0f ? 0.0f : scaled > 65535.0f ? 65535.0f : scaled);
+}
+
+uint8_t quantize_unorm8(float value)
+{
+    float scaled = value * 255.0f + 0.5f;
+    return (uint8_t)(scaled < 0.0f ? 0.0f : scaled > 255.0f ? 255.0f : scaled);
+}
+
+// The vertex shader part of decoding, see vertex.hlsl
+void decode_vertex(const VertexFormatDesc &desc, const uint8_t *data, const VertexDequantization &dequantization, float position[3], float color[4])
+{
+    float value[4];
+    vertex_element_fetch(desc.elements[0].format, data + desc.elements[0].offset, value);
+    for (int axis = 0; axis < 3; ++axis)
+        position[axis] = desc.dequantize ? value[axis] * dequantization.scale[axis] + dequantization.offset[axis] : value[axis];
+    vertex_element_fetch(desc.elements[1].format, data + desc.elements[1].offset, color);
+}
+} // namespace
+
+const VertexFormatDesc &vertex_format_desc(VertexFormat format)
+{
+    return vertex_formats[format < VERTEX_FORMAT_COUNT ? format : VERTEX_FORMAT_FLOAT];
+}
+
+VertexFormat vertex_format_choose(const Vertex *vertices, size_t count, float tolerance)
+{
+    if (tolerance <= 0.0f || count == 0)
+        return VERTEX_FORMAT_FLOAT;
+
+    //Unorm colors cannot go outside 0..1, hdr colors have to stay floats
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float color[4] = {vertices[i].color.x, vertices[i].color.y, vertices[i].color.z, vertices[i].color.w};
+        for (int c = 0; c < 4; ++c)
+        {
+            if (!(color[c] >= 0.0f && color[c] <= 1.0f))
+                return VERTEX_FORMAT_FLOAT;
+        }
+    }
+    return quantization_error(position_bounds(vertices, count)) <= tolerance ? VERTEX_FORMAT_QUANTIZED : VERTEX_FORMAT_FLOAT;
+}
+
+void vertex_format_encode(const Vertex *vertices, size_t count, VertexFormat format, VertexBufferData &buffer)
+{
+    const VertexFormatDesc &desc = vertex_format_desc(format);
+    buffer.format = format;
+    buffer.stride = desc.stride;
+    buffer.data.resize(count * desc.stride);
+    for (int axis = 0; axis < 4; ++axis)
+    {
+        buffer.dequantization.scale[axis] = 1.0f;
+        buffer.dequantization.offset[axis] = 0.0f;
+    }
+
+    if (format != VERTEX_FORMAT_QUANTIZED)
+    {
+        memcpy(buffer.data.data(), vertices, count * sizeof(Vertex));
+        return;
+    }
+
+    //65535 steps between the minimum and the maximum of each axis, the shader maps them back
+    Bounds bounds = position_bounds(vertices, count);
+    float extent[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        extent[axis] = bounds.maximum[axis] - bounds.minimum[axis];
+        buffer.dequantization.scale[axis] = extent[axis];
+        buffer.dequantization.offset[axis] = bounds.minimum[axis];
+    }
+
+    QuantizedVertex *quantized = (QuantizedVertex *)buffer.data.data();
+    for (size_t i = 0; i < count; ++i)
+    {
+        quantized[i].pos[0] = quantize_unorm16(vertices[i].pos.x, bounds.minimum[0], extent[0]);
+        quantized[i].pos[1] = quantize_unorm16(vertices[i].pos.y, bounds.minimum[1], extent[1]);
+        quantized[i].pos[2] = quantize_unorm16(vertices[i].pos.z, bounds.minimum[2], extent[2]);
+        quantized[i].pos[3] = 0;
+        quantized[i].color[0] = quantize_unorm8(vertices[i].color.x);
+        quantized[i].color[1] = quantize_unorm8(vertices[i].color.y);
+        quantized[i].color[2] = quantize_unorm8(vertices[i].color.z);
+        quantized[i].color[3] = quantize_unorm8(vertices[i].color.w);
+    }
+}
+
+void vertex_element_fetch(uint32_t format, const uint8_t *data, float value[4])
+{
+    value[0] = value[1] = value[2] = 0.0f;
+    value[3] = 1.0f;
+    switch (format)
+    {
+    case vertex_element_float3:
+        memcpy(value, data, 3 * sizeof(float));
+        break;
+    case vertex_element_float4:
+        memcpy(value, data, 4 * sizeof(float));
+        break;
+    case vertex_element_unorm16x4:
+    {
+        uint16_t stored[4];
+        memcpy(stored, data, sizeof(stored));
+        for (int c = 0; c < 4; ++c)
+            value[c] = stored[c] / 65535.0f;
+        break;
+    }
+    case vertex_element_unorm8x4:
+        for (int c = 0; c < 4; ++c)
+            value[c] = data[c] / 255.0f;
+        break;
+    }
+}
+
+bool vertex_format_benchmark()
+{
+    std::vector<Mesh> meshes;
+    meshes.push_back(mesh_make_grid(100, 100));
+    meshes.push_back(mesh_make_sphere(64, 32));
+    meshes.push_back(mesh_make_torus(96, 48));
+    meshes.push_back(mesh_make_grid(300, 300));
+
+    printf("mesh, format, bytes per vertex, vertex buffer bytes, saved, bytes fetched per draw (fifo %d), max position error, max color error, chosen at -quantize-vertices\n",
+           mesh_cache_size);
+
+    bool ok = true;
+    for (const Mesh &mesh : meshes)
+    {
+        uint32_t invocations = mesh_vertex_shader_invocations(mesh.indices.data(), mesh.indices.size(), (uint32_t)mesh.vertices.size(), mesh_cache_size);
+        VertexFormat chosen = vertex_format_choose(mesh.vertices.data(), mesh.vertices.size(), vertex_format_default_tolerance);
+        float promised = quantization_error(position_bounds(mesh.vertices.data(), mesh.vertices.size()));
+
+        for (int format = 0; format < VERTEX_FORMAT_COUNT; ++format)
+        {
+            const VertexFormatDesc &desc = vertex_format_desc((VertexFormat)format);
+            VertexBufferData buffer;
+            vertex_format_encode(mesh.vertices.data(), mesh.vertices.size(), (VertexFormat)format, buffer);
+
+            //Decode every vertex the way the input assembler and the shader would and compare
+            double position_error = 0.0, color_error = 0.0;
+            for (size_t i = 0; i < mesh.vertices.size(); ++i)
+            {
+                float position[3], color[4];
+                decode_vertex(desc, buffer.data.data() + i * buffer.stride, buffer.dequantization, position, color);
+                const Vertex &vertex = mesh.vertices[i];
+                position_error = fmax(position_error, fabs(position[0] - vertex.pos.x));
+                position_error = fmax(position_error, fabs(position[1] - vertex.pos.y));
+                position_error = fmax(position_error, fabs(position[2] - vertex.pos.z));
+                color_error = fmax(color_error, fabs(color[0] - vertex.color.x));
+                color_error = fmax(color_error, fabs(color[1] - vertex.color.y));
+                color_error = fmax(color_error, fabs(color[2] - vertex.color.z));
+                color_error = fmax(color_error, fabs(color[3] - vertex.color.w));
+            }
+
+            //Rounding plus a little float error in the shader's multiply add
+            bool within = format == VERTEX_FORMAT_FLOAT ? position_error == 0.0 && color_error == 0.0
+                                                        : position_error <= promised * 1.01 + 1e-6 && color_error <= 0.5 / 255.0 + 1e-6;
+            if (!within)
+                ok = false;
+
+            printf("%s, %s, %u, %zu, %.0f%%, %llu, %.2e, %.2e, %s%s\n", mesh.name.c_str(), desc.name, desc.stride, buffer.data.size(),
+                   100.0 * (1.0 - (double)desc.stride / sizeof(Vertex)), (unsigned long long)invocations * desc.stride, position_error, color_error,
+                   chosen == format ? "yes" : "no", within ? "" : ", ERROR TOO LARGE");
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "renderer_common.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/*
+    Vertex formats a mesh can be uploaded in.
+
+    Vertex is what meshes are built and optimized in: a float3 position and a float4 color, 28 bytes. Most of those bits are wasted. Positions
+    only need to be exact to a fraction of a pixel inside the mesh's own bounds, and colors end up in an 8 bit render target anyway. The
+    quantized format stores the position as 16 bit unorm relative to the mesh's bounding box and the color as 8 bit unorm, 12 bytes, which is
+    less than half the vertex fetch bandwidth and memory.
+
+    The input assembler turns unorm back into floats for free. Only the bounds are left, every mesh has its own scale and offset
+    (VertexDequantization) that the quantized vertex shader variant applies. The renderers build the input layout and pick the shader
+    variant from the VertexFormatDesc, so a new format only has to be described here and handled in vertex.hlsl.
+
+    Format values are DXGI_FORMAT ones, the same way mesh.h does it for indices, so this file builds without the windows sdk.
+*/
+
+enum VertexFormat
+{
+    VERTEX_FORMAT_FLOAT,     // Vertex as it is
+    VERTEX_FORMAT_QUANTIZED, // QuantizedVertex
+    VERTEX_FORMAT_COUNT,
+};
+
+const uint32_t vertex_element_float3 = 6;    // DXGI_FORMAT_R32G32B32_FLOAT
+const uint32_t vertex_element_float4 = 2;    // DXGI_FORMAT_R32G32B32A32_FLOAT
+const uint32_t vertex_element_unorm16x4 = 11; // DXGI_FORMAT_R16G16B16A16_UNORM, there is no three component 16 bit format
+const uint32_t vertex_element_unorm8x4 = 28;  // DXGI_FORMAT_R8G8B8A8_UNORM
+
+struct VertexElement
+{
+    const char *semantic;
+    uint32_t format;
+    uint32_t offset;
+};
+
+// Everything a renderer needs to know about a format: the input layout and the shader variant that reads it
+struct VertexFormatDesc
+{
+    const char *name;
+    uint32_t stride;
+    uint32_t element_count;
+    VertexElement elements[2]; // POSITION first, then COLOR
+    const char *shader_define; // Defined when vertex.hlsl is compiled for this format, nullptr for none
+    bool dequantize;           // The vertex shader scales the position by the mesh's VertexDequantization
+};
+
+struct QuantizedVertex
+{
+    uint16_t pos[4]; // x, y, z in the mesh's bounds, 0 is the minimum and 65535 the maximum. w is padding
+    uint8_t color[4];
+};
+
+// position = stored * scale + offset per axis. Float4s because that is how they line up in the shader's cbuffer
+struct VertexDequantization
+{
+    float scale[4];
+    float offset[4];
+};
+
+// A mesh's vertices ready to upload
+struct VertexBufferData
+{
+    VertexFormat format;
+    uint32_t stride;
+    std::vector<uint8_t> data;
+    VertexDequantization dequantization; // Identity for formats that do not need it
+};
+
+const float vertex_format_default_tolerance = 1.0f / 8192.0f; // Largest position error -quantize-vertices accepts, a twentieth of a pixel at 800 wide
+
+const VertexFormatDesc &vertex_format_desc(VertexFormat format);
+
+// Smallest format that keeps every position within tolerance (clip space units) and every color. A tolerance of 0 keeps floats
+VertexFormat vertex_format_choose(const Vertex *vertices, size_t count, float tolerance);
+
+void vertex_format_encode(const Vertex *vertices, size_t count, VertexFormat format, VertexBufferData &buffer);
+
+// What the input assembler does with one element of a vertex: unpack it into four floats, missing components are 0 and w is 1
+void vertex_element_fetch(uint32_t format, const uint8_t *data, float value[4]);
+
+// Memory, vertex fetch bytes and the largest position and color error of the sample meshes in every format. Returns false if an error is
+// larger than the format promises
+bool vertex_format_benchmark();